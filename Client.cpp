@@ -1,10 +1,21 @@
 // main.cpp //////////////////////////////////////
 
-#include <windows.h>
 #include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
 #include <conio.h>
 
 #include "load_ipc.h"
+#else
+#include <ipc.h>
+#include <string.h>
+
+// linked with libjr_ipc.so
+inline bool IPC_LoadDLL()	{ return true; }
+inline bool IPC_FreeDLL()	{ return true; }
+#define getch			getchar
+#endif
 
 //////////////////////////////////////////////////
 
@@ -15,7 +26,8 @@ int main( int argc, char **argv )
 
 	printf("\n    Client started\n");
 	printf("\n    Try to connect to server...\n"); 
-	HIPCCONNECTION hConnection1 = IPC_Connect( "ipc_test_server", INFINITE );
+	char szServerName[] = "ipc_test_server";
+	HIPCCONNECTION hConnection1 = IPC_Connect( szServerName, INFINITE );
 	if(	hConnection1 == (HIPCCONNECTION)0 || hConnection1 == (HIPCCONNECTION)IPC_RC_TIMEOUT ) {
 		printf("    Can't connect to Server\n"); 
 		IPC_FreeDLL();
@@ -35,12 +47,12 @@ int main( int argc, char **argv )
 	{
 		strcpy( p, "ClientSendData" );
 		DWORD rc = IPC_Send( hConnection1, p, 64 * 1024, INFINITE );
-		if( rc == -1 || rc == -2 ) 
+		if( rc == IPC_RC_ERROR || rc == IPC_RC_TIMEOUT ) 
 			printf( "\nerror\n" );
 // 		else
 // 			printf( "IPC_Send Count: %d\n" ,i);
 		rc = IPC_Recv(hConnection1, p, 64 * 1024, INFINITE);
-		if( rc == -1 || rc == -2 ) 
+		if( rc == IPC_RC_ERROR || rc == IPC_RC_TIMEOUT ) 
 			printf( "\nerror\n" );
 // 		else
 // 			printf( "IPC_Recv Count: %d\n" ,i);
@@ -48,7 +60,7 @@ int main( int argc, char **argv )
 
 //	rc = IPC_Send(hConnection, p, 1024, INFINITE);
 
-	BOOL r1 = IPC_CloseConnection( hConnection1 );
+	IPC_CloseConnection( hConnection1 );
 
 	delete[] p;
 	IPC_FreeDLL();
@@ -19,6 +19,32 @@ extern "C" {
 
 #include "ipc_def.h"
 
+//////////////////////////////////////////////////////////////////////////////
+// POSIX builds (libjr_ipc.so) use the shared memory transport over
+// shm_open() segments. Messages above the section threshold get a
+// one-shot shm_open() segment of their own. hBreakEvent and the user
+// events are file descriptors passed as (HANDLE)(intptr_t)fd, usually
+// eventfds; a readable one is signaled. The shared memory waits look at
+// them every 10 ms and IPC_GetEvents reports no IPC events. Async
+// operations are not available there and fail. Poll sets, IPC_ServerRun,
+// IPC_Call and IPC_CallAsync are Windows only, libjr_ipc.so does not
+// export them. A crashed peer breaks the connection within 100 ms.
+// With JR_IPC_TRANSPORT=socket in the environment the library uses
+// Unix-domain SOCK_SEQPACKET sockets instead, with the same events. The
+// backlog goes to listen().
+// JR_IPC_TRANSPORT=uring uses the same sockets through io_uring (Linux 6.0
+// or later): the receives are multishot into registered buffers and the
+// async operations are available, their callbacks run on the io_uring
+// thread of the library. A connection the engine cannot take keeps the
+// plain socket calls and its async operations fail.
+// Under uring, IPC_Send, IPC_SendV and the other synchronous sends do not
+// go through the engine; they stay direct sendmsg() calls on the socket.
+// The synchronous receives do go through it: each one waits for the ring
+// thread to hand over the packet. That pays off for one-way streams (about
+// 1.8x the socket throughput with 64-byte messages), but it costs a thread
+// hop per message in request/response traffic. The Client/Server
+// ping-pong takes about twice as long as with JR_IPC_TRANSPORT=socket.
+
 //////////////////////////////////////////////////////////////////////////////
 
 	IPC_API DWORD __stdcall				// [ 1, 2, ... IPC_RC_ERROR ]
@@ -45,6 +71,28 @@ IPC_Connect(
 	char			*pszServerName,
 	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
 
+//////////////////////////////////////////////////////////////////////////////
+// channel sizes are per direction, seen from the caller:
+// 0 - default (IPC_CHANNEL_SIZE_DEFAULT), otherwise rounded up to power of 2
+// in [ IPC_CHANNEL_SIZE_MIN, IPC_CHANNEL_SIZE_MAX ];
+// the larger of the client and server preferences is used for a connection;
+// the pipe transport uses the server sizes as its pipe buffer sizes and
+// ignores the sizes passed to IPC_ConnectEx (the client end of a pipe has
+// no buffers of its own)
+
+	IPC_API HIPCSERVER __stdcall		// [ 1, 2, ... , IPC_RC_INVALID_HANDLE ]
+IPC_ServerStartEx(
+	const char		*pszServerName,
+	DWORD			dwSendSize,			// server->client channel size
+	DWORD			dwRecvSize );		// client->server channel size
+
+	IPC_API HIPCCONNECTION __stdcall	// [ 1, 2, ... , IPC_RC_TIMEOUT, IPC_RC_INVALID_HANDLE ]
+IPC_ConnectEx(
+	char			*pszServerName,
+	DWORD			dwTimeout,			// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+	DWORD			dwSendSize,			// client->server channel size
+	DWORD			dwRecvSize );		// server->client channel size
+
 	IPC_API BOOL __stdcall
 IPC_CloseConnection(
 	HIPCCONNECTION	hConnection );
@@ -63,6 +111,276 @@ IPC_Send(
 	DWORD			dwBufSize,
 	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
 
+//////////////////////////////////////////////////////////////////////////////
+// zero-copy send: IPC_SendReserve returns a buffer inside the connection
+// channel, the message is sent by IPC_SendCommit; messages larger than the
+// channel are buffered and sent in packets. The send side of the connection
+// stays locked until IPC_SendCommit, which must be called by the same thread.
+// The dwTimeout of IPC_SendReserve applies again to IPC_SendCommit, counted
+// from the commit: a message buffered because it is larger than the channel
+// (always with the pipe and socket transports), or passed in a section,
+// waits for channel space when it is committed and is dropped on timeout.
+
+	IPC_API DWORD __stdcall				// [ dwSize, IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_SendReserve(
+	HIPCCONNECTION	hConnection,
+	DWORD			dwSize,
+	void			**ppvBuf,			// receives the message buffer
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API DWORD __stdcall				// [ dwSize, IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_SendCommit(
+	HIPCCONNECTION	hConnection,
+	void			*pvBuf,				// buffer returned by IPC_SendReserve
+	DWORD			dwSize );			// [ 0, 1, ... , reserved size ]
+
+//////////////////////////////////////////////////////////////////////////////
+// zero-copy receive: IPC_RecvView returns the next message in place inside
+// the connection channel (messages received in several packets are collected
+// in a connection buffer); the channel space is handed back to the sender by
+// IPC_RecvRelease, which must be called by the same thread.
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_RecvView(
+	HIPCCONNECTION	hConnection,
+	const void		**ppvBuf,			// receives the message data
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API BOOL __stdcall
+IPC_RecvRelease(
+	HIPCCONNECTION	hConnection,
+	const void		*pvBuf );			// buffer returned by IPC_RecvView
+
+//////////////////////////////////////////////////////////////////////////////
+// messages of dwThreshold bytes and larger are passed in a dedicated shared
+// section, only a small descriptor goes through the connection channel;
+// 0 restores IPC_SECTION_THRESHOLD_DEFAULT (ignored by the pipe and socket
+// transports)
+
+	IPC_API BOOL __stdcall
+IPC_SetSectionThreshold(
+	HIPCCONNECTION	hConnection,
+	DWORD			dwThreshold );		// [ 0, 1, ... ]
+
+//////////////////////////////////////////////////////////////////////////////
+// before blocking, send/receive waits poll the channel for a short time;
+// by default the spin time follows the recent wait durations, an explicit
+// value in microseconds fixes it (0 - never spin), IPC_SPIN_ADAPTIVE
+// restores the default (ignored by the pipe and socket transports)
+
+	IPC_API BOOL __stdcall
+IPC_SetSpinTime(
+	HIPCCONNECTION	hConnection,
+	DWORD			dwMicroseconds );	// [ 0, 1, ... , IPC_SPIN_ADAPTIVE ]
+
+//////////////////////////////////////////////////////////////////////////////
+// multi-producer mode: threads sending on the connection concurrently don't
+// serialize on the connection lock, they claim space in the channel and copy
+// their messages in parallel; messages are delivered in the order of claims
+// and only a full channel makes a sender wait; messages above 1/4 of the
+// channel, large (section) messages, batches and IPC_SendReserve still lock
+// the connection and hold the other senders meanwhile (ignored by the pipe
+// and socket transports and by the POSIX shared memory transport, where
+// the senders always take the lock)
+
+	IPC_API BOOL __stdcall
+IPC_SetMultiProducer(
+	HIPCCONNECTION	hConnection,
+	BOOL			bEnable );
+
+//////////////////////////////////////////////////////////////////////////////
+// scatter/gather: the message is the concatenation of dwCount segments;
+// IPC_SendV returns the message size, IPC_RecvV the bytes stored
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_SendV(
+	HIPCCONNECTION	hConnection,
+	const IPC_BUF	*pBufs,
+	DWORD			dwCount,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_RecvV(
+	HIPCCONNECTION	hConnection,
+	const IPC_BUF	*pBufs,
+	DWORD			dwCount,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+//////////////////////////////////////////////////////////////////////////////
+// batches: one message per IPC_BUF, the peer is woken once per batch;
+// both return the number of messages transferred, an error is returned
+// only if no message was transferred. IPC_RecvBatch waits for the first
+// message and then takes only the messages already queued. A message
+// larger than its buffer ends the batch; it is counted, with its whole size
+// in pdwSizes, and IPC_GetConnectionLastErr returns IPC_ERR_MSG_TRUNCATED.
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_SendBatch(
+	HIPCCONNECTION	hConnection,
+	const IPC_BUF	*pMsgs,
+	DWORD			dwCount,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_RecvBatch(
+	HIPCCONNECTION	hConnection,
+	const IPC_BUF	*pMsgs,
+	DWORD			dwCount,
+	DWORD			*pdwSizes,			// receives the message sizes
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+//////////////////////////////////////////////////////////////////////////////
+// number of clients the server accepts concurrently, the rest queue behind
+// them; 0 restores the default. The pipe transport keeps that many pipe
+// instances waiting for clients, the shared memory transport has a fixed
+// number of connection request slots and ignores the call (it returns TRUE
+// for a valid server).
+
+	IPC_API BOOL __stdcall
+IPC_SetBacklog(
+	HIPCSERVER		hServer,
+	DWORD			dwBacklog );		// [ 0, 1, ... ]
+
+#ifdef _WIN32
+
+//////////////////////////////////////////////////////////////////////////////
+// poll set (Windows only): one thread waits for readiness of many connections.
+// IPC_PollWait is level-triggered, a connection is reported until its
+// messages are received or its send space is used, and fills pEvents with
+// up to dwCount ready connections. IPC_POLL_CLOSED is always reported.
+// A connection belongs to one poll set at a time and leaves it when it is
+// closed. Only one thread should wait on a set. A polled direction is
+// served with dwTimeout 0: the set waits on the channel events itself.
+// The pipe transport reports a broken pipe as IPC_POLL_IN.
+
+	IPC_API HIPCPOLL __stdcall			// [ 1, 2, ... , IPC_RC_INVALID_HANDLE ]
+IPC_PollCreate();
+
+	IPC_API BOOL __stdcall
+IPC_PollClose(
+	HIPCPOLL		hPoll );
+
+	IPC_API BOOL __stdcall
+IPC_PollAdd(
+	HIPCPOLL		hPoll,
+	HIPCCONNECTION	hConnection,
+	DWORD			dwEvents );			// IPC_POLL_IN | IPC_POLL_OUT
+
+	IPC_API BOOL __stdcall
+IPC_PollRemove(
+	HIPCPOLL		hPoll,
+	HIPCCONNECTION	hConnection );
+
+	IPC_API DWORD __stdcall				// [ 1, 2, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_PollWait(
+	HIPCPOLL		hPoll,
+	IPC_POLL_EVENT	*pEvents,
+	DWORD			dwCount,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+#endif // _WIN32
+
+//////////////////////////////////////////////////////////////////////////////
+// asynchronous send/receive: the call returns at once and pfnCallback gets
+// the result IPC_Send/IPC_Recv would return, on one of the library's I/O
+// threads. The buffer belongs to the library until then. The operations of
+// one direction complete in the order they were posted. Closing the
+// connection fails the pending ones with IPC_RC_ERROR. A connection with
+// async operations cannot be in a poll set, and its synchronous calls must
+// not run concurrently with them. The I/O threads start with the first
+// operation, keep the library loaded while they may run.
+// IPC_CancelAsync fails the operations posted with pvContext (all if NULL)
+// with IPC_RC_ERROR, except one a thread is already transferring.
+// An async send does not wait for the receiver to drain the channel: the
+// shared memory transport passes a message the channel cannot take at once
+// in a section. The pipe transport writes it once the peer has credit, a
+// message larger than the pipe buffer holds up an I/O thread until the
+// peer reads it.
+// On POSIX the async operations are socket-only: JR_IPC_TRANSPORT=uring
+// runs them, the shared memory transport (the default) and plain sockets
+// have no I/O engine and IPC_SendAsync/IPC_RecvAsync return FALSE.
+
+	IPC_API BOOL __stdcall
+IPC_SendAsync(
+	HIPCCONNECTION		hConnection,
+	void				*pvBuf,
+	DWORD				dwBufSize,
+	IPC_ASYNC_CALLBACK	pfnCallback,
+	void				*pvContext );
+
+	IPC_API BOOL __stdcall
+IPC_RecvAsync(
+	HIPCCONNECTION		hConnection,
+	void				*pvBuf,
+	DWORD				dwBufSize,
+	IPC_ASYNC_CALLBACK	pfnCallback,
+	void				*pvContext );
+
+	IPC_API BOOL __stdcall
+IPC_CancelAsync(
+	HIPCCONNECTION		hConnection,
+	void				*pvContext );
+
+#ifdef _WIN32
+
+//////////////////////////////////////////////////////////////////////////////
+// built-in server loop (Windows only): accepts the clients of hServer and calls pfnHandler
+// for every received message on a pool of dwWorkers threads (0 - one per
+// processor). The messages of a connection are handled one at a time and
+// in order; the handler may reply with IPC_Send, the connections are closed
+// by the loop. Returns when hStopEvent is signaled.
+
+	IPC_API BOOL __stdcall
+IPC_ServerRun(
+	HIPCSERVER			hServer,
+	IPC_SERVER_HANDLER	pfnHandler,
+	void				*pvContext,
+	DWORD				dwWorkers,
+	HANDLE				hStopEvent );
+
+//////////////////////////////////////////////////////////////////////////////
+// RPC (the client is Windows only): many calls in flight on one connection. A request goes out with an
+// IPC_CALL_HDR in front of it, the server replies to its dwCallId with
+// IPC_Reply in any order. The library's RPC thread receives the replies and
+// hands them to the waiting calls, so the client must not receive on the
+// connection itself, add it to a poll set or post async operations on it.
+// The request is sent before the call returns. IPC_Call returns the reply
+// size; the callback of IPC_CallAsync gets it on the RPC thread (or on the
+// thread closing the connection) and pvReply belongs to the library until
+// then. A reply larger than dwReplySize is truncated and reported as
+// IPC_RC_ERROR. IPC_CancelAsync fails the async calls posted with pvContext,
+// their replies are dropped. The thread starts with the first call, keep
+// the library loaded while it may run.
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_Call(
+	HIPCCONNECTION		hConnection,
+	const void			*pvRequest,
+	DWORD				dwRequestSize,
+	void				*pvReply,
+	DWORD				dwReplySize,
+	DWORD				dwTimeout );	// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API BOOL __stdcall
+IPC_CallAsync(
+	HIPCCONNECTION		hConnection,
+	const void			*pvRequest,
+	DWORD				dwRequestSize,
+	void				*pvReply,
+	DWORD				dwReplySize,
+	IPC_ASYNC_CALLBACK	pfnCallback,
+	void				*pvContext );
+
+#endif // _WIN32
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_Reply(
+	HIPCCONNECTION		hConnection,
+	DWORD				dwCallId,		// IPC_CALL_HDR of the request
+	const void			*pvReply,
+	DWORD				dwReplySize,
+	DWORD				dwTimeout );	// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
 //////////////////////////////////////////////////////////////////////////////
 
 	IPC_API BOOL __stdcall
@@ -88,13 +406,50 @@ IPC_ResetEvents(
 IPC_GetConnectionLastErr(
 	HIPCCONNECTION	hConnection );
 
+//////////////////////////////////////////////////////////////////////////////
+// datagrams: a named endpoint owns a queue in shared memory, any process
+// may send to it without connecting. The datagrams of one thread arrive in
+// order, each at most a quarter of the queue (64K less 8 bytes). A full
+// queue makes the sender wait up to dwTimeout; IPC_DgSend fails when the
+// endpoint is stopped, or when its queue is full and its process is gone.
+// Only the process that started the endpoint receives, by name;
+// IPC_DgRecvBatch works as IPC_RecvBatch. An endpoint left by a dead
+// process is taken over by the next IPC_ServerDgStart, with the datagrams
+// not yet received.
+
+	IPC_API HIPCSERVER __stdcall
+IPC_ServerDgStart(
+	char			*pszDgServerName );
+
+	IPC_API BOOL __stdcall
+IPC_ServerDgStop(
+	HIPCSERVER		hServer );
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_DgSend(
+	char			*pszDgServerName,
+	void			*pvBuf,
+	DWORD			dwBufSize,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_DgRecv(
+	char			*pszDgServerName,
+	void			*pvBuf,
+	DWORD			dwBufSize,
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
+	IPC_API DWORD __stdcall				// [ 0, 1, ... , IPC_RC_TIMEOUT, IPC_RC_ERROR ]
+IPC_DgRecvBatch(
+	char			*pszDgServerName,
+	const IPC_BUF	*pMsgs,
+	DWORD			dwCount,
+	DWORD			*pdwSizes,			// receives the datagram sizes
+	DWORD			dwTimeout );		// [ 0, 1, ... , IPC_TIMEOUT_INFINITE ]
+
 //////////////////////////////////////////////////////////////////////////////
 
 // NOT IMPLEMENTED FUNCTIONS
-IPC_API HIPCSERVER	__stdcall IPC_ServerDgStart( char * pszDgServerName );
-IPC_API BOOL		__stdcall IPC_ServerDgStop( HIPCSERVER hServer );
-IPC_API DWORD		__stdcall IPC_DgRecv( char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout );
-IPC_API DWORD		__stdcall IPC_DgSend( char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout );
 IPC_API void		__stdcall IPC_Init();
 IPC_API void		__stdcall IPC_Done();
 
@@ -0,0 +1,454 @@
+// ipc_coro.h ////////////////////////////////////////////////////////////////
+
+// Interprocess Communication (IPC) C++20 coroutine front end
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Header only, over IPC_SendAsync/IPC_RecvAsync; include ipc.h or
+// load_ipc.h first. A session is a coroutine, the event loop thread
+// resumes it when its operation completes:
+//
+//	ipc::Session Echo (ipc::EventLoop& loop, ipc::Connection conn)
+//	{
+//		char buf[256];
+//		for (;;) {
+//			DWORD n = co_await conn.recv (buf, sizeof (buf));
+//			if (n == IPC_RC_ERROR || co_await conn.send (buf, n) == IPC_RC_ERROR) co_return;
+//		}
+//	}
+//
+//	for (;;) Echo (loop, co_await server.accept ());
+//
+// A stop_token passed to an operation cancels it; it then completes with
+// IPC_RC_ERROR (an accepted or connected Connection is not valid).
+// Server::accept and Connection::connect block on a thread of their own.
+// On POSIX, send and recv need the io_uring transport (see IPC_SendAsync).
+
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef IPC_CORO_H
+#define IPC_CORO_H
+
+#if !defined(IPC_H) && !defined(LOAD_IPC_H)
+#include "ipc.h"
+#endif
+
+#include <coroutine>
+#include <stop_token>
+#include <optional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <system_error>
+
+#ifndef _WIN32
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace ipc {
+
+//////////////////////////////////////////////////////////////////////////////
+// EventLoop: the thread in run () resumes the coroutines
+
+class EventLoop
+{
+public:
+	EventLoop () : m_bStop (false) {}
+
+	EventLoop (const EventLoop&) = delete;
+	EventLoop& operator= (const EventLoop&) = delete;
+
+	void post (std::coroutine_handle<> h)
+	{
+		{
+			std::lock_guard<std::mutex> lock (m_mutex);
+			m_ready.push_back (h);
+		}
+		m_cv.notify_one ();
+	}
+
+	// resumes the posted coroutines until stop ()
+	void run ()
+	{
+		for (;;) {
+			std::coroutine_handle<> h;
+			{
+				std::unique_lock<std::mutex> lock (m_mutex);
+				m_cv.wait (lock, [this] { return m_bStop || ! m_ready.empty (); });
+				if (m_bStop) return;
+				h = m_ready.front ();
+				m_ready.pop_front ();
+			}
+			h.resume ();
+		}
+	}
+
+	void stop ()
+	{
+		{
+			std::lock_guard<std::mutex> lock (m_mutex);
+			m_bStop = true;
+		}
+		m_cv.notify_all ();
+	}
+
+	// co_await loop.schedule () moves the coroutine to the loop thread
+	auto schedule ()
+	{
+		struct Awaiter
+		{
+			EventLoop *loop;
+			bool await_ready () const noexcept { return false; }
+			void await_suspend (std::coroutine_handle<> h) { loop->post (h); }
+			void await_resume () const noexcept {}
+		};
+		return Awaiter { this };
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::coroutine_handle<> > m_ready;
+	bool m_bStop;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Session: coroutine that runs on its own and frees itself at the end
+
+class Session
+{
+public:
+	struct promise_type
+	{
+		Session get_return_object () noexcept { return Session (); }
+		std::suspend_never initial_suspend () const noexcept { return {}; }
+		std::suspend_never final_suspend () const noexcept { return {}; }
+		void return_void () const noexcept {}
+		void unhandled_exception () const noexcept { std::terminate (); }
+	};
+};
+
+namespace detail {
+
+// resumes the awaiting coroutine on the loop, or on the completing thread without one
+class Resumer
+{
+protected:
+	explicit Resumer (EventLoop *loop) : m_loop (loop) {}
+
+	void resume ()
+	{
+		if (m_loop) m_loop->post (m_coro);
+		else m_coro.resume ();
+	}
+
+	EventLoop *m_loop;
+	std::coroutine_handle<> m_coro;
+};
+
+// manual-reset event that breaks IPC_ServerWaitForConnection: a Win32 event,
+// or an eventfd passed as (HANDLE)(intptr_t)fd on POSIX
+class BreakEvent
+{
+public:
+	BreakEvent () : m_hEvent (NULL), m_bSet (false) {}
+	~BreakEvent () { close (); }
+
+	BreakEvent (const BreakEvent&) = delete;
+	BreakEvent& operator= (const BreakEvent&) = delete;
+
+	bool create ()
+	{
+#ifdef _WIN32
+		m_hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+		return m_hEvent != NULL;
+#else
+		int fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fd < 0) return false;
+		m_hEvent = (HANDLE)(intptr_t)fd;
+		return true;
+#endif
+	}
+
+	void set ()
+	{
+		m_bSet = true;
+#ifdef _WIN32
+		SetEvent (m_hEvent);
+#else
+		uint64_t one = 1;
+		ssize_t rc = write ((int)(intptr_t)m_hEvent, &one, sizeof (one));
+		(void)rc;  // the counter can't overflow with one write
+#endif
+	}
+
+	bool isSet () const { return m_bSet; }
+
+	void close ()
+	{
+		if (m_hEvent == NULL) return;
+#ifdef _WIN32
+		CloseHandle (m_hEvent);
+#else
+		::close ((int)(intptr_t)m_hEvent);
+#endif
+		m_hEvent = NULL;
+	}
+
+	HANDLE handle () const { return m_hEvent; }
+
+private:
+	HANDLE m_hEvent;
+	std::atomic<bool> m_bSet;
+};
+
+} // namespace detail
+
+class Connection;
+
+//////////////////////////////////////////////////////////////////////////////
+// IoOp: co_await of Connection::send/recv, the result as IPC_Send/IPC_Recv return it
+
+class IoOp : private detail::Resumer
+{
+public:
+	IoOp (HIPCCONNECTION hConn, EventLoop *loop, bool bSend, void *buf, DWORD size, std::stop_token st)
+		: Resumer (loop), m_hConn (hConn), m_bSend (bSend), m_buf (buf), m_size (size),
+		  m_stop (std::move (st)), m_result (IPC_RC_ERROR), m_bArrived (false) {}
+
+	IoOp (const IoOp&) = delete;
+	IoOp& operator= (const IoOp&) = delete;
+
+	bool await_ready () const noexcept { return false; }
+
+	bool await_suspend (std::coroutine_handle<> h)
+	{
+		m_coro = h;
+		if (m_stop.stop_requested ()) return false;
+
+		BOOL bPosted = m_bSend ? IPC_SendAsync (m_hConn, m_buf, m_size, &IoOp::done, this)
+		                       : IPC_RecvAsync (m_hConn, m_buf, m_size, &IoOp::done, this);
+		if (! bPosted) return false;
+
+		// the completion waits for this point before it resumes
+		if (m_stop.stop_possible ()) m_cancel.emplace (m_stop, Canceller { this });
+		return ! m_bArrived.exchange (true);
+	}
+
+	DWORD await_resume ()
+	{
+		m_cancel.reset ();
+		return m_result;
+	}
+
+private:
+	struct Canceller
+	{
+		IoOp *op;
+		void operator() () const noexcept { IPC_CancelAsync (op->m_hConn, op); }
+	};
+
+	static void __stdcall done (HIPCCONNECTION, DWORD dwResult, void *pvContext)
+	{
+		IoOp *op = (IoOp *)pvContext;
+		op->m_result = dwResult;
+		if (op->m_bArrived.exchange (true)) op->resume ();
+	}
+
+	HIPCCONNECTION m_hConn;
+	bool  m_bSend;
+	void *m_buf;
+	DWORD m_size;
+	std::stop_token m_stop;
+	std::optional<std::stop_callback<Canceller> > m_cancel;
+	DWORD m_result;
+	std::atomic<bool> m_bArrived;  // set by the first of await_suspend and the completion
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// ConnectOp: co_await of Server::accept/Connection::connect, a Connection
+
+class ConnectOp : private detail::Resumer
+{
+public:
+	// hServer - accept on it, otherwise connect to pszServerName
+	ConnectOp (HIPCSERVER hServer, const char *pszServerName, DWORD dwTimeout, EventLoop *loop, std::stop_token st)
+		: Resumer (loop), m_hServer (hServer), m_pszServerName (pszServerName), m_dwTimeout (dwTimeout),
+		  m_stop (std::move (st)), m_hResult ((HIPCCONNECTION)IPC_RC_INVALID_HANDLE) {}
+
+	ConnectOp (const ConnectOp&) = delete;
+	ConnectOp& operator= (const ConnectOp&) = delete;
+
+	bool await_ready () const noexcept { return false; }
+
+	bool await_suspend (std::coroutine_handle<> h)
+	{
+		m_coro = h;
+		if (m_stop.stop_requested ()) return false;
+
+		if (! m_break.create ()) return false;
+		if (m_stop.stop_possible ()) m_cancel.emplace (m_stop, Breaker { &m_break });
+
+		try {
+			std::thread (&ConnectOp::work, this).detach ();
+			return true;
+		} catch (const std::system_error&) {
+			m_cancel.reset ();
+			return false;
+		}
+	}
+
+	Connection await_resume ();
+
+private:
+	struct Breaker
+	{
+		detail::BreakEvent *pBreak;
+		void operator() () const noexcept { pBreak->set (); }
+	};
+
+	static void work (ConnectOp *op)
+	{
+		// IPC_Connect has no break event: it waits in slices
+		const bool bSlices = (op->m_hServer == NULL);
+		const DWORD dwSlice = 100;
+		DWORD dwLeft = op->m_dwTimeout;
+		for (;;) {
+			DWORD dwWait = bSlices ? ((dwLeft < dwSlice) ? dwLeft : dwSlice) : dwLeft;
+			op->m_hResult = op->m_hServer
+				? IPC_ServerWaitForConnection (op->m_hServer, dwWait, op->m_break.handle ())
+				: IPC_Connect ((char *)op->m_pszServerName, dwWait);
+			if (op->m_hResult != (HIPCCONNECTION)IPC_RC_TIMEOUT || ! bSlices) break;
+			if (dwLeft != IPC_TIMEOUT_INFINITE) dwLeft -= dwWait;
+			if (dwLeft == 0 || op->m_break.isSet ()) break;
+		}
+
+		op->resume ();
+	}
+
+	HIPCSERVER  m_hServer;
+	const char *m_pszServerName;
+	DWORD       m_dwTimeout;
+	std::stop_token m_stop;
+	std::optional<std::stop_callback<Breaker> > m_cancel;
+	detail::BreakEvent m_break;
+	HIPCCONNECTION m_hResult;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Connection: owns the handle, the operations complete on the loop
+
+class Connection
+{
+public:
+	Connection () : m_hConn (NULL), m_loop (NULL) {}
+	explicit Connection (HIPCCONNECTION hConn, EventLoop *loop = NULL) : m_hConn (hConn), m_loop (loop) {}
+	~Connection () { close (); }
+
+	Connection (Connection&& other) noexcept : m_hConn (other.m_hConn), m_loop (other.m_loop) { other.m_hConn = NULL; }
+	Connection& operator= (Connection&& other) noexcept
+	{
+		if (this != &other) {
+			close ();
+			m_hConn = other.m_hConn;
+			m_loop = other.m_loop;
+			other.m_hConn = NULL;
+		}
+		return *this;
+	}
+
+	Connection (const Connection&) = delete;
+	Connection& operator= (const Connection&) = delete;
+
+	bool valid () const { return CHECK_IPC_HCONNECTION (m_hConn) != FALSE; }
+	HIPCCONNECTION handle () const { return m_hConn; }
+
+	// fails the pending operations
+	void close ()
+	{
+		if (valid ()) IPC_CloseConnection (m_hConn);
+		m_hConn = NULL;
+	}
+
+	IoOp send (const void *buf, DWORD size, std::stop_token st = {})
+		{ return IoOp (m_hConn, m_loop, true, (void *)buf, size, std::move (st)); }
+
+	IoOp recv (void *buf, DWORD size, std::stop_token st = {})
+		{ return IoOp (m_hConn, m_loop, false, buf, size, std::move (st)); }
+
+	static ConnectOp connect (const char *pszServerName, EventLoop *loop = NULL,
+		DWORD dwTimeout = IPC_TIMEOUT_INFINITE, std::stop_token st = {})
+		{ return ConnectOp (NULL, pszServerName, dwTimeout, loop, std::move (st)); }
+
+private:
+	HIPCCONNECTION m_hConn;
+	EventLoop     *m_loop;
+};
+
+inline Connection ConnectOp::await_resume ()
+{
+	m_cancel.reset ();
+	m_break.close ();
+	return Connection (CHECK_IPC_HCONNECTION (m_hResult) ? m_hResult : NULL, m_loop);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Server: owns the handle, accepted connections complete on its loop
+
+class Server
+{
+public:
+	Server () : m_hServer (NULL), m_loop (NULL) {}
+	explicit Server (HIPCSERVER hServer, EventLoop *loop = NULL) : m_hServer (hServer), m_loop (loop) {}
+	~Server () { stop (); }
+
+	Server (Server&& other) noexcept : m_hServer (other.m_hServer), m_loop (other.m_loop) { other.m_hServer = NULL; }
+	Server& operator= (Server&& other) noexcept
+	{
+		if (this != &other) {
+			stop ();
+			m_hServer = other.m_hServer;
+			m_loop = other.m_loop;
+			other.m_hServer = NULL;
+		}
+		return *this;
+	}
+
+	Server (const Server&) = delete;
+	Server& operator= (const Server&) = delete;
+
+	static Server start (const char *pszServerName, EventLoop *loop = NULL)
+	{
+		HIPCSERVER hServer = IPC_ServerStart ((char *)pszServerName);
+		return Server ((hServer != (HIPCSERVER)IPC_RC_INVALID_HANDLE && hServer != (HIPCSERVER)IPC_RC_TIMEOUT) ? hServer : NULL, loop);
+	}
+
+	bool valid () const { return m_hServer != NULL; }
+	HIPCSERVER handle () const { return m_hServer; }
+
+	void stop ()
+	{
+		if (m_hServer) IPC_ServerStop (m_hServer);
+		m_hServer = NULL;
+	}
+
+	ConnectOp accept (std::stop_token st = {}, DWORD dwTimeout = IPC_TIMEOUT_INFINITE)
+		{ return ConnectOp (m_hServer, NULL, dwTimeout, m_loop, std::move (st)); }
+
+private:
+	HIPCSERVER m_hServer;
+	EventLoop *m_loop;
+};
+
+} // namespace ipc
+
+#endif // IPC_CORO_H
+
+// eof ///////////////////////////////////////////////////////////////////////
@@ -19,6 +19,23 @@ extern "C" {
 
 #include "ipc_err.h"
 
+//////////////////////////////////////////////////////////////////////////////
+// Windows base types for the POSIX builds
+
+#ifndef _WIN32
+#	include <stddef.h>
+#	include <stdint.h>
+
+typedef	uint32_t	DWORD;
+typedef	int			BOOL;
+typedef	void *		HANDLE;
+
+#	define	TRUE				1
+#	define	FALSE				0
+#	define	INFINITE			0xFFFFFFFF
+#	define	__stdcall
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 
 #define	IPC_RC_INVALID_HANDLE	0x00000000
@@ -27,12 +44,54 @@ extern "C" {
 
 #define	IPC_TIMEOUT_INFINITE	INFINITE
 
+#define	IPC_CHANNEL_SIZE_DEFAULT	0x00001000
+#define	IPC_CHANNEL_SIZE_MIN		0x00001000
+#define	IPC_CHANNEL_SIZE_MAX		0x04000000
+
+#define	IPC_SECTION_THRESHOLD_DEFAULT	0x00100000
+
+#define	IPC_SPIN_ADAPTIVE		0xFFFFFFFF
+
 typedef	void * HIPCSERVER;		// [ 1, 2, ... , IPC_RC_TIMEOUT, IPC_RC_INVALID_HANDLE ]
 typedef	void * HIPCCONNECTION;	// [ 1, 2, ... , IPC_RC_TIMEOUT, IPC_RC_INVALID_HANDLE ]
+typedef	void * HIPCPOLL;		// [ 1, 2, ... , IPC_RC_INVALID_HANDLE ]
+
+// message segment for IPC_SendV/IPC_RecvV
+typedef struct _IPC_BUF
+{
+	void	*pvBuf;
+	DWORD	dwSize;
+} IPC_BUF;
+
+// IPC_PollAdd/IPC_PollWait events
+#define	IPC_POLL_IN				0x00000001	// a message can be received
+#define	IPC_POLL_OUT			0x00000002	// a message can be sent
+#define	IPC_POLL_CLOSED			0x00000004	// the connection is closed or broken (always reported)
+
+// ready connection returned by IPC_PollWait
+typedef struct _IPC_POLL_EVENT
+{
+	HIPCCONNECTION	hConnection;
+	DWORD			dwEvents;		// IPC_POLL_XXX
+} IPC_POLL_EVENT;
+
+// completion of IPC_SendAsync/IPC_RecvAsync, dwResult as IPC_Send/IPC_Recv return it
+typedef void (__stdcall *IPC_ASYNC_CALLBACK)(HIPCCONNECTION hConnection, DWORD dwResult, void *pvContext);
+
+// header of IPC_Call/IPC_CallAsync requests and IPC_Reply replies, the payload follows
+typedef struct _IPC_CALL_HDR
+{
+	DWORD	dwCallId;
+	DWORD	dwReserved;		// 0
+} IPC_CALL_HDR;
+
+// message handler of IPC_ServerRun, pvMsg is valid until it returns;
+// pvMsg NULL and dwSize IPC_RC_ERROR when the connection has closed
+typedef void (__stdcall *IPC_SERVER_HANDLER)(HIPCCONNECTION hConnection, const void *pvMsg, DWORD dwSize, void *pvContext);
 
 __inline BOOL CHECK_IPC_HCONNECTION(HIPCCONNECTION hConnection)
 {
-	return (hConnection && ((int)hConnection != -2));
+	return (hConnection && (hConnection != (HIPCCONNECTION)IPC_RC_TIMEOUT));
 }
 
 __inline BOOL CHECK_IPC_RESULT(int rc)
@@ -41,7 +100,11 @@ __inline BOOL CHECK_IPC_RESULT(int rc)
 }
 
 #ifndef		IPC_API
-#	define	IPC_API				__declspec(dllimport)
+#	ifdef	_WIN32
+#		define	IPC_API			__declspec(dllimport)
+#	else
+#		define	IPC_API			__attribute__((visibility("default")))
+#	endif
 #endif
 
 //////////////////////////////////////////////////////////////////////////////
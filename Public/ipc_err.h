@@ -24,6 +24,7 @@ extern "C" {
 #define	IPC_ERR_USER_EVENT_SET		0x00000003	// user event signaled
 #define	IPC_ERR_CLOSED				0x00000004	// connection closed from other thread
 #define	IPC_ERR_BROKEN				0x00000005	// connection broken
+#define	IPC_ERR_MSG_TRUNCATED		0x00000006	// message larger than the buffer, the rest was discarded
 #define	IPC_ERR_TIMEOUT				0xfffffffe	// this operation returned because the timeout period expired
 #define	IPC_ERR_UNKNOWN				0xffffffff	// unknown error
 
@@ -29,6 +29,34 @@ IPC_RESET_EVENTS				IPC_ResetEvents				= 0;
 
 IPC_GET_CONNECTION_LAST_ERR		IPC_GetConnectionLastErr	= 0;
 
+IPC_SERVER_START_EX				IPC_ServerStartEx			= 0;
+IPC_CONNECT_EX					IPC_ConnectEx				= 0;
+IPC_SEND_RESERVE				IPC_SendReserve				= 0;
+IPC_SEND_COMMIT					IPC_SendCommit				= 0;
+IPC_RECV_VIEW					IPC_RecvView				= 0;
+IPC_RECV_RELEASE				IPC_RecvRelease				= 0;
+IPC_SET_SECTION_THRESHOLD		IPC_SetSectionThreshold		= 0;
+IPC_SET_SPIN_TIME				IPC_SetSpinTime				= 0;
+IPC_SEND_V						IPC_SendV					= 0;
+IPC_RECV_V						IPC_RecvV					= 0;
+IPC_SEND_BATCH					IPC_SendBatch				= 0;
+IPC_RECV_BATCH					IPC_RecvBatch				= 0;
+IPC_SET_BACKLOG					IPC_SetBacklog				= 0;
+IPC_POLL_CREATE					IPC_PollCreate				= 0;
+IPC_POLL_CLOSE					IPC_PollClose				= 0;
+IPC_POLL_ADD					IPC_PollAdd					= 0;
+IPC_POLL_REMOVE					IPC_PollRemove				= 0;
+IPC_POLL_WAIT					IPC_PollWait				= 0;
+IPC_SEND_ASYNC					IPC_SendAsync				= 0;
+IPC_RECV_ASYNC					IPC_RecvAsync				= 0;
+IPC_CANCEL_ASYNC				IPC_CancelAsync				= 0;
+IPC_SERVER_RUN					IPC_ServerRun				= 0;
+IPC_SET_MULTI_PRODUCER			IPC_SetMultiProducer		= 0;
+IPC_CALL						IPC_Call					= 0;
+IPC_CALL_ASYNC					IPC_CallAsync				= 0;
+IPC_REPLY						IPC_Reply					= 0;
+IPC_DG_RECV_BATCH				IPC_DgRecvBatch				= 0;
+
 IPC_SERVER_DG_START				IPC_ServerDgStart			= 0;
 IPC_SERVER_DG_STOP				IPC_ServerDgStop			= 0;
 IPC_DG_RECV						IPC_DgRecv					= 0;
@@ -54,6 +82,34 @@ BOOL			__stdcall IPC_StubResetEvents				(HIPCCONNECTION hConnection) {return FAL
 
 DWORD			__stdcall IPC_StubGetConnectionLastErr		(HIPCCONNECTION hConnection) {return IPC_RC_ERROR;}
 
+HIPCSERVER		__stdcall IPC_StubServerStartEx				(const char *pszServerName, DWORD dwSendSize, DWORD dwRecvSize) {return 0;}
+HIPCCONNECTION	__stdcall IPC_StubConnectEx					(char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize) {return 0;}
+DWORD			__stdcall IPC_StubSendReserve				(HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubSendCommit				(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubRecvView					(HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout) {return IPC_RC_ERROR;}
+BOOL			__stdcall IPC_StubRecvRelease				(HIPCCONNECTION hConnection, const void *pvBuf) {return FALSE;}
+BOOL			__stdcall IPC_StubSetSectionThreshold		(HIPCCONNECTION hConnection, DWORD dwThreshold) {return FALSE;}
+BOOL			__stdcall IPC_StubSetSpinTime				(HIPCCONNECTION hConnection, DWORD dwMicroseconds) {return FALSE;}
+DWORD			__stdcall IPC_StubSendV						(HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubRecvV						(HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubSendBatch					(HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubRecvBatch					(HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout) {return IPC_RC_ERROR;}
+BOOL			__stdcall IPC_StubSetBacklog				(HIPCSERVER hServer, DWORD dwBacklog) {return FALSE;}
+HIPCPOLL		__stdcall IPC_StubPollCreate				() {return 0;}
+BOOL			__stdcall IPC_StubPollClose					(HIPCPOLL hPoll) {return FALSE;}
+BOOL			__stdcall IPC_StubPollAdd					(HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents) {return FALSE;}
+BOOL			__stdcall IPC_StubPollRemove				(HIPCPOLL hPoll, HIPCCONNECTION hConnection) {return FALSE;}
+DWORD			__stdcall IPC_StubPollWait					(HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout) {return IPC_RC_ERROR;}
+BOOL			__stdcall IPC_StubSendAsync					(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) {return FALSE;}
+BOOL			__stdcall IPC_StubRecvAsync					(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) {return FALSE;}
+BOOL			__stdcall IPC_StubCancelAsync				(HIPCCONNECTION hConnection, void *pvContext) {return FALSE;}
+BOOL			__stdcall IPC_StubServerRun					(HIPCSERVER hServer, IPC_SERVER_HANDLER pfnHandler, void *pvContext, DWORD dwWorkers, HANDLE hStopEvent) {return FALSE;}
+BOOL			__stdcall IPC_StubSetMultiProducer			(HIPCCONNECTION hConnection, BOOL bEnable) {return FALSE;}
+DWORD			__stdcall IPC_StubCall						(HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, DWORD dwTimeout) {return IPC_RC_ERROR;}
+BOOL			__stdcall IPC_StubCallAsync					(HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) {return FALSE;}
+DWORD			__stdcall IPC_StubReply						(HIPCCONNECTION hConnection, DWORD dwCallId, const void *pvReply, DWORD dwReplySize, DWORD dwTimeout) {return IPC_RC_ERROR;}
+DWORD			__stdcall IPC_StubDgRecvBatch				(char *pszDgServerName, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout) {return IPC_RC_ERROR;}
+
 HIPCSERVER		__stdcall IPC_StubServerDgStart				(char *pszServerName) {return 0;}
 BOOL			__stdcall IPC_StubServerDgStop				(HIPCSERVER	hServer) {return FALSE;}
 DWORD			__stdcall IPC_StubDgRecv					(char *pszServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout) {return IPC_RC_ERROR;}
@@ -135,6 +191,34 @@ bool IPC_LoadDLL()
 
 	if ( ! (IPC_GetConnectionLastErr	= (IPC_GET_CONNECTION_LAST_ERR)		GetProcAddress(IPC_g_hLib, "IPC_GetConnectionLastErr")))	IPC_GetConnectionLastErr	= IPC_StubGetConnectionLastErr;
 
+	if ( ! (IPC_ServerStartEx			= (IPC_SERVER_START_EX)				GetProcAddress(IPC_g_hLib, "IPC_ServerStartEx")))			IPC_ServerStartEx			= IPC_StubServerStartEx;
+	if ( ! (IPC_ConnectEx				= (IPC_CONNECT_EX)					GetProcAddress(IPC_g_hLib, "IPC_ConnectEx")))				IPC_ConnectEx				= IPC_StubConnectEx;
+	if ( ! (IPC_SendReserve				= (IPC_SEND_RESERVE)				GetProcAddress(IPC_g_hLib, "IPC_SendReserve")))				IPC_SendReserve				= IPC_StubSendReserve;
+	if ( ! (IPC_SendCommit				= (IPC_SEND_COMMIT)					GetProcAddress(IPC_g_hLib, "IPC_SendCommit")))				IPC_SendCommit				= IPC_StubSendCommit;
+	if ( ! (IPC_RecvView				= (IPC_RECV_VIEW)					GetProcAddress(IPC_g_hLib, "IPC_RecvView")))				IPC_RecvView				= IPC_StubRecvView;
+	if ( ! (IPC_RecvRelease				= (IPC_RECV_RELEASE)				GetProcAddress(IPC_g_hLib, "IPC_RecvRelease")))				IPC_RecvRelease				= IPC_StubRecvRelease;
+	if ( ! (IPC_SetSectionThreshold		= (IPC_SET_SECTION_THRESHOLD)		GetProcAddress(IPC_g_hLib, "IPC_SetSectionThreshold")))		IPC_SetSectionThreshold		= IPC_StubSetSectionThreshold;
+	if ( ! (IPC_SetSpinTime				= (IPC_SET_SPIN_TIME)				GetProcAddress(IPC_g_hLib, "IPC_SetSpinTime")))				IPC_SetSpinTime				= IPC_StubSetSpinTime;
+	if ( ! (IPC_SendV					= (IPC_SEND_V)						GetProcAddress(IPC_g_hLib, "IPC_SendV")))					IPC_SendV					= IPC_StubSendV;
+	if ( ! (IPC_RecvV					= (IPC_RECV_V)						GetProcAddress(IPC_g_hLib, "IPC_RecvV")))					IPC_RecvV					= IPC_StubRecvV;
+	if ( ! (IPC_SendBatch				= (IPC_SEND_BATCH)					GetProcAddress(IPC_g_hLib, "IPC_SendBatch")))				IPC_SendBatch				= IPC_StubSendBatch;
+	if ( ! (IPC_RecvBatch				= (IPC_RECV_BATCH)					GetProcAddress(IPC_g_hLib, "IPC_RecvBatch")))				IPC_RecvBatch				= IPC_StubRecvBatch;
+	if ( ! (IPC_SetBacklog				= (IPC_SET_BACKLOG)					GetProcAddress(IPC_g_hLib, "IPC_SetBacklog")))				IPC_SetBacklog				= IPC_StubSetBacklog;
+	if ( ! (IPC_PollCreate				= (IPC_POLL_CREATE)					GetProcAddress(IPC_g_hLib, "IPC_PollCreate")))				IPC_PollCreate				= IPC_StubPollCreate;
+	if ( ! (IPC_PollClose				= (IPC_POLL_CLOSE)					GetProcAddress(IPC_g_hLib, "IPC_PollClose")))				IPC_PollClose				= IPC_StubPollClose;
+	if ( ! (IPC_PollAdd					= (IPC_POLL_ADD)					GetProcAddress(IPC_g_hLib, "IPC_PollAdd")))					IPC_PollAdd					= IPC_StubPollAdd;
+	if ( ! (IPC_PollRemove				= (IPC_POLL_REMOVE)					GetProcAddress(IPC_g_hLib, "IPC_PollRemove")))				IPC_PollRemove				= IPC_StubPollRemove;
+	if ( ! (IPC_PollWait				= (IPC_POLL_WAIT)					GetProcAddress(IPC_g_hLib, "IPC_PollWait")))				IPC_PollWait				= IPC_StubPollWait;
+	if ( ! (IPC_SendAsync				= (IPC_SEND_ASYNC)					GetProcAddress(IPC_g_hLib, "IPC_SendAsync")))				IPC_SendAsync				= IPC_StubSendAsync;
+	if ( ! (IPC_RecvAsync				= (IPC_RECV_ASYNC)					GetProcAddress(IPC_g_hLib, "IPC_RecvAsync")))				IPC_RecvAsync				= IPC_StubRecvAsync;
+	if ( ! (IPC_CancelAsync				= (IPC_CANCEL_ASYNC)				GetProcAddress(IPC_g_hLib, "IPC_CancelAsync")))				IPC_CancelAsync				= IPC_StubCancelAsync;
+	if ( ! (IPC_ServerRun				= (IPC_SERVER_RUN)					GetProcAddress(IPC_g_hLib, "IPC_ServerRun")))				IPC_ServerRun				= IPC_StubServerRun;
+	if ( ! (IPC_SetMultiProducer		= (IPC_SET_MULTI_PRODUCER)			GetProcAddress(IPC_g_hLib, "IPC_SetMultiProducer")))		IPC_SetMultiProducer		= IPC_StubSetMultiProducer;
+	if ( ! (IPC_Call					= (IPC_CALL)						GetProcAddress(IPC_g_hLib, "IPC_Call")))					IPC_Call					= IPC_StubCall;
+	if ( ! (IPC_CallAsync				= (IPC_CALL_ASYNC)					GetProcAddress(IPC_g_hLib, "IPC_CallAsync")))				IPC_CallAsync				= IPC_StubCallAsync;
+	if ( ! (IPC_Reply					= (IPC_REPLY)						GetProcAddress(IPC_g_hLib, "IPC_Reply")))					IPC_Reply					= IPC_StubReply;
+	if ( ! (IPC_DgRecvBatch				= (IPC_DG_RECV_BATCH)				GetProcAddress(IPC_g_hLib, "IPC_DgRecvBatch")))				IPC_DgRecvBatch				= IPC_StubDgRecvBatch;
+
 	if ( ! (IPC_ServerDgStart			= (IPC_SERVER_DG_START)				GetProcAddress(IPC_g_hLib, "IPC_ServerDgStart")))			IPC_ServerDgStart			= IPC_StubServerDgStart;
 	if ( ! (IPC_ServerDgStop			= (IPC_SERVER_DG_STOP)				GetProcAddress(IPC_g_hLib, "IPC_ServerDgStop")))			IPC_ServerDgStop			= IPC_StubServerDgStop;
 	if ( ! (IPC_DgRecv					= (IPC_DG_RECV)						GetProcAddress(IPC_g_hLib, "IPC_DgRecv")))					IPC_DgRecv					= IPC_StubDgRecv;
@@ -174,6 +258,34 @@ bool IPC_FreeDLL()
 
 	IPC_GetConnectionLastErr	= 0;
 
+	IPC_ServerStartEx			= 0;
+	IPC_ConnectEx				= 0;
+	IPC_SendReserve				= 0;
+	IPC_SendCommit				= 0;
+	IPC_RecvView				= 0;
+	IPC_RecvRelease				= 0;
+	IPC_SetSectionThreshold		= 0;
+	IPC_SetSpinTime				= 0;
+	IPC_SendV					= 0;
+	IPC_RecvV					= 0;
+	IPC_SendBatch				= 0;
+	IPC_RecvBatch				= 0;
+	IPC_SetBacklog				= 0;
+	IPC_PollCreate				= 0;
+	IPC_PollClose				= 0;
+	IPC_PollAdd					= 0;
+	IPC_PollRemove				= 0;
+	IPC_PollWait				= 0;
+	IPC_SendAsync				= 0;
+	IPC_RecvAsync				= 0;
+	IPC_CancelAsync				= 0;
+	IPC_ServerRun				= 0;
+	IPC_SetMultiProducer		= 0;
+	IPC_Call					= 0;
+	IPC_CallAsync				= 0;
+	IPC_Reply					= 0;
+	IPC_DgRecvBatch				= 0;
+
 	IPC_ServerDgStart			= 0;
 	IPC_ServerDgStop			= 0;
 	IPC_DgRecv					= 0;
@@ -36,6 +36,34 @@ typedef	IPC_API BOOL			(__stdcall * IPC_RESET_EVENTS)				(HIPCCONNECTION hConnec
 
 typedef IPC_API	DWORD			(__stdcall * IPC_GET_CONNECTION_LAST_ERR)	(HIPCCONNECTION hConnection);
 
+typedef IPC_API HIPCSERVER		(__stdcall * IPC_SERVER_START_EX)			(const char *pszServerName, DWORD dwSendSize, DWORD dwRecvSize);
+typedef	IPC_API HIPCCONNECTION	(__stdcall * IPC_CONNECT_EX)				(char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize);
+typedef IPC_API DWORD			(__stdcall * IPC_SEND_RESERVE)				(HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout);
+typedef IPC_API DWORD			(__stdcall * IPC_SEND_COMMIT)				(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize);
+typedef IPC_API DWORD			(__stdcall * IPC_RECV_VIEW)					(HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout);
+typedef IPC_API BOOL			(__stdcall * IPC_RECV_RELEASE)				(HIPCCONNECTION hConnection, const void *pvBuf);
+typedef IPC_API BOOL			(__stdcall * IPC_SET_SECTION_THRESHOLD)		(HIPCCONNECTION hConnection, DWORD dwThreshold);
+typedef IPC_API BOOL			(__stdcall * IPC_SET_SPIN_TIME)				(HIPCCONNECTION hConnection, DWORD dwMicroseconds);
+typedef IPC_API DWORD			(__stdcall * IPC_SEND_V)					(HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout);
+typedef IPC_API DWORD			(__stdcall * IPC_RECV_V)					(HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout);
+typedef IPC_API DWORD			(__stdcall * IPC_SEND_BATCH)				(HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout);
+typedef IPC_API DWORD			(__stdcall * IPC_RECV_BATCH)				(HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout);
+typedef IPC_API BOOL			(__stdcall * IPC_SET_BACKLOG)				(HIPCSERVER hServer, DWORD dwBacklog);
+typedef IPC_API HIPCPOLL		(__stdcall * IPC_POLL_CREATE)				();
+typedef IPC_API BOOL			(__stdcall * IPC_POLL_CLOSE)				(HIPCPOLL hPoll);
+typedef IPC_API BOOL			(__stdcall * IPC_POLL_ADD)					(HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents);
+typedef IPC_API BOOL			(__stdcall * IPC_POLL_REMOVE)				(HIPCPOLL hPoll, HIPCCONNECTION hConnection);
+typedef IPC_API DWORD			(__stdcall * IPC_POLL_WAIT)					(HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout);
+typedef IPC_API BOOL			(__stdcall * IPC_SEND_ASYNC)				(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+typedef IPC_API BOOL			(__stdcall * IPC_RECV_ASYNC)				(HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+typedef IPC_API BOOL			(__stdcall * IPC_CANCEL_ASYNC)				(HIPCCONNECTION hConnection, void *pvContext);
+typedef IPC_API BOOL			(__stdcall * IPC_SERVER_RUN)				(HIPCSERVER hServer, IPC_SERVER_HANDLER pfnHandler, void *pvContext, DWORD dwWorkers, HANDLE hStopEvent);
+typedef IPC_API BOOL			(__stdcall * IPC_SET_MULTI_PRODUCER)		(HIPCCONNECTION hConnection, BOOL bEnable);
+typedef IPC_API DWORD			(__stdcall * IPC_CALL)						(HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, DWORD dwTimeout);
+typedef IPC_API BOOL			(__stdcall * IPC_CALL_ASYNC)				(HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+typedef IPC_API DWORD			(__stdcall * IPC_REPLY)						(HIPCCONNECTION hConnection, DWORD dwCallId, const void *pvReply, DWORD dwReplySize, DWORD dwTimeout);
+typedef IPC_API DWORD			(__stdcall * IPC_DG_RECV_BATCH)				(char *pszDgServerName, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout);
+
 typedef	IPC_API	HIPCSERVER		(__stdcall * IPC_SERVER_DG_START)			(char *pszServerName);
 typedef	IPC_API	BOOL			(__stdcall * IPC_SERVER_DG_STOP)			(HIPCSERVER hServer);
 typedef	IPC_API DWORD			(__stdcall * IPC_DG_RECV)					(char *pszServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout);
@@ -61,6 +89,34 @@ extern IPC_RESET_EVENTS					IPC_ResetEvents;
 
 extern IPC_GET_CONNECTION_LAST_ERR		IPC_GetConnectionLastErr;
 
+extern IPC_SERVER_START_EX				IPC_ServerStartEx;
+extern IPC_CONNECT_EX					IPC_ConnectEx;
+extern IPC_SEND_RESERVE					IPC_SendReserve;
+extern IPC_SEND_COMMIT					IPC_SendCommit;
+extern IPC_RECV_VIEW					IPC_RecvView;
+extern IPC_RECV_RELEASE					IPC_RecvRelease;
+extern IPC_SET_SECTION_THRESHOLD		IPC_SetSectionThreshold;
+extern IPC_SET_SPIN_TIME				IPC_SetSpinTime;
+extern IPC_SEND_V						IPC_SendV;
+extern IPC_RECV_V						IPC_RecvV;
+extern IPC_SEND_BATCH					IPC_SendBatch;
+extern IPC_RECV_BATCH					IPC_RecvBatch;
+extern IPC_SET_BACKLOG					IPC_SetBacklog;
+extern IPC_POLL_CREATE					IPC_PollCreate;
+extern IPC_POLL_CLOSE					IPC_PollClose;
+extern IPC_POLL_ADD						IPC_PollAdd;
+extern IPC_POLL_REMOVE					IPC_PollRemove;
+extern IPC_POLL_WAIT					IPC_PollWait;
+extern IPC_SEND_ASYNC					IPC_SendAsync;
+extern IPC_RECV_ASYNC					IPC_RecvAsync;
+extern IPC_CANCEL_ASYNC					IPC_CancelAsync;
+extern IPC_SERVER_RUN					IPC_ServerRun;
+extern IPC_SET_MULTI_PRODUCER			IPC_SetMultiProducer;
+extern IPC_CALL							IPC_Call;
+extern IPC_CALL_ASYNC					IPC_CallAsync;
+extern IPC_REPLY						IPC_Reply;
+extern IPC_DG_RECV_BATCH				IPC_DgRecvBatch;
+
 extern IPC_SERVER_DG_START				IPC_ServerDgStart;
 extern IPC_SERVER_DG_STOP				IPC_ServerDgStop;
 extern IPC_DG_RECV						IPC_DgRecv;
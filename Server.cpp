@@ -1,8 +1,28 @@
 // main.cpp //////////////////////////////////////
 
-#include <windows.h>
 #include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
 #include "load_ipc.h"
+#else
+#include <ipc.h>
+#include <string.h>
+#include <time.h>
+
+// linked with libjr_ipc.so
+inline bool IPC_LoadDLL()	{ return true; }
+inline bool IPC_FreeDLL()	{ return true; }
+#define getch			getchar
+#define __TEXT(s)		s
+
+static DWORD GetTickCount()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (DWORD)( ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+#endif
 //#include "DateTime.h"
 
 //////////////////////////////////////////////////
@@ -48,14 +68,14 @@ int main( int argc, char * * argv )
 	for ( DWORD i = 0; i <= 300000; i++ )
 	{
 		DWORD rc = IPC_Recv( hConnection1, p, 64 * 1024, INFINITE );
- 		if ( rc == -1 || rc == -2 ) 
+ 		if ( rc == IPC_RC_ERROR || rc == IPC_RC_TIMEOUT ) 
 			printf( "\nerror\n" );
 // 		else
 // 			printf( "IPC_Recv Count: %d\n" ,i);
 
 		strcpy( p, "ServerSendData" );
 		rc = IPC_Send( hConnection1, p, 64 * 1024, INFINITE );
-		if ( rc == -1 || rc == -2 ) 
+		if ( rc == IPC_RC_ERROR || rc == IPC_RC_TIMEOUT ) 
 			printf( "\nerror\n" );
 // 		else
 // 			printf( "IPC_Send Count: %d\n" ,i);
@@ -63,7 +83,7 @@ int main( int argc, char * * argv )
 // 		BOOL boRes = IPC_GetEvents( hConnection1, &dwRes, 0 );
 	}
 	DWORD dwTickCount2 = GetTickCount();
-	printf("\nTickCount=%ld\n", dwTickCount2 - dwTickCount1);
+	printf("\nTickCount=%u\n", (unsigned)( dwTickCount2 - dwTickCount1 ));
 	float ftime = (dwTickCount2 - dwTickCount1)/1000.0;
 	printf("300000 items Recv and Send with 64K data per item \nUse time :%f seconds\n",ftime);
 
@@ -71,7 +91,7 @@ int main( int argc, char * * argv )
 
 	delete[] p;
 
-	BOOL r1 = IPC_CloseConnection( hConnection1 );
+	IPC_CloseConnection( hConnection1 );
 
 	IPC_ServerStop( hServer );
 	IPC_FreeDLL();
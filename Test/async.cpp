@@ -0,0 +1,102 @@
+// async.cpp /////////////////////////////////////
+//
+// async operations: completion, order with messages larger than the
+// channel, cancel. Skipped where the transport has no I/O engine (the
+// POSIX shared memory and plain socket transports).
+
+#include "test.h"
+
+struct AsyncOp
+{
+	volatile DWORD	bDone;
+	DWORD			dwResult;
+	unsigned char	buf[20000];
+};
+
+static void __stdcall AsyncDone( HIPCCONNECTION hConnection, DWORD dwResult, void *pvContext )
+{
+	AsyncOp *pOp = (AsyncOp *) pvContext;
+	pOp->dwResult = dwResult;
+	pOp->bDone = 1;
+}
+
+// waits for the callback of pOp
+static bool AsyncWait( AsyncOp *pOp, DWORD dwTimeout )
+{
+	DWORD dwStart = TestTicks();
+	while ( ! pOp->bDone ) {
+		if ( TestTicks() - dwStart > dwTimeout ) return false;
+		TestSleep( 1 );
+	}
+	return true;
+}
+
+TEST_CASE( TestAsync, "async send and receive" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	static AsyncOp recvOp, sendOp;
+	recvOp.bDone = 0;
+	sendOp.bDone = 0;
+	if ( ! IPC_RecvAsync( hConn, recvOp.buf, sizeof(recvOp.buf), AsyncDone, &recvOp ) ) {
+		// no I/O engine
+		CHECK( ! IPC_SendAsync( hClient, sendOp.buf, 100, AsyncDone, &sendOp ) );
+		IPC_CloseConnection( hClient );
+		IPC_CloseConnection( hConn );
+		return true;
+	}
+
+	TestFill( sendOp.buf, 100, 1 );
+	CHECK( IPC_SendAsync( hClient, sendOp.buf, 100, AsyncDone, &sendOp ) );
+	CHECK( AsyncWait( &sendOp, TEST_TIMEOUT ) && sendOp.dwResult == 100 );
+	CHECK( AsyncWait( &recvOp, TEST_TIMEOUT ) && recvOp.dwResult == 100 );
+	CHECK( TestVerify( recvOp.buf, 100, 1 ) );
+
+	// a pending receive fails on cancel, the connection stays usable
+	recvOp.bDone = 0;
+	CHECK( IPC_RecvAsync( hConn, recvOp.buf, sizeof(recvOp.buf), AsyncDone, &recvOp ) );
+	CHECK( IPC_CancelAsync( hConn, &recvOp ) );
+	CHECK( AsyncWait( &recvOp, TEST_TIMEOUT ) && recvOp.dwResult == IPC_RC_ERROR );
+
+	unsigned char buf[100];
+	TestFill( buf, sizeof(buf), 2 );
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( TestVerify( buf, sizeof(buf), 2 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+TEST_CASE( TestAsyncLarge, "async send larger than the channel" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn, IPC_CHANNEL_SIZE_MIN ) );
+
+	// the middle one does not fit the channel behind the first
+	static const DWORD dwSizes[3] = { 3000, 20000, 100 };
+	static AsyncOp ops[3];
+	bool bPosted = true;
+	for ( int i = 0; i < 3 && bPosted; i++ ) {
+		ops[i].bDone = 0;
+		TestFill( ops[i].buf, dwSizes[i], i );
+		bPosted = IPC_SendAsync( hClient, ops[i].buf, dwSizes[i], AsyncDone, &ops[i] ) != FALSE;
+		if ( ! bPosted ) CHECK( i == 0 );		// no I/O engine
+	}
+
+	if ( bPosted ) {
+		static unsigned char buf[20000];
+		for ( int i = 0; i < 3; i++ ) {
+			CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == dwSizes[i] );
+			CHECK( TestVerify( buf, dwSizes[i], i ) );
+		}
+		for ( int i = 0; i < 3; i++ )
+			CHECK( AsyncWait( &ops[i], TEST_TIMEOUT ) && ops[i].dwResult == dwSizes[i] );
+	}
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
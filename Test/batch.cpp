@@ -0,0 +1,81 @@
+// batch.cpp /////////////////////////////////////
+//
+// batches: IPC_SendBatch / IPC_RecvBatch, truncated messages
+
+#include "test.h"
+
+#define BATCH_MSGS	40
+#define MSG_SIZE	64
+
+TEST_CASE( TestBatch, "batches" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	static unsigned char send[BATCH_MSGS][MSG_SIZE], recv[BATCH_MSGS + 8][MSG_SIZE];
+	IPC_BUF sendBufs[BATCH_MSGS], recvBufs[BATCH_MSGS + 8];
+	DWORD sizes[BATCH_MSGS + 8];
+	for ( DWORD i = 0; i < BATCH_MSGS; i++ ) {
+		TestFill( send[i], MSG_SIZE, i );
+		sendBufs[i].pvBuf = send[i];
+		sendBufs[i].dwSize = i % MSG_SIZE + 1;
+	}
+	for ( DWORD i = 0; i < BATCH_MSGS + 8; i++ ) {
+		recvBufs[i].pvBuf = recv[i];
+		recvBufs[i].dwSize = MSG_SIZE;
+	}
+
+	CHECK( IPC_RecvBatch( hConn, recvBufs, BATCH_MSGS + 8, sizes, 0 ) == IPC_RC_TIMEOUT );
+	CHECK( IPC_SendBatch( hClient, sendBufs, BATCH_MSGS, TEST_TIMEOUT ) == BATCH_MSGS );
+
+	// only the queued messages are taken, they may come in several batches
+	DWORD n = 0;
+	while ( n < BATCH_MSGS ) {
+		DWORD dwCount = IPC_RecvBatch( hConn, recvBufs + n, BATCH_MSGS + 8 - n, sizes + n, TEST_TIMEOUT );
+		CHECK( dwCount != IPC_RC_TIMEOUT && dwCount != IPC_RC_ERROR && dwCount != 0 );
+		n += dwCount;
+	}
+	CHECK( n == BATCH_MSGS );
+	for ( DWORD i = 0; i < BATCH_MSGS; i++ )
+		CHECK( sizes[i] == i % MSG_SIZE + 1 && TestVerify( recv[i], sizes[i], i ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+// the rest of a truncated message is dropped, the next one is intact
+
+TEST_CASE( TestTruncated, "truncated messages" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	unsigned char big[100], small[10], buf[100];
+	TestFill( big, sizeof(big), 1 );
+	CHECK( IPC_Send( hClient, big, sizeof(big), TEST_TIMEOUT ) == sizeof(big) );
+	CHECK( IPC_Send( hClient, big, 20, TEST_TIMEOUT ) == 20 );
+	CHECK( IPC_Recv( hConn, small, sizeof(small), TEST_TIMEOUT ) == IPC_RC_ERROR );
+	CHECK( IPC_GetConnectionLastErr( hConn ) == IPC_ERR_MSG_TRUNCATED );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 20 );
+	CHECK( TestVerify( buf, 20, 1 ) );
+
+	// in a batch the truncated message is counted with its whole size and ends the batch
+	IPC_BUF send[] = { { big, sizeof(big) }, { big, 30 } };
+	CHECK( IPC_SendBatch( hClient, send, 2, TEST_TIMEOUT ) == 2 );
+
+	unsigned char a[50], b[50];
+	IPC_BUF recv[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+	DWORD sizes[2] = { 0, };
+	CHECK( IPC_RecvBatch( hConn, recv, 2, sizes, TEST_TIMEOUT ) == 1 );
+	CHECK( IPC_GetConnectionLastErr( hConn ) == IPC_ERR_MSG_TRUNCATED );
+	CHECK( sizes[0] == sizeof(big) && TestVerify( a, sizeof(a), 1 ) );
+
+	CHECK( IPC_RecvBatch( hConn, recv, 2, sizes, TEST_TIMEOUT ) == 1 );
+	CHECK( sizes[0] == 30 && TestVerify( a, 30, 1 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
@@ -0,0 +1,83 @@
+// connect.cpp ///////////////////////////////////
+//
+// connecting: timeouts, a burst of clients behind the backlog
+
+#include "test.h"
+
+#define BURST_SERVER	"jr_ipc_test_burst"
+#define BURST_CLIENTS	12
+
+TEST_CASE( TestConnectTimeout, "connect and accept timeouts" )
+{
+	char szNoServer[] = "jr_ipc_test_none";
+	DWORD dwStart = TestTicks();
+	HIPCCONNECTION hClient = IPC_Connect( szNoServer, 100 );
+	CHECK( ! CHECK_IPC_HCONNECTION( hClient ) );
+	CHECK( TestTicks() - dwStart < TEST_TIMEOUT );
+
+	char szServerName[] = BURST_SERVER;
+	HIPCSERVER hServer = IPC_ServerStart( szServerName );
+	CHECK( hServer != IPC_RC_INVALID_HANDLE );
+	dwStart = TestTicks();
+	CHECK( IPC_ServerWaitForConnection( hServer, 100, NULL ) == (HIPCCONNECTION) IPC_RC_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	IPC_ServerStop( hServer );
+	CHECK( dwElapsed >= 90 && dwElapsed < TEST_TIMEOUT );
+	return true;
+}
+
+//////////////////////////////////////////////////
+
+struct BurstClient
+{
+	DWORD			dwIndex;
+	HIPCCONNECTION	hClient;
+};
+
+static void BurstConnect( void *pvClient )
+{
+	BurstClient *pClient = (BurstClient *) pvClient;
+	char szServerName[] = BURST_SERVER;
+	pClient->hClient = IPC_Connect( szServerName, TEST_TIMEOUT );
+	if ( CHECK_IPC_HCONNECTION( pClient->hClient ) )
+		IPC_Send( pClient->hClient, &pClient->dwIndex, sizeof(pClient->dwIndex), TEST_TIMEOUT );
+}
+
+TEST_CASE( TestConnectBurst, "burst of clients" )
+{
+	char szServerName[] = BURST_SERVER;
+	HIPCSERVER hServer = IPC_ServerStart( szServerName );
+	CHECK( hServer != IPC_RC_INVALID_HANDLE );
+	IPC_SetBacklog( hServer, 4 );	// a hint, the default transport may ignore it
+
+	BurstClient clients[BURST_CLIENTS];
+	TestThread *pThreads[BURST_CLIENTS];
+	for ( DWORD i = 0; i < BURST_CLIENTS; i++ ) {
+		clients[i].dwIndex = i;
+		clients[i].hClient = IPC_RC_INVALID_HANDLE;
+		pThreads[i] = TestThreadStart( BurstConnect, &clients[i] );
+	}
+
+	// every client is accepted once and its connection is its own
+	HIPCCONNECTION hConns[BURST_CLIENTS];
+	DWORD dwSeen = 0, n;
+	for ( n = 0; n < BURST_CLIENTS; n++ ) {
+		hConns[n] = IPC_ServerWaitForConnection( hServer, TEST_TIMEOUT, NULL );
+		if ( ! CHECK_IPC_HCONNECTION( hConns[n] ) ) break;
+		DWORD dwIndex = BURST_CLIENTS;
+		if ( IPC_Recv( hConns[n], &dwIndex, sizeof(dwIndex), TEST_TIMEOUT ) != sizeof(dwIndex) || dwIndex >= BURST_CLIENTS ) break;
+		dwSeen |= 1 << dwIndex;
+	}
+	for ( DWORD i = 0; i < BURST_CLIENTS; i++ )
+		TestThreadJoin( pThreads[i] );
+
+	for ( DWORD i = 0; i < n; i++ )
+		IPC_CloseConnection( hConns[i] );
+	for ( DWORD i = 0; i < BURST_CLIENTS; i++ )
+		if ( CHECK_IPC_HCONNECTION( clients[i].hClient ) ) IPC_CloseConnection( clients[i].hClient );
+	IPC_ServerStop( hServer );
+
+	CHECK( n == BURST_CLIENTS );
+	CHECK( dwSeen == ( 1 << BURST_CLIENTS ) - 1 );
+	return true;
+}
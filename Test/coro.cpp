@@ -0,0 +1,122 @@
+// coro.cpp //////////////////////////////////////
+//
+// ipc_coro.h: accept and connect, an echo session, a receive cancelled
+// through its stop_token. Needs C++20 coroutines (the Makefile builds this
+// file with -std=c++20); without them, or without an I/O engine for the
+// transport, only the connection is checked.
+
+#include "test.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <ipc_coro.h>
+
+#define TEST_CORO_SERVER	"jr_ipc_test_coro"
+
+struct CoroState
+{
+	std::atomic<int>	nPhase;			// 1 - waits for the cancelled receive, 2 - done
+	std::atomic<bool>	bEchoDone;
+	bool				bConnected;
+	DWORD				dwSent, dwEcho, dwCancelled;
+	unsigned char		buf[100], reply[100];
+	std::stop_source	stop;
+};
+
+static void __stdcall CoroProbeDone( HIPCCONNECTION, DWORD, void * )
+{
+}
+
+static ipc::Session CoroEcho( ipc::Connection conn, CoroState& st )
+{
+	unsigned char buf[256];
+	for (;;) {
+		DWORD n = co_await conn.recv( buf, sizeof(buf) );
+		if ( n == IPC_RC_ERROR || co_await conn.send( buf, n ) == IPC_RC_ERROR ) break;
+	}
+	st.bEchoDone = true;
+}
+
+static ipc::Session CoroAccept( ipc::Server& server, CoroState& st )
+{
+	ipc::Connection conn = co_await server.accept( {}, TEST_TIMEOUT );
+	if ( conn.valid() ) CoroEcho( std::move( conn ), st );
+	else st.bEchoDone = true;
+}
+
+static ipc::Session CoroClient( ipc::EventLoop& loop, CoroState& st )
+{
+	ipc::Connection conn = co_await ipc::Connection::connect( TEST_CORO_SERVER, &loop, TEST_TIMEOUT );
+	st.bConnected = conn.valid();
+	if ( st.bConnected ) {
+		TestFill( st.buf, sizeof(st.buf), 1 );
+		st.dwSent = co_await conn.send( st.buf, sizeof(st.buf) );
+		if ( st.dwSent == sizeof(st.buf) ) {
+			st.dwEcho = co_await conn.recv( st.reply, sizeof(st.reply) );
+
+			// nothing answers this one
+			st.nPhase = 1;
+			st.dwCancelled = co_await conn.recv( st.reply, sizeof(st.reply), st.stop.get_token() );
+		}
+	}
+	st.nPhase = 2;
+}
+
+// waits for flag to reach value
+template <class T>
+static bool CoroWait( const std::atomic<T>& flag, T value )
+{
+	DWORD dwStart = TestTicks();
+	while ( flag < value ) {
+		if ( TestTicks() - dwStart > TEST_TIMEOUT ) return false;
+		TestSleep( 1 );
+	}
+	return true;
+}
+
+TEST_CASE( TestCoro, "coroutines" )
+{
+	// does the transport run async operations at all
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	static unsigned char probe[16];
+	bool bEngine = IPC_RecvAsync( hConn, probe, sizeof(probe), CoroProbeDone, NULL ) != FALSE;
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+
+	ipc::EventLoop loop;
+	ipc::Server server = ipc::Server::start( TEST_CORO_SERVER, &loop );
+	CHECK( server.valid() );
+	std::thread runner( [&loop] { loop.run(); } );
+
+	static CoroState st;
+	st.nPhase = 0;
+	st.bEchoDone = false;
+	st.dwSent = st.dwEcho = st.dwCancelled = 0;
+	CoroAccept( server, st );
+	CoroClient( loop, st );
+
+	bool bCancelled = CoroWait( st.nPhase, 1 ) && st.nPhase == 1;
+	if ( bCancelled ) {
+		TestSleep( 50 );
+		st.stop.request_stop();
+	}
+	bool bDone = CoroWait( st.nPhase, 2 ) && CoroWait( st.bEchoDone, true );
+
+	loop.stop();
+	runner.join();
+	server.stop();
+
+	CHECK( bDone && st.bConnected );
+	if ( bEngine ) {
+		CHECK( bCancelled );
+		CHECK( st.dwSent == sizeof(st.buf) );
+		CHECK( st.dwEcho == sizeof(st.buf) && TestVerify( st.reply, sizeof(st.reply), 1 ) );
+		CHECK( st.dwCancelled == IPC_RC_ERROR );
+	} else {
+		CHECK( st.dwSent == IPC_RC_ERROR );
+	}
+	return true;
+}
+
+#endif // __cpp_impl_coroutine
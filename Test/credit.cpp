@@ -0,0 +1,31 @@
+// credit.cpp ////////////////////////////////////
+//
+// sends timing out on a full connection give their send space back
+
+#include "test.h"
+
+#define MSG_SIZE		1000		// four of them fill the default channel
+#define TIMED_OUT_SENDS	40		// more than the pipe credit window
+
+TEST_CASE( TestSendTimeouts, "timed-out sends" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	unsigned char buf[MSG_SIZE];
+	for ( int nRound = 0; nRound < 2; nRound++ ) {
+		DWORD n = TestFillChannel( hClient, MSG_SIZE );
+		CHECK( n != 0 && n < 100000 );
+
+		for ( int i = 0; i < TIMED_OUT_SENDS; i++ )
+			CHECK( IPC_Send( hClient, buf, MSG_SIZE, 10 ) == IPC_RC_TIMEOUT );
+
+		for ( DWORD i = 0; i < n; i++ )
+			CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == MSG_SIZE );
+		CHECK( IPC_Recv( hConn, buf, sizeof(buf), 0 ) == IPC_RC_TIMEOUT );
+	}
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
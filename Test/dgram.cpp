@@ -0,0 +1,113 @@
+// dgram.cpp /////////////////////////////////////
+//
+// datagrams: several producer threads, and on POSIX producer processes;
+// the datagrams of each producer arrive in order and none is lost
+
+#include "test.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#define TEST_DG_SERVER		"jr_ipc_test_dg"
+#define TEST_DG_PRODUCERS	4
+#define TEST_DG_MSGS		20000
+
+struct DgMsg
+{
+	DWORD	dwProducer;
+	DWORD	dwSeq;
+};
+
+// the datagrams of producer dwProducer, returns the number sent
+static DWORD DgProduce( DWORD dwProducer )
+{
+	char szDgName[] = TEST_DG_SERVER;
+	DgMsg msg = { dwProducer, 0 };
+	for ( ; msg.dwSeq < TEST_DG_MSGS; msg.dwSeq++ )
+		if ( IPC_DgSend( szDgName, &msg, sizeof(msg), TEST_TIMEOUT ) != sizeof(msg) ) break;
+	return msg.dwSeq;
+}
+
+// receives the datagrams of all producers, returns the number in order
+static DWORD DgConsume()
+{
+	char szDgName[] = TEST_DG_SERVER;
+	DWORD next[TEST_DG_PRODUCERS] = { 0, };
+	DWORD n, dwInOrder = 0;
+	for ( n = 0; n < TEST_DG_MSGS * TEST_DG_PRODUCERS; n++ ) {
+		DgMsg msg;
+		if ( IPC_DgRecv( szDgName, &msg, sizeof(msg), TEST_TIMEOUT ) != sizeof(msg) ) break;
+		if ( msg.dwProducer < TEST_DG_PRODUCERS && msg.dwSeq == next[msg.dwProducer] ) {
+			next[msg.dwProducer]++;
+			dwInOrder++;
+		}
+	}
+	return dwInOrder;
+}
+
+struct DgArgs
+{
+	DWORD	dwProducer;
+	DWORD	dwSent;
+};
+
+static void DgProducer( void *pvArgs )
+{
+	DgArgs *pArgs = (DgArgs *) pvArgs;
+	pArgs->dwSent = DgProduce( pArgs->dwProducer );
+}
+
+TEST_CASE( TestDgThreads, "datagrams from threads" )
+{
+	char szDgName[] = TEST_DG_SERVER;
+	HIPCSERVER hDg = IPC_ServerDgStart( szDgName );
+	CHECK( hDg != IPC_RC_INVALID_HANDLE );
+
+	static DgArgs args[TEST_DG_PRODUCERS];
+	TestThread *pThreads[TEST_DG_PRODUCERS];
+	for ( DWORD i = 0; i < TEST_DG_PRODUCERS; i++ ) {
+		args[i].dwProducer = i;
+		args[i].dwSent = 0;
+		pThreads[i] = TestThreadStart( DgProducer, &args[i] );
+	}
+	DWORD dwInOrder = DgConsume();
+	for ( int i = 0; i < TEST_DG_PRODUCERS; i++ )
+		TestThreadJoin( pThreads[i] );
+	IPC_ServerDgStop( hDg );
+
+	for ( int i = 0; i < TEST_DG_PRODUCERS; i++ )
+		CHECK( args[i].dwSent == TEST_DG_MSGS );
+	CHECK( dwInOrder == TEST_DG_MSGS * TEST_DG_PRODUCERS );
+	return true;
+}
+
+#ifndef _WIN32
+
+TEST_CASE( TestDgProcesses, "datagrams from processes" )
+{
+	char szDgName[] = TEST_DG_SERVER;
+	HIPCSERVER hDg = IPC_ServerDgStart( szDgName );
+	CHECK( hDg != IPC_RC_INVALID_HANDLE );
+
+	pid_t pids[TEST_DG_PRODUCERS];
+	for ( DWORD i = 0; i < TEST_DG_PRODUCERS; i++ ) {
+		pids[i] = fork();
+		if ( pids[i] == 0 ) _exit( DgProduce( i ) == TEST_DG_MSGS ? 0 : 1 );
+	}
+	DWORD dwInOrder = DgConsume();
+
+	int nFailed = 0;
+	for ( int i = 0; i < TEST_DG_PRODUCERS; i++ ) {
+		int status;
+		if ( pids[i] < 0 || waitpid( pids[i], &status, 0 ) != pids[i] || ! WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) nFailed++;
+	}
+	IPC_ServerDgStop( hDg );
+
+	CHECK( nFailed == 0 );
+	CHECK( dwInOrder == TEST_DG_MSGS * TEST_DG_PRODUCERS );
+	return true;
+}
+
+#endif // _WIN32
@@ -0,0 +1,50 @@
+// duplex.cpp ////////////////////////////////////
+//
+// full duplex: a thread blocked in IPC_Recv does not hold up IPC_Send
+// on the same connection
+
+#include "test.h"
+
+struct DuplexArgs
+{
+	HIPCCONNECTION	hClient;
+	DWORD			dwSize;
+	unsigned char	buf[100];
+};
+
+static void DuplexReceiver( void *pvArgs )
+{
+	DuplexArgs *pArgs = (DuplexArgs *) pvArgs;
+	pArgs->dwSize = IPC_Recv( pArgs->hClient, pArgs->buf, sizeof(pArgs->buf), TEST_TIMEOUT );
+}
+
+TEST_CASE( TestDuplex, "full duplex" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	static DuplexArgs args;
+	args.hClient = hClient;
+	TestThread *pReceiver = TestThreadStart( DuplexReceiver, &args );
+	TestSleep( 50 );
+
+	// the request goes out while the client waits for the reply
+	unsigned char buf[100];
+	TestFill( buf, sizeof(buf), 1 );
+	DWORD dwStart = TestTicks();
+	DWORD dwSent = IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT );
+	DWORD dwReceived = IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+
+	TestFill( buf, sizeof(buf), 2 );
+	IPC_Send( hConn, buf, sizeof(buf), TEST_TIMEOUT );
+	TestThreadJoin( pReceiver );
+
+	CHECK( dwSent == sizeof(buf) && dwReceived == sizeof(buf) );
+	CHECK( dwElapsed < 1000 );
+	CHECK( args.dwSize == sizeof(buf) && TestVerify( args.buf, sizeof(buf), 2 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
@@ -0,0 +1,108 @@
+// events.cpp ////////////////////////////////////
+//
+// user events end a wait for a message, the break event ends a wait for a
+// client; Win32 events on Windows, eventfds on POSIX
+
+#include "test.h"
+
+#ifndef _WIN32
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+#define TEST_BREAK_SERVER	"jr_ipc_test_break"
+
+#ifdef _WIN32
+static HANDLE EventCreate()			{ return CreateEvent( NULL, TRUE, FALSE, NULL ); }
+static void EventSet( HANDLE h )	{ SetEvent( h ); }
+static void EventClose( HANDLE h )	{ CloseHandle( h ); }
+#else
+static HANDLE EventCreate()
+{
+	int fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+	return ( fd < 0 ) ? NULL : (HANDLE)(intptr_t) fd;
+}
+
+static void EventSet( HANDLE h )
+{
+	uint64_t one = 1;
+	if ( write( (int)(intptr_t) h, &one, sizeof(one) ) != sizeof(one) ) printf( "    eventfd write failed\n" );
+}
+
+static void EventClose( HANDLE h )	{ close( (int)(intptr_t) h ); }
+#endif
+
+static void EventSetLater( void *pvEvent )
+{
+	TestSleep( 50 );
+	EventSet( (HANDLE) pvEvent );
+}
+
+TEST_CASE( TestUserEvents, "user events" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	HANDLE hEvent = EventCreate();
+	CHECK( hEvent != NULL );
+	CHECK( IPC_SetEvents( hConn, &hEvent, 1, NULL ) );
+
+	// IPC_GetEvents reports the signaled user events as bits on POSIX only
+#ifndef _WIN32
+	DWORD dwUser = 1, dwIpc;
+	CHECK( IPC_GetEvents( hConn, &dwUser, &dwIpc ) && dwUser == 0 );
+#endif
+
+	// a waiting receive wakes up
+	TestThread *pSetter = TestThreadStart( EventSetLater, hEvent );
+	unsigned char buf[100];
+	DWORD dwStart = TestTicks();
+	DWORD dwSize = IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	TestThreadJoin( pSetter );
+	CHECK( dwSize == IPC_RC_ERROR );
+	CHECK( IPC_GetConnectionLastErr( hConn ) == IPC_ERR_USER_EVENT_SET );
+	CHECK( dwElapsed < 1000 );
+#ifndef _WIN32
+	CHECK( IPC_GetEvents( hConn, &dwUser, &dwIpc ) && dwUser == 1 && dwIpc == 0 );
+#endif
+
+	// a message is received even so
+	TestFill( buf, sizeof(buf), 1 );
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( TestVerify( buf, sizeof(buf), 1 ) );
+
+	// without the events the wait runs into its timeout
+	CHECK( IPC_ResetEvents( hConn ) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), 100 ) == IPC_RC_TIMEOUT );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	EventClose( hEvent );
+	return true;
+}
+
+TEST_CASE( TestBreakEvent, "break event" )
+{
+	char szServerName[] = TEST_BREAK_SERVER;
+	HIPCSERVER hServer = IPC_ServerStart( szServerName );
+	CHECK( hServer != IPC_RC_INVALID_HANDLE );
+	HANDLE hEvent = EventCreate();
+	CHECK( hEvent != NULL );
+
+	// the backlog is a hint, the call succeeds everywhere
+	CHECK( IPC_SetBacklog( hServer, 4 ) );
+
+	TestThread *pSetter = TestThreadStart( EventSetLater, hEvent );
+	DWORD dwStart = TestTicks();
+	HIPCCONNECTION hConn = IPC_ServerWaitForConnection( hServer, TEST_TIMEOUT, hEvent );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	TestThreadJoin( pSetter );
+
+	EventClose( hEvent );
+	IPC_ServerStop( hServer );
+	CHECK( hConn == (HIPCCONNECTION) IPC_RC_TIMEOUT );
+	CHECK( dwElapsed >= 40 && dwElapsed < 1000 );
+	return true;
+}
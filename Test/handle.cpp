@@ -0,0 +1,30 @@
+// handle.cpp ////////////////////////////////////
+//
+// a closed connection handle is rejected, also after its slot is reused
+
+#include "test.h"
+
+TEST_CASE( TestStaleHandle, "stale handle" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	CHECK( IPC_CloseConnection( hClient ) );
+
+	unsigned char buf[16] = { 0, };
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), 0 ) == IPC_RC_ERROR );
+	CHECK( IPC_Recv( hClient, buf, sizeof(buf), 0 ) == IPC_RC_ERROR );
+	CHECK( ! IPC_SetSpinTime( hClient, 0 ) );
+	CHECK( ! IPC_CloseConnection( hClient ) );
+
+	HIPCCONNECTION hClient2, hConn2;
+	CHECK( TestOpen( hClient2, hConn2 ) );
+	CHECK( hClient2 != hClient );
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), 0 ) == IPC_RC_ERROR );
+	CHECK( IPC_Send( hClient2, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_Recv( hConn2, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+
+	IPC_CloseConnection( hClient2 );
+	IPC_CloseConnection( hConn2 );
+	IPC_CloseConnection( hConn );
+	return true;
+}
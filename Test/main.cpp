@@ -0,0 +1,196 @@
+// main.cpp //////////////////////////////////////
+//
+// ipc_test [name]: runs the test cases whose name contains `name`, all by
+// default; the exit code is the number of failed cases
+
+#include "test.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+static TestCase *pTestCases;
+
+TestCase::TestCase( const char *pszName, bool (*pfn)() )
+	: pszName( pszName ), pfn( pfn ), pNext( pTestCases )
+{
+	pTestCases = this;
+}
+
+//////////////////////////////////////////////////
+
+static HIPCSERVER hServer;
+
+struct AcceptArgs
+{
+	HIPCCONNECTION	hConn;
+};
+
+static void AcceptThread( void *pvArgs )
+{
+	AcceptArgs *pArgs = (AcceptArgs *) pvArgs;
+	pArgs->hConn = IPC_ServerWaitForConnection( hServer, TEST_TIMEOUT, NULL );
+}
+
+bool TestOpen( HIPCCONNECTION& hClient, HIPCCONNECTION& hServerConn, DWORD dwSize )
+{
+	char szServerName[] = TEST_SERVER;
+	AcceptArgs args = { IPC_RC_INVALID_HANDLE };
+	TestThread *pThread = TestThreadStart( AcceptThread, &args );
+	hClient = dwSize ? IPC_ConnectEx( szServerName, TEST_TIMEOUT, dwSize, dwSize )
+					 : IPC_Connect( szServerName, TEST_TIMEOUT );
+	TestThreadJoin( pThread );
+	hServerConn = args.hConn;
+	return CHECK_IPC_HCONNECTION( hClient ) && CHECK_IPC_HCONNECTION( hServerConn );
+}
+
+// under uring the receive side keeps taking packets off the socket for a while
+DWORD TestFillChannel( HIPCCONNECTION hClient, DWORD dwMsgSize )
+{
+	static unsigned char buf[IPC_CHANNEL_SIZE_MIN];
+	DWORD n = 0;
+	while ( n < 100000 ) {
+		while ( n < 100000 && IPC_Send( hClient, buf, dwMsgSize, 0 ) == dwMsgSize ) n++;
+		TestSleep( 20 );
+		if ( IPC_Send( hClient, buf, dwMsgSize, 0 ) != dwMsgSize ) break;
+		n++;
+	}
+	return n;
+}
+
+void TestFill( void *pvBuf, DWORD dwSize, DWORD dwSeq )
+{
+	unsigned char *pBuf = (unsigned char *) pvBuf;
+	for ( DWORD i = 0; i < dwSize; i++ ) pBuf[i] = (unsigned char)( dwSeq * 7 + i );
+}
+
+bool TestVerify( const void *pvBuf, DWORD dwSize, DWORD dwSeq )
+{
+	const unsigned char *pBuf = (const unsigned char *) pvBuf;
+	for ( DWORD i = 0; i < dwSize; i++ )
+		if ( pBuf[i] != (unsigned char)( dwSeq * 7 + i ) ) return false;
+	return true;
+}
+
+//////////////////////////////////////////////////
+
+struct TestThread
+{
+	void	(*pfn)( void *pvArg );
+	void	*pvArg;
+#ifdef _WIN32
+	HANDLE		hThread;
+#else
+	pthread_t	thread;
+#endif
+};
+
+#ifdef _WIN32
+
+static DWORD WINAPI ThreadProc( void *pvThread )
+{
+	TestThread *pThread = (TestThread *) pvThread;
+	pThread->pfn( pThread->pvArg );
+	return 0;
+}
+
+TestThread *TestThreadStart( void (*pfn)( void *pvArg ), void *pvArg )
+{
+	TestThread *pThread = new TestThread;
+	pThread->pfn = pfn;
+	pThread->pvArg = pvArg;
+	pThread->hThread = CreateThread( NULL, 0, ThreadProc, pThread, 0, NULL );
+	return pThread;
+}
+
+void TestThreadJoin( TestThread *pThread )
+{
+	WaitForSingleObject( pThread->hThread, INFINITE );
+	CloseHandle( pThread->hThread );
+	delete pThread;
+}
+
+DWORD TestTicks()
+{
+	return GetTickCount();
+}
+
+void TestSleep( DWORD dwMilliseconds )
+{
+	Sleep( dwMilliseconds );
+}
+
+#else
+
+static void *ThreadProc( void *pvThread )
+{
+	TestThread *pThread = (TestThread *) pvThread;
+	pThread->pfn( pThread->pvArg );
+	return NULL;
+}
+
+TestThread *TestThreadStart( void (*pfn)( void *pvArg ), void *pvArg )
+{
+	TestThread *pThread = new TestThread;
+	pThread->pfn = pfn;
+	pThread->pvArg = pvArg;
+	pthread_create( &pThread->thread, NULL, ThreadProc, pThread );
+	return pThread;
+}
+
+void TestThreadJoin( TestThread *pThread )
+{
+	pthread_join( pThread->thread, NULL );
+	delete pThread;
+}
+
+DWORD TestTicks()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (DWORD)( ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+
+void TestSleep( DWORD dwMilliseconds )
+{
+	usleep( dwMilliseconds * 1000 );
+}
+
+#endif
+
+//////////////////////////////////////////////////
+
+int main( int argc, char **argv )
+{
+	if ( ! IPC_LoadDLL() ) return 1;
+
+	char szServerName[] = TEST_SERVER;
+	hServer = IPC_ServerStart( szServerName );
+	if ( hServer == IPC_RC_INVALID_HANDLE ) {
+		printf("    IPC_ServerStart failed\n");
+		return 1;
+	}
+
+	// registered last to first
+	TestCase *pList = NULL;
+	while ( pTestCases ) {
+		TestCase *pCase = pTestCases;
+		pTestCases = pCase->pNext;
+		pCase->pNext = pList;
+		pList = pCase;
+	}
+
+	int nFailed = 0;
+	for ( TestCase *pCase = pList; pCase; pCase = pCase->pNext ) {
+		if ( argc > 1 && ! strstr( pCase->pszName, argv[1] ) ) continue;
+		bool bOk = pCase->pfn();
+		printf("    %-36s %s\n", pCase->pszName, bOk ? "ok" : "FAILED");
+		if ( ! bOk ) nFailed++;
+	}
+
+	IPC_ServerStop( hServer );
+	IPC_FreeDLL();
+	return nFailed;
+}
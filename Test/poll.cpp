@@ -0,0 +1,84 @@
+// poll.cpp //////////////////////////////////////
+//
+// poll sets (Windows only): readiness of a connection in both directions,
+// a reserved message is not readable before its commit
+
+#include "test.h"
+
+#ifdef _WIN32
+
+// the events IPC_PollWait reports for hConn, 0 on a timeout
+static DWORD PollEvents( HIPCPOLL hPoll, HIPCCONNECTION hConn, DWORD dwTimeout )
+{
+	IPC_POLL_EVENT ev[2];
+	DWORD dwCount = IPC_PollWait( hPoll, ev, 2, dwTimeout );
+	if ( dwCount == IPC_RC_TIMEOUT || dwCount == IPC_RC_ERROR || dwCount > 2 ) return 0;
+	for ( DWORD i = 0; i < dwCount; i++ )
+		if ( ev[i].hConnection == hConn ) return ev[i].dwEvents;
+	return 0;
+}
+
+TEST_CASE( TestPoll, "poll set" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	HIPCPOLL hPoll = IPC_PollCreate();
+	CHECK( hPoll != IPC_RC_INVALID_HANDLE );
+	CHECK( IPC_PollAdd( hPoll, hConn, IPC_POLL_IN | IPC_POLL_OUT ) );
+
+	// an empty connection can send only
+	CHECK( PollEvents( hPoll, hConn, 0 ) == IPC_POLL_OUT );
+
+	unsigned char buf[100];
+	TestFill( buf, sizeof(buf), 1 );
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( PollEvents( hPoll, hConn, TEST_TIMEOUT ) == ( IPC_POLL_IN | IPC_POLL_OUT ) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), 0 ) == sizeof(buf) );
+	CHECK( TestVerify( buf, sizeof(buf), 1 ) );
+
+	// only the receive direction
+	CHECK( IPC_PollRemove( hPoll, hConn ) );
+	CHECK( IPC_PollAdd( hPoll, hConn, IPC_POLL_IN ) );
+	CHECK( PollEvents( hPoll, hConn, 0 ) == 0 );
+
+	// the peer going away is reported
+	IPC_CloseConnection( hClient );
+	CHECK( PollEvents( hPoll, hConn, TEST_TIMEOUT ) & IPC_POLL_CLOSED );
+
+	IPC_CloseConnection( hConn );
+	IPC_PollClose( hPoll );
+	return true;
+}
+
+TEST_CASE( TestPollReserve, "poll of a reserved message" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn, IPC_CHANNEL_SIZE_MIN ) );
+	HIPCPOLL hPoll = IPC_PollCreate();
+	CHECK( hPoll != IPC_RC_INVALID_HANDLE );
+	CHECK( IPC_PollAdd( hPoll, hConn, IPC_POLL_IN ) );
+
+	// the reservation wraps the ring, which holds nothing but the pad
+	// until the commit
+	unsigned char buf[3500];
+	CHECK( IPC_Send( hClient, buf, 3000, TEST_TIMEOUT ) == 3000 );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 3000 );
+
+	void *pvBuf = NULL;
+	CHECK( IPC_SendReserve( hClient, 3500, &pvBuf, TEST_TIMEOUT ) == 3500 );
+	DWORD dwBefore = PollEvents( hPoll, hConn, 0 );
+	TestFill( pvBuf, 3500, 1 );
+	CHECK( IPC_SendCommit( hClient, pvBuf, 3500 ) == 3500 );
+	CHECK( dwBefore == 0 );
+
+	CHECK( PollEvents( hPoll, hConn, TEST_TIMEOUT ) == IPC_POLL_IN );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), 0 ) == 3500 );
+	CHECK( TestVerify( buf, 3500, 1 ) );
+
+	IPC_PollClose( hPoll );
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+#endif // _WIN32
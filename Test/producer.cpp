@@ -0,0 +1,67 @@
+// producer.cpp //////////////////////////////////
+//
+// multi-producer mode: threads share one connection, the messages of
+// each thread arrive in order and none is lost
+
+#include "test.h"
+
+#define TEST_PRODUCERS	4
+#define TEST_MP_MSGS	20000
+
+struct ProducerMsg
+{
+	DWORD	dwProducer;
+	DWORD	dwSeq;
+};
+
+struct ProducerArgs
+{
+	HIPCCONNECTION	hClient;
+	DWORD			dwProducer;
+	DWORD			dwSent;
+};
+
+static void Producer( void *pvArgs )
+{
+	ProducerArgs *pArgs = (ProducerArgs *) pvArgs;
+	ProducerMsg msg = { pArgs->dwProducer, 0 };
+	for ( ; msg.dwSeq < TEST_MP_MSGS; msg.dwSeq++ )
+		if ( IPC_Send( pArgs->hClient, &msg, sizeof(msg), TEST_TIMEOUT ) != sizeof(msg) ) break;
+	pArgs->dwSent = msg.dwSeq;
+}
+
+TEST_CASE( TestMultiProducer, "multi-producer ordering" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	CHECK( IPC_SetMultiProducer( hClient, TRUE ) );
+
+	static ProducerArgs args[TEST_PRODUCERS];
+	TestThread *pThreads[TEST_PRODUCERS];
+	for ( int i = 0; i < TEST_PRODUCERS; i++ ) {
+		args[i].hClient = hClient;
+		args[i].dwProducer = i;
+		args[i].dwSent = 0;
+		pThreads[i] = TestThreadStart( Producer, &args[i] );
+	}
+
+	DWORD next[TEST_PRODUCERS] = { 0, };
+	DWORD n, dwOutOfOrder = 0;
+	for ( n = 0; n < TEST_MP_MSGS * TEST_PRODUCERS; n++ ) {
+		ProducerMsg msg;
+		if ( IPC_Recv( hConn, &msg, sizeof(msg), TEST_TIMEOUT ) != sizeof(msg) ) break;
+		if ( msg.dwProducer >= TEST_PRODUCERS || msg.dwSeq != next[msg.dwProducer] ) dwOutOfOrder++;
+		else next[msg.dwProducer]++;
+	}
+	for ( int i = 0; i < TEST_PRODUCERS; i++ )
+		TestThreadJoin( pThreads[i] );
+
+	CHECK( n == TEST_MP_MSGS * TEST_PRODUCERS );
+	CHECK( dwOutOfOrder == 0 );
+	for ( int i = 0; i < TEST_PRODUCERS; i++ )
+		CHECK( args[i].dwSent == TEST_MP_MSGS );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
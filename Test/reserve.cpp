@@ -0,0 +1,104 @@
+// reserve.cpp ///////////////////////////////////
+//
+// zero-copy send: IPC_SendReserve / IPC_SendCommit
+
+#include "test.h"
+
+#define BIG_SIZE	20000		// several times the default channel
+
+TEST_CASE( TestReserve, "reserve and commit" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	unsigned char buf[100];
+	void *pvBuf = NULL;
+	CHECK( IPC_SendCommit( hClient, buf, 10 ) == IPC_RC_ERROR );
+
+	CHECK( IPC_SendReserve( hClient, sizeof(buf), &pvBuf, TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_SendCommit( hClient, buf, 10 ) == IPC_RC_ERROR );
+	CHECK( IPC_SendCommit( hClient, pvBuf, sizeof(buf) + 1 ) == IPC_RC_ERROR );
+	TestFill( pvBuf, 60, 3 );
+	CHECK( IPC_SendCommit( hClient, pvBuf, 60 ) == 60 );
+
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 60 );
+	CHECK( TestVerify( buf, 60, 3 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+
+struct BigArgs
+{
+	HIPCCONNECTION	hConn;
+	DWORD			dwSize;
+	unsigned char	buf[BIG_SIZE];
+};
+
+static void BigReceiver( void *pvArgs )
+{
+	BigArgs *pArgs = (BigArgs *) pvArgs;
+	pArgs->dwSize = IPC_Recv( pArgs->hConn, pArgs->buf, sizeof(pArgs->buf), TEST_TIMEOUT );
+}
+
+TEST_CASE( TestReserveBig, "reserve larger than the channel" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	static BigArgs args;
+	args.hConn = hConn;
+	TestThread *pReceiver = TestThreadStart( BigReceiver, &args );
+
+	void *pvBuf = NULL;
+	DWORD dwReserved = IPC_SendReserve( hClient, BIG_SIZE, &pvBuf, TEST_TIMEOUT );
+	if ( dwReserved == BIG_SIZE ) {
+		TestFill( pvBuf, BIG_SIZE, 5 );
+		dwReserved = IPC_SendCommit( hClient, pvBuf, BIG_SIZE );
+	}
+	TestThreadJoin( pReceiver );
+
+	CHECK( dwReserved == BIG_SIZE );
+	CHECK( args.dwSize == BIG_SIZE && TestVerify( args.buf, BIG_SIZE, 5 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+// the commit of a buffered message waits within the reservation timeout
+// and drops the message when it expires
+
+TEST_CASE( TestCommitTimeout, "commit timeout" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	unsigned char buf[1000];
+	DWORD n = TestFillChannel( hClient, sizeof(buf) );
+	CHECK( n < 100000 );
+
+	void *pvBuf = NULL;
+	CHECK( IPC_SendReserve( hClient, BIG_SIZE, &pvBuf, 100 ) == BIG_SIZE );
+	TestFill( pvBuf, BIG_SIZE, 7 );
+	DWORD dwStart = TestTicks();
+	CHECK( IPC_SendCommit( hClient, pvBuf, BIG_SIZE ) == IPC_RC_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	CHECK( dwElapsed >= 90 && dwElapsed < TEST_TIMEOUT );
+
+	for ( DWORD i = 0; i < n; i++ )
+		CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), 0 ) == IPC_RC_TIMEOUT );
+
+	// the connection is still usable
+	CHECK( IPC_Send( hClient, buf, 10, TEST_TIMEOUT ) == 10 );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 10 );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
@@ -0,0 +1,96 @@
+// ring.cpp //////////////////////////////////////
+//
+// the connection channel: odd sized messages wrapping around the ring,
+// the peer waking up when the sender pads the end of the ring
+
+#include "test.h"
+
+#define WRAP_MSGS		20000
+#define WRAP_MAX_SIZE	3000
+
+static DWORD WrapSize( DWORD dwSeq )
+{
+	return ( dwSeq * 37 ) % WRAP_MAX_SIZE + 1;
+}
+
+static void WrapSender( void *pvClient )
+{
+	HIPCCONNECTION hClient = *(HIPCCONNECTION *) pvClient;
+	unsigned char buf[WRAP_MAX_SIZE];
+	for ( DWORD n = 0; n < WRAP_MSGS; n++ ) {
+		TestFill( buf, WrapSize( n ), n );
+		if ( IPC_Send( hClient, buf, WrapSize( n ), TEST_TIMEOUT ) != WrapSize( n ) ) break;
+	}
+}
+
+TEST_CASE( TestWrap, "ring wrap" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	TestThread *pSender = TestThreadStart( WrapSender, &hClient );
+
+	unsigned char buf[WRAP_MAX_SIZE];
+	DWORD n;
+	for ( n = 0; n < WRAP_MSGS; n++ ) {
+		DWORD dwSize = IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT );
+		if ( dwSize != WrapSize( n ) || ! TestVerify( buf, dwSize, n ) ) break;
+	}
+	TestThreadJoin( pSender );
+	CHECK( n == WRAP_MSGS );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+// a reservation that does not fit before the end of the ring pads it:
+// the sleeping receiver must skip the pad and hand the space back at once
+
+struct WakeArgs
+{
+	HIPCCONNECTION	hConn;
+	DWORD			dwSize;
+	unsigned char	buf[IPC_CHANNEL_SIZE_MIN];
+};
+
+static void WakeReceiver( void *pvArgs )
+{
+	WakeArgs *pArgs = (WakeArgs *) pvArgs;
+	pArgs->dwSize = IPC_Recv( pArgs->hConn, pArgs->buf, sizeof(pArgs->buf), TEST_TIMEOUT );
+}
+
+TEST_CASE( TestWrapWakeup, "ring wrap wakes the peer" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn, IPC_CHANNEL_SIZE_MIN ) );
+	CHECK( IPC_SetSpinTime( hClient, 0 ) );
+	CHECK( IPC_SetSpinTime( hConn, 0 ) );
+
+	static WakeArgs args;
+	CHECK( IPC_Send( hClient, args.buf, 3000, TEST_TIMEOUT ) == 3000 );
+	CHECK( IPC_Recv( hConn, args.buf, sizeof(args.buf), TEST_TIMEOUT ) == 3000 );
+
+	args.hConn = hConn;
+	TestThread *pReceiver = TestThreadStart( WakeReceiver, &args );
+	TestSleep( 50 );
+
+	void *pvBuf = NULL;
+	DWORD dwStart = TestTicks();
+	DWORD dwReserved = IPC_SendReserve( hClient, 3500, &pvBuf, TEST_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	if ( dwReserved == 3500 ) {
+		TestFill( pvBuf, 3500, 1 );
+		IPC_SendCommit( hClient, pvBuf, 3500 );
+	}
+	TestThreadJoin( pReceiver );
+
+	CHECK( dwReserved == 3500 );
+	CHECK( dwElapsed < 50 );
+	CHECK( args.dwSize == 3500 && TestVerify( args.buf, 3500, 1 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
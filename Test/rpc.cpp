@@ -0,0 +1,141 @@
+// rpc.cpp ///////////////////////////////////////
+//
+// RPC (the client is Windows only): replies in any order, a call timing
+// out, an async call cancelled; a late reply is dropped
+
+#include "test.h"
+
+#ifdef _WIN32
+
+struct RpcRequest
+{
+	IPC_CALL_HDR	hdr;
+	unsigned char	payload[100];
+};
+
+struct RpcAsync
+{
+	volatile LONG	bDone;
+	DWORD			dwResult;
+	unsigned char	reply[100];
+};
+
+static void __stdcall RpcDone( HIPCCONNECTION hConnection, DWORD dwResult, void *pvContext )
+{
+	RpcAsync *pCall = (RpcAsync *) pvContext;
+	pCall->dwResult = dwResult;
+	pCall->bDone = 1;
+}
+
+static bool RpcWait( RpcAsync *pCall )
+{
+	DWORD dwStart = TestTicks();
+	while ( ! pCall->bDone ) {
+		if ( TestTicks() - dwStart > TEST_TIMEOUT ) return false;
+		TestSleep( 1 );
+	}
+	return true;
+}
+
+// receives a request on the server end, returns its payload size
+static DWORD RpcRecv( HIPCCONNECTION hConn, RpcRequest& req )
+{
+	DWORD dwSize = IPC_Recv( hConn, &req, sizeof(req), TEST_TIMEOUT );
+	if ( dwSize == IPC_RC_TIMEOUT || dwSize == IPC_RC_ERROR || dwSize < sizeof(IPC_CALL_HDR) ) return IPC_RC_ERROR;
+	return dwSize - sizeof(IPC_CALL_HDR);
+}
+
+struct RpcServeArgs
+{
+	HIPCCONNECTION	hConn;
+	DWORD			dwReplied;
+};
+
+// echoes one request
+static void RpcServeOne( void *pvArgs )
+{
+	RpcServeArgs *pArgs = (RpcServeArgs *) pvArgs;
+	RpcRequest req;
+	DWORD dwSize = RpcRecv( pArgs->hConn, req );
+	pArgs->dwReplied = ( dwSize == IPC_RC_ERROR ) ? IPC_RC_ERROR
+		: IPC_Reply( pArgs->hConn, req.hdr.dwCallId, req.payload, dwSize, TEST_TIMEOUT );
+}
+
+TEST_CASE( TestRpc, "rpc calls" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	// a blocking call
+	static RpcServeArgs args;
+	args.hConn = hConn;
+	TestThread *pServer = TestThreadStart( RpcServeOne, &args );
+	unsigned char buf[100], reply[100];
+	TestFill( buf, 40, 1 );
+	DWORD dwReply = IPC_Call( hClient, buf, 40, reply, sizeof(reply), TEST_TIMEOUT );
+	TestThreadJoin( pServer );
+	CHECK( args.dwReplied == 40 );
+	CHECK( dwReply == 40 && TestVerify( reply, 40, 1 ) );
+
+	// two async calls answered in reverse order
+	static RpcAsync calls[2];
+	RpcRequest req[2];
+	for ( DWORD i = 0; i < 2; i++ ) {
+		calls[i].bDone = 0;
+		TestFill( buf, 10 + i, 2 + i );
+		CHECK( IPC_CallAsync( hClient, buf, 10 + i, calls[i].reply, sizeof(calls[i].reply), RpcDone, &calls[i] ) );
+		CHECK( RpcRecv( hConn, req[i] ) == 10 + i );
+	}
+	for ( DWORD i = 2; i-- > 0; )
+		CHECK( IPC_Reply( hConn, req[i].hdr.dwCallId, req[i].payload, 10 + i, TEST_TIMEOUT ) == 10 + i );
+	for ( DWORD i = 0; i < 2; i++ ) {
+		CHECK( RpcWait( &calls[i] ) && calls[i].dwResult == 10 + i );
+		CHECK( TestVerify( calls[i].reply, 10 + i, 2 + i ) );
+	}
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+TEST_CASE( TestRpcTimeout, "rpc timeout and cancel" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	// nothing answers in time
+	unsigned char buf[100], reply[100];
+	TestFill( buf, 20, 1 );
+	DWORD dwStart = TestTicks();
+	CHECK( IPC_Call( hClient, buf, 20, reply, sizeof(reply), 100 ) == IPC_RC_TIMEOUT );
+	DWORD dwElapsed = TestTicks() - dwStart;
+	CHECK( dwElapsed >= 90 && dwElapsed < TEST_TIMEOUT );
+
+	// an async call fails on cancel
+	static RpcAsync call;
+	call.bDone = 0;
+	CHECK( IPC_CallAsync( hClient, buf, 20, call.reply, sizeof(call.reply), RpcDone, &call ) );
+	CHECK( IPC_CancelAsync( hClient, &call ) );
+	CHECK( RpcWait( &call ) && call.dwResult == IPC_RC_ERROR );
+
+	// the late replies are dropped, the next call gets its own
+	RpcRequest req;
+	for ( int i = 0; i < 2; i++ ) {
+		CHECK( RpcRecv( hConn, req ) == 20 );
+		CHECK( IPC_Reply( hConn, req.hdr.dwCallId, req.payload, 20, TEST_TIMEOUT ) == 20 );
+	}
+
+	static RpcServeArgs args;
+	args.hConn = hConn;
+	TestThread *pServer = TestThreadStart( RpcServeOne, &args );
+	TestFill( buf, 30, 2 );
+	DWORD dwReply = IPC_Call( hClient, buf, 30, reply, sizeof(reply), TEST_TIMEOUT );
+	TestThreadJoin( pServer );
+	CHECK( dwReply == 30 && TestVerify( reply, 30, 2 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+#endif // _WIN32
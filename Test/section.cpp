@@ -0,0 +1,52 @@
+// section.cpp ///////////////////////////////////
+//
+// large messages passed in a shared section of their own
+
+#include "test.h"
+
+#define BIG_SIZE	100000
+
+TEST_CASE( TestSections, "section messages" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+	CHECK( IPC_SetSectionThreshold( hClient, 1000 ) );
+
+	// below and at the threshold, queued together
+	static unsigned char buf[BIG_SIZE];
+	TestFill( buf, 999, 1 );
+	CHECK( IPC_Send( hClient, buf, 999, TEST_TIMEOUT ) == 999 );
+	TestFill( buf, 1000, 2 );
+	CHECK( IPC_Send( hClient, buf, 1000, TEST_TIMEOUT ) == 1000 );
+	TestFill( buf, 3000, 3 );
+	CHECK( IPC_Send( hClient, buf, 3000, TEST_TIMEOUT ) == 3000 );
+
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 999 );
+	CHECK( TestVerify( buf, 999, 1 ) );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 1000 );
+	CHECK( TestVerify( buf, 1000, 2 ) );
+
+	const void *pvView = NULL;
+	CHECK( IPC_RecvView( hConn, &pvView, TEST_TIMEOUT ) == 3000 );
+	CHECK( TestVerify( pvView, 3000, 3 ) );
+	CHECK( IPC_RecvRelease( hConn, pvView ) );
+
+	// many times the channel, reserved in place
+	void *pvBuf = NULL;
+	CHECK( IPC_SendReserve( hClient, BIG_SIZE, &pvBuf, TEST_TIMEOUT ) == BIG_SIZE );
+	TestFill( pvBuf, BIG_SIZE, 4 );
+	CHECK( IPC_SendCommit( hClient, pvBuf, BIG_SIZE ) == BIG_SIZE );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == BIG_SIZE );
+	CHECK( TestVerify( buf, BIG_SIZE, 4 ) );
+
+	// 0 restores the default
+	CHECK( IPC_SetSectionThreshold( hClient, 0 ) );
+	TestFill( buf, 3000, 5 );
+	CHECK( IPC_Send( hClient, buf, 3000, TEST_TIMEOUT ) == 3000 );
+	CHECK( IPC_Recv( hConn, buf, sizeof(buf), TEST_TIMEOUT ) == 3000 );
+	CHECK( TestVerify( buf, 3000, 5 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
@@ -0,0 +1,86 @@
+// serve.cpp /////////////////////////////////////
+//
+// IPC_ServerRun (Windows only): echo to several clients, the handler sees
+// the connections close, the loop returns on the stop event
+
+#include "test.h"
+
+#ifdef _WIN32
+
+#define TEST_RUN_SERVER		"jr_ipc_test_run"
+#define TEST_RUN_CLIENTS	4
+#define TEST_RUN_MSGS		100
+
+struct RunArgs
+{
+	HIPCSERVER		hServer;
+	HANDLE			hStopEvent;
+	BOOL			bResult;
+	volatile LONG	lClosed;
+};
+
+static void __stdcall RunEcho( HIPCCONNECTION hConnection, const void *pvMsg, DWORD dwSize, void *pvContext )
+{
+	RunArgs *pArgs = (RunArgs *) pvContext;
+	if ( pvMsg == NULL ) InterlockedIncrement( &pArgs->lClosed );
+	else IPC_Send( hConnection, (void *) pvMsg, dwSize, TEST_TIMEOUT );
+}
+
+static void RunServer( void *pvArgs )
+{
+	RunArgs *pArgs = (RunArgs *) pvArgs;
+	pArgs->bResult = IPC_ServerRun( pArgs->hServer, RunEcho, pArgs, 2, pArgs->hStopEvent );
+}
+
+TEST_CASE( TestServerRun, "server loop" )
+{
+	char szServerName[] = TEST_RUN_SERVER;
+	static RunArgs args;
+	args.hServer = IPC_ServerStart( szServerName );
+	CHECK( args.hServer != IPC_RC_INVALID_HANDLE );
+	args.hStopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	args.bResult = FALSE;
+	args.lClosed = 0;
+	TestThread *pServer = TestThreadStart( RunServer, &args );
+
+	// the clients take turns, the messages of each come back in order
+	HIPCCONNECTION hClients[TEST_RUN_CLIENTS];
+	int nConnected = 0;
+	for ( ; nConnected < TEST_RUN_CLIENTS; nConnected++ ) {
+		hClients[nConnected] = IPC_Connect( szServerName, TEST_TIMEOUT );
+		if ( ! CHECK_IPC_HCONNECTION( hClients[nConnected] ) ) break;
+	}
+
+	DWORD n = 0;
+	if ( nConnected == TEST_RUN_CLIENTS ) {
+		unsigned char buf[200];
+		for ( ; n < TEST_RUN_MSGS; n++ ) {
+			HIPCCONNECTION hClient = hClients[n % TEST_RUN_CLIENTS];
+			DWORD dwSize = n + 1;
+			TestFill( buf, dwSize, n );
+			if ( IPC_Send( hClient, buf, dwSize, TEST_TIMEOUT ) != dwSize ) break;
+			if ( IPC_Recv( hClient, buf, sizeof(buf), TEST_TIMEOUT ) != dwSize ) break;
+			if ( ! TestVerify( buf, dwSize, n ) ) break;
+		}
+	}
+
+	for ( int i = 0; i < nConnected; i++ )
+		IPC_CloseConnection( hClients[i] );
+	DWORD dwStart = TestTicks();
+	while ( args.lClosed < nConnected && TestTicks() - dwStart < TEST_TIMEOUT )
+		TestSleep( 1 );
+	LONG lClosed = args.lClosed;
+
+	SetEvent( args.hStopEvent );
+	TestThreadJoin( pServer );
+	CloseHandle( args.hStopEvent );
+	IPC_ServerStop( args.hServer );
+
+	CHECK( nConnected == TEST_RUN_CLIENTS );
+	CHECK( n == TEST_RUN_MSGS );
+	CHECK( lClosed == TEST_RUN_CLIENTS );
+	CHECK( args.bResult );
+	return true;
+}
+
+#endif // _WIN32
@@ -0,0 +1,62 @@
+// sgio.cpp //////////////////////////////////////
+//
+// scatter/gather: IPC_SendV / IPC_RecvV
+
+#include "test.h"
+
+#define BIG_SIZE	20000		// several times the default channel
+
+TEST_CASE( TestScatterGather, "scatter/gather" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	// the segments of one message, an empty one among them
+	unsigned char msg[300], a[300], b[300];
+	TestFill( msg, sizeof(msg), 1 );
+	IPC_BUF send[] = { { msg, 10 }, { msg + 10, 0 }, { msg + 10, 290 } };
+	CHECK( IPC_SendV( hClient, send, 3, TEST_TIMEOUT ) == 300 );
+
+	IPC_BUF recv[] = { { a, 100 }, { b, sizeof(b) } };
+	CHECK( IPC_RecvV( hConn, recv, 2, TEST_TIMEOUT ) == 300 );
+	CHECK( memcmp( a, msg, 100 ) == 0 );
+	CHECK( memcmp( b, msg + 100, 200 ) == 0 );
+
+	CHECK( IPC_SendV( hClient, send, 0, TEST_TIMEOUT ) == 0 );
+	CHECK( IPC_RecvV( hConn, recv, 2, TEST_TIMEOUT ) == 0 );
+	CHECK( IPC_SendV( hClient, NULL, 1, TEST_TIMEOUT ) == IPC_RC_ERROR );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+
+static void BigSender( void *pvClient )
+{
+	HIPCCONNECTION hClient = *(HIPCCONNECTION *) pvClient;
+	static unsigned char buf[BIG_SIZE];
+	TestFill( buf, sizeof(buf), 2 );
+	IPC_BUF send[] = { { buf, 1 }, { buf + 1, 7000 }, { buf + 7001, BIG_SIZE - 7001 } };
+	IPC_SendV( hClient, send, 3, TEST_TIMEOUT );
+}
+
+TEST_CASE( TestScatterGatherBig, "scatter/gather larger than the channel" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	static unsigned char buf[BIG_SIZE];
+	IPC_BUF recv[] = { { buf, 5000 }, { buf + 5000, 3 }, { buf + 5003, BIG_SIZE - 5003 } };
+	TestThread *pSender = TestThreadStart( BigSender, &hClient );
+	DWORD dwSize = IPC_RecvV( hConn, recv, 3, TEST_TIMEOUT );
+	TestThreadJoin( pSender );
+
+	CHECK( dwSize == BIG_SIZE );
+	CHECK( TestVerify( buf, BIG_SIZE, 2 ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
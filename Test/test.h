@@ -0,0 +1,72 @@
+// test.h ////////////////////////////////////////
+//
+// ipc_test: checks of the library API, run against the default transport
+// (`make test` repeats them for every JR_IPC_TRANSPORT). A test case is a
+// function returning false on the first failed CHECK.
+
+#ifndef IPC_TEST_H
+#define IPC_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+#include "load_ipc.h"
+#else
+#include <ipc.h>
+
+// linked with libjr_ipc.so
+inline bool IPC_LoadDLL()	{ return true; }
+inline bool IPC_FreeDLL()	{ return true; }
+#endif
+
+//////////////////////////////////////////////////
+
+#define TEST_SERVER		"jr_ipc_test"
+#define TEST_TIMEOUT	5000
+
+#define CHECK(expr) \
+	do { if ( !(expr) ) { printf("    %s(%d): %s\n", __FILE__, __LINE__, #expr); return false; } } while (0)
+
+struct TestCase
+{
+	const char	*pszName;
+	bool		(*pfn)();
+	TestCase	*pNext;
+
+	TestCase( const char *pszName, bool (*pfn)() );
+};
+
+// TEST_CASE( TestWrap, "ring wrap" ) { ... return true; }
+#define TEST_CASE(fn, name) \
+	static bool fn(); \
+	static TestCase fn##Case( name, fn ); \
+	static bool fn()
+
+//////////////////////////////////////////////////
+// helpers of main.cpp
+
+// a connected pair through TEST_SERVER: hClient -> hServerConn;
+// dwSize != 0 asks for channels of that size (IPC_ConnectEx)
+bool TestOpen( HIPCCONNECTION& hClient, HIPCCONNECTION& hServerConn, DWORD dwSize = 0 );
+
+// sends dwMsgSize byte messages until the channel is full, returns their
+// number (0 - full already, 100000 - never full); a message split into
+// packets waits for the receiver after the first one, so dwMsgSize should
+// divide the channel
+DWORD TestFillChannel( HIPCCONNECTION hClient, DWORD dwMsgSize );
+
+// the byte pattern of message dwSeq
+void TestFill( void *pvBuf, DWORD dwSize, DWORD dwSeq );
+bool TestVerify( const void *pvBuf, DWORD dwSize, DWORD dwSeq );
+
+struct TestThread;
+TestThread *TestThreadStart( void (*pfn)( void *pvArg ), void *pvArg );
+void TestThreadJoin( TestThread *pThread );
+
+DWORD TestTicks();						// milliseconds
+void TestSleep( DWORD dwMilliseconds );
+
+#endif // IPC_TEST_H
@@ -0,0 +1,66 @@
+// view.cpp //////////////////////////////////////
+//
+// zero-copy receive: IPC_RecvView / IPC_RecvRelease
+
+#include "test.h"
+
+#define BIG_SIZE	20000		// several times the default channel
+
+TEST_CASE( TestView, "view and release" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	const void *pvView = NULL;
+	CHECK( IPC_RecvView( hConn, &pvView, 0 ) == IPC_RC_TIMEOUT );
+	CHECK( ! IPC_RecvRelease( hConn, pvView ) );
+
+	unsigned char buf[100];
+	TestFill( buf, sizeof(buf), 1 );
+	CHECK( IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( IPC_Send( hClient, buf, 10, TEST_TIMEOUT ) == 10 );
+
+	CHECK( IPC_RecvView( hConn, &pvView, TEST_TIMEOUT ) == sizeof(buf) );
+	CHECK( TestVerify( pvView, sizeof(buf), 1 ) );
+	CHECK( ! IPC_RecvRelease( hConn, buf ) );
+	CHECK( IPC_RecvRelease( hConn, pvView ) );
+	CHECK( ! IPC_RecvRelease( hConn, pvView ) );
+
+	// the next message follows
+	CHECK( IPC_RecvView( hConn, &pvView, TEST_TIMEOUT ) == 10 );
+	CHECK( TestVerify( pvView, 10, 1 ) );
+	CHECK( IPC_RecvRelease( hConn, pvView ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
+
+//////////////////////////////////////////////////
+
+static void BigSender( void *pvClient )
+{
+	HIPCCONNECTION hClient = *(HIPCCONNECTION *) pvClient;
+	static unsigned char buf[BIG_SIZE];
+	TestFill( buf, sizeof(buf), 2 );
+	IPC_Send( hClient, buf, sizeof(buf), TEST_TIMEOUT );
+}
+
+TEST_CASE( TestViewBig, "view larger than the channel" )
+{
+	HIPCCONNECTION hClient, hConn;
+	CHECK( TestOpen( hClient, hConn ) );
+
+	TestThread *pSender = TestThreadStart( BigSender, &hClient );
+	const void *pvView = NULL;
+	DWORD dwSize = IPC_RecvView( hConn, &pvView, TEST_TIMEOUT );
+	TestThreadJoin( pSender );
+
+	CHECK( dwSize == BIG_SIZE );
+	CHECK( TestVerify( pvView, BIG_SIZE, 2 ) );
+	CHECK( IPC_RecvRelease( hConn, pvView ) );
+
+	IPC_CloseConnection( hClient );
+	IPC_CloseConnection( hConn );
+	return true;
+}
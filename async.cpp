@@ -0,0 +1,330 @@
+// async.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Async engine: IPC_SendAsync/IPC_RecvAsync
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_impl.h"
+
+////////////////////////////////////////////////////////////////
+// IPC_AsyncConn
+
+struct IPC_AsyncOp
+{
+	IPC_AsyncOp        *next;
+	HIPCCONNECTION      hConn;
+	void               *buf;
+	DWORD               size;
+	IPC_ASYNC_CALLBACK  cb;
+	void               *ctx;
+};
+
+struct IPC_AsyncConn
+{
+	IPC_PollSource *src;
+	IPC_AsyncOp    *first [2];  // pending operations per direction
+	IPC_AsyncOp    *last [2];
+	bool            busy [2];   // the first operation is posted to the workers
+	bool            running [2];  // ... and a worker is inside the transfer
+	DWORD           events;     // IPC_POLL_XXX subscribed in the poll set
+	bool            bClosed;
+	IPC_AsyncConn  *nextDead;
+};
+
+// completion port packet keys, RECV and SEND run the first operation
+const ULONG_PTR IPC_ASYNC_DONE = 2;
+
+void IPC_PollSource::asyncDetach ()
+{
+	if (m_pAsyncConn) IPC_AsyncEngine::instance ().detach (this);
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_AsyncEngine
+
+IPC_AsyncEngine IPC_AsyncEngine::g_instance;
+
+IPC_AsyncEngine::IPC_AsyncEngine () : m_bStarted (false), m_pDead (NULL)
+{
+	InitializeCriticalSection (&m_cs);
+}
+
+IPC_AsyncEngine::~IPC_AsyncEngine ()
+{
+	// the threads may still be inside m_cs when the process exits
+	if (! m_bStarted) DeleteCriticalSection (&m_cs);
+}
+
+// called with m_cs held
+bool IPC_AsyncEngine::start ()
+{
+	if (m_bStarted) return true;
+	if (! m_set.isValid ()) return false;
+
+	m_hPort = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (! m_hPort.isValid ()) return false;
+
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	DWORD workers = si.dwNumberOfProcessors;
+	if (workers < 2) workers = 2;
+	if (workers > IPC_ASYNC_MAX_WORKERS) workers = IPC_ASYNC_MAX_WORKERS;
+
+	// threads left from a failed start leave when the old port is closed
+	for (DWORD i = 0; i < workers; i++) {
+		HANDLE h = CreateThread (NULL, 0, worker, this, 0, NULL);
+		if (h == NULL) return false;
+		CloseHandle (h);
+	}
+
+	HANDLE h = CreateThread (NULL, 0, dispatcher, this, 0, NULL);
+	if (h == NULL) return false;
+	CloseHandle (h);
+
+	m_bStarted = true;
+	return true;
+}
+
+DWORD IPC_AsyncEngine::post (IPC_PollSource *src, HIPCCONNECTION hConn, int dir,
+	void *buf, DWORD size, IPC_ASYNC_CALLBACK cb, void *ctx)
+{
+	if (src == NULL || (buf == NULL && size != 0) || cb == NULL) return IPC_ERR_INVALID_ARG;
+
+	IPC_AsyncOp *op = new IPC_AsyncOp;
+	if (op == NULL) return IPC_ERR_OUT_OF_MEMORY;
+	op->next = NULL;
+	op->hConn = hConn;
+	op->buf = buf;
+	op->size = size;
+	op->cb = cb;
+	op->ctx = ctx;
+
+	EnterCriticalSection (&m_cs);
+
+	if (! start ()) {
+		LeaveCriticalSection (&m_cs);
+		delete op;
+		return IPC_ERR_UNKNOWN;
+	}
+
+	IPC_AsyncConn *c = src->m_pAsyncConn;
+	if (c == NULL) {
+		// the engine waits on its own poll set, a connection is in one set at a time
+		if (src->m_pPollEntry != NULL || (c = new IPC_AsyncConn) == NULL) {
+			LeaveCriticalSection (&m_cs);
+			delete op;
+			return (src->m_pPollEntry != NULL) ? IPC_ERR_INVALID_ARG : IPC_ERR_OUT_OF_MEMORY;
+		}
+		memset (c, 0, sizeof (*c));
+		c->src = src;
+		src->m_pAsyncConn = c;
+	}
+
+	if (c->last[dir]) c->last[dir]->next = op; else c->first[dir] = op;
+	c->last[dir] = op;
+
+	// try it at once, the poll set is for operations that have to wait
+	if (! c->busy[dir] && c->first[dir] == op) schedule (c, dir);
+
+	LeaveCriticalSection (&m_cs);
+	return 0;
+}
+
+void IPC_AsyncEngine::detach (IPC_PollSource *src)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_AsyncConn *c = src->m_pAsyncConn;
+	if (c == NULL) {
+		LeaveCriticalSection (&m_cs);
+		return;
+	}
+
+	c->bClosed = true;
+	if (c->events != 0) m_set.remove (src);
+
+	// the running transfers see the closed connection and return;
+	// the posted ones find it closed and leave the source alone
+	while (c->running[RECV] || c->running[SEND]) {
+		LeaveCriticalSection (&m_cs);
+		Sleep (1);
+		EnterCriticalSection (&m_cs);
+	}
+
+	src->m_pAsyncConn = NULL;
+	c->src = NULL;
+	c->nextDead = m_pDead;
+	m_pDead = c;
+
+	// fail the rest, the callbacks run on the workers
+	for (int dir = RECV; dir <= SEND; dir++) {
+		while (IPC_AsyncOp *op = c->first[dir]) {
+			c->first[dir] = op->next;
+			PostQueuedCompletionStatus (m_hPort, IPC_RC_ERROR, IPC_ASYNC_DONE, (LPOVERLAPPED)op);
+		}
+		c->last[dir] = NULL;
+	}
+
+	LeaveCriticalSection (&m_cs);
+}
+
+void IPC_AsyncEngine::cancel (IPC_PollSource *src, void *ctx)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_AsyncConn *c = src->m_pAsyncConn;
+	if (c == NULL || c->bClosed) {
+		LeaveCriticalSection (&m_cs);
+		return;
+	}
+
+	for (int dir = RECV; dir <= SEND; dir++) {
+		// a running transfer completes as it goes
+		IPC_AsyncOp **pp = c->running[dir] ? &c->first[dir]->next : &c->first[dir];
+		c->last[dir] = NULL;
+		while (IPC_AsyncOp *op = *pp) {
+			if (ctx != NULL && op->ctx != ctx) {
+				c->last[dir] = op;
+				pp = &op->next;
+				continue;
+			}
+			*pp = op->next;
+			PostQueuedCompletionStatus (m_hPort, IPC_RC_ERROR, IPC_ASYNC_DONE, (LPOVERLAPPED)op);
+		}
+		if (c->last[dir] == NULL && c->running[dir]) c->last[dir] = c->first[dir];
+	}
+	subscribe (c);
+
+	LeaveCriticalSection (&m_cs);
+}
+
+// called with m_cs held: the poll set watches the directions
+// that have operations and no running one
+void IPC_AsyncEngine::subscribe (IPC_AsyncConn *c)
+{
+	DWORD events = 0;
+	if (c->first[RECV] && ! c->busy[RECV]) events |= IPC_POLL_IN;
+	if (c->first[SEND] && ! c->busy[SEND]) events |= IPC_POLL_OUT;
+	if (events == c->events) return;
+
+	if (events == 0) m_set.remove (c->src);
+	else if (m_set.add (c->src, (HIPCCONNECTION)c, events) != 0) events = 0;
+	c->events = events;
+}
+
+// called with m_cs held
+void IPC_AsyncEngine::schedule (IPC_AsyncConn *c, int dir)
+{
+	c->busy[dir] = true;
+	PostQueuedCompletionStatus (m_hPort, 0, (ULONG_PTR)dir, (LPOVERLAPPED)c);
+}
+
+// worker: the first operation of the direction, c->busy[dir] is set
+void IPC_AsyncEngine::run (IPC_AsyncConn *c, int dir)
+{
+	EnterCriticalSection (&m_cs);
+	if (c->bClosed) {
+		c->busy[dir] = false;
+		LeaveCriticalSection (&m_cs);
+		return;
+	}
+	// a cancel may have taken the operation it was posted for
+	IPC_AsyncOp *op = c->first[dir];
+	if (op == NULL) {
+		c->busy[dir] = false;
+		LeaveCriticalSection (&m_cs);
+		return;
+	}
+	c->running[dir] = true;
+	LeaveCriticalSection (&m_cs);
+
+	DWORD rc = (dir == SEND) ? c->src->asyncSend (op->buf, op->size)
+	                         : c->src->asyncRecv (op->buf, op->size);
+
+	EnterCriticalSection (&m_cs);
+
+	IPC_AsyncOp *done = NULL;
+	if (rc != IPC_RC_TIMEOUT) {
+		done = op;
+		c->first[dir] = op->next;
+		if (c->first[dir] == NULL) c->last[dir] = NULL;
+	}
+	c->running[dir] = false;
+	c->busy[dir] = false;
+
+	if (! c->bClosed) {
+		// the next operation may well be ready too
+		if (done && c->first[dir]) schedule (c, dir);
+		subscribe (c);
+	}
+
+	LeaveCriticalSection (&m_cs);
+
+	if (done) {
+		done->cb (done->hConn, rc, done->ctx);
+		delete done;
+	}
+}
+
+DWORD WINAPI IPC_AsyncEngine::worker (LPVOID param)
+{
+	IPC_AsyncEngine *engine = (IPC_AsyncEngine *)param;
+
+	for (;;) {
+		DWORD bytes;
+		ULONG_PTR key;
+		LPOVERLAPPED ovl = NULL;
+		if (! GetQueuedCompletionStatus (engine->m_hPort, &bytes, &key, &ovl, INFINITE) && ovl == NULL) return 0;
+
+		if (key == IPC_ASYNC_DONE) {
+			IPC_AsyncOp *op = (IPC_AsyncOp *)ovl;
+			op->cb (op->hConn, bytes, op->ctx);
+			delete op;
+		} else {
+			engine->run ((IPC_AsyncConn *)ovl, (int)key);
+		}
+	}
+}
+
+DWORD WINAPI IPC_AsyncEngine::dispatcher (LPVOID param)
+{
+	IPC_AsyncEngine *engine = (IPC_AsyncEngine *)param;
+	IPC_POLL_EVENT events [IPC_ASYNC_EVENTS];
+
+	for (;;) {
+		// the poll set has dropped them, no wait reports them any more;
+		// the ones still posted to the workers wait for the next round
+		EnterCriticalSection (&engine->m_cs);
+		IPC_AsyncConn **pp = &engine->m_pDead;
+		while (IPC_AsyncConn *c = *pp) {
+			if (c->busy[RECV] || c->busy[SEND]) {
+				pp = &c->nextDead;
+				continue;
+			}
+			*pp = c->nextDead;
+			delete c;
+		}
+		LeaveCriticalSection (&engine->m_cs);
+
+		DWORD ready;
+		DWORD err = engine->m_set.wait (events, IPC_ASYNC_EVENTS, INFINITE, ready);
+		if (err != 0) return err;
+
+		EnterCriticalSection (&engine->m_cs);
+		for (DWORD i = 0; i < ready; i++) {
+			IPC_AsyncConn *c = (IPC_AsyncConn *)events[i].hConnection;
+			if (c->bClosed) continue;
+
+			// a closed connection fails the operations of both directions
+			const DWORD st = events[i].dwEvents;
+			if ((st & (IPC_POLL_IN|IPC_POLL_CLOSED)) && c->first[RECV] && ! c->busy[RECV]) engine->schedule (c, RECV);
+			if ((st & (IPC_POLL_OUT|IPC_POLL_CLOSED)) && c->first[SEND] && ! c->busy[SEND]) engine->schedule (c, SEND);
+			engine->subscribe (c);
+		}
+		LeaveCriticalSection (&engine->m_cs);
+	}
+}
@@ -19,26 +19,36 @@ bool IPC_PortAccess::create (SECURITY_ATTRIBUTES *pSA, char *pathBuf, unsigned i
 	m_hAvail = CreateEvent (pSA, TRUE, FALSE, pathBuf);
 	if (! m_hAvail.isValid ()) return false;
 
-	strcpy_s (pathBuf+prefixLen,3, IPC_SUFFIX_MUTEX);
-	m_hMutex = CreateMutex (pSA, FALSE, pathBuf);
-	if (! m_hMutex.isValid ()) return false;
+	strcpy_s (pathBuf+prefixLen,3, IPC_SUFFIX_FREE);
+	m_hFree = CreateSemaphore (pSA, IPC_CONNECT_SLOTS, IPC_CONNECT_SLOTS, pathBuf);
+	if (! m_hFree.isValid ()) return false;
 
 	return true;
 }
 
 DWORD IPC_PortAccess::waitAccess (DWORD tmo)
 {
-	HANDLE hdls[2] = { m_hAvail, m_hMutex };
-	DWORD st = WaitForMultipleObjects (2, hdls, TRUE, tmo);
-	switch (st) {
-	case WAIT_OBJECT_0:
-	case WAIT_OBJECT_0+1:
-	case WAIT_ABANDONED_0:
-	case WAIT_ABANDONED_0+1:
-		st = WAIT_OBJECT_0;
-		break;
+	DWORD st = WaitForSingleObject (m_hAvail, tmo);
+	return (st == WAIT_OBJECT_0) ? WAIT_OBJECT_0 : st;
+}
+
+DWORD IPC_PortAccess::waitSlot (DWORD tmo)
+{
+	DWORD st = WaitForSingleObject (m_hFree, tmo);
+	return (st == WAIT_OBJECT_0) ? WAIT_OBJECT_0 : st;
+}
+
+int IPC_PortAccess::claimSlot (IPC_CONNECT_SLOT *slots)
+{
+	// the semaphore counts free slots, so one of them is free for us;
+	// another client may be just taking the one we look at
+	for (;;) {
+		for (int i = 0; i < IPC_CONNECT_SLOTS; i++) {
+			if (InterlockedCompareExchange (&slots[i].state, IPC_SLOT_CLAIMED, IPC_SLOT_FREE) == IPC_SLOT_FREE)
+				return i;
+		}
+		YieldProcessor ();
 	}
-	return st;
 }
 
 ////////////////////////////////////////////////////////////////
@@ -144,10 +154,126 @@ void  IPC_Channel::unlock ()
 	ReleaseMutex (m_hMutex);
 }
 
+IPC_MSG_HDR * IPC_Channel::ringReserve (DWORD minPkt, DWORD maxPkt, DWORD& pktSize)
+{
+	const DWORD hdrSize = sizeof (IPC_MSG_HDR);
+
+	for (;;) {
+		DWORD head = (DWORD)m_ring->head;
+		m_seenTail = ReadAcquire (&m_ring->tail);
+		DWORD freeSize = m_bufSize - (head - (DWORD)m_seenTail);
+		DWORD off = head & (m_bufSize - 1);
+		DWORD contig = m_bufSize - off;
+
+		// all offsets are aligned, so room is either zero or >= hdrSize
+		DWORD room = (contig < freeSize) ? contig : freeSize;
+		if (room >= hdrSize && room - hdrSize >= minPkt) {
+			pktSize = room - hdrSize;
+			if (pktSize > maxPkt) pktSize = maxPkt;
+			return (IPC_MSG_HDR *)(m_buffer + off);
+		}
+
+		// not enough space before the end of the ring: pad and wrap around
+		if (off == 0 || contig > freeSize) return NULL;
+
+		IPC_MSG_HDR *pad = (IPC_MSG_HDR *)(m_buffer + off);
+		pad->msgSize = IPC_MSG_WRAP;
+		pad->pktSize = contig - hdrSize;
+		WriteRelease (&m_ring->head, (LONG)(head + contig));
+
+		// a sleeping receiver has to skip the pad before the space shows up
+		notifyData ();
+	}
+}
+
+void IPC_Channel::ringCommit (DWORD pktSize)
+{
+	DWORD head = (DWORD)m_ring->head;
+	WriteRelease (&m_ring->head, (LONG)(head + IPC_RingAlign (sizeof (IPC_MSG_HDR) + pktSize)));
+}
+
+const IPC_MSG_HDR * IPC_Channel::ringPeek ()
+{
+	for (;;) {
+		DWORD tail = (DWORD)m_ring->tail;
+		m_seenHead = ReadAcquire (&m_ring->head);
+		if ((DWORD)m_seenHead == tail) return NULL;
+
+		DWORD off = tail & (m_bufSize - 1);
+		const IPC_MSG_HDR *hdr = (const IPC_MSG_HDR *)(m_buffer + off);
+		if (hdr->msgSize != IPC_MSG_WRAP) return hdr;
+
+		WriteRelease (&m_ring->tail, (LONG)(tail + m_bufSize - off));
+		notifySpace ();
+	}
+}
+
+DWORD IPC_Channel::ringPktSize (const IPC_MSG_HDR *hdr) const
+{
+	DWORD maxPkt = m_bufSize - (DWORD)((const unsigned char *)hdr - m_buffer) - sizeof (IPC_MSG_HDR);
+	return (hdr->pktSize > maxPkt) ? maxPkt : hdr->pktSize; // sender error !!!
+}
+
+void IPC_Channel::ringRelease (const IPC_MSG_HDR *hdr)
+{
+	DWORD tail = (DWORD)m_ring->tail;
+	WriteRelease (&m_ring->tail, (LONG)(tail + IPC_RingAlign (sizeof (IPC_MSG_HDR) + ringPktSize (hdr))));
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Spin
+
+IPC_Spin::IPC_Spin () : m_budget (0), m_avg (0), m_limit (IPC_SPIN_ADAPTIVE)
+{
+	setLimit (IPC_SPIN_ADAPTIVE);
+}
+
+bool IPC_Spin::spin (const volatile LONG *pWord, LONG seen, LONGLONG& t0)
+{
+	t0 = IPC_Ticks ();
+	if (m_budget == 0) return false;
+
+	for (unsigned int i = 1; ; i++) {
+		if (*pWord != seen) {
+			learn (IPC_Ticks () - t0);
+			return true;
+		}
+		YieldProcessor ();
+
+		// reading the counter costs more than a pause, check it now and then
+		if ((i & 31) == 0 && IPC_Ticks () - t0 >= m_budget) return false;
+	}
+}
+
+void IPC_Spin::setLimit (DWORD us)
+{
+	IPC_Runtime& rt = IPC_Runtime::instance ();
+	m_limit = us;
+
+	if (us != IPC_SPIN_ADAPTIVE) {
+		m_budget = rt.canSpin () ? rt.usToTicks (us) : 0;
+	} else {
+		m_avg = rt.usToTicks (IPC_SPIN_DEFAULT_US) / 2;
+		m_budget = rt.canSpin () ? 2*m_avg : 0;
+	}
+}
+
+void IPC_Spin::learn (LONGLONG dt)
+{
+	if (m_limit != IPC_SPIN_ADAPTIVE) return;
+
+	IPC_Runtime& rt = IPC_Runtime::instance ();
+	if (! rt.canSpin ()) return;
+
+	// spin for twice the average wait, unless waits are too long to spin at all
+	m_avg += (dt - m_avg) / 8;
+	m_budget = (2*m_avg <= rt.usToTicks (IPC_SPIN_MAX_US)) ? 2*m_avg : 0;
+}
+
 ////////////////////////////////////////////////////////////////
 // IPC_Server
 
-IPC_Server::IPC_Server ()
+IPC_Server::IPC_Server () : m_accepting (0)
 {
 }
 
@@ -156,10 +282,11 @@ IPC_Server::~IPC_Server ()
 	unlisten ();
 }
 
-DWORD IPC_Server::listen (const char *epName)
+DWORD IPC_Server::listen (const char *epName, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
 {
 	unsigned int nameLen = IPC_strlen (epName);
 	if (nameLen == 0 || nameLen > IPC_MAX_SERVER_NAME) return IPC_ERR_INVALID_ARG;
+	if (sendSize > IPC_MAX_CHANNEL_SIZE || recvSize > IPC_MAX_CHANNEL_SIZE) return IPC_ERR_INVALID_ARG;
 
 	char pathBuf[IPC_MAX_PATH];
 	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_PORT_PREFIX, epName);
@@ -185,15 +312,22 @@ DWORD IPC_Server::listen (const char *epName)
 	// create connection state
 	if (! m_control.create (pSA, pathBuf, prefixLen)) return IPC_ERR_UNKNOWN;
 
-	// create connection channel
-	
-	// channel buffer points just after the IPC_PORT_INFO structure
-	IPC_PORT_INFO *portInfo = (IPC_PORT_INFO *)m_buffer.data ();
+	// create connection request objects
+	// (the slots follow the IPC_PORT_INFO structure, the mapping is zeroed)
+	strcpy_s(pathBuf + prefixLen,3, IPC_SUFFIX_REQUEST);
+	m_hRequest = CreateSemaphore (pSA, 0, IPC_CONNECT_SLOTS, pathBuf);
+	if (! m_hRequest.isValid () || GetLastError () == ERROR_ALREADY_EXISTS) return IPC_ERR_UNKNOWN;
 
-	if (! m_channel.create (pSA, pathBuf, prefixLen)) return IPC_ERR_UNKNOWN;
-	m_channel.setBuffer (m_buffer.data() + sizeof(IPC_PORT_INFO));
+	for (int i = 0; i < IPC_CONNECT_SLOTS; i++) {
+		sprintf_s (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, "%s%d", IPC_SUFFIX_REPLY, i);
+		m_hReply[i] = CreateEvent (pSA, FALSE, FALSE, pathBuf);
+		if (! m_hReply[i].isValid () || GetLastError () == ERROR_ALREADY_EXISTS) return IPC_ERR_UNKNOWN;
+	}
 
+	IPC_PORT_INFO *portInfo = (IPC_PORT_INFO *)m_buffer.data ();
 	portInfo->serverPid = GetCurrentProcessId ();
+	portInfo->sendSize = sendSize;
+	portInfo->recvSize = recvSize;
 
 	// open the port for external access
 	m_portAccess.allowAccess ();
@@ -211,7 +345,8 @@ BOOL IPC_Server::unlisten ()
 	waitForOperationsComplete();
 
 	m_control.close ();
-	m_channel.close ();
+	m_hRequest.close ();
+	for (int i = 0; i < IPC_CONNECT_SLOTS; i++) m_hReply[i].close ();
 	m_buffer.close ();
 	m_hBuffer.close ();
 
@@ -224,9 +359,10 @@ BOOL IPC_Server::unlisten ()
 
 void IPC_Server::waitForOperationsComplete(DWORD tmo /*= INFINITE*/)
 {
-	// wait for completting of a current channel operaton
-	IPC_Channel_Lock locker;
-	locker.lock(&m_channel, tmo);
+	// wait for completting of the current accept operations,
+	// hClose is already set so they return promptly
+	DWORD t0 = GetTickCount ();
+	while (m_accepting != 0 && IPC_RemainingTimeout (tmo, t0) != 0) Sleep (1);
 }
 
 IPC_Connection * IPC_Server::accept (DWORD tmo, DWORD& err, HANDLE hBreakEvent /*= NULL*/)
@@ -237,76 +373,88 @@ IPC_Connection * IPC_Server::accept (DWORD tmo, DWORD& err, HANDLE hBreakEvent /
 	DWORD t0;
 	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
 
-	IPC_Channel_Lock locker;
-	err = locker.lock (&m_channel, tmo);
-	if (err != 0) return NULL; // timeout or error
+	InterlockedIncrement (&m_accepting);
 
-	// rendezvous handles:
-	// 0 - primary handle
+	// request handles:
+	// 0 - posted requests semaphore
 	// 1 - hClose
 	int hcnt = 2;
 	HANDLE hdls[3];
+	hdls[0] = m_hRequest;
 	hdls[1] = m_control.m_hClose;
 	if (hBreakEvent)
 		hdls[hcnt++] = hBreakEvent;
 
-	IPC_MSG_HDR *msgHdr = (IPC_MSG_HDR *)(m_channel.m_buffer);
+	IPC_PORT_INFO *portInfo = (IPC_PORT_INFO *)m_buffer.data ();
+	IPC_CONNECT_SLOT *slots = (IPC_CONNECT_SLOT *)(m_buffer.data () + IPC_CONNECT_SLOTS_OFFSET);
+
+	// take a posted request
+	int slot = -1;
+	IPC_CONNECT_REQUEST connReq;
+	while (slot < 0) {
 
-	// perform rendezvous
-	for (;;) {
+		DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
 
-		DWORD rtmo = tmo;
-		if (rtmo != INFINITE && rtmo != 0) {
-			DWORD dt = GetTickCount () - t0;
-			if (dt < rtmo) rtmo -= dt; else rtmo = 0;
-		}
+		// the client bumps connectSeq before posting, spinning on it
+		// leaves the semaphore signaled and the wait below returns without sleeping
+		LONGLONG ts;
+		LONG seq = portInfo->connectSeq;
+		bool bSpun = (rtmo != 0) && m_spin.spin (&portInfo->connectSeq, seq, ts);
 
-		hdls[0] = m_channel.m_hSendRdy;
 		DWORD st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
 		switch (st) {
-		case WAIT_OBJECT_0: break;
+		case WAIT_OBJECT_0:
+			if (! bSpun && rtmo != 0) m_spin.done (ts);
+			break;
 		case WAIT_OBJECT_0+1:
 			err = IPC_ERR_CLOSED;
-			return NULL;
+			break;
 		case WAIT_OBJECT_0+2:
 			err = IPC_ERR_USER_EVENT_SET;
-			return NULL;
+			break;
 		case WAIT_TIMEOUT:
 			err = IPC_ERR_TIMEOUT;
-			return NULL;
+			break;
 		default:
 			err = IPC_ERR_UNKNOWN;
-			return NULL;
+			break;
 		}
-
-		SetEvent (m_channel.m_hRecv);
-
-		hdls[0] = m_channel.m_hSend;
-
-		st = WaitForMultipleObjects (hcnt, hdls, FALSE, INFINITE);
-		switch (st) {
-		case WAIT_OBJECT_0: break;
-		default:
-			ResetEvent (m_channel.m_hRecv);
-			err = IPC_ERR_UNKNOWN;
+		if (err != 0) {
+			InterlockedDecrement (&m_accepting);
 			return NULL;
 		}
 
-		if (msgHdr->msgSize != IPC_MSG_INVALID) break;
+		// no request found: the client has withdrawn it after a timeout
+		for (int i = 0; i < IPC_CONNECT_SLOTS; i++) {
+			if (InterlockedCompareExchange (&slots[i].state, IPC_SLOT_ACCEPTING, IPC_SLOT_REQUEST) == IPC_SLOT_REQUEST) {
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0) continue;
+
+		connReq = slots[slot].request;
+		// zero-terminate name, just in case...
+		connReq.connName[sizeof(connReq.connName)-1] = 0;
+
+		// nobody is left to free the slot of a dead client
+		Handle hClient = OpenProcess (SYNCHRONIZE, FALSE, connReq.clientPid);
+		if (! hClient.isValid () || WaitForSingleObject (hClient, 0) == WAIT_OBJECT_0) {
+			InterlockedExchange (&slots[slot].state, IPC_SLOT_FREE);
+			m_portAccess.releaseSlot ();
+			slot = -1;
+		}
 	}
 
-	// data received
-	// accept connection request packet
-	IPC_CONNECT_REQUEST *connReq = (IPC_CONNECT_REQUEST *)(msgHdr+1);
-	// zero-terminate name, just in case...
-	connReq->connName[sizeof(connReq->connName)-1] = 0;
-
-	IPC_CONNECT_REPLY *connRep = (IPC_CONNECT_REPLY *)(msgHdr+1);
+	DWORD clientSendSize = connReq.clientSendSize;
+	DWORD serverSendSize = connReq.serverSendSize;
 
-	// initialize connection
-	IPC_Connection *pConn = new IPC_Connection ();
-	if (pConn != NULL) {
-		if (pConn->initServerSide (connReq)) {
+	// initialize connection, other threads accept the other slots meanwhile
+	IPC_Connection *pConn = NULL;
+	if (! IPC_IsValidChannelSize (clientSendSize) || ! IPC_IsValidChannelSize (serverSendSize)) {
+		err = IPC_ERR_INVALID_ARG;
+	} else if ((pConn = new IPC_Connection ()) != NULL) {
+		if (pConn->initServerSide (&connReq)) {
 			err = 0;
 		} else {
 			delete pConn;
@@ -317,28 +465,41 @@ IPC_Connection * IPC_Server::accept (DWORD tmo, DWORD& err, HANDLE hBreakEvent /
 		err = IPC_ERR_OUT_OF_MEMORY;
 	}
 
-	msgHdr->msgSize = sizeof (IPC_CONNECT_REPLY);
-	msgHdr->pktSize = sizeof (IPC_CONNECT_REPLY);
+	IPC_CONNECT_REPLY *connRep = &slots[slot].reply;
 	connRep->status = err;
+	connRep->clientSendSize = clientSendSize;
+	connRep->serverSendSize = serverSendSize;
 
-	SetEvent (m_channel.m_hRecv);
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_REPLIED);
+	SetEvent (m_hReply[slot]);
+
+	InterlockedDecrement (&m_accepting);
 	return pConn;
 }
 
 ////////////////////////////////////////////////////////////////
 // IPC_Connection
 
-IPC_Connection::IPC_Connection () : m_hUserEvent (0)
+IPC_Connection::IPC_Connection () : m_bDataPending (false), m_bMultiProducer (false),
+	m_sendClaim (IPC_CLAIM_LOCKED), m_pollArmed (0), m_hUserEvent (0), m_bServerSide (false),
+	m_sectionThreshold (IPC_DEFAULT_SECTION_THRESHOLD), m_sectionSeq (0),
+	m_reserveHdr (NULL), m_reserveBuf (NULL), m_reserveBufSize (0), m_reserveSize (IPC_MSG_INVALID),
+	m_reserveTimeout (INFINITE), m_reserveSeq (0),
+	m_viewHdr (NULL), m_viewPtr (NULL), m_viewBuf (NULL), m_viewBufSize (0)
 {
+	m_connName[0] = 0;
+	for (int i = 0; i < IPC_MAX_PENDING_SECTIONS; i++) m_sectionSeqs[i] = 0;
 	clearLastError ();
 }
 
 IPC_Connection::~IPC_Connection ()
 {
 	close ();
+	free (m_reserveBuf);
+	free (m_viewBuf);
 }
 
-DWORD IPC_Connection::connect (const char *epName, DWORD tmo)
+DWORD IPC_Connection::connect (const char *epName, DWORD tmo, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
 {
 	// no synchronization here, sorry...
 	clearLastError ();
@@ -346,6 +507,10 @@ DWORD IPC_Connection::connect (const char *epName, DWORD tmo)
 	unsigned int nameLen = IPC_strlen (epName);
 	if (nameLen == 0 || nameLen > IPC_MAX_SERVER_NAME) return setLastError (IPC_ERR_INVALID_ARG);
 
+	sendSize = IPC_ChannelSize (sendSize);
+	recvSize = IPC_ChannelSize (recvSize);
+	if (sendSize == 0 || recvSize == 0) return setLastError (IPC_ERR_INVALID_ARG);
+
 	if (! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
 
 	DWORD t0;
@@ -363,9 +528,7 @@ DWORD IPC_Connection::connect (const char *epName, DWORD tmo)
 	if (st == WAIT_TIMEOUT) return setLastError (IPC_ERR_TIMEOUT);
 	if (st != WAIT_OBJECT_0) return setLastError (IPC_ERR_UNKNOWN);
 
-	IPC_PortAccessHolder accessHolder (portAccess);
-
-	// mutex locked, get access to the shared memory buffer
+	// the server is listening, get access to the shared memory buffer
 	strcpy_s(pathBuf + prefixLen,3, IPC_SUFFIX_BUF);
 	Handle hBuffer = OpenFileMapping (FILE_MAP_WRITE, FALSE, pathBuf);
 	if (! hBuffer.isValid ()) return setLastError (IPC_ERR_UNKNOWN);
@@ -374,109 +537,105 @@ DWORD IPC_Connection::connect (const char *epName, DWORD tmo)
 	if (! buffer.isValid ()) return setLastError (IPC_ERR_UNKNOWN);
 
 	IPC_PORT_INFO *portInfo = (IPC_PORT_INFO *)buffer.data ();
+	IPC_CONNECT_SLOT *slots = (IPC_CONNECT_SLOT *)(buffer.data () + IPC_CONNECT_SLOTS_OFFSET);
 
 	m_hProcess = OpenProcess (SYNCHRONIZE, FALSE, portInfo->serverPid);
 	if (! m_hProcess.isValid ()) return setLastError (IPC_ERR_UNKNOWN);
 
-	IPC_Control control;
-	IPC_Channel channel;
+	// negotiate channel sizes: the larger of the client and server preferences
+	DWORD serverSize = IPC_ChannelSize (portInfo->recvSize);
+	if (serverSize > sendSize) sendSize = serverSize;
+	serverSize = IPC_ChannelSize (portInfo->sendSize);
+	if (serverSize > recvSize) recvSize = serverSize;
 
+	IPC_Control control;
 	if (! control.open (pathBuf, prefixLen)) return setLastError (IPC_ERR_UNKNOWN);
 
-	if (! channel.open (pathBuf, prefixLen)) return setLastError (IPC_ERR_UNKNOWN);
-	channel.setBuffer (buffer.data() + sizeof (IPC_PORT_INFO));
+	strcpy_s(pathBuf + prefixLen,3, IPC_SUFFIX_REQUEST);
+	Handle hRequest = OpenSemaphore (SYNCHRONIZE|SEMAPHORE_MODIFY_STATE, FALSE, pathBuf);
+	if (! hRequest.isValid ()) return setLastError (IPC_ERR_UNKNOWN);
 
-	// perform rendezvous
+	// create the connection objects before taking a slot,
+	// other clients use the slots meanwhile
+	IPC_CONNECT_REQUEST request;
+	request.clientSendSize = sendSize;
+	request.serverSendSize = recvSize;
+	if (! initClientSide (&request)) return setLastError (IPC_ERR_UNKNOWN);
+
+	st = portAccess.waitSlot (IPC_RemainingTimeout (tmo, t0));
+	if (st == WAIT_TIMEOUT) return setLastError (IPC_ERR_TIMEOUT);
+	if (st != WAIT_OBJECT_0) return setLastError (IPC_ERR_UNKNOWN);
+
+	int slot = IPC_PortAccess::claimSlot (slots);
+
+	sprintf_s (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, "%s%d", IPC_SUFFIX_REPLY, slot);
+	Handle hReply = OpenEvent (SYNCHRONIZE, FALSE, pathBuf);
+	if (! hReply.isValid ()) {
+		InterlockedExchange (&slots[slot].state, IPC_SLOT_FREE);
+		portAccess.releaseSlot ();
+		return setLastError (IPC_ERR_UNKNOWN);
+	}
 
-	// rendezvous handles:
+	// post the request
+	slots[slot].request = request;
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_REQUEST);
+	InterlockedIncrement (&portInfo->connectSeq);
+	ReleaseSemaphore (hRequest, 1, NULL);
+
+	// reply handles:
 	// 0 - primary handle
 	// 1 - hClose
 	// 2 - hServerProcess
 	int hcnt = 3;
 	HANDLE hdls[3];
-	hdls[0] = channel.m_hRecv;
+	hdls[0] = hReply;
 	hdls[1] = control.m_hClose;
 	hdls[2] = m_hProcess;
 
-	DWORD rtmo = tmo;
-	if (rtmo != INFINITE && rtmo != 0) {
-		DWORD dt = GetTickCount () - t0;
-		if (dt < rtmo) rtmo -= dt; else rtmo = 0;
-	}
-
-	SetEvent (channel.m_hSendRdy);
+	DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+	while (slots[slot].state != IPC_SLOT_REPLIED) {
+		st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
+		switch (st) {
+		case WAIT_OBJECT_0:
+			continue;
+		case WAIT_OBJECT_0+1: // m_hClose
+		case WAIT_OBJECT_0+2: // m_hProcess
+			return setLastError (IPC_ERR_UNKNOWN);
+		case WAIT_TIMEOUT:
+			break;
+		default:
+			return setLastError (IPC_ERR_UNKNOWN);
+		}
 
-	DWORD err = 0;
-	st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
-	switch (st) {
-	case WAIT_OBJECT_0: break;
-	case WAIT_OBJECT_0+1: // m_hClose
-	case WAIT_OBJECT_0+2: // m_hProcess
-		return setLastError (IPC_ERR_UNKNOWN);
-	case WAIT_TIMEOUT:
-		err = IPC_ERR_TIMEOUT;
-		break;
-	default:
-		err = IPC_ERR_UNKNOWN;
-		break;
-	}
-
-	IPC_MSG_HDR *msgHdr = (IPC_MSG_HDR *)(channel.m_buffer);
-
-	if (st != WAIT_OBJECT_0) {
-		// timeout/error handling
-		// try to 'atomically' drop SendRdy event
-		st = WaitForSingleObject (channel.m_hSendRdy, 0);
-		if (st == WAIT_TIMEOUT) {
-			// receiver already synchronized on the object
-			// discard message
-			msgHdr->msgSize = IPC_MSG_INVALID;
-			msgHdr->pktSize = 0;
-			SetEvent (channel.m_hSend);
-			// synchronize on hRecv+hClose (to clear hRecv), ignore result
-			WaitForMultipleObjects (hcnt, hdls, FALSE, INFINITE);
+		// timeout: withdraw the request unless a server thread has taken it
+		if (InterlockedCompareExchange (&slots[slot].state, IPC_SLOT_FREE, IPC_SLOT_REQUEST) == IPC_SLOT_REQUEST) {
+			portAccess.releaseSlot ();
+			return setLastError (IPC_ERR_TIMEOUT);
 		}
-		return setLastError (err);
+		// the server is creating the connection, wait for its reply
+		rtmo = INFINITE;
 	}
 
-	// create connection
-	IPC_CONNECT_REQUEST *request = (IPC_CONNECT_REQUEST *)(msgHdr+1);
-
-	if (! initClientSide (request)) {
-		// error creating/duplicating connection handles
-		msgHdr->msgSize = IPC_MSG_INVALID;
-		msgHdr->pktSize = 0;
-		SetEvent (channel.m_hSend);
+	// check reply
+	IPC_CONNECT_REPLY reply = slots[slot].reply;
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_FREE);
+	portAccess.releaseSlot ();
 
-		return setLastError (IPC_ERR_UNKNOWN);
+	if (reply.status != 0) {
+		return setLastError (reply.status);
 	}
-
-	msgHdr->msgSize = sizeof(IPC_CONNECT_REQUEST);
-	msgHdr->pktSize = sizeof(IPC_CONNECT_REQUEST);
-	SetEvent (channel.m_hSend);
-
-	// synchronize on hRecv+hClose
-	st = WaitForMultipleObjects (hcnt, hdls, FALSE, INFINITE);
-	switch (st) {
-	case WAIT_OBJECT_0: break;
-	default:
+	if (reply.clientSendSize != sendSize || reply.serverSendSize != recvSize) {
 		return setLastError (IPC_ERR_UNKNOWN);
 	}
 
-	// check reply
-	IPC_CONNECT_REPLY *reply = (IPC_CONNECT_REPLY *)(msgHdr+1);
-	if (reply->status != 0) {
-		return setLastError (reply->status);
-	}
-
 	return 0;
 }
 
 bool IPC_Connection::initClientSide (IPC_CONNECT_REQUEST *connData)
 {
-	// create IPC buffer size twice of IPC_BUFFER_SIZE:
-	// first half:  client->server channel
-	// second half: server->client channel
+	// create IPC buffer for two channel rings of the requested sizes:
+	// first:  client->server channel ring
+	// second: server->client channel ring
 	SECURITY_ATTRIBUTES *pSA = IPC_Runtime::instance ().getSecurityAttributes ();
 
 	connData->clientPid = GetCurrentProcessId ();
@@ -486,7 +645,11 @@ bool IPC_Connection::initClientSide (IPC_CONNECT_REQUEST *connData)
 	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_CONN_PREFIX, connData->connName);
 
 	strcpy_s(pathBuf + prefixLen,3, IPC_SUFFIX_BUF);
-	m_hBuffer = CreateFileMapping (INVALID_HANDLE_VALUE, pSA, PAGE_READWRITE, 0, IPC_BUFFER_SIZE*2, pathBuf);
+	const DWORD sendOffset = 0;
+	const DWORD recvOffset = sizeof (IPC_RING_HDR) + connData->clientSendSize;
+	const DWORD totalSize = recvOffset + sizeof (IPC_RING_HDR) + connData->serverSendSize;
+
+	m_hBuffer = CreateFileMapping (INVALID_HANDLE_VALUE, pSA, PAGE_READWRITE, 0, totalSize, pathBuf);
 	if (! m_hBuffer.isValid () || GetLastError () == ERROR_ALREADY_EXISTS) return false;
 
 	m_buffer = MapViewOfFile (m_hBuffer, FILE_MAP_WRITE, 0, 0, 0);
@@ -497,13 +660,15 @@ bool IPC_Connection::initClientSide (IPC_CONNECT_REQUEST *connData)
 	strcpy_s(pathBuf + prefixLen,4, IPC_SUFFIX_CLIENT);
 	unsigned int suffixLen = strlen (pathBuf + prefixLen);
 	if (! m_sendChannel.create (pSA, pathBuf, prefixLen + suffixLen)) return false;
-	m_sendChannel.setBuffer (m_buffer.data ());
+	m_sendChannel.setRing (m_buffer.data () + sendOffset, connData->clientSendSize);
 
 	strcpy_s(pathBuf + prefixLen,4, IPC_SUFFIX_SERVER);
 	suffixLen = strlen (pathBuf + prefixLen);
 	if (! m_recvChannel.create (pSA, pathBuf, prefixLen + suffixLen)) return false;
-	m_recvChannel.setBuffer (m_buffer.data () + IPC_BUFFER_SIZE);
+	m_recvChannel.setRing (m_buffer.data () + recvOffset, connData->serverSendSize);
 
+	strcpy_s (m_connName, sizeof (m_connName), connData->connName);
+	m_bServerSide = false;
 	return true;
 }
 
@@ -515,6 +680,9 @@ bool IPC_Connection::initServerSide (const IPC_CONNECT_REQUEST *connData)
 		return false;
 	}
 
+	const DWORD recvOffset = 0;
+	const DWORD sendOffset = sizeof (IPC_RING_HDR) + connData->clientSendSize;
+
 	char pathBuf[IPC_MAX_PATH];
 	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_CONN_PREFIX, connData->connName);
 
@@ -530,13 +698,15 @@ bool IPC_Connection::initServerSide (const IPC_CONNECT_REQUEST *connData)
 	strcpy_s(pathBuf+prefixLen,4, IPC_SUFFIX_CLIENT);
 	unsigned int suffixLen = strlen (pathBuf+prefixLen);
 	if (! m_recvChannel.open (pathBuf, prefixLen + suffixLen)) return false;
-	m_recvChannel.setBuffer (m_buffer.data ());
+	m_recvChannel.setRing (m_buffer.data () + recvOffset, connData->clientSendSize);
 
 	strcpy_s(pathBuf+prefixLen,4, IPC_SUFFIX_SERVER);
 	suffixLen = strlen (pathBuf+prefixLen);
 	if (! m_sendChannel.open (pathBuf, prefixLen + suffixLen)) return false;
-	m_sendChannel.setBuffer (m_buffer.data () + IPC_BUFFER_SIZE);
+	m_sendChannel.setRing (m_buffer.data () + sendOffset, connData->serverSendSize);
 
+	strcpy_s (m_connName, sizeof (m_connName), connData->connName);
+	m_bServerSide = true;
 	return true;
 }
 
@@ -544,9 +714,12 @@ BOOL IPC_Connection::close ()
 {
 	if (! m_hBuffer.isValid ()) return FALSE;
 
-	m_control.signalClose ();
+	pollRemove ();
+	shutdown ();
 
 	waitForOperationsComplete();
+	asyncDetach ();
+	rpcDetach ();
 
 	m_control.close ();
 	m_sendChannel.close ();
@@ -556,129 +729,437 @@ BOOL IPC_Connection::close ()
 	m_hProcess.close ();
 	m_hUserEvent = 0;
 
+	// drop sections the receiver has not opened
+	for (int i = 0; i < IPC_MAX_PENDING_SECTIONS; i++) m_sections[i].close ();
+	m_reserveView.close ();
+	m_reserveSection.close ();
+	m_viewMap.close ();
+	m_viewSection.close ();
+
 	return TRUE;
 }
 
+void IPC_Connection::shutdown ()
+{
+	if (! m_hBuffer.isValid ()) return;
+
+	if (m_sendChannel.m_ring) InterlockedExchange (&m_sendChannel.m_ring->closed, 1);
+	if (m_recvChannel.m_ring) InterlockedExchange (&m_recvChannel.m_ring->closed, 1);
+	m_control.signalClose ();
+}
+
 void IPC_Connection::waitForOperationsComplete(DWORD tmo /*= INFINITE*/)
 {
 	IPC_Channel_Lock send_locker, recv_locker;
 	send_locker.lock(&m_sendChannel, tmo);
 	recv_locker.lock(&m_recvChannel, tmo);
+
+	// let the multi-producer senders publish their claims and keep the
+	// late ones on the locked path, which sees the closed ring
+	lockClaims ();
+	m_bMultiProducer = false;
 }
 
+// bData: the receiver waits for data (head), otherwise the sender waits for space (tail);
+// the peer position the caller has seen is the one recorded by ringPeek/ringReserve
+DWORD IPC_Connection::waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0)
+{
+	// the receiver must see batched data before the sender blocks on it
+	if (! bData && m_bDataPending) {
+		m_bDataPending = false;
+		channel.notifyData ();
+	}
+
+	return waitChannel (channel, bData, bFirst, tmo, t0, bData ? channel.m_seenHead : channel.m_seenTail);
+}
+
+DWORD IPC_Connection::waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0, LONG seen)
+{
+	const volatile LONG *pWatch = bData ? &channel.m_ring->head : &channel.m_ring->tail;
+	volatile LONG *pWaiter = bData ? &channel.m_ring->dataWaiter : &channel.m_ring->spaceWaiter;
+	HANDLE hEvent = bData ? channel.m_hSend : channel.m_hRecv;
+
+	// spin phase: a busy peer usually moves the ring within microseconds
+	LONGLONG ts;
+	bool bSpin = ! (bFirst && tmo == 0);
+	if (bSpin && channel.m_spin.spin (pWatch, seen, ts)) return 0;
+
+	// announce the wait, then recheck: the peer either sees the waiter
+	// or has moved the ring before we looked; a poll set may be counted too
+	InterlockedIncrement (pWaiter);
+	if (*pWatch != seen) {
+		InterlockedDecrement (pWaiter);
+		return 0;
+	}
+
+	// wait handles:
+	// 0 - channel event
+	// 1 - hClose
+	// 2 - peer process
+	// 3 - user handle (optional, first packet only)
+	int hcnt = 3;
+	HANDLE hdls[4];
+	hdls[0] = hEvent;
+	hdls[1] = m_control.m_hClose;
+	hdls[2] = m_hProcess;
+
+	DWORD rtmo = INFINITE;
+	if (bFirst) {
+		if (m_hUserEvent != 0) hdls[hcnt++] = m_hUserEvent;
+		rtmo = IPC_RemainingTimeout (tmo, t0);
+	}
+
+	DWORD st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
+	InterlockedDecrement (pWaiter);
+
+	switch (st) {
+	case WAIT_OBJECT_0:
+		if (bSpin) channel.m_spin.done (ts);
+		return 0;
+	case WAIT_OBJECT_0+1: return IPC_ERR_CLOSED;
+	case WAIT_OBJECT_0+2: return IPC_ERR_BROKEN;
+	case WAIT_OBJECT_0+3: return IPC_ERR_USER_EVENT_SET;
+	case WAIT_TIMEOUT:    return IPC_ERR_TIMEOUT;
+	default:              return IPC_ERR_UNKNOWN;
+	}
+}
+
+// The channel is a single-producer/single-consumer ring: the sender keeps
+// writing packets while there is free space and the receiver drains them
+// concurrently. Either side blocks only when the ring is full or empty.
+// The timeout applies until the first packet of a message is queued or
+// received, the rest of the message is transferred unconditionally.
+
 DWORD IPC_Connection::send (const void *buf, DWORD bufSize, DWORD tmo)
+{
+	IPC_BUF data = { (void *)buf, bufSize };
+	return sendV (&data, 1, tmo);
+}
+
+DWORD IPC_Connection::sendV (const IPC_BUF *bufs, DWORD count, DWORD tmo)
 {
 	clearLastError ();
-	if (bufSize >= IPC_MSG_SIZE_LIMIT || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	if (bufs == NULL && count != 0) return setLastError (IPC_ERR_INVALID_ARG);
 
-	const unsigned char *udata = (const unsigned char *)buf;
+	DWORD bufSize = IPC_BufCursor::totalSize (bufs, count);
+	if (bufSize >= IPC_MSG_SIZE_LIMIT || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
 
-	// lock connection object
 	DWORD t0;
 	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
 
+	// multi-producer mode: single packet messages don't take the mutex
+	if (m_bMultiProducer && bufSize < m_sectionThreshold &&
+		IPC_RingAlign (sizeof (IPC_MSG_HDR) + bufSize) <= m_sendChannel.m_bufSize / IPC_CLAIM_RING_PART) {
+		IPC_BufCursor data (bufs, count);
+		return setLastError (sendShared (data, bufSize, tmo, t0));
+	}
+
+	// lock connection object
 	IPC_Channel_Lock locker;
 	DWORD err = locker.lock (&m_sendChannel, tmo);
 	if (err != 0) return setLastError (err); // timeout or error
 
-	// perform rendezvous
+	lockClaims ();
+	IPC_BufCursor data (bufs, count);
+	err = sendLocked (data, bufSize, tmo, t0);
+	unlockClaims ();
+	return setLastError (err);
+}
 
-	// rendezvous handles:
-	// 0 - primary handle
-	// 1 - hClose
-	// 2 - server process
-	// 3 - user handle (optional)
-	int hcnt = 3;
-	HANDLE hdls[4];
-	hdls[0] = m_sendChannel.m_hRecv;
-	hdls[1] = m_control.m_hClose;
-	hdls[2] = m_hProcess;
-	if (m_hUserEvent != 0) hdls[hcnt++] = m_hUserEvent;
+DWORD IPC_Connection::sendLocked (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0, bool bDefer /*= false*/, bool bWhole /*= false*/)
+{
+	if (m_reserveSize != IPC_MSG_INVALID) return IPC_ERR_INVALID_ARG; // reserved by this thread
+	if (m_sendChannel.m_ring->closed) return IPC_ERR_CLOSED;
+
+	bool bSection = (bufSize >= m_sectionThreshold);
+	if (bWhole && ! bSection) {
+		DWORD pktSize;
+		if (m_sendChannel.ringReserve (bufSize, bufSize, pktSize) == NULL) {
+			// only the descriptor has to fit
+			if (m_sendChannel.ringReserve (sizeof (IPC_SECTION_DESC), sizeof (IPC_SECTION_DESC), pktSize) == NULL)
+				return IPC_ERR_TIMEOUT;
+			bSection = true;
+		}
+	}
 
-	DWORD rtmo = tmo;
-	if (rtmo != INFINITE && rtmo != 0) {
-		DWORD dt = GetTickCount () - t0;
-		if (dt < rtmo) rtmo -= dt; else rtmo = 0;
+	if (bSection) {
+		// large message: copy into a dedicated section, send the descriptor only
+		Handle hSection;
+		MapView view;
+		DWORD seq;
+		DWORD err = createSection (bufSize, hSection, view, seq, tmo, t0);
+		if (err != 0) return err;
+
+		data.gather (view.data (), bufSize);
+		view.close ();
+		return sendSection (hSection, seq, bufSize, tmo, t0);
 	}
 
-	SetEvent (m_sendChannel.m_hSendRdy);
+	// send packets
+	const DWORD msgSize = bufSize;
+	bool bFirst = true;
 
-	err = 0;
-	DWORD st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
-	switch (st) {
-	case WAIT_OBJECT_0: break;
-	case WAIT_OBJECT_0+1: // hClose
-		return setLastError (IPC_ERR_CLOSED);
-	case WAIT_OBJECT_0+2: // hProcess
-		return setLastError (IPC_ERR_BROKEN);
-	case WAIT_OBJECT_0+3: // hUserEvent
-		err = IPC_ERR_USER_EVENT_SET;
-		break;
-	case WAIT_TIMEOUT:
-		err = IPC_ERR_TIMEOUT;
-		break;
-	default:
-		err = IPC_ERR_UNKNOWN;
-		break;
-	}
-
-	IPC_MSG_HDR *msgHdr = (IPC_MSG_HDR *)(m_sendChannel.m_buffer);
-
-	if (st != WAIT_OBJECT_0) {
-		// timeout/error handling
-		// try to 'atomically' drop SendRdy event
-		st = WaitForSingleObject (m_sendChannel.m_hSendRdy, 0);
-		if (st == WAIT_TIMEOUT) {
-			// receiver already synchronized on the object
-			// discard message
-			msgHdr->msgSize = IPC_MSG_INVALID;
-			msgHdr->pktSize = 0;
-			SetEvent (m_sendChannel.m_hSend);
-			// synchronize on hRecv+hClose+hProcess (to clear hRecv), ignore result
-			WaitForMultipleObjects (3, hdls, FALSE, INFINITE);
+	do {
+		DWORD minPkt = (bufSize < IPC_RING_MIN_PKT) ? bufSize : IPC_RING_MIN_PKT;
+		DWORD portion;
+		IPC_MSG_HDR *msgHdr = m_sendChannel.ringReserve (minPkt, bufSize, portion);
+		if (msgHdr == NULL) {
+			// ring is full, wait for the receiver
+			DWORD err = waitChannel (m_sendChannel, false, bFirst, tmo, t0);
+			if (err != 0) return err;
+			continue;
 		}
-		return setLastError (err);
+
+		msgHdr->msgSize = msgSize;
+		msgHdr->pktSize = portion;
+		data.gather (msgHdr + 1, portion);
+		bufSize -= portion;
+
+		m_sendChannel.ringCommit (portion);
+		if (bufSize != 0 || ! bDefer) m_sendChannel.notifyData ();
+		else m_bDataPending = true;
+		bFirst = false;
+
+	} while (bufSize != 0);
+
+	return 0;
+}
+
+// Multi-producer mode: the sending threads claim ring space by moving
+// m_sendClaim with a compare-exchange, copy their messages concurrently and
+// publish them in claim order by moving the ring head, so the receiver sees
+// the usual single-producer ring. Only a full ring makes them block. The
+// locked senders (chunked, section and reserved messages, batches) set
+// IPC_CLAIM_LOCKED, wait until the claims are published and own the ring
+// head until unlockClaims; the claiming threads queue on the mutex meanwhile.
+
+DWORD IPC_Connection::sendShared (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0)
+{
+	const DWORD hdrSize = sizeof (IPC_MSG_HDR);
+	const DWORD recSize = IPC_RingAlign (hdrSize + bufSize);
+	IPC_Channel& channel = m_sendChannel;
+
+	DWORD start, claim, off;
+	for (;;) {
+		if (channel.m_ring->closed) return IPC_ERR_CLOSED;
+
+		LONG pos = m_sendClaim;
+		if (pos & IPC_CLAIM_LOCKED) {
+			// a locked sender owns the ring, wait for it on the mutex
+			IPC_Channel_Lock locker;
+			DWORD err = locker.lock (&channel, IPC_RemainingTimeout (tmo, t0));
+			if (err != 0) return err;
+			if (m_reserveSize != IPC_MSG_INVALID) return IPC_ERR_INVALID_ARG; // reserved by this thread
+			if (! m_bMultiProducer) return sendLocked (data, bufSize, tmo, t0);  // switched off meanwhile
+			continue;
+		}
+
+		start = (DWORD)pos;
+		LONG tail = ReadAcquire (&channel.m_ring->tail);
+		off = start & (channel.m_bufSize - 1);
+
+		// not enough space before the end of the ring: claim the pad too
+		DWORD contig = channel.m_bufSize - off;
+		claim = (contig >= recSize) ? recSize : contig + recSize;
+
+		if (claim > channel.m_bufSize - (start - (DWORD)tail)) {
+			// ring is full, wait for the receiver
+			DWORD err = waitChannel (channel, false, true, tmo, t0, tail);
+			if (err != 0) return err;
+
+			// the space event is auto-reset, pass it on to the next waiter
+			if (channel.m_ring->spaceWaiter) SetEvent (channel.m_hRecv);
+			continue;
+		}
+
+		if (InterlockedCompareExchange (&m_sendClaim, (LONG)(start + claim), pos) == pos) break;
 	}
 
-	// send packets
-	void *databuf = msgHdr + 1;
+	// the claimed space is invisible to the receiver until published
+	IPC_MSG_HDR *msgHdr = (IPC_MSG_HDR *)(channel.m_buffer + off);
+	if (claim != recSize) {
+		msgHdr->msgSize = IPC_MSG_WRAP;
+		msgHdr->pktSize = claim - recSize - hdrSize;
+		msgHdr = (IPC_MSG_HDR *)channel.m_buffer;
+	}
 	msgHdr->msgSize = bufSize;
+	msgHdr->pktSize = bufSize;
+	data.gather (msgHdr + 1, bufSize);
 
-	do {
-		DWORD portion = IPC_BUFFER_SIZE - sizeof (IPC_MSG_HDR);
-		if (portion > bufSize) portion = bufSize;
+	waitPublished (start);
+	WriteRelease (&channel.m_ring->head, (LONG)(start + claim));
+	channel.notifyData ();
+	return 0;
+}
 
-		msgHdr->pktSize = portion;
-		memcpy (databuf, udata, portion);
+// the earlier claims are being copied, their owners don't block
+void IPC_Connection::waitPublished (DWORD pos)
+{
+	for (unsigned int i = 1; (DWORD)ReadAcquire (&m_sendChannel.m_ring->head) != pos; i++) {
+		if (i & 63) YieldProcessor ();
+		else SwitchToThread ();
+	}
+}
 
-		udata += portion;
-		bufSize -= portion;
+// called with the send channel locked
+void IPC_Connection::lockClaims ()
+{
+	if (! m_bMultiProducer) return;
 
-		SetEvent (m_sendChannel.m_hSend);
+	LONG pos;
+	do pos = m_sendClaim;
+	while (InterlockedCompareExchange (&m_sendClaim, pos | IPC_CLAIM_LOCKED, pos) != pos);
 
-		// sync on hRecv+hClose+hProcess
-		st = WaitForMultipleObjects (3, hdls, FALSE, INFINITE);
-		switch (st) {
-		case WAIT_OBJECT_0: break;
-		case WAIT_OBJECT_0+1: // hClose
-			return setLastError (IPC_ERR_CLOSED);
-		case WAIT_OBJECT_0+2: // hProcess
-			return setLastError (IPC_ERR_BROKEN);
-		default:
-			return setLastError (IPC_ERR_UNKNOWN);
+	waitPublished ((DWORD)(pos & ~IPC_CLAIM_LOCKED));
+}
+
+void IPC_Connection::unlockClaims ()
+{
+	if (m_bMultiProducer) WriteRelease (&m_sendClaim, m_sendChannel.m_ring->head);
+}
+
+DWORD IPC_Connection::sendBatch (const IPC_BUF *msgs, DWORD count, DWORD tmo, DWORD& sent)
+{
+	clearLastError ();
+	sent = 0;
+	if ((msgs == NULL && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	for (DWORD i = 0; i < count; i++) {
+		if (msgs[i].dwSize >= IPC_MSG_SIZE_LIMIT) return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_sendChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	// pack the messages back to back, the timeout applies to the whole batch
+	lockClaims ();
+	for (; sent < count; sent++) {
+		IPC_BufCursor data (&msgs[sent], 1);
+		err = sendLocked (data, msgs[sent].dwSize, tmo, t0, true);
+		if (err != 0) break;
+	}
+
+	// wake the receiver once for the batch
+	if (m_bDataPending) {
+		m_bDataPending = false;
+		m_sendChannel.notifyData ();
+	}
+	unlockClaims ();
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::sendReserve (DWORD size, void **ppBuf, DWORD tmo)
+{
+	clearLastError ();
+	if (ppBuf == NULL || size >= IPC_MSG_SIZE_LIMIT || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	*ppBuf = NULL;
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	DWORD err = m_sendChannel.lock (tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	// the mutex is recursive, so a second reserve from the same thread gets here
+	if (m_reserveSize != IPC_MSG_INVALID) err = IPC_ERR_INVALID_ARG;
+	else {
+		lockClaims ();  // held until sendCommit
+		if (m_sendChannel.m_ring->closed) err = IPC_ERR_CLOSED;
+	}
+
+	if (err == 0 && size >= m_sectionThreshold) {
+		// large message: reserve a dedicated section, sent as a descriptor on commit
+		err = createSection (size, m_reserveSection, m_reserveView, m_reserveSeq, tmo, t0);
+		if (err == 0) *ppBuf = m_reserveView.data ();
+	} else if (err == 0 && size <= m_sendChannel.m_bufSize - sizeof (IPC_MSG_HDR)) {
+		// the message fits into the ring: wait for contiguous space
+		DWORD pktSize;
+		while ((m_reserveHdr = m_sendChannel.ringReserve (size, size, pktSize)) == NULL) {
+			err = waitChannel (m_sendChannel, false, true, tmo, t0);
+			if (err != 0) break;
+		}
+		if (err == 0) *ppBuf = m_reserveHdr + 1;
+	} else if (err == 0) {
+		// larger messages are serialized into the local buffer
+		// and sent by the chunked path on commit
+		if (size > m_reserveBufSize) {
+			unsigned char *p = (unsigned char *)realloc (m_reserveBuf, size);
+			if (p == NULL) err = IPC_ERR_OUT_OF_MEMORY;
+			else { m_reserveBuf = p; m_reserveBufSize = size; }
 		}
+		if (err == 0) *ppBuf = m_reserveBuf;
+	}
 
-	} while (bufSize != 0);
+	if (err != 0) {
+		if (m_reserveSize == IPC_MSG_INVALID) unlockClaims ();
+		m_sendChannel.unlock ();
+		return setLastError (err);
+	}
 
+	m_reserveSize = size;
+	m_reserveTimeout = tmo;
 	return 0;
 }
 
-DWORD IPC_Connection::recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz)
+DWORD IPC_Connection::sendCommit (void *pBuf, DWORD size)
 {
 	clearLastError ();
-	if (! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	if (m_reserveSize == IPC_MSG_INVALID) return setLastError (IPC_ERR_INVALID_ARG);
+
+	// lock recursively to make sure the caller owns the reservation
+	DWORD err = m_sendChannel.lock (0);
+	if (err != 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	void *pReserved = (m_reserveHdr != NULL) ? (void *)(m_reserveHdr + 1) : (void *)m_reserveBuf;
+	if (m_reserveView.isValid ()) pReserved = m_reserveView.data ();
+	if (pBuf != pReserved || size > m_reserveSize) {
+		m_sendChannel.unlock ();
+		return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	m_reserveSize = IPC_MSG_INVALID;
 
-	unsigned char *udata = (unsigned char *)buf;
+	// the reserved ring slot is committed at once; a section descriptor and
+	// a chunked message wait for the ring within the timeout of the reservation
+	DWORD tmo = m_reserveTimeout;
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	if (m_reserveHdr != NULL) {
+		m_reserveHdr->msgSize = size;
+		m_reserveHdr->pktSize = size;
+		m_reserveHdr = NULL;
+		m_sendChannel.ringCommit (size);
+		m_sendChannel.notifyData ();
+	} else if (m_reserveView.isValid ()) {
+		m_reserveView.close ();
+		err = sendSection (m_reserveSection, m_reserveSeq, size, tmo, t0);
+		m_reserveSection.close ();
+	} else {
+		IPC_BUF reserved = { m_reserveBuf, size };
+		IPC_BufCursor data (&reserved, 1);
+		err = sendLocked (data, size, tmo, t0);
+	}
+
+	unlockClaims ();
+	m_sendChannel.unlock ();  // recursive lock
+	m_sendChannel.unlock ();  // sendReserve lock
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz)
+{
+	IPC_BUF data = { buf, bufSize };
+	return recvV (&data, 1, tmo, rsz);
+}
+
+DWORD IPC_Connection::recvV (const IPC_BUF *bufs, DWORD count, DWORD tmo, DWORD& rsz)
+{
+	clearLastError ();
+	if ((bufs == NULL && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
 
 	// lock connection object
 	DWORD t0;
@@ -688,103 +1169,330 @@ DWORD IPC_Connection::recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz)
 	DWORD err = locker.lock (&m_recvChannel, tmo);
 	if (err != 0) return setLastError (err); // timeout or error
 
-	// perform rendezvous
+	IPC_BufCursor data (bufs, count);
+	return setLastError (recvLocked (data, tmo, t0, rsz));
+}
 
-	// rendezvous handles:
-	// 0 - primary handle (m_hSendRdy or m_hSend)
-	// 1 - hClose
-	// 2 - server process
-	// 3 - user handle (optional)
-	int hcnt = 3;
-	HANDLE hdls[4];
-	hdls[1] = m_control.m_hClose;
-	hdls[2] = m_hProcess;
-	if (m_hUserEvent != 0) hdls[hcnt++] = m_hUserEvent;
+const IPC_MSG_HDR * IPC_Connection::recvPeek (DWORD tmo, DWORD t0, DWORD& err)
+{
+	const IPC_MSG_HDR *msgHdr;
+	while ((msgHdr = m_recvChannel.ringPeek ()) == NULL) {
+		err = waitChannel (m_recvChannel, true, true, tmo, t0);
+		if (err != 0) return NULL;
+	}
+	err = 0;
+	return msgHdr;
+}
+
+DWORD IPC_Connection::recvLocked (IPC_BufCursor& data, DWORD tmo, DWORD t0, DWORD& rsz)
+{
+	if (m_viewPtr != NULL) return IPC_ERR_INVALID_ARG; // view held by this thread
+
+	DWORD err;
+	const IPC_MSG_HDR *msgHdr = recvPeek (tmo, t0, err);
+	if (msgHdr == NULL) return err;
+
+	if (msgHdr->msgSize & IPC_MSG_SECTION) {
+		// large message passed in a dedicated section
+		Handle hSection;
+		MapView view;
+		DWORD msgSize;
+		err = openSection (msgHdr, hSection, view, msgSize);
+		if (err != 0) return err;
+
+		rsz = data.scatter (view.data (), msgSize);
+		if (rsz < msgSize) {
+			rsz = msgSize;
+			return IPC_ERR_MSG_TRUNCATED;
+		}
+		return 0;
+	}
 
-	const IPC_MSG_HDR *msgHdr = (const IPC_MSG_HDR *)(m_recvChannel.m_buffer);
+	// normal data packet received
+	DWORD orgMsgSize = msgHdr->msgSize;
+	DWORD msgSize = orgMsgSize;
+	rsz = 0;
 
-	// perform rendezvous
 	for (;;) {
-		DWORD rtmo = tmo;
-		if (rtmo != INFINITE && rtmo != 0) {
-			DWORD dt = GetTickCount () - t0;
-			if (dt < rtmo) rtmo -= dt; else rtmo = 0;
-		}
+		DWORD pktSize = m_recvChannel.ringPktSize (msgHdr);
+		if (pktSize > msgSize) pktSize = msgSize;
 
-		hdls[0] = m_recvChannel.m_hSendRdy;
-		DWORD st = WaitForMultipleObjects (hcnt, hdls, FALSE, rtmo);
-		switch (st) {
-		case WAIT_OBJECT_0: break;
-		case WAIT_OBJECT_0+1: // hClose
-			return setLastError (IPC_ERR_CLOSED);
-		case WAIT_OBJECT_0+2: // hProcess
-			return setLastError (IPC_ERR_BROKEN);
-		case WAIT_OBJECT_0+3: // hUserEvent
-			return setLastError (IPC_ERR_USER_EVENT_SET);
-		case WAIT_TIMEOUT:
-			return setLastError (IPC_ERR_TIMEOUT);
-		default:
-			return setLastError (IPC_ERR_UNKNOWN);
+		rsz += data.scatter (msgHdr + 1, pktSize);
+
+		m_recvChannel.ringRelease (msgHdr);
+		m_recvChannel.notifySpace ();
+
+		msgSize -= pktSize;
+		if (msgSize == 0) break;
+
+		while ((msgHdr = m_recvChannel.ringPeek ()) == NULL) {
+			err = waitChannel (m_recvChannel, true, false, tmo, t0);
+			if (err != 0) return err;
 		}
+	}
 
-		SetEvent (m_recvChannel.m_hRecv);
+	if (rsz < orgMsgSize) {
+		rsz = orgMsgSize;
+		return IPC_ERR_MSG_TRUNCATED;
+	}
+	return 0;
+}
 
-		hdls[0] = m_recvChannel.m_hSend;
+DWORD IPC_Connection::recvBatch (const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received)
+{
+	clearLastError ();
+	received = 0;
+	if (((msgs == NULL || sizes == NULL) && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
 
-		// sync on hSend, hClose, hProcess
-		st = WaitForMultipleObjects (3, hdls, FALSE, INFINITE);
-		switch (st) {
-		case WAIT_OBJECT_0: break;
-		default:
-			ResetEvent (m_recvChannel.m_hRecv);
-			return setLastError (IPC_ERR_UNKNOWN);
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_recvChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	for (; received < count; received++) {
+		// wait for the first message only, then drain what is queued
+		if (received != 0 && m_recvChannel.ringPeek () == NULL) break;
+
+		IPC_BufCursor data (&msgs[received], 1);
+		err = recvLocked (data, tmo, t0, sizes[received]);
+		if (err == IPC_ERR_MSG_TRUNCATED) received++;  // consumed: counted with its whole size
+		if (err != 0) break;
+	}
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::recvView (const void **ppBuf, DWORD tmo, DWORD& rsz)
+{
+	clearLastError ();
+	if (ppBuf == NULL || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	*ppBuf = NULL;
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	DWORD err = m_recvChannel.lock (tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	const IPC_MSG_HDR *msgHdr = NULL;
+	if (m_viewPtr != NULL) err = IPC_ERR_INVALID_ARG; // view held by this thread
+	else msgHdr = recvPeek (tmo, t0, err);
+
+	if (err == 0) {
+		DWORD msgSize = msgHdr->msgSize;
+		if (msgSize & IPC_MSG_SECTION) {
+			// large message: adopt the section mapping
+			err = openSection (msgHdr, m_viewSection, m_viewMap, rsz);
+			if (err == 0) {
+				m_viewHdr = NULL;
+				m_viewPtr = m_viewMap.data ();
+			}
+		} else if (m_recvChannel.ringPktSize (msgHdr) >= msgSize) {
+			// single packet message: view the channel data in place
+			m_viewHdr = msgHdr;
+			m_viewPtr = msgHdr + 1;
+			rsz = msgSize;
+		} else {
+			// the message is split into packets: collect it in the local buffer
+			if (msgSize > m_viewBufSize) {
+				unsigned char *p = (unsigned char *)realloc (m_viewBuf, msgSize);
+				if (p == NULL) err = IPC_ERR_OUT_OF_MEMORY;
+				else { m_viewBuf = p; m_viewBufSize = msgSize; }
+			}
+			if (err == 0) {
+				IPC_BUF view = { m_viewBuf, msgSize };
+				IPC_BufCursor data (&view, 1);
+				err = recvLocked (data, tmo, t0, rsz);
+			}
+			if (err == 0) {
+				m_viewHdr = NULL;
+				m_viewPtr = m_viewBuf;
+			}
 		}
+	}
 
-		if (msgHdr->msgSize != IPC_MSG_INVALID) break;
+	if (err != 0) {
+		m_recvChannel.unlock ();
+		return setLastError (err);
 	}
 
-	// normal data packet received
-	DWORD orgMsgSize = msgHdr->msgSize;
-	DWORD msgSize = orgMsgSize;
-	rsz = 0;
+	*ppBuf = m_viewPtr;
+	return 0;
+}
+
+DWORD IPC_Connection::recvRelease (const void *pBuf)
+{
+	clearLastError ();
+	if (m_viewPtr == NULL) return setLastError (IPC_ERR_INVALID_ARG);
+
+	// lock recursively to make sure the caller owns the view
+	DWORD err = m_recvChannel.lock (0);
+	if (err != 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	if (pBuf != m_viewPtr) {
+		m_recvChannel.unlock ();
+		return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	// hand the ring space back to the sender
+	if (m_viewHdr != NULL) {
+		m_recvChannel.ringRelease (m_viewHdr);
+		m_recvChannel.notifySpace ();
+		m_viewHdr = NULL;
+	}
+	m_viewMap.close ();
+	m_viewSection.close ();
+	m_viewPtr = NULL;
 
-	const unsigned char *msgBuf = (const unsigned char *)(msgHdr + 1);
+	m_recvChannel.unlock ();  // recursive lock
+	m_recvChannel.unlock ();  // recvView lock
+	return 0;
+}
+
+// Messages of m_sectionThreshold bytes and larger don't go through the ring.
+// The sender creates a one-shot named section per message and queues only an
+// IPC_SECTION_DESC record, so the transfer costs a single copy instead of a
+// rendezvous per packet. The sender keeps the section handle until the
+// receiver opens it and reports that in the ring's sectionAck field.
+
+void IPC_Connection::formatSectionName (char *pathBuf, bool bSend, DWORD seq)
+{
+	// the name follows the direction of the data, like the channel objects
+	bool bClientToServer = (bSend != m_bServerSide);
+
+	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_CONN_PREFIX, m_connName);
+	sprintf_s (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, "%s%s%08X",
+		bClientToServer ? IPC_SUFFIX_CLIENT : IPC_SUFFIX_SERVER, IPC_SUFFIX_SECTION, seq);
+}
 
+void IPC_Connection::sweepSections ()
+{
+	// the receiver acknowledges before releasing the descriptor,
+	// so a wait on the tail seen here can't miss the acknowledgement
+	m_sendChannel.m_seenTail = ReadAcquire (&m_sendChannel.m_ring->tail);
+
+	DWORD ack = (DWORD)ReadAcquire (&m_sendChannel.m_ring->sectionAck);
+	for (int i = 0; i < IPC_MAX_PENDING_SECTIONS; i++) {
+		if (m_sections[i].isValid () && (LONG)(m_sectionSeqs[i] - ack) <= 0)
+			m_sections[i].close ();
+	}
+}
+
+DWORD IPC_Connection::createSection (DWORD size, Handle& hSection, MapView& view, DWORD& seq, DWORD tmo, DWORD t0)
+{
+	// wait until the receiver opens one of the pending sections
 	for (;;) {
-		DWORD pktSize = msgHdr->pktSize;
-		if (pktSize > IPC_MAX_PKT_SIZE) pktSize = IPC_MAX_PKT_SIZE; // sender error !!!
-		if (pktSize > msgSize) pktSize = msgSize;
+		sweepSections ();
 
-		DWORD portion = pktSize;
-		if (portion > bufSize) portion = bufSize;
-		memcpy (udata, msgBuf, portion);
+		int i = 0;
+		while (i < IPC_MAX_PENDING_SECTIONS && m_sections[i].isValid ()) i++;
+		if (i < IPC_MAX_PENDING_SECTIONS) break;
 
-		bufSize -= portion;
-		udata += portion;
-		rsz += portion;
+		DWORD err = waitChannel (m_sendChannel, false, true, tmo, t0);
+		if (err != 0) return err;
+	}
 
-		SetEvent (m_recvChannel.m_hRecv);
+	seq = ++m_sectionSeq;
 
-		msgSize -= pktSize;
-		if (msgSize == 0) break;
+	char pathBuf[IPC_MAX_PATH];
+	formatSectionName (pathBuf, true, seq);
 
-		// sync on hSend, hClose, hProcess
-		DWORD st = WaitForMultipleObjects (3, hdls, FALSE, INFINITE);
-		switch (st) {
-		case WAIT_OBJECT_0: break;
-		case WAIT_OBJECT_0+1: // hClose
-			return setLastError (IPC_ERR_CLOSED);
-		case WAIT_OBJECT_0+2: // hProcess
-			return setLastError (IPC_ERR_BROKEN);
-		default:
-			return setLastError (IPC_ERR_UNKNOWN);
+	SECURITY_ATTRIBUTES *pSA = IPC_Runtime::instance ().getSecurityAttributes ();
+	hSection = CreateFileMapping (INVALID_HANDLE_VALUE, pSA, PAGE_READWRITE, 0, size, pathBuf);
+	if (! hSection.isValid ()) return IPC_ERR_OUT_OF_MEMORY;
+	if (GetLastError () == ERROR_ALREADY_EXISTS) { hSection.close (); return IPC_ERR_UNKNOWN; }
+
+	view = MapViewOfFile (hSection, FILE_MAP_WRITE, 0, 0, 0);
+	if (! view.isValid ()) { hSection.close (); return IPC_ERR_OUT_OF_MEMORY; }
+
+	return 0;
+}
+
+DWORD IPC_Connection::sendSection (Handle& hSection, DWORD seq, DWORD size, DWORD tmo, DWORD t0)
+{
+	if (m_sendChannel.m_ring->closed) return IPC_ERR_CLOSED;
+
+	DWORD pktSize;
+	IPC_MSG_HDR *msgHdr;
+	while ((msgHdr = m_sendChannel.ringReserve (sizeof (IPC_SECTION_DESC), sizeof (IPC_SECTION_DESC), pktSize)) == NULL) {
+		DWORD err = waitChannel (m_sendChannel, false, true, tmo, t0);
+		if (err != 0) return err;
+	}
+
+	// keep the section alive until the receiver opens it
+	for (int i = 0; i < IPC_MAX_PENDING_SECTIONS; i++) {
+		if (! m_sections[i].isValid ()) {
+			m_sections[i] = hSection.detach ();
+			m_sectionSeqs[i] = seq;
+			break;
 		}
 	}
 
-	if (rsz < orgMsgSize) return setLastError (IPC_ERR_UNKNOWN);
+	msgHdr->msgSize = size | IPC_MSG_SECTION;
+	msgHdr->pktSize = sizeof (IPC_SECTION_DESC);
+	((IPC_SECTION_DESC *)(msgHdr + 1))->seq = seq;
+
+	m_sendChannel.ringCommit (sizeof (IPC_SECTION_DESC));
+	m_sendChannel.notifyData ();
+	return 0;
+}
+
+DWORD IPC_Connection::openSection (const IPC_MSG_HDR *msgHdr, Handle& hSection, MapView& view, DWORD& size)
+{
+	size = msgHdr->msgSize & ~IPC_MSG_SECTION;
+
+	DWORD seq = 0;
+	if (m_recvChannel.ringPktSize (msgHdr) >= sizeof (IPC_SECTION_DESC))
+		seq = ((const IPC_SECTION_DESC *)(msgHdr + 1))->seq;
+
+	char pathBuf[IPC_MAX_PATH];
+	formatSectionName (pathBuf, false, seq);
+
+	hSection = OpenFileMapping (FILE_MAP_READ, FALSE, pathBuf);
+	if (hSection.isValid ()) view = MapViewOfFile (hSection, FILE_MAP_READ, 0, 0, 0);
+
+	// consume the descriptor and let the sender drop its handle
+	WriteRelease (&m_recvChannel.m_ring->sectionAck, (LONG)seq);
+	m_recvChannel.ringRelease (msgHdr);
+	m_recvChannel.notifySpace ();
+
+	if (! view.isValid ()) { hSection.close (); return IPC_ERR_UNKNOWN; }
 	return 0;
 }
 
+BOOL IPC_Connection::setSectionThreshold (DWORD threshold)
+{
+	clearLastError ();
+	m_sectionThreshold = (threshold == 0) ? IPC_DEFAULT_SECTION_THRESHOLD : threshold;
+	return TRUE;
+}
+
+BOOL IPC_Connection::setSpinTime (DWORD us)
+{
+	clearLastError ();
+	m_sendChannel.m_spin.setLimit (us);
+	m_recvChannel.m_spin.setLimit (us);
+	return TRUE;
+}
+
+BOOL IPC_Connection::setMultiProducer (BOOL bEnable)
+{
+	clearLastError ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_sendChannel, INFINITE);
+	if (err == 0 && m_reserveSize != IPC_MSG_INVALID) err = IPC_ERR_INVALID_ARG; // reserved by this thread
+	if (err != 0) { setLastError (err); return FALSE; }
+
+	// switching on opens the claims at the ring head, switching off
+	// leaves them locked, the claiming threads fall back to the mutex
+	lockClaims ();
+	m_bMultiProducer = (bEnable != FALSE);
+	unlockClaims ();
+	return TRUE;
+}
+
 BOOL IPC_Connection::setUserEvent (HANDLE hEvent)
 {
 	clearLastError ();
@@ -813,3 +1521,90 @@ BOOL IPC_Connection::resetUserEvent ()
 }
 
 
+
+////////////////////////////////////////////////////////////////
+// IPC_Connection: poll set support
+// The poll set counts itself in the ring waiter fields while it waits,
+// so the peer signals the channel events as it does for a blocked call.
+
+DWORD IPC_Connection::pollCheck (DWORD events)
+{
+	DWORD st = 0;
+	if (m_recvChannel.m_ring->closed || m_sendChannel.m_ring->closed
+		|| WaitForSingleObject (m_control.m_hClose, 0) == WAIT_OBJECT_0
+		|| WaitForSingleObject (m_hProcess, 0) == WAIT_OBJECT_0)
+		st |= IPC_POLL_CLOSED;
+
+	// a wrap pad alone is no message: skip it as a receive would,
+	// unless a receiving thread has the channel
+	const IPC_RING_HDR *ring = m_recvChannel.m_ring;
+	if (events & IPC_POLL_IN) {
+		if (m_recvChannel.lock (0) == 0) {
+			if (m_recvChannel.ringPeek () != NULL) st |= IPC_POLL_IN;
+			m_recvChannel.unlock ();
+		} else if (ring->head != ring->tail) st |= IPC_POLL_IN;
+	}
+
+	// room for a packet of the minimal size
+	ring = m_sendChannel.m_ring;
+	if ((events & IPC_POLL_OUT) && m_sendChannel.m_bufSize - (DWORD)(ring->head - ring->tail) >= IPC_RING_MIN_PKT)
+		st |= IPC_POLL_OUT;
+
+	return st;
+}
+
+int IPC_Connection::pollHandles (DWORD events, HANDLE *hdls)
+{
+	int n = 0;
+	hdls[n++] = m_control.m_hClose;
+	hdls[n++] = m_hProcess;
+	if (events & IPC_POLL_IN) hdls[n++] = m_recvChannel.m_hSend;
+	if (events & IPC_POLL_OUT) hdls[n++] = m_sendChannel.m_hRecv;
+	return n;
+}
+
+void IPC_Connection::pollArm (DWORD events)
+{
+	events &= ~m_pollArmed;
+	if (events & IPC_POLL_IN) InterlockedIncrement (&m_recvChannel.m_ring->dataWaiter);
+	if (events & IPC_POLL_OUT) InterlockedIncrement (&m_sendChannel.m_ring->spaceWaiter);
+	m_pollArmed |= events;
+}
+
+void IPC_Connection::pollDisarm (DWORD events)
+{
+	events &= m_pollArmed;
+	if (events & IPC_POLL_IN) InterlockedDecrement (&m_recvChannel.m_ring->dataWaiter);
+	if (events & IPC_POLL_OUT) InterlockedDecrement (&m_sendChannel.m_ring->spaceWaiter);
+	m_pollArmed &= ~events;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Connection: async engine support
+
+DWORD IPC_Connection::asyncSend (const void *buf, DWORD size)
+{
+	// a chunked message would wait for the receiver after its first packet
+	// and hold up the worker: it is sent whole or in a section
+	clearLastError ();
+	if (size >= IPC_MSG_SIZE_LIMIT) return IPC_ERR_TO_RC (setLastError (IPC_ERR_INVALID_ARG));
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_sendChannel, 0);
+	if (err == 0) {
+		IPC_BUF msg = { (void *)buf, size };
+		IPC_BufCursor data (&msg, 1);
+		lockClaims ();
+		err = sendLocked (data, size, 0, 0, false, true);
+		unlockClaims ();
+	}
+	setLastError (err);
+	return (err == 0) ? size : IPC_ERR_TO_RC (err);
+}
+
+DWORD IPC_Connection::asyncRecv (void *buf, DWORD size)
+{
+	DWORD rsz = 0;
+	DWORD err = recv (buf, size, 0, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
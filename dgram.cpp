@@ -0,0 +1,558 @@
+// dgram.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Datagram engine: IPC_ServerDgStart/IPC_DgSend/IPC_DgRecv
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_dgram.h"
+
+#ifndef _WIN32
+#	include <fcntl.h>
+#	include <limits.h>
+#	include <signal.h>
+#	include <stdio.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+////////////////////////////////////////////////////////////////
+// IPC_DgEndpoint, IPC_DgSender
+
+struct IPC_DgEndpoint
+{
+	IPC_DgEndpoint   *next;
+	char              name[IPC_DG_MAX_NAME + 1];
+	IPC_DgSegment     seg;
+	IPC_DgRing        ring;
+	CRITICAL_SECTION  csRecv;    // one receiving thread at a time
+	DWORD             refs;      // list and callers, under the engine lock
+	volatile bool     bStopped;
+
+	IPC_DgEndpoint () : next (NULL), refs (1), bStopped (false)
+		{ InitializeCriticalSection (&csRecv); }
+	~IPC_DgEndpoint ()
+		{ DeleteCriticalSection (&csRecv); }
+};
+
+struct IPC_DgSender
+{
+	IPC_DgSender  *next;
+	char           name[IPC_DG_MAX_NAME + 1];
+	IPC_DgSegment  seg;
+	IPC_DgRing     ring;
+	DWORD          refs;         // list and callers, under the engine lock
+
+	IPC_DgSender () : next (NULL), refs (1) {}
+};
+
+static bool IPC_DgValidName (const char *name)
+{
+	if (name == NULL) return false;
+	size_t len = strlen (name);
+	return len != 0 && len <= IPC_DG_MAX_NAME
+		&& strchr (name, '/') == NULL && strchr (name, '\\') == NULL;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_DgSegment
+
+IPC_DgSegment::IPC_DgSegment () : m_hdr (NULL)
+{
+#ifndef _WIN32
+	m_path[0] = 0;
+#endif
+}
+
+#ifdef _WIN32
+
+DWORD IPC_DgSegment::create (const char *name)
+{
+	char pathBuf[IPC_MAX_PATH];
+	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_DG_PREFIX, name);
+	SECURITY_ATTRIBUTES *pSA = IPC_Runtime::instance ().getSecurityAttributes ();
+
+	// an existing segment is taken over, the owner check is the caller's
+	m_hMap = CreateFileMapping (INVALID_HANDLE_VALUE, pSA, PAGE_READWRITE, 0, IPC_DG_SEGMENT_SIZE, pathBuf);
+	if (! m_hMap.isValid ()) return IPC_ERR_UNKNOWN;
+
+	m_view = MapViewOfFile (m_hMap, FILE_MAP_WRITE, 0, 0, IPC_DG_SEGMENT_SIZE);
+	if (! m_view.isValid ()) { close (); return IPC_ERR_UNKNOWN; }
+
+	strcpy_s (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, IPC_DG_SUFFIX_WAKE);
+	m_hWake = CreateEvent (pSA, FALSE, FALSE, pathBuf);
+	if (! m_hWake.isValid ()) { close (); return IPC_ERR_UNKNOWN; }
+
+	m_hdr = (IPC_DG_HDR *)m_view.data ();
+	return 0;
+}
+
+DWORD IPC_DgSegment::open (const char *name)
+{
+	char pathBuf[IPC_MAX_PATH];
+	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_DG_PREFIX, name);
+
+	m_hMap = OpenFileMapping (FILE_MAP_WRITE, FALSE, pathBuf);
+	if (! m_hMap.isValid ()) return IPC_ERR_CLOSED;
+
+	// fails if the mapping is smaller than ours
+	m_view = MapViewOfFile (m_hMap, FILE_MAP_WRITE, 0, 0, IPC_DG_SEGMENT_SIZE);
+	if (! m_view.isValid ()) { close (); return IPC_ERR_CLOSED; }
+
+	strcpy_s (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, IPC_DG_SUFFIX_WAKE);
+	m_hWake = OpenEvent (EVENT_MODIFY_STATE, FALSE, pathBuf);
+	if (! m_hWake.isValid ()) { close (); return IPC_ERR_CLOSED; }
+
+	m_hdr = (IPC_DG_HDR *)m_view.data ();
+	return 0;
+}
+
+void IPC_DgSegment::close ()
+{
+	m_hdr = NULL;
+	m_view.close ();
+	m_hMap.close ();
+	m_hWake.close ();
+}
+
+void IPC_DgSegment::remove ()
+{
+	// the kernel objects go away with their last handle
+}
+
+void IPC_DgSegment::wake ()
+{
+	InterlockedIncrement (&m_hdr->wakeSeq);
+	SetEvent (m_hWake);
+}
+
+void IPC_DgSegment::wait (LONG seen, DWORD tmo)
+{
+	// the event is auto-reset and keeps a wake-up that came before the wait
+	if (ReadAcquire (&m_hdr->wakeSeq) == seen) WaitForSingleObject (m_hWake, tmo);
+}
+
+bool IPC_DgSegment::isProcessAlive (DWORD pid)
+{
+	HANDLE h = OpenProcess (SYNCHRONIZE, FALSE, pid);
+	if (h == NULL) return GetLastError () != ERROR_INVALID_PARAMETER;  // access denied - alive
+
+	DWORD rc = WaitForSingleObject (h, 0);
+	CloseHandle (h);
+	return rc == WAIT_TIMEOUT;
+}
+
+#else // _WIN32
+
+DWORD IPC_DgSegment::create (const char *name)
+{
+	snprintf (m_path, sizeof (m_path), "%s%s", IPC_DG_PREFIX, name);
+
+	int fd = shm_open (m_path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) return IPC_ERR_UNKNOWN;
+
+	// any user may send, as with the Windows security attributes
+	fchmod (fd, 0666);
+	return map (fd, true);
+}
+
+DWORD IPC_DgSegment::open (const char *name)
+{
+	snprintf (m_path, sizeof (m_path), "%s%s", IPC_DG_PREFIX, name);
+
+	int fd = shm_open (m_path, O_RDWR, 0);
+	if (fd < 0) return IPC_ERR_CLOSED;
+	return map (fd, false);
+}
+
+DWORD IPC_DgSegment::map (int fd, bool bCreate)
+{
+	DWORD err = 0;
+	struct stat st;
+
+	if (fstat (fd, &st) != 0) err = IPC_ERR_UNKNOWN;
+	else if (st.st_size < (off_t)IPC_DG_SEGMENT_SIZE) {
+		// a new segment is sized by its owner, a sender waits for that
+		if (! bCreate) err = IPC_ERR_CLOSED;
+		else if (st.st_size != 0 || ftruncate (fd, IPC_DG_SEGMENT_SIZE) != 0) err = IPC_ERR_UNKNOWN;
+	}
+
+	if (err == 0) {
+		void *p = mmap (NULL, IPC_DG_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) err = IPC_ERR_UNKNOWN;
+		else m_hdr = (IPC_DG_HDR *)p;
+	}
+
+	::close (fd);
+	return err;
+}
+
+void IPC_DgSegment::close ()
+{
+	if (m_hdr != NULL) munmap (m_hdr, IPC_DG_SEGMENT_SIZE);
+	m_hdr = NULL;
+}
+
+void IPC_DgSegment::remove ()
+{
+	if (m_path[0] != 0) shm_unlink (m_path);
+}
+
+void IPC_DgSegment::wake ()
+{
+	InterlockedIncrement (&m_hdr->wakeSeq);
+	IPC_FutexWake (&m_hdr->wakeSeq);
+}
+
+void IPC_DgSegment::wait (LONG seen, DWORD tmo)
+{
+	IPC_FutexWait (&m_hdr->wakeSeq, seen, tmo);
+}
+
+bool IPC_DgSegment::isProcessAlive (DWORD pid)
+{
+	return kill ((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+#endif // _WIN32
+
+////////////////////////////////////////////////////////////////
+// IPC_DgEngine
+
+IPC_DgEngine IPC_DgEngine::g_instance;
+
+IPC_DgEngine::IPC_DgEngine () : m_pEndpoints (NULL), m_pSenders (NULL)
+{
+	InitializeCriticalSection (&m_cs);
+}
+
+IPC_DgEngine::~IPC_DgEngine ()
+{
+	// endpoints still running at exit keep their segments, the next
+	// owner takes them over
+	if (m_pEndpoints == NULL && m_pSenders == NULL) DeleteCriticalSection (&m_cs);
+}
+
+HIPCSERVER IPC_DgEngine::start (const char *name)
+{
+	if (! IPC_DgValidName (name)) return HIPCSERVER_INVALID;
+
+	EnterCriticalSection (&m_cs);
+
+	for (IPC_DgEndpoint *e = m_pEndpoints; e; e = e->next) {
+		if (strcmp (e->name, name) == 0) {
+			LeaveCriticalSection (&m_cs);
+			return HIPCSERVER_INVALID;
+		}
+	}
+
+	IPC_DgEndpoint *ep = new IPC_DgEndpoint;
+	DWORD err = (ep == NULL) ? IPC_ERR_OUT_OF_MEMORY : ep->seg.create (name);
+
+	if (err == 0) {
+		IPC_DG_HDR *hdr = ep->seg.header ();
+		LONG pid = (LONG)GetCurrentProcessId ();
+
+		// the first owner formats the segment, it is zero filled
+		if (ReadAcquire ((volatile LONG *)&hdr->magic) == 0) {
+			hdr->ringSize = IPC_DG_RING_SIZE;
+			WriteRelease ((volatile LONG *)&hdr->magic, (LONG)IPC_DG_MAGIC);
+		}
+		if (hdr->magic != IPC_DG_MAGIC || hdr->ringSize != IPC_DG_RING_SIZE) err = IPC_ERR_INVALID_ARG;
+
+		// take over a segment left by a dead owner, the records it has
+		// not released are delivered again
+		while (err == 0) {
+			LONG owner = ReadAcquire (&hdr->owner);
+			if (owner != 0 && IPC_DgSegment::isProcessAlive ((DWORD)owner)) err = IPC_ERR_INVALID_ARG;
+			else if (InterlockedCompareExchange (&hdr->owner, pid, owner) == owner) break;
+		}
+	}
+
+	if (err != 0) {
+		delete ep;
+		LeaveCriticalSection (&m_cs);
+		return HIPCSERVER_INVALID;
+	}
+
+	memcpy (ep->name, name, strlen (name) + 1);
+	ep->ring.attach (ep->seg.header ());
+	ep->next = m_pEndpoints;
+	m_pEndpoints = ep;
+
+	LeaveCriticalSection (&m_cs);
+	return (HIPCSERVER)ep;
+}
+
+DWORD IPC_DgEngine::stop (HIPCSERVER h)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_DgEndpoint **pp = &m_pEndpoints;
+	while (*pp && *pp != (IPC_DgEndpoint *)h) pp = &(*pp)->next;
+
+	IPC_DgEndpoint *ep = *pp;
+	if (ep == NULL) {
+		LeaveCriticalSection (&m_cs);
+		return IPC_ERR_INVALID_ARG;
+	}
+	*pp = ep->next;
+	ep->bStopped = true;
+
+	LeaveCriticalSection (&m_cs);
+
+	// get the receivers out, then give the consumed space back
+	// while the segment is still ours
+	IPC_DG_HDR *hdr = ep->seg.header ();
+	ep->seg.wake ();
+
+	EnterCriticalSection (&ep->csRecv);
+	ep->ring.release ();
+	LeaveCriticalSection (&ep->csRecv);
+
+	ep->seg.remove ();
+	InterlockedCompareExchange (&hdr->owner, 0, (LONG)GetCurrentProcessId ());
+
+	releaseEndpoint (ep);
+	return 0;
+}
+
+IPC_DgEndpoint * IPC_DgEngine::findEndpoint (const char *name)
+{
+	if (name == NULL) return NULL;
+
+	EnterCriticalSection (&m_cs);
+
+	IPC_DgEndpoint *ep = m_pEndpoints;
+	while (ep && strcmp (ep->name, name) != 0) ep = ep->next;
+	if (ep) ep->refs++;
+
+	LeaveCriticalSection (&m_cs);
+	return ep;
+}
+
+void IPC_DgEngine::releaseEndpoint (IPC_DgEndpoint *ep)
+{
+	EnterCriticalSection (&m_cs);
+	bool bLast = (--ep->refs == 0);
+	LeaveCriticalSection (&m_cs);
+
+	if (bLast) delete ep;
+}
+
+// a cached sender for name; stale - the caller's entry of a stopped
+// endpoint, it is dropped and the segment is opened again
+IPC_DgSender * IPC_DgEngine::findSender (const char *name, IPC_DgSender *stale)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_DgSender **pp = &m_pSenders;
+	while (*pp && strcmp ((*pp)->name, name) != 0) pp = &(*pp)->next;
+
+	IPC_DgSender *s = *pp;
+	if (s != NULL && s != stale) {
+		s->refs++;
+		LeaveCriticalSection (&m_cs);
+		return s;
+	}
+
+	IPC_DgSender *dead = NULL;
+	if (s != NULL) {
+		*pp = s->next;
+		if (--s->refs == 0) dead = s;
+	}
+
+	s = new IPC_DgSender;
+	if (s != NULL && s->seg.open (name) == 0) {
+		memcpy (s->name, name, strlen (name) + 1);
+		s->ring.attach (s->seg.header ());
+		s->refs = 2;
+		s->next = m_pSenders;
+		m_pSenders = s;
+	}
+	else {
+		delete s;
+		s = NULL;
+	}
+
+	LeaveCriticalSection (&m_cs);
+
+	delete dead;
+	return s;
+}
+
+void IPC_DgEngine::releaseSender (IPC_DgSender *s)
+{
+	EnterCriticalSection (&m_cs);
+	bool bLast = (--s->refs == 0);
+	LeaveCriticalSection (&m_cs);
+
+	if (bLast) delete s;
+}
+
+DWORD IPC_DgEngine::send (const char *name, const void *buf, DWORD size, DWORD tmo)
+{
+	if (! IPC_DgValidName (name) || (buf == NULL && size != 0)
+	 || size > IPC_DG_MAX_DATA || ! IsValidTimeout (tmo)) return IPC_ERR_INVALID_ARG;
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_DgSender *s = findSender (name, NULL);
+	if (s == NULL) return IPC_ERR_CLOSED;
+
+	DWORD err;
+	bool bReopened = false;
+	for (int spins = 0; ; spins++) {
+		IPC_DG_HDR *hdr = s->ring.header ();
+
+		LONG owner = ReadAcquire (&hdr->owner);
+		if (ReadAcquire ((volatile LONG *)&hdr->magic) != (LONG)IPC_DG_MAGIC || owner == 0) {
+			// stopped: a new owner may have created another segment
+			err = IPC_ERR_CLOSED;
+			if (bReopened) break;
+
+			IPC_DgSender *n = findSender (name, s);
+			releaseSender (s);
+			if ((s = n) == NULL) return err;
+			bReopened = true;
+			continue;
+		}
+
+		bool bWake;
+		err = s->ring.push (buf, size, bWake);
+		if (err == 0) {
+			if (bWake) s->seg.wake ();
+			break;
+		}
+
+		// full: wait for the owner to drain the ring
+		if (! IPC_DgSegment::isProcessAlive ((DWORD)owner)) { err = IPC_ERR_BROKEN; break; }
+		if (IPC_RemainingTimeout (tmo, t0) == 0) { err = IPC_ERR_TIMEOUT; break; }
+
+		if (spins < 16) SwitchToThread ();
+		else Sleep (1);
+	}
+
+	releaseSender (s);
+	return err;
+}
+
+// called with ep->csRecv held
+DWORD IPC_DgEngine::waitData (IPC_DgEndpoint *ep, DWORD tmo)
+{
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_DG_HDR *hdr = ep->ring.header ();
+	for (;;) {
+		DWORD size;
+		if (ep->bStopped) return IPC_ERR_CLOSED;
+		if (ep->ring.peek (size) != NULL) return 0;
+
+		// empty: the producers get all the space before we sleep
+		ep->ring.release ();
+
+		DWORD left = IPC_RemainingTimeout (tmo, t0);
+		if (left == 0) return IPC_ERR_TIMEOUT;
+
+		// announce the sleep, then recheck: a producer publishing after
+		// the recheck sees 'waiter' and wakes us
+		LONG seq = ReadAcquire (&hdr->wakeSeq);
+		InterlockedExchange (&hdr->waiter, 1);
+		if (ep->ring.peek (size) != NULL || ep->bStopped) continue;
+
+		ep->seg.wait (seq, left);
+	}
+}
+
+DWORD IPC_DgEngine::recv (const char *name, void *buf, DWORD size, DWORD tmo, DWORD& rsz)
+{
+	rsz = 0;
+	if ((buf == NULL && size != 0) || ! IsValidTimeout (tmo)) return IPC_ERR_INVALID_ARG;
+
+	IPC_DgEndpoint *ep = findEndpoint (name);
+	if (ep == NULL) return IPC_ERR_INVALID_ARG;
+
+	EnterCriticalSection (&ep->csRecv);
+
+	DWORD err = waitData (ep, tmo);
+	if (err == 0) {
+		DWORD dataSize = 0;
+		const IPC_DG_REC *rec = ep->ring.peek (dataSize);
+
+		memcpy (buf, rec + 1, (dataSize < size) ? dataSize : size);
+		if (dataSize > size) err = IPC_ERR_MSG_TRUNCATED;
+		rsz = dataSize;
+
+		ep->ring.pop (dataSize);
+	}
+
+	LeaveCriticalSection (&ep->csRecv);
+
+	releaseEndpoint (ep);
+	return err;
+}
+
+DWORD IPC_DgEngine::recvBatch (const char *name, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received)
+{
+	received = 0;
+	if (((msgs == NULL || sizes == NULL) && count != 0) || ! IsValidTimeout (tmo)) return IPC_ERR_INVALID_ARG;
+
+	IPC_DgEndpoint *ep = findEndpoint (name);
+	if (ep == NULL) return IPC_ERR_INVALID_ARG;
+
+	EnterCriticalSection (&ep->csRecv);
+
+	// wait for the first datagram only, then drain what is queued
+	DWORD err = (count != 0) ? waitData (ep, tmo) : 0;
+	for (; err == 0 && received < count; received++) {
+		DWORD dataSize = 0;
+		const IPC_DG_REC *rec = ep->ring.peek (dataSize);
+		if (rec == NULL) break;
+
+		const IPC_BUF& msg = msgs[received];
+		memcpy (msg.pvBuf, rec + 1, (dataSize < msg.dwSize) ? dataSize : msg.dwSize);
+		if (dataSize > msg.dwSize) err = IPC_ERR_MSG_TRUNCATED;
+		sizes[received] = dataSize;
+
+		ep->ring.pop (dataSize);
+	}
+
+	LeaveCriticalSection (&ep->csRecv);
+
+	releaseEndpoint (ep);
+	return err;
+}
+
+////////////////////////////////////////////////////////////////
+// exports
+
+IPC_API HIPCSERVER __stdcall IPC_ServerDgStart (char *pszDgServerName)
+{ return IPC_DgEngine::instance ().start (pszDgServerName); }
+
+IPC_API BOOL __stdcall IPC_ServerDgStop (HIPCSERVER hServer)
+{ return IPC_DgEngine::instance ().stop (hServer) == 0; }
+
+IPC_API DWORD __stdcall IPC_DgRecv (char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+{
+	DWORD rsz;
+	DWORD err = IPC_DgEngine::instance ().recv (pszDgServerName, pvBuf, dwBufSize, dwTimeout, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+IPC_API DWORD __stdcall IPC_DgRecvBatch (char *pszDgServerName, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+{
+	DWORD received;
+	DWORD err = IPC_DgEngine::instance ().recvBatch (pszDgServerName, pMsgs, dwCount, pdwSizes, dwTimeout, received);
+	return (err == 0 || received != 0) ? received : IPC_ERR_TO_RC (err);
+}
+
+IPC_API DWORD __stdcall IPC_DgSend (char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+{
+	DWORD err = IPC_DgEngine::instance ().send (pszDgServerName, pvBuf, dwBufSize, dwTimeout);
+	return (err == 0) ? dwBufSize : IPC_ERR_TO_RC (err);
+}
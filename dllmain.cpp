@@ -15,6 +15,7 @@
 #include <crtdbg.h>
 #include "version.h"
 #include "sa.h"
+#include "ipc_credit.h"
 
 #ifdef _DEBUG
 #define verify(f)          assert(f)
@@ -22,7 +23,7 @@
 #define verify(f)          ((void)(f))
 #endif
 
-class IIpc
+class IIpc: public IPC_ServeOps
 {
 public:
 	virtual DWORD GetVersion() = 0;
@@ -37,6 +38,28 @@ public:
 	virtual BOOL GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents ) = 0;
 	virtual BOOL ResetEvents( HIPCCONNECTION hConnection ) = 0;
 	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection ) = 0;
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize) = 0;
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize) = 0;
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout) = 0;
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize) = 0;
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout) = 0;
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf) = 0;
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold) = 0;
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds) = 0;
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable) = 0;
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout) = 0;
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog) = 0;
+	virtual HIPCPOLL PollCreate () = 0;
+	virtual BOOL PollClose (HIPCPOLL hPoll) = 0;
+	virtual BOOL PollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents) = 0;
+	virtual BOOL PollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConnection) = 0;
+	virtual DWORD PollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) = 0;
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) = 0;
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext) = 0;
 };
 
 class CMemoryMappedIpc: public IIpc
@@ -77,6 +100,82 @@ public:
 
 	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection )
 	{ return IPC_Runtime::instance().getConnectionLastErr (hConnection); }
+
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+	{ return IPC_Runtime::instance().serverStart (epName, dwSendSize, dwRecvSize); }
+
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+	{ return IPC_Runtime::instance().connect (pszServerName, dwTimeout, dwSendSize, dwRecvSize); }
+
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendReserve (hConnection, dwSize, ppvBuf, dwTimeout); }
+
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+	{ return IPC_Runtime::instance().sendCommit (hConnection, pvBuf, dwSize); }
+
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvView (hConnection, ppvBuf, dwTimeout); }
+
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+	{ return IPC_Runtime::instance().recvRelease (hConnection, pvBuf); }
+
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+	{ return IPC_Runtime::instance().setSectionThreshold (hConnection, dwThreshold); }
+
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+	{ return IPC_Runtime::instance().setSpinTime (hConnection, dwMicroseconds); }
+
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+	{ return IPC_Runtime::instance().setMultiProducer (hConnection, bEnable); }
+
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendV (hConnection, pBufs, dwCount, dwTimeout); }
+
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvV (hConnection, pBufs, dwCount, dwTimeout); }
+
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendBatch (hConnection, pMsgs, dwCount, dwTimeout); }
+
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvBatch (hConnection, pMsgs, dwCount, pdwSizes, dwTimeout); }
+
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+	{
+		// the port has a fixed number of connection request slots
+		assert(hServer);
+		return hServer != NULL;
+	}
+
+	virtual HIPCPOLL PollCreate ()
+	{ return IPC_Runtime::instance().pollCreate (); }
+
+	virtual BOOL PollClose (HIPCPOLL hPoll)
+	{ return IPC_Runtime::instance().pollClose (hPoll); }
+
+	virtual BOOL PollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents)
+	{ return IPC_Runtime::instance().pollAdd (hPoll, hConnection, dwEvents); }
+
+	virtual BOOL PollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConnection)
+	{ return IPC_Runtime::instance().pollRemove (hPoll, hConnection); }
+
+	virtual DWORD PollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().pollWait (hPoll, pEvents, dwCount, dwTimeout); }
+
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{ return IPC_Runtime::instance().sendAsync (hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{ return IPC_Runtime::instance().recvAsync (hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+	{ return IPC_Runtime::instance().cancelAsync (hConnection, pvContext); }
+
+	virtual IPC_PollSource * PollAcquire (HIPCCONNECTION hConnection)
+	{ return IPC_Runtime::instance().pollAcquire (hConnection); }
+
+	virtual void PollRelease (HIPCCONNECTION hConnection)
+	{ IPC_Runtime::instance().pollRelease (hConnection); }
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -117,38 +216,65 @@ CTimeout::operator bool() const
 	return !m_bInfintine && GetTickCount()>m_dwDeadline;
 }
 
-struct CCritSec
-{
-	CCritSec() { InitializeCriticalSection(&m_cs); }
-	~CCritSec() { DeleteCriticalSection(&m_cs); }
-	CRITICAL_SECTION m_cs;
-};
-
-class CCSLock
+// the server sends the connection counter, which names the credit
+// semaphores, the client reads it; false if the transfer fails or the
+// timeout ends it
+static bool PipeHandshake(HANDLE hPipe, bool bSend, int* pnCounter, const CTimeout& timeout)
 {
-	CCritSec& m_cs;
-public:
-	CCSLock(CCritSec& cs): m_cs(cs) { EnterCriticalSection(&m_cs.m_cs); }
-	~CCSLock() { LeaveCriticalSection(&m_cs.m_cs); }
-};
+	OVERLAPPED ovl = { 0, };
+	ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!ovl.hEvent)
+		return false;
+
+	DWORD dwBytes = 0;
+	BOOL bDone = bSend
+		? WriteFile(hPipe, pnCounter, sizeof(*pnCounter), &dwBytes, &ovl)
+		: ReadFile(hPipe, pnCounter, sizeof(*pnCounter), &dwBytes, &ovl);
+	if (!bDone && GetLastError() == ERROR_IO_PENDING)
+	{
+		if (WaitForSingleObject(ovl.hEvent, timeout.GetTimeLeft()) != WAIT_OBJECT_0)
+			CancelIoEx(hPipe, &ovl);
+		bDone = GetOverlappedResult(hPipe, &ovl, &dwBytes, TRUE);
+	}
+	CloseHandle(ovl.hEvent);
+	return bDone && dwBytes == sizeof(*pnCounter);
+}
 
 #define PIPE_READ_BUF_SIZE (1024*4)
 #define PIPE_WAIT_TIMEOUT 60000
 #define PIPE_PREFIX "\\\\.\\pipe\\JR_IPC_"
-#define EVENT_SR2R_PREFIX "Global\\JR_IPC_sr2r"
-#define EVENT_CR2R_PREFIX "Global\\JR_IPC_cr2r"
+#define CREDIT_C2S_PREFIX "Global\\JR_IPC_c2s"	// client->server messages, granted by the server
+#define CREDIT_S2C_PREFIX "Global\\JR_IPC_s2c"	// server->client messages, granted by the client
 
-class CPipeTransport
+class CPipeTransport: public IPC_PollSource
 {
 	HANDLE m_hPipe;
 	HANDLE m_evStop;
-	CCritSec m_cs;
+	CCritSec m_cs;					// connection state, user handles
+	CCritSec m_csSend;				// send path: m_ovlSend, reserve buffer
+	CCritSec m_csRecv;				// receive path: m_ovlRecv, view buffer
+	volatile LONG m_lBroken;		// I/O failed, the pipe is closed by the destructor
 	DWORD m_dwLastError;
 	int m_nHandleCount;
 	HANDLE* m_arrUserHandles;
 	OVERLAPPED m_ovlRecv, m_ovlSend;
-	HANDLE m_evImReadyToRcv;
-	HANDLE m_evHeReadyToRcv;
+	HANDLE m_hMyCredit;				// semaphore: credit I grant to the peer's sends
+	HANDLE m_hPeerCredit;			// semaphore: credit the peer granted to my sends
+	volatile LONG m_lHeldCredit;	// units taken from m_hPeerCredit by the poll, used by the next Send
+	IPC_CreditGrant m_grant;		// receive path: messages read but not yet granted back
+	OVERLAPPED m_ovlPoll;			// zero-byte read completing when a message arrives
+	bool m_bPollRead;				// m_ovlPoll is pending
+	int m_iPollCredit;				// index of m_hPeerCredit in the poll handles, -1 if none
+	BYTE m_pollByte;
+	BYTE* m_pReserveBuf;			// SendReserve buffer
+	DWORD m_dwReserveBufSize;
+	DWORD m_dwReserveSize;			// NO_RESERVATION if not reserved
+	DWORD m_dwReserveTimeout;		// of SendReserve, used by SendCommit
+	BYTE* m_pViewBuf;				// RecvView buffer
+	DWORD m_dwViewBufSize;
+	bool m_bViewHeld;
+
+	enum { NO_RESERVATION = 0xFFFFFFFF };
 
 	DWORD SetError(DWORD dwError)
 	{
@@ -156,32 +282,131 @@ class CPipeTransport
 		return dwError == IPC_ERR_TIMEOUT ? IPC_RC_TIMEOUT : IPC_RC_ERROR;
 	}
 
+	// the other direction may be inside an overlapped call on m_hPipe,
+	// so a failed pipe is only marked here
+	DWORD SetBroken(DWORD dwWin32Error)
+	{
+		InterlockedExchange(&m_lBroken, 1);
+		return SetError(dwWin32Error == ERROR_BROKEN_PIPE ? IPC_ERR_CLOSED : IPC_ERR_UNKNOWN);
+	}
+
+	// the read goes straight into the caller's buffer,
+	// so wait until the cancelled read has really stopped
+	void CancelRecv()
+	{
+		DWORD dwBytes;
+		CancelIo(m_hPipe);
+		GetOverlappedResult(m_hPipe, &m_ovlRecv, &dwBytes, TRUE);
+	}
+
+	// the same for a write; a message the cancel stopped returns its unit
+	// of credit, true if it was written after all
+	bool CancelSend()
+	{
+		DWORD dwBytes;
+		CancelIo(m_hPipe);
+		if (GetOverlappedResult(m_hPipe, &m_ovlSend, &dwBytes, TRUE))
+			return true;
+		ReleaseSemaphore(m_hPeerCredit, 1, NULL);
+		return false;
+	}
+
+	// a unit of credit the poll has taken already
+	bool TakeHeldCredit()
+	{
+		for (LONG l = m_lHeldCredit; l > 0; l = m_lHeldCredit)
+			if (InterlockedCompareExchange(&m_lHeldCredit, l - 1, l) == l)
+				return true;
+		return false;
+	}
+
+	// the poll tests the credit by taking a unit, which it holds for the next Send
+	bool HoldCredit()
+	{
+		if (m_lHeldCredit > 0)
+			return true;
+		if (WaitForSingleObject(m_hPeerCredit, 0) != WAIT_OBJECT_0)
+			return false;
+		InterlockedIncrement(&m_lHeldCredit);
+		return true;
+	}
+
+	bool IsBroken() const
+	{
+		return m_hPipe == INVALID_HANDLE_VALUE || m_lBroken != 0;
+	}
+
+	// wait list: nFixed handles already in ev followed by the user handles
+	DWORD GetWaitHandles(HANDLE* ev, DWORD nFixed)
+	{
+		CCSLock lock(m_cs);
+		memcpy(ev + nFixed, m_arrUserHandles, sizeof(HANDLE) * m_nHandleCount);
+		return nFixed + m_nHandleCount;
+	}
+
+	bool GrowReserveBuf(DWORD dwSize)
+	{
+		if (dwSize <= m_dwReserveBufSize)
+			return true;
+		BYTE* pBuf = new BYTE[dwSize];
+		if (!pBuf)
+			return false;
+		delete[] m_pReserveBuf;
+		m_pReserveBuf = pBuf;
+		m_dwReserveBufSize = dwSize;
+		return true;
+	}
+
 public:
 	CPipeTransport()
 		: m_hPipe(INVALID_HANDLE_VALUE)
+		, m_lBroken(0)
 		, m_dwLastError(0)
 		, m_nHandleCount(0)
 		, m_arrUserHandles(NULL)
-		, m_evImReadyToRcv(NULL)
-		, m_evHeReadyToRcv(NULL)
+		, m_hMyCredit(NULL)
+		, m_hPeerCredit(NULL)
+		, m_lHeldCredit(0)
+		, m_bPollRead(false)
+		, m_iPollCredit(-1)
+		, m_pReserveBuf(NULL)
+		, m_dwReserveBufSize(0)
+		, m_dwReserveSize(NO_RESERVATION)
+		, m_dwReserveTimeout(INFINITE)
+		, m_pViewBuf(NULL)
+		, m_dwViewBufSize(0)
+		, m_bViewHeld(false)
 	{
 		assert(_CrtIsValidHeapPointer(this));
 		m_ovlRecv.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 		m_ovlSend.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		m_ovlPoll.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 		m_evStop = CreateEvent(NULL, TRUE, FALSE, NULL);
 	}
 
-	CPipeTransport(HANDLE hPipe, HANDLE evImReadyToRcv, HANDLE evHeReadyToRcv)
+	CPipeTransport(HANDLE hPipe, HANDLE hMyCredit, HANDLE hPeerCredit)
 		: m_hPipe(hPipe)
+		, m_lBroken(0)
 		, m_dwLastError(0)
 		, m_nHandleCount(0)
 		, m_arrUserHandles(NULL)
-		, m_evImReadyToRcv(evImReadyToRcv)
-		, m_evHeReadyToRcv(evHeReadyToRcv)
+		, m_hMyCredit(hMyCredit)
+		, m_hPeerCredit(hPeerCredit)
+		, m_lHeldCredit(0)
+		, m_bPollRead(false)
+		, m_iPollCredit(-1)
+		, m_pReserveBuf(NULL)
+		, m_dwReserveBufSize(0)
+		, m_dwReserveSize(NO_RESERVATION)
+		, m_dwReserveTimeout(INFINITE)
+		, m_pViewBuf(NULL)
+		, m_dwViewBufSize(0)
+		, m_bViewHeld(false)
 	{
 		assert(_CrtIsValidHeapPointer(this));
 		m_ovlRecv.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 		m_ovlSend.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		m_ovlPoll.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 		m_evStop = CreateEvent(NULL, TRUE, FALSE, NULL);
 	}
 
@@ -189,8 +414,16 @@ public:
 	{
 		assert(_CrtIsValidHeapPointer(this));
 
+		// the poll set takes its lock before m_cs
+		pollRemove();
+
 		SetEvent(m_evStop);
+		asyncDetach();
+		rpcDetach();
 
+		// wait for both directions to leave
+		CCSLock lockSend(m_csSend);
+		CCSLock lockRecv(m_csRecv);
 		CCSLock lock(m_cs);
 
 		verify(CloseHandle(m_evStop));
@@ -198,6 +431,7 @@ public:
 
 		verify(CloseHandle(m_ovlRecv.hEvent));
 		verify(CloseHandle(m_ovlSend.hEvent));
+		verify(CloseHandle(m_ovlPoll.hEvent));
 
 		if (m_hPipe != INVALID_HANDLE_VALUE)
 		{
@@ -210,13 +444,26 @@ public:
 			m_nHandleCount = 0;
 			m_arrUserHandles = NULL;
 		}
+		delete[] m_pReserveBuf;
+		m_pReserveBuf = NULL;
+		delete[] m_pViewBuf;
+		m_pViewBuf = NULL;
 
-		SetEvent(m_evImReadyToRcv); 
+		// wake a peer sender waiting for credit, its write then fails on the closed pipe
+		if (m_hMyCredit)
+		{
+			ReleaseSemaphore(m_hMyCredit, 1, NULL);
+			verify(CloseHandle(m_hMyCredit));
+		}
+		if (m_hPeerCredit)
+			verify(CloseHandle(m_hPeerCredit));
+	}
 
-		if (m_evImReadyToRcv)
-			verify(CloseHandle(m_evImReadyToRcv));
-		if (m_evHeReadyToRcv)
-			verify(CloseHandle(m_evHeReadyToRcv));
+	// wakes the blocked calls, the new ones fail; CloseConnection calls it
+	// before it waits for the handle references to drop
+	void Shutdown()
+	{
+		SetEvent(m_evStop);
 	}
 
 	HIPCCONNECTION Connect(const char *pszServerName, DWORD dwTimeout)
@@ -257,6 +504,10 @@ public:
 				}
 				if (GetLastError() != ERROR_PIPE_BUSY)
 					return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE; 
+				// another client took the instance, wait for the next one
+				if (timeout)
+					return (HIPCCONNECTION) IPC_RC_TIMEOUT;
+				continue;
 			}
 
 			HANDLE* ev = (HANDLE*) _malloca(sizeof(HANDLE) * (m_nHandleCount + 1));
@@ -268,57 +519,87 @@ public:
 		}
 		
  		int nCounter = 0;
-
-		OVERLAPPED ovl = { 0, };
-		ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-		DWORD dwRead = 0;
-		ReadFile(m_hPipe, &nCounter, sizeof(nCounter), &dwRead, &ovl);
-		WaitForSingleObject(_Post_ _Notnull_ ovl.hEvent, INFINITE);
-		CloseHandle(_Post_ _Notnull_ ovl.hEvent);
-
-		char szEvName[MAX_PATH];
-		sprintf_s(szEvName, "%s_%s_%i", EVENT_SR2R_PREFIX, pszServerName, nCounter);
-		m_evHeReadyToRcv = OpenEvent(EVENT_ALL_ACCESS, FALSE, szEvName);
-		sprintf_s(szEvName, "%s_%s_%i", EVENT_CR2R_PREFIX, pszServerName, nCounter);
-		m_evImReadyToRcv = OpenEvent(EVENT_ALL_ACCESS, FALSE, szEvName);
-
-		assert(m_evHeReadyToRcv && m_evImReadyToRcv);
-
-		return (HIPCCONNECTION) this;
+		if (PipeHandshake(m_hPipe, false, &nCounter, timeout))
+		{
+			char szSemName[MAX_PATH];
+			sprintf_s(szSemName, "%s_%s_%i", CREDIT_C2S_PREFIX, pszServerName, nCounter);
+			m_hPeerCredit = OpenSemaphore(SEMAPHORE_ALL_ACCESS, FALSE, szSemName);
+			sprintf_s(szSemName, "%s_%s_%i", CREDIT_S2C_PREFIX, pszServerName, nCounter);
+			m_hMyCredit = OpenSemaphore(SEMAPHORE_ALL_ACCESS, FALSE, szSemName);
+		}
+		if (m_hPeerCredit && m_hMyCredit)
+			return (HIPCCONNECTION) this;
+
+		// without the counter the credit would be another connection's
+		if (m_hPeerCredit)
+			verify(CloseHandle(m_hPeerCredit));
+		if (m_hMyCredit)
+			verify(CloseHandle(m_hMyCredit));
+		m_hPeerCredit = m_hMyCredit = NULL;
+		verify(CloseHandle(m_hPipe));
+		m_hPipe = INVALID_HANDLE_VALUE;
+		if (timeout)
+			return (HIPCCONNECTION) IPC_RC_TIMEOUT;
+		return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
 	}
 
-	DWORD Recv(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+	// ppGrowBuf/pdwGrowSize - heap buffer (pvBuf) to grow up to the message size;
+	// pdwMsgSize receives the whole message size when it is truncated
+	DWORD Recv(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout, BYTE** ppGrowBuf = NULL, DWORD* pdwGrowSize = NULL, DWORD* pdwMsgSize = NULL)
 	{
 		assert(_CrtIsValidHeapPointer(this));
-		CCSLock lock(m_cs);
+		CCSLock lock(m_csRecv);
 		assert(_CrtIsValidHeapPointer(this));
 
 		assert(m_hPipe != INVALID_HANDLE_VALUE);
-		if (m_hPipe == INVALID_HANDLE_VALUE)
+		if (IsBroken())
 			return SetError(IPC_ERR_BROKEN); 
 
 		CTimeout timeout(dwTimeout);
 
-		SetEvent(m_evImReadyToRcv);
-
 		DWORD dwTotalReaded = 0;
+		DWORD dwDiscarded = 0;
+		bool bTruncated = false;
 
 		bool bMore;
 		do
 		{
+			// read straight into the caller's buffer; when it is full, grow it
+			// to the rest of the message (RecvView) or discard the rest
+			if (!dwBufSize && ppGrowBuf && dwTotalReaded)
+			{
+				DWORD dwLeft = 0;
+				if (!PeekNamedPipe(m_hPipe, NULL, 0, NULL, NULL, &dwLeft) || !dwLeft)
+					dwLeft = dwTotalReaded;
+				DWORD dwNewSize = dwTotalReaded + dwLeft;
+				BYTE* pNewBuf = new BYTE[dwNewSize];
+				memcpy(pNewBuf, *ppGrowBuf, dwTotalReaded);
+				delete[] *ppGrowBuf;
+				*ppGrowBuf = pNewBuf;
+				*pdwGrowSize = dwNewSize;
+				pvBuf = pNewBuf + dwTotalReaded;
+				dwBufSize = dwLeft;
+			}
+			else if (!dwBufSize && ppGrowBuf)
+			{
+				delete[] *ppGrowBuf;
+				*ppGrowBuf = new BYTE[PIPE_READ_BUF_SIZE];
+				*pdwGrowSize = PIPE_READ_BUF_SIZE;
+				pvBuf = *ppGrowBuf;
+				dwBufSize = PIPE_READ_BUF_SIZE;
+			}
+
+			BYTE discard[PIPE_READ_BUF_SIZE];
+			BYTE* pDst = dwBufSize ? (BYTE*)pvBuf : discard;
+			DWORD dwLen = dwBufSize ? dwBufSize : PIPE_READ_BUF_SIZE;
+
 			m_ovlRecv.Offset = m_ovlRecv.OffsetHigh = 0;
 			DWORD dwBytesReaded;
-			BYTE buf[PIPE_READ_BUF_SIZE];
-			if (!ReadFile(m_hPipe, buf, PIPE_READ_BUF_SIZE, &dwBytesReaded, &m_ovlRecv))
+			if (!ReadFile(m_hPipe, pDst, dwLen, &dwBytesReaded, &m_ovlRecv))
 			{
 				DWORD dwErr = GetLastError();
 				if (dwErr != ERROR_MORE_DATA && dwErr != ERROR_IO_PENDING)
-				{
-					ResetEvent(m_evImReadyToRcv);
-					CloseHandle(m_hPipe);
-					m_hPipe = INVALID_HANDLE_VALUE;
-					return SetError(dwErr == ERROR_BROKEN_PIPE ? IPC_ERR_CLOSED : IPC_ERR_UNKNOWN ); 
-				}
+					return SetBroken(dwErr);
 			}
 
 TryAgain:
@@ -332,27 +613,24 @@ TryAgain:
 					{
 						if (timeout)
 						{
-							ResetEvent(m_evImReadyToRcv);
+							CancelRecv();
 							return SetError(IPC_ERR_TIMEOUT);
 						}
-						HANDLE* ev = (HANDLE*) _malloca(sizeof(HANDLE) * (m_nHandleCount + 2));
+						HANDLE ev[MAXIMUM_WAIT_OBJECTS];
 						ev[0] = m_ovlRecv.hEvent;
 						ev[1] = m_evStop;
-						memcpy(ev + 2, m_arrUserHandles, sizeof(HANDLE) * m_nHandleCount);
-						switch (WaitForMultipleObjects(m_nHandleCount + 2, ev, FALSE, timeout.GetTimeLeft()))
+						DWORD nCount = GetWaitHandles(ev, 2);
+						switch (WaitForMultipleObjects(nCount, ev, FALSE, timeout.GetTimeLeft()))
 						{
 						case WAIT_OBJECT_0: break;
 						case WAIT_OBJECT_0 + 1:
-							ResetEvent(m_evImReadyToRcv);
-							CancelIo(m_hPipe);
+							CancelRecv();
 							return SetError(IPC_ERR_UNKNOWN);
 						case WAIT_TIMEOUT:
-							ResetEvent(m_evImReadyToRcv);
-							CancelIo(m_hPipe);
+							CancelRecv();
 							return SetError(IPC_ERR_TIMEOUT);
 						default:
-							ResetEvent(m_evImReadyToRcv);
-							CancelIo(m_hPipe);
+							CancelRecv();
 							return SetError(IPC_ERR_USER_EVENT_SET);
 						}
 
@@ -363,78 +641,227 @@ TryAgain:
 					bMore = true;
 					break;
 				default:
-					ResetEvent(m_evImReadyToRcv);
-					CloseHandle(m_hPipe);
-					m_hPipe = INVALID_HANDLE_VALUE;
-					if (dwErr == ERROR_BROKEN_PIPE)
-						return SetError(IPC_ERR_CLOSED); 
-					return SetError(IPC_ERR_UNKNOWN); 
+					return SetBroken(dwErr);
 				}
 			}
 
-			assert(dwBufSize >= dwBytesReaded);
-			DWORD dwLen = min(dwBufSize, dwBytesReaded);
-			memcpy(pvBuf, buf, dwLen);
-			reinterpret_cast<BYTE*&>(pvBuf) += dwLen;
-			dwBufSize -= dwLen;
-			dwTotalReaded += dwLen;
+			if (pDst == discard)
+			{
+				if (dwBytesReaded)
+					bTruncated = true;
+				dwDiscarded += dwBytesReaded;
+				continue;
+			}
+
+			reinterpret_cast<BYTE*&>(pvBuf) += dwBytesReaded;
+			dwBufSize -= dwBytesReaded;
+			dwTotalReaded += dwBytesReaded;
 		} while(bMore);
 
-		ResetEvent(m_evImReadyToRcv);
+		// the message has left the pipe, return its credit (batched)
+		if (DWORD dwGrant = m_grant.consume())
+			ReleaseSemaphore(m_hMyCredit, dwGrant, NULL);
 
+		if (bTruncated)
+		{
+			if (pdwMsgSize)
+				*pdwMsgSize = dwTotalReaded + dwDiscarded;
+			return SetError(IPC_ERR_MSG_TRUNCATED);
+		}
 		return dwTotalReaded;
 	}
 
 	DWORD Send(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
 	{
 		assert(_CrtIsValidHeapPointer(this));
-		CCSLock lock(m_cs);
+		CCSLock lock(m_csSend);
 		assert(_CrtIsValidHeapPointer(this));
 
 		assert(m_hPipe != INVALID_HANDLE_VALUE);
-		if (m_hPipe == INVALID_HANDLE_VALUE)
+		if (IsBroken())
 			return SetError(IPC_ERR_BROKEN); 
 
-		HANDLE* ev = (HANDLE*) _malloca(sizeof(HANDLE) * (m_nHandleCount + 2));
-		ev[0] = m_evHeReadyToRcv;
+		CTimeout timeout(dwTimeout);
+
+		// one unit of credit per message; the writes pipeline up to the window
+		HANDLE ev[MAXIMUM_WAIT_OBJECTS];
+		ev[0] = m_hPeerCredit;
 		ev[1] = m_evStop;
-		memcpy(ev + 2, m_arrUserHandles, sizeof(HANDLE) * m_nHandleCount);
-		switch (WaitForMultipleObjects(m_nHandleCount + 2, ev, FALSE, dwTimeout))
+		DWORD nCount = GetWaitHandles(ev, 2);
+		if (!TakeHeldCredit())
 		{
-		case WAIT_OBJECT_0: break;
-		case WAIT_OBJECT_0 + 1: return SetError(IPC_ERR_UNKNOWN);
-		case WAIT_TIMEOUT: return SetError(IPC_ERR_TIMEOUT);
-		default: return SetError(IPC_ERR_USER_EVENT_SET);
+			switch (WaitForMultipleObjects(nCount, ev, FALSE, dwTimeout))
+			{
+			case WAIT_OBJECT_0: break;
+			case WAIT_OBJECT_0 + 1: return SetError(IPC_ERR_UNKNOWN);
+			case WAIT_TIMEOUT: return SetError(IPC_ERR_TIMEOUT);
+			default: return SetError(IPC_ERR_USER_EVENT_SET);
+			}
 		}
 
 		DWORD dwWritten = 0;
 		m_ovlSend.Offset = m_ovlSend.OffsetHigh = 0;
 		if (WriteFile(m_hPipe, pvBuf, dwBufSize, &dwWritten, &m_ovlSend))
 			return dwWritten;
-		if (GetLastError() != ERROR_IO_PENDING)
+		DWORD dwErr = GetLastError();
+		if (dwErr != ERROR_IO_PENDING)
+			return SetBroken(dwErr);
+
+		ev[0] = m_ovlSend.hEvent;
+		DWORD dwWait = WaitForMultipleObjects(nCount, ev, FALSE, timeout.GetTimeLeft());
+		if (dwWait == WAIT_OBJECT_0 || CancelSend())
+			return dwBufSize;
+
+		switch (dwWait)
 		{
-			CloseHandle(m_hPipe);
-			m_hPipe = INVALID_HANDLE_VALUE;
-			if (GetLastError() == ERROR_BROKEN_PIPE)
-				return SetError(IPC_ERR_CLOSED);
-			return SetError(IPC_ERR_UNKNOWN); 
+		case WAIT_OBJECT_0 + 1: return SetError(IPC_ERR_UNKNOWN);
+		case WAIT_TIMEOUT: return SetError(IPC_ERR_TIMEOUT);
+		default: return SetError(IPC_ERR_USER_EVENT_SET);
 		}
+	}
 
-		ev[0] = m_ovlSend.hEvent;
-		switch (WaitForMultipleObjects(m_nHandleCount + 2, ev, FALSE, dwTimeout))
+	// a pipe message is written at once, so the reserved buffer is local
+	// and the timeout applies to the write in SendCommit
+	DWORD SendReserve(DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+	{
+		assert(_CrtIsValidHeapPointer(this));
+		CCSLock lock(m_csSend);
+		assert(_CrtIsValidHeapPointer(this));
+
+		if (!ppvBuf || m_dwReserveSize != NO_RESERVATION)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		if (!GrowReserveBuf(dwSize))
+			return SetError(IPC_ERR_OUT_OF_MEMORY);
+
+		m_dwReserveSize = dwSize;
+		m_dwReserveTimeout = dwTimeout;
+		*ppvBuf = m_pReserveBuf;
+		return dwSize;
+	}
+
+	DWORD SendCommit(void *pvBuf, DWORD dwSize)
+	{
+		CCSLock lock(m_csSend);
+		if (m_dwReserveSize == NO_RESERVATION || pvBuf != m_pReserveBuf || dwSize > m_dwReserveSize)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		DWORD res = Send(pvBuf, dwSize, m_dwReserveTimeout);
+		m_dwReserveSize = NO_RESERVATION;
+		return res;
+	}
+
+	// a pipe message is written at once, so the segments are gathered
+	// into the local reserve buffer (not available while reserved)
+	DWORD SendV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		assert(_CrtIsValidHeapPointer(this));
+		CCSLock lock(m_csSend);
+		assert(_CrtIsValidHeapPointer(this));
+
+		if ((!pBufs && dwCount) || m_dwReserveSize != NO_RESERVATION)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		DWORD dwSize = IPC_BufCursor::totalSize(pBufs, dwCount);
+		if (dwSize >= IPC_MSG_SIZE_LIMIT)
+			return SetError(IPC_ERR_INVALID_ARG);
+		if (!GrowReserveBuf(dwSize))
+			return SetError(IPC_ERR_OUT_OF_MEMORY);
+
+		IPC_BufCursor data(pBufs, dwCount);
+		data.gather(m_pReserveBuf, dwSize);
+		return Send(m_pReserveBuf, dwSize, dwTimeout);
+	}
+
+	// the message is read into the view buffer and scattered from there
+	DWORD RecvV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CCSLock lock(m_csRecv);
+		if ((!pBufs && dwCount) || m_bViewHeld)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		DWORD res = Recv(m_pViewBuf, m_dwViewBufSize, dwTimeout, &m_pViewBuf, &m_dwViewBufSize);
+		if (res == IPC_RC_ERROR || res == IPC_RC_TIMEOUT)
+			return res;
+
+		IPC_BufCursor data(pBufs, dwCount);
+		if (data.scatter(m_pViewBuf, res) < res)
+			return SetError(IPC_ERR_MSG_TRUNCATED);
+		return res;
+	}
+
+	// every pipe message is a separate write
+	DWORD SendBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CCSLock lock(m_csSend);
+		if (!pMsgs && dwCount)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		CTimeout timeout(dwTimeout);
+		DWORD dwSent = 0;
+		for (; dwSent < dwCount; dwSent++)
 		{
-		case WAIT_OBJECT_0:
-			return dwBufSize;
-		case WAIT_OBJECT_0 + 1:
-			CancelIo(m_hPipe);
-			return SetError(IPC_ERR_UNKNOWN);
-		case WAIT_TIMEOUT:
-			CancelIo(m_hPipe);
-			return SetError(IPC_ERR_TIMEOUT);
-		default:
-			CancelIo(m_hPipe);
-			return SetError(IPC_ERR_USER_EVENT_SET);
+			DWORD res = Send(pMsgs[dwSent].pvBuf, pMsgs[dwSent].dwSize, timeout.GetTimeLeft());
+			if (res == IPC_RC_ERROR || res == IPC_RC_TIMEOUT)
+				return dwSent ? dwSent : res;
+		}
+		return dwSent;
+	}
+
+	// waits for the first message, then takes the messages already in the pipe
+	DWORD RecvBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+	{
+		CCSLock lock(m_csRecv);
+		if ((!pMsgs || !pdwSizes) && dwCount)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		DWORD dwReceived = 0;
+		for (; dwReceived < dwCount; dwReceived++)
+		{
+			if (dwReceived)
+			{
+				DWORD dwAvail = 0;
+				if (!PeekNamedPipe(m_hPipe, NULL, 0, NULL, &dwAvail, NULL) || !dwAvail)
+					break;
+			}
+			DWORD res = Recv(pMsgs[dwReceived].pvBuf, pMsgs[dwReceived].dwSize, dwReceived ? INFINITE : dwTimeout,
+				NULL, NULL, &pdwSizes[dwReceived]);
+			// a truncated message has left the pipe: it is counted, with its whole size
+			if (res == IPC_RC_ERROR && m_dwLastError == IPC_ERR_MSG_TRUNCATED)
+				return dwReceived + 1;
+			if (res == IPC_RC_ERROR || res == IPC_RC_TIMEOUT)
+				return dwReceived ? dwReceived : res;
+			pdwSizes[dwReceived] = res;
+		}
+		return dwReceived;
+	}
+
+	// the message is read into the local buffer and stays there until RecvRelease
+	DWORD RecvView(const void **ppvBuf, DWORD dwTimeout)
+	{
+		CCSLock lock(m_csRecv);
+		if (!ppvBuf || m_bViewHeld)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+		DWORD res = Recv(m_pViewBuf, m_dwViewBufSize, dwTimeout, &m_pViewBuf, &m_dwViewBufSize);
+		if (res == IPC_RC_ERROR || res == IPC_RC_TIMEOUT)
+			return res;
+
+		m_bViewHeld = true;
+		*ppvBuf = m_pViewBuf;
+		return res;
+	}
+
+	BOOL RecvRelease(const void *pvBuf)
+	{
+		CCSLock lock(m_csRecv);
+		if (!m_bViewHeld || pvBuf != m_pViewBuf)
+		{
+			SetError(IPC_ERR_INVALID_ARG);
+			return FALSE;
 		}
+		m_bViewHeld = false;
+		return TRUE;
 	}
 
 	BOOL SetEvents(HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents )
@@ -444,6 +871,8 @@ TryAgain:
 		assert(_CrtIsValidHeapPointer(this));
 
 		assert(dwUserEventsCount == 1 && pIPCEvents == NULL); 
+		if (dwUserEventsCount > MAXIMUM_WAIT_OBJECTS - 2)
+			return FALSE;
 		if (m_arrUserHandles)
 			delete[] m_arrUserHandles;
 		m_arrUserHandles = new HANDLE[dwUserEventsCount];
@@ -483,28 +912,216 @@ TryAgain:
 		assert(_CrtIsValidHeapPointer(this));
 		return m_dwLastError;
 	}
+
+	// IPC_PollSource
+	// a message arriving completes a zero-byte read, which consumes nothing;
+	// send space is the peer's credit, a unit taken by the check or by the
+	// wait is held for the next Send
+
+	virtual DWORD pollCheck(DWORD dwEvents)
+	{
+		CCSLock lock(m_cs);
+
+		if (m_bPollRead && WaitForSingleObject(m_ovlPoll.hEvent, 0) == WAIT_OBJECT_0)
+		{
+			DWORD dwBytes;
+			if (!GetOverlappedResult(m_hPipe, &m_ovlPoll, &dwBytes, FALSE) && GetLastError() != ERROR_MORE_DATA)
+				SetBroken(GetLastError());
+			m_bPollRead = false;
+		}
+
+		DWORD st = 0;
+		if (IsBroken())
+			return IPC_POLL_CLOSED;
+
+		DWORD dwAvail = 0;
+		if ((dwEvents & IPC_POLL_IN) && PeekNamedPipe(m_hPipe, NULL, 0, NULL, &dwAvail, NULL) && dwAvail)
+			st |= IPC_POLL_IN;
+
+		if ((dwEvents & IPC_POLL_OUT) && HoldCredit())
+			st |= IPC_POLL_OUT;
+		return st;
+	}
+
+	virtual int pollHandles(DWORD dwEvents, HANDLE* hdls)
+	{
+		int n = 0;
+		m_iPollCredit = -1;
+		if (dwEvents & IPC_POLL_IN)
+			hdls[n++] = m_ovlPoll.hEvent;
+		if (dwEvents & IPC_POLL_OUT)
+		{
+			m_iPollCredit = n;
+			hdls[n++] = m_hPeerCredit;
+		}
+		return n;
+	}
+
+	virtual void pollArm(DWORD dwEvents)
+	{
+		CCSLock lock(m_cs);
+
+		if (!(dwEvents & IPC_POLL_IN) || m_bPollRead || IsBroken())
+			return;
+
+		ResetEvent(m_ovlPoll.hEvent);
+		m_ovlPoll.Offset = m_ovlPoll.OffsetHigh = 0;
+		DWORD dwRead;
+		if (ReadFile(m_hPipe, &m_pollByte, 0, &dwRead, &m_ovlPoll))
+			m_bPollRead = true;
+		else
+		{
+			DWORD dwErr = GetLastError();
+			if (dwErr == ERROR_IO_PENDING || dwErr == ERROR_MORE_DATA)
+				m_bPollRead = true;
+			else
+			{
+				// let the check see the broken pipe
+				SetBroken(dwErr);
+				SetEvent(m_ovlPoll.hEvent);
+			}
+		}
+	}
+
+	virtual void pollDisarm(DWORD dwEvents)
+	{
+		CCSLock lock(m_cs);
+
+		if (!(dwEvents & IPC_POLL_IN) || !m_bPollRead)
+			return;
+
+		DWORD dwBytes;
+		CancelIoEx(m_hPipe, &m_ovlPoll);
+		GetOverlappedResult(m_hPipe, &m_ovlPoll, &dwBytes, TRUE);
+		m_bPollRead = false;
+	}
+
+	virtual void pollFired(int index)
+	{
+		// the satisfied wait took a unit of credit
+		if (index == m_iPollCredit)
+			InterlockedIncrement(&m_lHeldCredit);
+	}
+
+	// once credit or a message is there, the transfer completes without the peer
+	virtual DWORD asyncSend(const void *pvBuf, DWORD dwBufSize)
+	{
+		if (!IsBroken() && !HoldCredit())
+			return SetError(IPC_ERR_TIMEOUT);
+		return Send(const_cast<void*>(pvBuf), dwBufSize, INFINITE);
+	}
+
+	virtual DWORD asyncRecv(void *pvBuf, DWORD dwBufSize)
+	{
+		DWORD dwAvail = 0;
+		if (!IsBroken() && PeekNamedPipe(m_hPipe, NULL, 0, NULL, &dwAvail, NULL) && !dwAvail)
+			return SetError(IPC_ERR_TIMEOUT);
+		return Recv(pvBuf, dwBufSize, INFINITE);
+	}
 };
 
+#define PIPE_BACKLOG_DEFAULT 8
+#define PIPE_BACKLOG_MAX (MAXIMUM_WAIT_OBJECTS - 3)	// + m_evStop, m_evBacklog, hBreakEvent
+
 class CPipeServer
 {
-	HANDLE m_hPipe;
+	// a pipe instance with ConnectNamedPipe posted on it;
+	// heap allocated, a pending OVERLAPPED must not move
+	struct PIPE_INSTANCE
+	{
+		HANDLE hPipe;
+		OVERLAPPED ovl;
+		bool bConnected;			// the client came before ConnectNamedPipe
+	};
+
+	PIPE_INSTANCE* m_arrInst[PIPE_BACKLOG_MAX];
+	DWORD m_nInstances;
+	volatile LONG m_lBacklog;		// wanted number of instances
+	HANDLE m_evBacklog;				// m_lBacklog changed
 	HANDLE m_evStop;
 	CCritSec m_cs;
-	OVERLAPPED m_ovl;
 	char* m_pszName;
 	char* m_pszPipeName;
 	HSA m_hSA;
 	int m_nCounter;
+	DWORD m_dwOutBufSize;			// pipe buffer sizes passed to CreateNamedPipe
+	DWORD m_dwInBufSize;
+
+	PIPE_INSTANCE* Post()
+	{
+		PIPE_INSTANCE* inst = new PIPE_INSTANCE;
+		memset(inst, 0, sizeof(*inst));
+		inst->hPipe = CreateNamedPipe(
+			m_pszPipeName,
+			PIPE_ACCESS_DUPLEX|FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_MESSAGE|PIPE_READMODE_MESSAGE|PIPE_WAIT,
+			PIPE_UNLIMITED_INSTANCES,
+			m_dwOutBufSize,
+			m_dwInBufSize,
+			PIPE_WAIT_TIMEOUT,
+			SA_Get(m_hSA));
+		if (inst->hPipe == INVALID_HANDLE_VALUE)
+		{
+			delete inst;
+			return NULL;
+		}
+		inst->ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (!ConnectNamedPipe(inst->hPipe, &inst->ovl))
+		{
+			switch(GetLastError())
+			{
+			case ERROR_IO_PENDING:
+				return inst;
+			case ERROR_PIPE_CONNECTED:
+				inst->bConnected = true;
+				SetEvent(inst->ovl.hEvent);
+				return inst;
+			}
+		}
+		Close(inst);
+		return NULL;
+	}
+
+	void Close(PIPE_INSTANCE* inst)
+	{
+		if (!inst->bConnected)
+		{
+			DWORD dwBytes;
+			CancelIoEx(inst->hPipe, &inst->ovl);
+			GetOverlappedResult(inst->hPipe, &inst->ovl, &dwBytes, TRUE);
+		}
+		CloseHandle(inst->hPipe);
+		CloseHandle(inst->ovl.hEvent);
+		delete inst;
+	}
+
+	// bring the pool up to the backlog; excess instances go as they are accepted
+	void Replenish()
+	{
+		while (m_nInstances < (DWORD)m_lBacklog)
+		{
+			PIPE_INSTANCE* inst = Post();
+			if (!inst)
+				break;
+			m_arrInst[m_nInstances++] = inst;
+		}
+	}
+
 public:
-	CPipeServer(const char *epName)
-		: m_hPipe(INVALID_HANDLE_VALUE)
+	// dwOutBufSize/dwInBufSize - pipe buffer sizes (0 - PIPE_READ_BUF_SIZE)
+	CPipeServer(const char *epName, DWORD dwOutBufSize = 0, DWORD dwInBufSize = 0)
+		: m_nInstances(0)
+		, m_lBacklog(PIPE_BACKLOG_DEFAULT)
 		, m_pszName(NULL)
 		, m_pszPipeName(NULL)
 		, m_nCounter(0)
+		, m_dwOutBufSize(dwOutBufSize ? dwOutBufSize : PIPE_READ_BUF_SIZE)
+		, m_dwInBufSize(dwInBufSize ? dwInBufSize : PIPE_READ_BUF_SIZE)
 	{
 		assert(_CrtIsValidHeapPointer(this));
 		m_evStop = CreateEvent(NULL, TRUE, FALSE, NULL);
-		m_ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		m_evBacklog = CreateEvent(NULL, FALSE, FALSE, NULL);
 		m_pszName = new char[strlen(epName) + 1];
 		strcpy_s(m_pszName, strlen(epName) + 1, epName);
 		m_pszPipeName = new char[strlen(epName) + 1 + sizeof(PIPE_PREFIX)];
@@ -525,18 +1142,16 @@ public:
 
 		CloseHandle(m_evStop);
 		m_evStop = NULL;
+		CloseHandle(m_evBacklog);
+		m_evBacklog = NULL;
+
+		while (m_nInstances)
+			Close(m_arrInst[--m_nInstances]);
 
 		delete[] m_pszPipeName;
 		m_pszPipeName = NULL;
 		delete[] m_pszName;
 		m_pszName = NULL;
-		CloseHandle(m_ovl.hEvent);
-		m_ovl.hEvent = NULL;
-		if (m_hPipe != INVALID_HANDLE_VALUE)
-		{
-			CloseHandle(m_hPipe);
-			m_hPipe = INVALID_HANDLE_VALUE;
-		}
 
 		SA_Destroy(m_hSA);
 	}
@@ -547,17 +1162,18 @@ public:
 		CCSLock lock(m_cs);
 		assert(_CrtIsValidHeapPointer(this));
 
-		m_hPipe = CreateNamedPipe(
-			m_pszPipeName,
-			PIPE_ACCESS_DUPLEX|FILE_FLAG_OVERLAPPED,
-			PIPE_TYPE_MESSAGE|PIPE_READMODE_MESSAGE|PIPE_WAIT,
-			PIPE_UNLIMITED_INSTANCES,
-			PIPE_READ_BUF_SIZE,
-			PIPE_READ_BUF_SIZE,
-			PIPE_WAIT_TIMEOUT,
-			SA_Get(m_hSA));
+		Replenish();
+		return m_nInstances != 0;
+	}
 
-		return m_hPipe != INVALID_HANDLE_VALUE;
+	// dwBacklog - instances waiting for clients (0 - PIPE_BACKLOG_DEFAULT);
+	// a running ServerWaitForConnection picks the new size up at once
+	void SetBacklog(DWORD dwBacklog)
+	{
+		if (!dwBacklog)
+			dwBacklog = PIPE_BACKLOG_DEFAULT;
+		InterlockedExchange(&m_lBacklog, min(dwBacklog, (DWORD)PIPE_BACKLOG_MAX));
+		SetEvent(m_evBacklog);
 	}
 
 	HIPCCONNECTION ServerWaitForConnection(DWORD dwTimeout, HANDLE hBreakEvent)
@@ -566,57 +1182,102 @@ public:
 		CCSLock lock(m_cs);
 		assert(_CrtIsValidHeapPointer(this));
 
-		if (!ConnectNamedPipe(m_hPipe, &m_ovl))
+		CTimeout timeout(dwTimeout);
+
+		for (;;)
 		{
-			switch(GetLastError())
+			PIPE_INSTANCE* inst = NULL;
+			while (!inst)
 			{
-			case ERROR_PIPE_CONNECTED:
-				break;
-			case ERROR_IO_PENDING:
+				Replenish();
+				if (!m_nInstances)
+					return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+				HANDLE ev[MAXIMUM_WAIT_OBJECTS];
+				for (DWORD i = 0; i < m_nInstances; ++i)
+					ev[i] = m_arrInst[i]->ovl.hEvent;
+				ev[m_nInstances] = m_evStop;
+				ev[m_nInstances + 1] = m_evBacklog;
+				ev[m_nInstances + 2] = hBreakEvent;
+
+				DWORD dwWait = WaitForMultipleObjects(m_nInstances + (hBreakEvent?3:2), ev, FALSE, timeout.GetTimeLeft());
+				if (dwWait == WAIT_TIMEOUT)
+					return (HIPCCONNECTION) IPC_RC_TIMEOUT; // timeout
+				DWORD i = dwWait - WAIT_OBJECT_0;
+				if (i == m_nInstances)
+					return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE; // destructing
+				if (i == m_nInstances + 1)
+					continue; // backlog changed
+				if (i == m_nInstances + 2)
+					return (HIPCCONNECTION) IPC_RC_TIMEOUT; // user event
+				if (i > m_nInstances)
+					return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+				// take the instance out of the pool, the rest keep accepting
+				inst = m_arrInst[i];
+				m_arrInst[i] = m_arrInst[--m_nInstances];
+
+				DWORD dwBytes;
+				if (!inst->bConnected && !GetOverlappedResult(inst->hPipe, &inst->ovl, &dwBytes, FALSE))
 				{
-					HANDLE hEvnts[] = { m_ovl.hEvent, m_evStop, hBreakEvent };
-					switch (WaitForMultipleObjects(hBreakEvent?3:2, hEvnts, FALSE, dwTimeout))
-					{
-					case WAIT_OBJECT_0:
-						break;
-					case WAIT_OBJECT_0 + 1:
-						return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE; // destructing
-					case WAIT_OBJECT_0 + 2:
-						return (HIPCCONNECTION) IPC_RC_TIMEOUT; // user event
-					case WAIT_TIMEOUT:
-						return (HIPCCONNECTION) IPC_RC_TIMEOUT; // timeout
-					}
-					break;
+					// the client is gone already
+					Close(inst);
+					inst = NULL;
 				}
-			default:
-				return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+				else
+					inst->bConnected = true;
 			}
-		}
 
-		char szEvName[MAX_PATH];
-		sprintf_s(szEvName, "%s_%s_%i", EVENT_SR2R_PREFIX, m_pszName, m_nCounter);
-		HANDLE evSR2R = CreateEvent(SA_Get(m_hSA), FALSE, FALSE, szEvName);
-		sprintf_s(szEvName, "%s_%s_%i", EVENT_CR2R_PREFIX, m_pszName, m_nCounter);
-		HANDLE evCR2R = CreateEvent(SA_Get(m_hSA), FALSE, FALSE, szEvName);
+			// re-arm before the handshake, so a burst of clients finds free instances
+			Replenish();
 
-		OVERLAPPED ovl = { 0, };
-		ovl.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-		DWORD dwWritten = 0;
-		WriteFile(m_hPipe, &m_nCounter, sizeof(m_nCounter), &dwWritten, &ovl);
-		WaitForSingleObject(_Post_ _Notnull_ ovl.hEvent, INFINITE);
-		CloseHandle(_Post_ _Notnull_ ovl.hEvent);
+			HANDLE hPipe = inst->hPipe;
+			CloseHandle(inst->ovl.hEvent);
+			delete inst;
 
-		++m_nCounter;
+			// each direction starts with a full window of credit
+			char szSemName[MAX_PATH];
+			sprintf_s(szSemName, "%s_%s_%i", CREDIT_C2S_PREFIX, m_pszName, m_nCounter);
+			HANDLE hC2S = CreateSemaphore(SA_Get(m_hSA), IPC_CREDIT_WINDOW_DEFAULT, IPC_CREDIT_WINDOW_DEFAULT, szSemName);
+			sprintf_s(szSemName, "%s_%s_%i", CREDIT_S2C_PREFIX, m_pszName, m_nCounter);
+			HANDLE hS2C = CreateSemaphore(SA_Get(m_hSA), IPC_CREDIT_WINDOW_DEFAULT, IPC_CREDIT_WINDOW_DEFAULT, szSemName);
 
-		CPipeTransport* pipe = new CPipeTransport(m_hPipe, evSR2R, evCR2R);
-		m_hPipe = INVALID_HANDLE_VALUE;
-		Create();
-		return (HIPCCONNECTION) pipe;
+			bool bSent = hC2S && hS2C && PipeHandshake(hPipe, true, &m_nCounter, timeout);
+			++m_nCounter;
+			if (bSent)
+			{
+				CPipeTransport* pipe = new CPipeTransport(hPipe, hC2S, hS2C);
+				return (HIPCCONNECTION) pipe;
+			}
+
+			// the client is gone or stuck, wait for the next one
+			if (hC2S)
+				CloseHandle(hC2S);
+			if (hS2C)
+				CloseHandle(hS2C);
+			CloseHandle(hPipe);
+			if (timeout)
+				return (HIPCCONNECTION) IPC_RC_TIMEOUT;
+		}
 	}
 };
 
 class CPipeIpc: public IIpc
 {
+	typedef IPC_HandleRef<CPipeTransport> CPipeRef;
+
+	IPC_HandleTable m_handles;		// connections, a reference per call
+
+	// the handle of a new connection, a full table fails it
+	HIPCCONNECTION AddPipe(CPipeTransport* pipe)
+	{
+		HIPCCONNECTION h = m_handles.add(pipe);
+		if (h != HIPCCONNECTION_INVALID)
+			return h;
+		delete pipe;
+		return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+	}
+
 public:
 	virtual DWORD GetVersion()
 	{
@@ -628,11 +1289,17 @@ public:
 
 	virtual HIPCSERVER ServerStart (const char *epName)
 	{
-		CPipeServer* server = new CPipeServer(epName);
+		return ServerStartEx(epName, 0, 0);
+	}
+
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+	{
+		// the channel sizes tune the server side pipe buffers
+		CPipeServer* server = new CPipeServer(epName, dwSendSize, dwRecvSize);
 		if (server->Create())
 			return (HIPCSERVER) server;
 		delete server;
-		return (HIPCSERVER) IPC_ERR_UNKNOWN;
+		return (HIPCSERVER) IPC_RC_INVALID_HANDLE;
 	}
 
 	virtual BOOL ServerStop (HIPCSERVER hServer)
@@ -649,7 +1316,10 @@ public:
 		assert(hServer);
 		if (!hServer)
 			return (HIPCCONNECTION) IPC_RC_ERROR;
-		return static_cast<CPipeServer*>(hServer)->ServerWaitForConnection(dwTimeout, hBreakEvent);
+		HIPCCONNECTION res = static_cast<CPipeServer*>(hServer)->ServerWaitForConnection(dwTimeout, hBreakEvent);
+		if (!CHECK_IPC_HCONNECTION(res))
+			return res;
+		return AddPipe(static_cast<CPipeTransport*>(res));
 	}
 
 	virtual HIPCCONNECTION Connect (char *pszServerName, DWORD dwTimeout)
@@ -657,66 +1327,258 @@ public:
 		CPipeTransport* pipe = new CPipeTransport();
 		HIPCCONNECTION res = pipe->Connect(pszServerName, dwTimeout);
 		if (static_cast<CPipeTransport*>(res) != pipe)
+		{
 			delete pipe;
-		return res;
+			return res;
+		}
+		return AddPipe(pipe);
 	}
 
 	virtual BOOL CloseConnection (HIPCCONNECTION hConnection)
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeTransport* pipe = static_cast<CPipeTransport*>(m_handles.close(hConnection));
+		if (!pipe)
 			return FALSE;
-		delete static_cast<CPipeTransport*>(hConnection);
+
+		// get the blocked calls out, the handle is freed when they have left
+		pipe->Shutdown();
+		m_handles.remove(hConnection);
+		delete pipe;
 		return TRUE;
 	}
 
 	virtual DWORD Recv (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return IPC_RC_ERROR;
-		return static_cast<CPipeTransport*>(hConnection)->Recv(pvBuf, dwBufSize, dwTimeout);
+		return pipe->Recv(pvBuf, dwBufSize, dwTimeout);
 	}
 
 	virtual DWORD Send( HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout )
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return IPC_RC_ERROR;
-		return static_cast<CPipeTransport*>(hConnection)->Send(pvBuf, dwBufSize, dwTimeout);
+		return pipe->Send(pvBuf, dwBufSize, dwTimeout);
 	}
 
 	virtual BOOL SetEvents( HIPCCONNECTION hConnection, HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents )
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return FALSE;
-		return static_cast<CPipeTransport*>(hConnection)->SetEvents(pUserEvents, dwUserEventsCount, pIPCEvents);
+		return pipe->SetEvents(pUserEvents, dwUserEventsCount, pIPCEvents);
 	}
 
 	virtual BOOL GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents )
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return FALSE;
-		return static_cast<CPipeTransport*>(hConnection)->GetEvents(pdwUserEvents, pdwIPCEvents);
+		return pipe->GetEvents(pdwUserEvents, pdwIPCEvents);
 	}
 
 	virtual BOOL ResetEvents( HIPCCONNECTION hConnection )
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return FALSE;
-		static_cast<CPipeTransport*>(hConnection)->ResetEvents();
+		pipe->ResetEvents();
 		return TRUE;
 	}
 
 	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection )
 	{
-		assert(hConnection);
-		if (!hConnection)
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
 			return IPC_ERR_UNKNOWN;
-		return static_cast<CPipeTransport*>(hConnection)->GetConnectionLastErr();
+		return pipe->GetConnectionLastErr();
+	}
+
+	// the client side of a pipe has no buffers of its own
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+	{ return Connect(pszServerName, dwTimeout); }
+
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->SendReserve(dwSize, ppvBuf, dwTimeout);
+	}
+
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->SendCommit(pvBuf, dwSize);
+	}
+
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->RecvView(ppvBuf, dwTimeout);
+	}
+
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return FALSE;
+		return pipe->RecvRelease(pvBuf);
+	}
+
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+	{
+		// pipe messages are streamed, there are no shared sections to tune
+		CPipeRef pipe(m_handles, hConnection);
+		return pipe != NULL;
+	}
+
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+	{
+		// pipe waits are overlapped I/O completions, there is nothing to poll
+		CPipeRef pipe(m_handles, hConnection);
+		return pipe != NULL;
+	}
+
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+	{
+		// a pipe message is a single write under an in-process lock, no ring to claim
+		CPipeRef pipe(m_handles, hConnection);
+		return pipe != NULL;
+	}
+
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->SendV(pBufs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->RecvV(pBufs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->SendBatch(pMsgs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return IPC_RC_ERROR;
+		return pipe->RecvBatch(pMsgs, dwCount, pdwSizes, dwTimeout);
+	}
+
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+	{
+		assert(hServer);
+		if (!hServer)
+			return FALSE;
+		static_cast<CPipeServer*>(hServer)->SetBacklog(dwBacklog);
+		return TRUE;
+	}
+
+	virtual HIPCPOLL PollCreate ()
+	{
+		IPC_PollSet* pSet = new IPC_PollSet();
+		if (!pSet)
+			return IPC_RC_INVALID_HANDLE;
+		if (!pSet->isValid())
+		{
+			delete pSet;
+			return IPC_RC_INVALID_HANDLE;
+		}
+		return pSet;
+	}
+
+	virtual BOOL PollClose (HIPCPOLL hPoll)
+	{
+		assert(hPoll);
+		if (!hPoll)
+			return FALSE;
+		delete static_cast<IPC_PollSet*>(hPoll);
+		return TRUE;
+	}
+
+	virtual BOOL PollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents)
+	{
+		assert(hPoll);
+		CPipeRef pipe(m_handles, hConnection);
+		if (!hPoll || !pipe)
+			return FALSE;
+		return static_cast<IPC_PollSet*>(hPoll)->add(pipe, hConnection, dwEvents) == 0;
+	}
+
+	virtual BOOL PollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConnection)
+	{
+		assert(hPoll);
+		CPipeRef pipe(m_handles, hConnection);
+		if (!hPoll || !pipe)
+			return FALSE;
+		return static_cast<IPC_PollSet*>(hPoll)->remove(pipe) == 0;
+	}
+
+	virtual DWORD PollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout)
+	{
+		assert(hPoll);
+		if (!hPoll)
+			return IPC_RC_ERROR;
+		DWORD dwReady;
+		DWORD dwErr = static_cast<IPC_PollSet*>(hPoll)->wait(pEvents, dwCount, dwTimeout, dwReady);
+		return dwErr ? IPC_ERR_TO_RC(dwErr) : dwReady;
+	}
+
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return FALSE;
+		return IPC_AsyncEngine::instance().post(pipe, hConnection,
+			IPC_AsyncEngine::SEND, pvBuf, dwBufSize, pfnCallback, pvContext) == 0;
+	}
+
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return FALSE;
+		return IPC_AsyncEngine::instance().post(pipe, hConnection,
+			IPC_AsyncEngine::RECV, pvBuf, dwBufSize, pfnCallback, pvContext) == 0;
+	}
+
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+	{
+		CPipeRef pipe(m_handles, hConnection);
+		if (!pipe)
+			return FALSE;
+		IPC_AsyncEngine::instance().cancel(pipe, pvContext);
+		return TRUE;
+	}
+
+	virtual IPC_PollSource * PollAcquire (HIPCCONNECTION hConnection)
+	{
+		return static_cast<CPipeTransport*>(m_handles.acquire(hConnection));
+	}
+
+	virtual void PollRelease (HIPCCONNECTION hConnection)
+	{
+		m_handles.release(hConnection);
 	}
 };
 
@@ -789,20 +1651,100 @@ IPC_API BOOL __stdcall IPC_ResetEvents( HIPCCONNECTION hConnection )
 IPC_API DWORD __stdcall IPC_GetConnectionLastErr( HIPCCONNECTION hConnection )
 { return g_pIpc->GetConnectionLastErr(hConnection); }
 
-////////////////////////////////////////////////////////////////
-// not implemented
+IPC_API HIPCSERVER __stdcall IPC_ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+{ return g_pIpc->ServerStartEx(epName, dwSendSize, dwRecvSize); }
+
+IPC_API HIPCCONNECTION __stdcall IPC_ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+{ return g_pIpc->ConnectEx(pszServerName, dwTimeout, dwSendSize, dwRecvSize); }
+
+IPC_API DWORD __stdcall IPC_SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+{ return g_pIpc->SendReserve(hConnection, dwSize, ppvBuf, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+{ return g_pIpc->SendCommit(hConnection, pvBuf, dwSize); }
+
+IPC_API DWORD __stdcall IPC_RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+{ return g_pIpc->RecvView(hConnection, ppvBuf, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+{ return g_pIpc->RecvRelease(hConnection, pvBuf); }
+
+IPC_API BOOL __stdcall IPC_SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+{ return g_pIpc->SetSectionThreshold(hConnection, dwThreshold); }
+
+IPC_API BOOL __stdcall IPC_SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+{ return g_pIpc->SetSpinTime(hConnection, dwMicroseconds); }
 
-IPC_API HIPCSERVER __stdcall IPC_ServerDgStart (char *pszDgServerName)
-{ return ( HIPCSERVER )IPC_RC_ERROR; }
+IPC_API BOOL __stdcall IPC_SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+{ return g_pIpc->SetMultiProducer(hConnection, bEnable); }
 
-IPC_API BOOL __stdcall IPC_ServerDgStop (HIPCSERVER hServer)
-{ return FALSE; }
+IPC_API DWORD __stdcall IPC_SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->SendV(hConnection, pBufs, dwCount, dwTimeout); }
 
-IPC_API DWORD __stdcall IPC_DgRecv (char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
-{ return IPC_RC_ERROR; }
+IPC_API DWORD __stdcall IPC_RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->RecvV(hConnection, pBufs, dwCount, dwTimeout); }
 
-IPC_API DWORD __stdcall IPC_DgSend (char *pszDgServerName, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
-{ return IPC_RC_ERROR; }
+IPC_API DWORD __stdcall IPC_SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->SendBatch(hConnection, pMsgs, dwCount, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+{ return g_pIpc->RecvBatch(hConnection, pMsgs, dwCount, pdwSizes, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+{ return g_pIpc->SetBacklog(hServer, dwBacklog); }
+
+IPC_API HIPCPOLL __stdcall IPC_PollCreate ()
+{ return g_pIpc->PollCreate(); }
+
+IPC_API BOOL __stdcall IPC_PollClose (HIPCPOLL hPoll)
+{ return g_pIpc->PollClose(hPoll); }
+
+IPC_API BOOL __stdcall IPC_PollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConnection, DWORD dwEvents)
+{ return g_pIpc->PollAdd(hPoll, hConnection, dwEvents); }
+
+IPC_API BOOL __stdcall IPC_PollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConnection)
+{ return g_pIpc->PollRemove(hPoll, hConnection); }
+
+IPC_API DWORD __stdcall IPC_PollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *pEvents, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->PollWait(hPoll, pEvents, dwCount, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{ return g_pIpc->SendAsync(hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+IPC_API BOOL __stdcall IPC_RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{ return g_pIpc->RecvAsync(hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+IPC_API BOOL __stdcall IPC_CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+{
+	if (! g_pIpc->CancelAsync(hConnection, pvContext)) return FALSE;
+
+	// the async RPC calls as well
+	IPC_PollSourceRef src(*g_pIpc, hConnection);
+	IPC_RpcEngine::instance().cancel(src, pvContext);
+	return TRUE;
+}
+
+IPC_API BOOL __stdcall IPC_ServerRun (HIPCSERVER hServer, IPC_SERVER_HANDLER pfnHandler, void *pvContext, DWORD dwWorkers, HANDLE hStopEvent)
+{
+	IPC_ServeRunner runner(*g_pIpc, pfnHandler, pvContext);
+	return runner.run(hServer, dwWorkers, hStopEvent) == 0;
+}
+
+IPC_API DWORD __stdcall IPC_Call (HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, DWORD dwTimeout)
+{
+	DWORD rsz = 0;
+	DWORD err = IPC_RpcEngine::instance().call(*g_pIpc, hConnection, pvRequest, dwRequestSize, pvReply, dwReplySize, dwTimeout, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC(err);
+}
+
+IPC_API BOOL __stdcall IPC_CallAsync (HIPCCONNECTION hConnection, const void *pvRequest, DWORD dwRequestSize, void *pvReply, DWORD dwReplySize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{ return IPC_RpcEngine::instance().callAsync(*g_pIpc, hConnection, pvRequest, dwRequestSize, pvReply, dwReplySize, pfnCallback, pvContext) == 0; }
+
+IPC_API DWORD __stdcall IPC_Reply (HIPCCONNECTION hConnection, DWORD dwCallId, const void *pvReply, DWORD dwReplySize, DWORD dwTimeout)
+{ return IPC_RpcEngine::reply(*g_pIpc, hConnection, dwCallId, pvReply, dwReplySize, dwTimeout); }
+
+////////////////////////////////////////////////////////////////
+// not implemented
 
 IPC_API void __stdcall IPC_Init ()
 {}
@@ -0,0 +1,45 @@
+// ipc_credit.h
+//
+// Interprocess communication library (IPC)
+//
+// Credit-based flow control for message transports
+//
+// The receiver starts the sender with a window of messages it may have in
+// flight and hands the consumed messages back in batches; the sender writes
+// while it holds credit. The named pipe transport posts the grants to a
+// named semaphore. The Unix socket transports use none: a SOCK_SEQPACKET
+// writer already blocks on the receiver's socket buffer.
+//
+
+#ifndef _ipc_credit_h_INCLUDED_
+#define _ipc_credit_h_INCLUDED_ 1
+
+#define IPC_CREDIT_WINDOW_DEFAULT	32
+
+// receiver side: counts consumed messages, returns credit in batches of half the window
+class IPC_CreditGrant
+{
+	DWORD m_dwWindow;
+	DWORD m_dwConsumed;
+
+public:
+	explicit IPC_CreditGrant(DWORD dwWindow = IPC_CREDIT_WINDOW_DEFAULT)
+		: m_dwWindow(dwWindow ? dwWindow : 1)
+		, m_dwConsumed(0)
+	{
+	}
+
+	DWORD window() const { return m_dwWindow; }
+
+	// one message fully read; returns the credit to hand back now, 0 to keep batching
+	DWORD consume()
+	{
+		if (++m_dwConsumed < (m_dwWindow + 1) / 2)
+			return 0;
+		DWORD dwGrant = m_dwConsumed;
+		m_dwConsumed = 0;
+		return dwGrant;
+	}
+};
+
+#endif // _ipc_credit_h_INCLUDED_
@@ -0,0 +1,295 @@
+// ipc_dgram.h
+//
+// Interprocess communication library (IPC)
+//
+// Datagram endpoints: a multi-producer/single-consumer ring in a named
+// shared memory segment
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_dgram_h_INCLUDED_
+#define _ipc_dgram_h_INCLUDED_ 1
+
+#ifdef _WIN32
+#	include "ipc_impl.h"
+#else
+#	include "ipc_proto.h"
+#endif
+
+////////////////////////////////////////////////////////////////
+// segment layout
+//
+// The segment is an IPC_DG_HDR followed by the ring. Positions are free
+// running byte counters, the ring offset is position & (ringSize-1).
+// A producer claims space by moving 'claim' forward, writes the record
+// and publishes it by storing ~position into the record tag. The owner
+// reads the records in position order and gives the space back by moving
+// 'tail'; the released space is zeroed first, so a tag can never match
+// before its record is published.
+
+const DWORD IPC_DG_MAGIC     = 0x47444A52;	// 'JRDG'
+const DWORD IPC_DG_RING_SIZE = 0x40000;		// power of 2
+const DWORD IPC_DG_ALIGN     = 8;
+const DWORD IPC_DG_WRAP      = 0x80000000;	// record size flag: pad to the ring end
+const DWORD IPC_DG_LINE      = 64;
+const DWORD IPC_DG_MAX_NAME  = 128;
+
+// segment names: kernel objects on Windows, shm_open() paths on POSIX
+#ifdef _WIN32
+const char IPC_DG_PREFIX[]      = "JR-IPC-D-3F9A61C27E04-";
+const char IPC_DG_SUFFIX_WAKE[] = "-W";  // owner wake-up event
+#else
+const char IPC_DG_PREFIX[]      = "/jr-ipc-d-";
+#endif
+
+#pragma pack(push, 8)
+
+struct IPC_DG_REC
+{
+	volatile LONG tag;		// ~position when published, 0 otherwise
+	DWORD         size;		// data size or IPC_DG_WRAP
+};
+
+struct IPC_DG_HDR
+{
+	// set once by the first owner
+	DWORD         magic;
+	DWORD         ringSize;
+	volatile LONG owner;		// process id of the owner, 0 - none
+	unsigned char pad0[IPC_DG_LINE - 12];
+
+	// producers
+	volatile LONG claim;
+	unsigned char pad1[IPC_DG_LINE - 4];
+
+	// consumer
+	volatile LONG tail;
+	volatile LONG waiter;		// the owner sleeps, wake it after publishing
+	volatile LONG wakeSeq;		// futex word on POSIX
+	unsigned char pad2[IPC_DG_LINE - 12];
+};
+
+#pragma pack(pop)
+
+const DWORD IPC_DG_SEGMENT_SIZE = sizeof (IPC_DG_HDR) + IPC_DG_RING_SIZE;
+
+// largest datagram; a quarter of the ring keeps a slow owner from
+// starving the producers with a few big records
+const DWORD IPC_DG_MAX_DATA = IPC_DG_RING_SIZE / 4 - sizeof (IPC_DG_REC);
+
+inline DWORD IPC_DgRecSize (DWORD size)
+	{ return (sizeof (IPC_DG_REC) + size + IPC_DG_ALIGN - 1) & ~(IPC_DG_ALIGN - 1); }
+
+///////////////////////////////////////////////////////////////
+// ring view of a mapped segment
+
+class IPC_DgRing
+{
+public:
+	IPC_DgRing () : m_hdr (NULL), m_ring (NULL), m_size (0), m_tail (0) {}
+
+	void attach (IPC_DG_HDR *hdr)
+	{
+		m_hdr  = hdr;
+		m_ring = (unsigned char *)(hdr + 1);
+		m_size = IPC_DG_RING_SIZE;
+		m_tail = (DWORD)ReadAcquire (&hdr->tail);
+	}
+
+	IPC_DG_HDR * header () const	{ return m_hdr; }
+
+	// producer side, any thread of any process
+	// returns IPC_ERR_XXX, IPC_ERR_TIMEOUT when the ring is full;
+	// bWake - the caller must wake the owner
+	DWORD push (const void *buf, DWORD size, bool& bWake)
+	{
+		DWORD need = IPC_DgRecSize (size);
+		DWORD pos, off, total;
+
+		bWake = false;
+		for (;;) {
+			LONG c = ReadAcquire (&m_hdr->claim);
+			pos   = (DWORD)c;
+			off   = pos & (m_size - 1);
+			total = (off + need > m_size) ? need + (m_size - off) : need;
+
+			if (pos - (DWORD)ReadAcquire (&m_hdr->tail) + total > m_size)
+				return IPC_ERR_TIMEOUT;
+
+			if (InterlockedCompareExchange (&m_hdr->claim, (LONG)(pos + total), c) == c)
+				break;
+		}
+
+		if (total != need) {
+			// the record does not fit before the ring end, pad it
+			IPC_DG_REC *pad = (IPC_DG_REC *)(m_ring + off);
+			pad->size = IPC_DG_WRAP;
+			WriteRelease (&pad->tag, (LONG)~pos);
+			pos += m_size - off;
+			off  = 0;
+		}
+
+		IPC_DG_REC *rec = (IPC_DG_REC *)(m_ring + off);
+		rec->size = size;
+		memcpy (rec + 1, buf, size);
+		WriteRelease (&rec->tag, (LONG)~pos);
+
+		// pairs with the barrier of the owner between 'waiter' and its recheck
+		MemoryBarrier ();
+		bWake = m_hdr->waiter != 0 && InterlockedExchange (&m_hdr->waiter, 0) != 0;
+		return 0;
+	}
+
+	// consumer side, the owner only
+	// returns the next published record, NULL when there is none
+	const IPC_DG_REC * peek (DWORD& size)
+	{
+		for (;;) {
+			DWORD off = m_tail & (m_size - 1);
+			IPC_DG_REC *rec = (IPC_DG_REC *)(m_ring + off);
+
+			if (ReadAcquire (&rec->tag) != (LONG)~m_tail)
+				return NULL;
+
+			if (rec->size & IPC_DG_WRAP) {
+				m_tail += m_size - off;
+				continue;
+			}
+
+			// a producer can not be trusted with our bounds
+			size = (rec->size > IPC_DG_MAX_DATA) ? IPC_DG_MAX_DATA : rec->size;
+			return rec;
+		}
+	}
+
+	// consume the record returned by peek; the space goes back in chunks
+	void pop (DWORD size)
+	{
+		m_tail += IPC_DgRecSize (size);
+		if (m_tail - (DWORD)m_hdr->tail >= m_size / 8)
+			release ();
+	}
+
+	// give the consumed space back to the producers
+	void release ()
+	{
+		DWORD from = (DWORD)m_hdr->tail;
+		DWORD len  = m_tail - from;
+		if (len == 0)
+			return;
+
+		DWORD off   = from & (m_size - 1);
+		DWORD first = (off + len > m_size) ? m_size - off : len;
+		memset (m_ring + off, 0, first);
+		if (len > first)
+			memset (m_ring, 0, len - first);
+
+		WriteRelease (&m_hdr->tail, (LONG)m_tail);
+	}
+
+private:
+	IPC_DG_HDR    *m_hdr;
+	unsigned char *m_ring;
+	DWORD          m_size;
+	DWORD          m_tail;		// consumer position, ahead of hdr->tail until release
+};
+
+///////////////////////////////////////////////////////////////
+// named segment and the owner's wake-up
+
+class IPC_DgSegment
+{
+public:
+	IPC_DgSegment ();
+	~IPC_DgSegment () { close (); }
+
+	// create or open the segment as its owner; returns IPC_ERR_XXX
+	DWORD create (const char *name);
+
+	// open an existing segment; returns IPC_ERR_XXX
+	DWORD open (const char *name);
+
+	void close ();
+
+	// owner: drop the name, later senders find a new segment
+	void remove ();
+
+	IPC_DG_HDR * header () const	{ return m_hdr; }
+
+	// wake the owner
+	void wake ();
+
+	// owner: sleep until woken, unless wakeSeq moved past seen
+	void wait (LONG seen, DWORD tmo);
+
+	static bool isProcessAlive (DWORD pid);
+
+private:
+	IPC_DG_HDR *m_hdr;
+#ifdef _WIN32
+	Handle      m_hMap;
+	MapView     m_view;
+	Handle      m_hWake;
+#else
+	char        m_path[IPC_DG_MAX_NAME + 16];
+
+	DWORD map (int fd, bool bCreate);
+#endif
+
+	IPC_DgSegment (const IPC_DgSegment&);
+	IPC_DgSegment& operator= (const IPC_DgSegment&);
+};
+
+///////////////////////////////////////////////////////////////
+// datagram endpoints of this process and the senders' cache
+
+struct IPC_DgEndpoint;
+struct IPC_DgSender;
+
+class IPC_DgEngine
+{
+public:
+	IPC_DgEngine ();
+	~IPC_DgEngine ();
+
+	// returns the endpoint handle, NULL on error
+	HIPCSERVER start (const char *name);
+
+	// returns IPC_ERR_XXX
+	DWORD stop (HIPCSERVER h);
+
+	// returns IPC_ERR_XXX
+	DWORD send (const char *name, const void *buf, DWORD size, DWORD tmo);
+
+	// returns IPC_ERR_XXX, rsz - datagram size
+	DWORD recv (const char *name, void *buf, DWORD size, DWORD tmo, DWORD& rsz);
+
+	// waits for the first datagram only; returns IPC_ERR_XXX, count - datagrams received
+	DWORD recvBatch (const char *name, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received);
+
+	static inline IPC_DgEngine& instance () { return g_instance; }
+
+private:
+	IPC_DgEndpoint * findEndpoint (const char *name);
+	void releaseEndpoint (IPC_DgEndpoint *ep);
+
+	IPC_DgSender * findSender (const char *name, IPC_DgSender *stale);
+	void releaseSender (IPC_DgSender *s);
+
+	// wait for a datagram, ep->csRecv held; returns IPC_ERR_XXX
+	DWORD waitData (IPC_DgEndpoint *ep, DWORD tmo);
+
+	CRITICAL_SECTION m_cs;
+	IPC_DgEndpoint  *m_pEndpoints;
+	IPC_DgSender    *m_pSenders;
+
+	static IPC_DgEngine g_instance;
+
+	IPC_DgEngine (const IPC_DgEngine&);
+	IPC_DgEngine& operator= (const IPC_DgEngine&);
+};
+
+#endif // _ipc_dgram_h_INCLUDED_
@@ -25,6 +25,7 @@
 #define	IPC_API	__declspec(dllexport)
 #include <ipc.h>
 #include <sa.h>
+#include "ipc_proto.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -35,27 +36,19 @@
 class IPC_Runtime;
 class IPC_Server;
 class IPC_Connection;
+class IPC_PollSet;
 
 ////////////////////////////////////////////////////////////////
-// Utilites and constants
-
-const HIPCSERVER     HIPCSERVER_INVALID = 0;
-const HIPCCONNECTION HIPCCONNECTION_INVALID = 0;
-
-// timeout values are limited to 1/4 of max range
-inline bool IsValidTimeout (DWORD tmo)
-	{ return (tmo == INFINITE || tmo < 0x40000000); }
-
-// name limits
-const int IPC_MAX_PATH = MAX_PATH;
-const int IPC_MAX_SERVER_NAME = IPC_MAX_PATH - 40;
+// Win32 kernel objects
 
 // kernel object name components
 const char IPC_PORT_PREFIX[]     = "JR-IPC-P-56828276151E-";  // prefix for port object names
 const char IPC_CONN_PREFIX[]     = "JR-IPC-C-25ECA7CF0DC6-";  // prefix for connection control objects
 
 const char IPC_SUFFIX_AVAIL[]   = "-A";  // 'port available' event
-const char IPC_SUFFIX_MUTEX[]   = "-M";  // port access mutex
+const char IPC_SUFFIX_FREE[]    = "-F";  // free connection slots semaphore
+const char IPC_SUFFIX_REQUEST[] = "-Q";  // posted connection requests semaphore
+const char IPC_SUFFIX_REPLY[]   = "-Y";  // connection reply event (followed by slot index)
 const char IPC_SUFFIX_BUF[]     = "-B";  // connection SHM buffer
 const char IPC_SUFFIX_CLOSE[]   = "-X";  // connection close event
 
@@ -65,18 +58,9 @@ const char IPC_SUFFIX_SERVER[]  = "-SC";  // server->client channel objects
 const char IPC_SUFFIX_SENDRDY[] = "-SR"; // client SendRdy event
 const char IPC_SUFFIX_SEND[]    = "-S";  // client Send event
 const char IPC_SUFFIX_RECV[]    = "-R";  // client Recv event
+const char IPC_SUFFIX_SECTION[] = "-L";  // large message section (followed by sequence number)
 
-const DWORD IPC_BUFFER_SIZE = 0x1000;
-const DWORD IPC_MSG_SIZE_LIMIT = 0x20000000;
-
-inline DWORD IPC_ERR_TO_RC (DWORD ec)
-	{ return (ec == IPC_ERR_TIMEOUT) ? IPC_RC_TIMEOUT : IPC_RC_ERROR; }
-
-inline HIPCSERVER IPC_ERR_TO_HIPCSERVER (DWORD ec)
-	{ return (ec == IPC_ERR_TIMEOUT) ? ( HIPCSERVER ) IPC_RC_TIMEOUT : ( HIPCSERVER ) IPC_RC_INVALID_HANDLE; }
-
-inline HIPCCONNECTION IPC_ERR_TO_HIPCCONNECTION (DWORD ec)
-	{ return (ec == IPC_ERR_TIMEOUT) ? ( HIPCCONNECTION ) IPC_RC_TIMEOUT : ( HIPCCONNECTION ) IPC_RC_INVALID_HANDLE; }
+const DWORD IPC_BUFFER_SIZE = 0x1000;  // port buffer size
 
 ////////////////////////////////////////////////////////////////
 // IPC structures
@@ -102,30 +86,30 @@ struct IPC_CHANNEL_DATA
 struct IPC_PORT_INFO
 {
 	DWORD  serverPid;
+	DWORD  sendSize;  // server preferred server->client channel size (0 - default)
+	DWORD  recvSize;  // server preferred client->server channel size (0 - default)
+	volatile LONG connectSeq;  // bumped by the client when it posts a request
 };
 
-struct IPC_MSG_HDR
-{
-	DWORD msgSize;
-	DWORD pktSize;
-};
+const DWORD IPC_MAX_PKT_SIZE = IPC_BUFFER_SIZE - sizeof (IPC_MSG_HDR);
 
-const DWORD IPC_MSG_INVALID       = 0xFFFFFFFF;
+// multi-producer sends: a locked sender owns the ring while this bit of the
+// claimed position is set (positions are aligned); messages up to this part
+// of the ring are claimed, so a wrap pad wastes a bounded amount of space
+const LONG  IPC_CLAIM_LOCKED   = 1;
+const DWORD IPC_CLAIM_RING_PART = 4;
 
-const DWORD IPC_MAX_PKT_SIZE = IPC_BUFFER_SIZE - sizeof (IPC_MSG_HDR);
+// messages of this size and larger go through a per-message section
+const DWORD IPC_DEFAULT_SECTION_THRESHOLD = IPC_SECTION_THRESHOLD_DEFAULT;
+// sections created but not opened by the receiver yet
+const int IPC_MAX_PENDING_SECTIONS = 8;
 
-// connection establishment request
-// handles are already duplicated to the server process
-struct IPC_CONNECT_REQUEST
-{
-	DWORD  clientPid;
-	char   connName [80];  // UUID
-};
+// spin phase before blocking on a channel event (microseconds)
+const DWORD IPC_SPIN_DEFAULT_US = 20;
+const DWORD IPC_SPIN_MAX_US     = 100;  // adaptive budget limit
 
-struct IPC_CONNECT_REPLY
-{
-	DWORD  status; // zero - OK, nonzero - error
-};
+inline LONGLONG IPC_Ticks ()
+	{ LARGE_INTEGER t; QueryPerformanceCounter (&t); return t.QuadPart; }
 
 #pragma pack(pop)
 
@@ -198,9 +182,6 @@ private:
 ////////////////////////////////////////////////////////////////
 // Utility structures
 
-inline unsigned int IPC_strlen (const char *s)
-	{ return s==NULL ? 0 : strlen(s); }
-
 // IPC connection control
 struct IPC_Control
 {
@@ -217,6 +198,33 @@ struct IPC_Control
 	void close ();
 };
 
+// Bounded spin phase before blocking on a channel event.
+// The budget is kept in performance counter ticks and, unless set
+// explicitly, follows the average of the recent wait durations:
+// short waits are spun, long waits go straight to the kernel.
+class IPC_Spin
+{
+public:
+	IPC_Spin ();
+
+	// spins while *pWord == seen, returns true if the word changed;
+	// t0 receives the start time to be passed to done ()
+	bool spin (const volatile LONG *pWord, LONG seen, LONGLONG& t0);
+
+	// reports the end of a blocking wait
+	void done (LONGLONG t0)  { learn (IPC_Ticks () - t0); }
+
+	// us: spin time in microseconds or IPC_SPIN_ADAPTIVE
+	void setLimit (DWORD us);
+
+private:
+	LONGLONG m_budget;  // spin time, ticks
+	LONGLONG m_avg;     // average wait, ticks
+	DWORD    m_limit;   // explicit spin time or IPC_SPIN_ADAPTIVE
+
+	void learn (LONGLONG dt);
+};
+
 // IPC channel control
 struct IPC_Channel
 {
@@ -226,8 +234,12 @@ struct IPC_Channel
 	Handle m_hRecv;         // 'ready to receive/data received' event
 	unsigned char * m_buffer;
 	DWORD  m_bufSize;
+	IPC_RING_HDR * m_ring;  // connection channels only
+	IPC_Spin m_spin;        // waits for the peer on this channel
+	LONG   m_seenHead;      // peer position seen by the last ringPeek
+	LONG   m_seenTail;      // peer position seen by the last ringReserve
 
-	IPC_Channel () : m_buffer(NULL), m_bufSize (0) {}
+	IPC_Channel () : m_buffer(NULL), m_bufSize (0), m_ring (NULL), m_seenHead (0), m_seenTail (0) {}
 	~IPC_Channel ()  { close (); }
 
 	// pathBuf contains prefix of length prefixLen
@@ -237,6 +249,24 @@ struct IPC_Channel
 	void setBuffer (void *buf)
 		{ m_buffer = (unsigned char *)buf; }
 
+	// buf points to IPC_RING_HDR followed by dataSize bytes of ring data
+	void setRing (void *buf, DWORD dataSize)
+		{ m_ring = (IPC_RING_HDR *)buf; m_buffer = (unsigned char *)(m_ring + 1); m_bufSize = dataSize; }
+
+	// sender side: returns slot for a packet of [minPkt, maxPkt] bytes
+	// (actual size in pktSize) or NULL if the ring is full
+	IPC_MSG_HDR * ringReserve (DWORD minPkt, DWORD maxPkt, DWORD& pktSize);
+	void ringCommit (DWORD pktSize);
+
+	// receiver side: returns the next packet or NULL if the ring is empty
+	const IPC_MSG_HDR * ringPeek ();
+	DWORD ringPktSize (const IPC_MSG_HDR *hdr) const;  // validated hdr->pktSize
+	void ringRelease (const IPC_MSG_HDR *hdr);
+
+	// the barrier orders the head/tail update before the waiter flag check
+	void notifyData ()   { MemoryBarrier (); if (m_ring->dataWaiter) SetEvent (m_hSend); }
+	void notifySpace ()  { MemoryBarrier (); if (m_ring->spaceWaiter) SetEvent (m_hRecv); }
+
 	void close ();
 
 	DWORD lock (DWORD tmo);  // returns IPC_ERR_XXXX
@@ -268,7 +298,7 @@ private:
 };
 
 ////////////////////////////////////////////////////////////////
-// Port access lock (event+mutex pair)
+// Port access (availability event + free slots semaphore)
 
 class IPC_PortAccess
 {
@@ -278,33 +308,328 @@ public:
 
 	bool create (SECURITY_ATTRIBUTES *pSA, char *pathBuf, unsigned int prefixLen);
 	void close ()
-		{ m_hAvail.close (); m_hMutex.close (); }
+		{ m_hAvail.close (); m_hFree.close (); }
 
 	void allowAccess ()  { SetEvent (m_hAvail); }
 	void blockAccess ()  { ResetEvent (m_hAvail); }
 
-	// returns WAIT_OBJECT_0 (success)
+	// both return WAIT_OBJECT_0 (success)
 	// WAIT_TIMEOUT or other error instead
-	DWORD waitAccess (DWORD tmo);
+	DWORD waitAccess (DWORD tmo);  // the server is listening
+	DWORD waitSlot (DWORD tmo);    // a connection slot is reserved
+
+	// returns the reserved slot to the port
+	void releaseSlot ()  { ReleaseSemaphore (m_hFree, 1, NULL); }
+
+	// takes a free slot of the reservation, returns its index
+	static int claimSlot (IPC_CONNECT_SLOT *slots);
 
 	bool isValid () const
-		{ return m_hAvail.isValid () && m_hMutex.isValid (); }
+		{ return m_hAvail.isValid () && m_hFree.isValid (); }
 
 private:
 	Handle m_hAvail;  // 'port available' event
-	Handle m_hMutex;  // access mutex
+	Handle m_hFree;   // free slots semaphore
+};
+
+////////////////////////////////////////////////////////////////
+// Poll set
+
+const int IPC_POLL_MAX_HANDLES = 4;  // kernel objects watched per connection
+
+struct IPC_PollEntry;
+struct IPC_AsyncConn;
+struct IPC_RpcConn;
+
+// connection of either transport as seen by a poll set, the async and RPC engines
+class IPC_PollSource
+{
+public:
+	IPC_PollSource () : m_pPollEntry (NULL), m_pAsyncConn (NULL), m_pRpcConn (NULL) {}
+
+	// IPC_POLL_XXX bits of events that are ready now
+	virtual DWORD pollCheck (DWORD events) = 0;
+
+	// kernel objects signaled when the readiness may have changed
+	virtual int pollHandles (DWORD events, HANDLE *hdls) = 0;
+
+	// make the peer signal pollHandles on a change / stop it again;
+	// pollArm is called before every wait, also when already armed
+	virtual void pollArm (DWORD events) = 0;
+	virtual void pollDisarm (DWORD events) = 0;
 
-	friend class IPC_PortAccessHolder;
+	// the wait on pollHandles ()[index] was satisfied
+	virtual void pollFired (int index) {}
+
+	// transfer of the async engine: does not wait for the message to start,
+	// returns the message size, IPC_RC_TIMEOUT if it cannot start or IPC_RC_ERROR
+	virtual DWORD asyncSend (const void *buf, DWORD size) = 0;
+	virtual DWORD asyncRecv (void *buf, DWORD size) = 0;
+
+protected:
+	// the owner calls it before the handles are closed
+	void pollRemove ();
+
+	// the owner calls it after the blocked calls are woken up, before the
+	// handles are closed; the pending async operations fail
+	void asyncDetach ();
+
+	// the same for the pending RPC calls, after asyncDetach
+	void rpcDetach ();
+
+private:
+	IPC_PollEntry *m_pPollEntry;  // entry in the poll set, if any
+	IPC_AsyncConn *m_pAsyncConn;  // async operations, if any
+	IPC_RpcConn   *m_pRpcConn;    // RPC calls, if any
+
+	friend class IPC_PollSet;
+	friend class IPC_AsyncEngine;
+	friend class IPC_RpcEngine;
 };
 
-class IPC_PortAccessHolder
+// Level-triggered readiness of many connections.
+// Each connection gets thread pool waits on its pollHandles, a signaled
+// wait queues the connection for a check; wait () checks only the queued
+// connections, which include those it reported ready last time.
+class IPC_PollSet
 {
 public:
-	IPC_PortAccessHolder (IPC_PortAccess& acc) : m_acc (acc) {}
-	~IPC_PortAccessHolder () { ReleaseMutex (m_acc.m_hMutex); }
+	IPC_PollSet ();
+	~IPC_PollSet ();
+
+	bool isValid () const  { return m_hWake.isValid (); }
+
+	// returns IPC_ERR_XXX
+	// bOneShot - the connection is reported once, then again after rearm ()
+	DWORD add (IPC_PollSource *src, HIPCCONNECTION hConn, DWORD events, bool bOneShot = false);
+	DWORD remove (IPC_PollSource *src);
+	void rearm (IPC_PollSource *src);
+
+	// returns IPC_ERR_XXX, ready - number of events stored;
+	// IPC_ERR_USER_EVENT_SET after interrupt ()
+	DWORD wait (IPC_POLL_EVENT *events, DWORD count, DWORD tmo, DWORD& ready);
+	void interrupt ();
 
 private:
-	IPC_PortAccess& m_acc;
+	CRITICAL_SECTION m_cs;
+	Handle m_hWake;           // a wait fired
+	bool   m_bInterrupted;
+	IPC_PollEntry *m_pFirst;  // all entries
+	IPC_PollEntry *m_pQueue;  // entries to check
+
+	void queue (IPC_PollEntry *e);
+	static void CALLBACK onSignal (PVOID ctx, BOOLEAN bTimedOut);
+
+	IPC_PollSet (const IPC_PollSet&);
+	IPC_PollSet& operator= (const IPC_PollSet&);
+};
+
+////////////////////////////////////////////////////////////////
+// Async engine
+
+const DWORD IPC_ASYNC_MAX_WORKERS = 4;   // completion port threads
+const DWORD IPC_ASYNC_EVENTS      = 64;  // ready connections taken per poll wait
+
+struct IPC_AsyncOp;
+
+// IPC_SendAsync/IPC_RecvAsync of either transport.
+// The operations of a connection run one at a time per direction, in order.
+// A dispatcher thread waits on a poll set holding the directions with
+// pending operations; a ready direction runs its first operation on a
+// completion port thread, which then calls the callback.
+// The threads are started by the first operation and live until the process exits.
+class IPC_AsyncEngine
+{
+public:
+	enum { RECV = 0, SEND = 1 };
+
+	// returns IPC_ERR_XXX
+	DWORD post (IPC_PollSource *src, HIPCCONNECTION hConn, int dir,
+		void *buf, DWORD size, IPC_ASYNC_CALLBACK cb, void *ctx);
+
+	// completes the pending operations of src with IPC_RC_ERROR
+	void detach (IPC_PollSource *src);
+
+	// the same for the operations posted with ctx (all if NULL) that are not running
+	void cancel (IPC_PollSource *src, void *ctx);
+
+	static inline IPC_AsyncEngine& instance () { return g_instance; }
+
+private:
+	IPC_AsyncEngine ();
+	~IPC_AsyncEngine ();
+
+	CRITICAL_SECTION m_cs;
+	IPC_PollSet    m_set;      // directions waiting for readiness
+	Handle         m_hPort;    // completion port of the worker threads
+	bool           m_bStarted;
+	IPC_AsyncConn *m_pDead;    // detached, freed by the dispatcher
+
+	bool start ();
+	void subscribe (IPC_AsyncConn *c);
+	void schedule (IPC_AsyncConn *c, int dir);
+	void run (IPC_AsyncConn *c, int dir);
+
+	static DWORD WINAPI dispatcher (LPVOID param);
+	static DWORD WINAPI worker (LPVOID param);
+
+	static IPC_AsyncEngine g_instance;
+
+	IPC_AsyncEngine (const IPC_AsyncEngine&);
+	IPC_AsyncEngine& operator= (const IPC_AsyncEngine&);
+};
+
+////////////////////////////////////////////////////////////////
+// Server runner
+
+const DWORD IPC_SERVE_MAX_WORKERS = 64;
+const int   IPC_SERVE_BATCH       = 16;  // messages of a connection before it yields the worker
+const DWORD IPC_SERVE_BACKOFF_MAX = 100; // ms between accepts after repeated failures
+
+// transport calls of IPC_ServerRun and the RPC engine, the IPC_XXX API of the transport
+class IPC_ServeOps
+{
+public:
+	virtual HIPCCONNECTION ServerWaitForConnection (HIPCSERVER hServer, DWORD dwTimeout, HANDLE hBreakEvent) = 0;
+	virtual BOOL CloseConnection (HIPCCONNECTION hConnection) = 0;
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout) = 0;
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf) = 0;
+
+	// the connection object with a handle table reference, NULL for a stale
+	// handle; PollRelease drops the reference
+	virtual IPC_PollSource * PollAcquire (HIPCCONNECTION hConnection) = 0;
+	virtual void PollRelease (HIPCCONNECTION hConnection) = 0;
+};
+
+// reference on the connection object of a handle for the duration of one call
+class IPC_PollSourceRef
+{
+public:
+	IPC_PollSourceRef (IPC_ServeOps& ops, HIPCCONNECTION h)
+		: m_ops (ops), m_h (h), m_src (ops.PollAcquire (h)) {}
+	~IPC_PollSourceRef ()
+		{ if (m_src != NULL) m_ops.PollRelease (m_h); }
+
+	operator IPC_PollSource * () const { return m_src; }
+
+private:
+	IPC_ServeOps&   m_ops;
+	HIPCCONNECTION  m_h;
+	IPC_PollSource *m_src;
+
+	IPC_PollSourceRef (const IPC_PollSourceRef&);
+	IPC_PollSourceRef& operator= (const IPC_PollSourceRef&);
+};
+
+struct IPC_ServeConn;
+struct IPC_ServeWorker;
+
+// IPC_ServerRun: the calling thread accepts, a poller thread waits for
+// messages on a one-shot poll set and hands the ready connections to the
+// workers round robin. A worker runs its own queue newest first and steals
+// the oldest connection of another queue when it runs dry; a connection is
+// in one queue or parked in the poll set, so its messages are handled in order.
+class IPC_ServeRunner
+{
+public:
+	IPC_ServeRunner (IPC_ServeOps& ops, IPC_SERVER_HANDLER handler, void *ctx);
+	~IPC_ServeRunner ();
+
+	// returns when hStop is signaled, IPC_ERR_XXX
+	DWORD run (HIPCSERVER hServer, DWORD workers, HANDLE hStop);
+
+private:
+	IPC_ServeOps&      m_ops;
+	IPC_SERVER_HANDLER m_handler;
+	void              *m_ctx;
+
+	IPC_PollSet      m_set;
+	Handle           m_hWork;     // semaphore, a unit per queued connection
+	Handle           m_hStop;     // stops the workers
+	IPC_ServeWorker *m_workers;
+	DWORD            m_nWorkers;
+	DWORD            m_nextWorker;  // round robin of the poller
+
+	CRITICAL_SECTION m_cs;        // m_pConns
+	IPC_ServeConn   *m_pConns;    // all served connections
+
+	void push (DWORD worker, IPC_ServeConn *c, bool bOldest);
+	IPC_ServeConn * pop (DWORD worker);
+	void serve (DWORD worker, IPC_ServeConn *c);
+	void closeConn (IPC_ServeConn *c);
+
+	static DWORD WINAPI poller (LPVOID param);
+	static DWORD WINAPI worker (LPVOID param);
+
+	IPC_ServeRunner (const IPC_ServeRunner&);
+	IPC_ServeRunner& operator= (const IPC_ServeRunner&);
+};
+
+////////////////////////////////////////////////////////////////
+// RPC engine
+
+const DWORD IPC_RPC_EVENTS = 64;  // ready connections taken per poll wait
+const int   IPC_RPC_BATCH  = 16;  // replies of a connection per wakeup
+const DWORD IPC_RPC_SLOTS  = 64;  // pending call table of a connection, a power of 2
+
+struct IPC_RpcCall;
+
+// IPC_Call/IPC_CallAsync of either transport.
+// A request goes out with IPC_CALL_HDR carrying a call id unique on the
+// connection; the caller sends it, then the call is pending until a reply
+// with the same id arrives, in any order. A dispatcher thread waits on a
+// poll set holding the connections with calls, receives the replies and
+// completes the matching calls; the replies nobody waits for are dropped.
+// The thread is started by the first call and lives until the process exits.
+// Each connection locks its own calls, found by id in a slot table;
+// m_cs only attaches the connection state to a source and frees it.
+class IPC_RpcEngine
+{
+public:
+	// returns IPC_ERR_XXX, rsz - reply size
+	DWORD call (IPC_ServeOps& ops, HIPCCONNECTION hConn, const void *req, DWORD reqSize,
+		void *reply, DWORD replySize, DWORD tmo, DWORD& rsz);
+
+	// returns IPC_ERR_XXX, cb gets the reply size or IPC_RC_ERROR
+	DWORD callAsync (IPC_ServeOps& ops, HIPCCONNECTION hConn, const void *req, DWORD reqSize,
+		void *reply, DWORD replySize, IPC_ASYNC_CALLBACK cb, void *ctx);
+
+	// server side: returns the reply size or IPC_RC_XXX like IPC_Send
+	static DWORD reply (IPC_ServeOps& ops, HIPCCONNECTION hConn, DWORD callId,
+		const void *buf, DWORD size, DWORD tmo);
+
+	// completes the pending calls of src with IPC_RC_ERROR
+	void detach (IPC_PollSource *src);
+
+	// the same for the async calls posted with ctx (all if NULL)
+	void cancel (IPC_PollSource *src, void *ctx);
+
+	static inline IPC_RpcEngine& instance () { return g_instance; }
+
+private:
+	IPC_RpcEngine ();
+	~IPC_RpcEngine ();
+
+	CRITICAL_SECTION m_cs;
+	IPC_PollSet  m_set;      // connections with calls
+	bool         m_bStarted;
+	IPC_RpcConn *m_pDead;    // detached, freed by the dispatcher
+
+	bool start ();
+	IPC_RpcConn * acquire (IPC_PollSource *src, IPC_ServeOps *ops, HIPCCONNECTION hConn, DWORD& err);
+	DWORD post (IPC_ServeOps& ops, HIPCCONNECTION hConn, IPC_RpcCall *call,
+		const void *req, DWORD reqSize, DWORD tmo, IPC_RpcConn *&conn);
+	void release (IPC_RpcConn *c);
+	void receive (IPC_RpcConn *c);
+
+	static void complete (IPC_RpcCall *call, DWORD err);
+	static DWORD WINAPI dispatcher (LPVOID param);
+
+	static IPC_RpcEngine g_instance;
+
+	IPC_RpcEngine (const IPC_RpcEngine&);
+	IPC_RpcEngine& operator= (const IPC_RpcEngine&);
 };
 
 ////////////////////////////////////////////////////////////////
@@ -316,17 +641,22 @@ public:
 	IPC_Server ();
 	~IPC_Server ();
 
-	DWORD listen (const char *epName);
+	// sendSize/recvSize - preferred channel sizes for accepted connections (0 - default)
+	DWORD listen (const char *epName, DWORD sendSize = 0, DWORD recvSize = 0);
 	BOOL  unlisten ();
 
+	// may be called by several threads at once, each takes its own request
 	IPC_Connection * accept (DWORD tmo, DWORD& err, HANDLE hBreakEvent = NULL);
 
 private:
 	IPC_PortAccess m_portAccess; // port access
-	Handle      m_hBuffer;     // IPC buffer for port info and connection channel
+	Handle      m_hBuffer;     // IPC buffer for port info and connection slots
 	MapView     m_buffer;
 	IPC_Control m_control;     // connection control
-	IPC_Channel m_channel;     // send/receive channel for connection requests
+	Handle      m_hRequest;    // posted connection requests semaphore
+	Handle      m_hReply [IPC_CONNECT_SLOTS]; // per slot 'reply ready' events
+	IPC_Spin    m_spin;        // waits for connection requests
+	volatile LONG m_accepting; // accept () calls in progress
 
 	IPC_Server (const IPC_Connection&);
 	IPC_Server& operator= (const IPC_Connection&);
@@ -337,24 +667,68 @@ private:
 ////////////////////////////////////////////////////////////////
 // Connection object
 
-class IPC_Connection
+class IPC_Connection : public IPC_PollSource
 {
 public:
 	IPC_Connection ();
 	~IPC_Connection ();
 
 	// returns IPC_ERR_XXX
-	DWORD connect (const char *epName, DWORD tmo);
+	// sendSize/recvSize - requested channel sizes (0 - default),
+	// the larger of the client and server preferences is used
+	DWORD connect (const char *epName, DWORD tmo, DWORD sendSize = 0, DWORD recvSize = 0);
 	BOOL close ();
 
+	// mark the connection closed and wake the blocked calls, close () follows
+	void shutdown ();
+
 	// returns IPC_ERR_XXX
 	DWORD send (const void *buf, DWORD bufSize, DWORD tmo);
 	DWORD recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz);
 
+	// scatter/gather: the message is the concatenation of the buffers
+	DWORD sendV (const IPC_BUF *bufs, DWORD count, DWORD tmo);
+	DWORD recvV (const IPC_BUF *bufs, DWORD count, DWORD tmo, DWORD& rsz);
+
+	// batches: one message per buffer, the receiver is woken once per batch;
+	// recvBatch waits for the first message only and then takes the messages
+	// already queued; sent/received - messages transferred before an error,
+	// a truncated message ends the batch but is counted, with its whole size
+	DWORD sendBatch (const IPC_BUF *msgs, DWORD count, DWORD tmo, DWORD& sent);
+	DWORD recvBatch (const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received);
+
+	// zero-copy send: the send channel stays locked from reserve to commit,
+	// both must be called from the same thread; returns IPC_ERR_XXX
+	DWORD sendReserve (DWORD size, void **ppBuf, DWORD tmo);
+	DWORD sendCommit (void *pBuf, DWORD size);
+
+	// zero-copy receive: single packet messages are viewed inside the channel,
+	// the receive side stays locked until recvRelease; returns IPC_ERR_XXX
+	DWORD recvView (const void **ppBuf, DWORD tmo, DWORD& rsz);
+	DWORD recvRelease (const void *pBuf);
+
 	BOOL setUserEvent (HANDLE hEvent);
 	BOOL getUserEvent (HANDLE *phEvent);
 	BOOL resetUserEvent ();
 
+	// messages of threshold bytes and larger are passed in a separate section
+	BOOL setSectionThreshold (DWORD threshold);
+
+	// spin time before blocking (microseconds or IPC_SPIN_ADAPTIVE)
+	BOOL setSpinTime (DWORD us);
+
+	// multi-producer mode: single packet messages bypass the channel mutex,
+	// the sending threads claim ring space and publish in claim order
+	BOOL setMultiProducer (BOOL bEnable);
+
+	// IPC_PollSource
+	virtual DWORD pollCheck (DWORD events);
+	virtual int pollHandles (DWORD events, HANDLE *hdls);
+	virtual void pollArm (DWORD events);
+	virtual void pollDisarm (DWORD events);
+	virtual DWORD asyncSend (const void *buf, DWORD size);
+	virtual DWORD asyncRecv (void *buf, DWORD size);
+
 	DWORD getLastError () const { return m_lastError; }
 
 	bool initClientSide (IPC_CONNECT_REQUEST *connData);
@@ -367,7 +741,37 @@ private:
 	IPC_Control m_control;     // connection control
 	IPC_Channel m_sendChannel; // send channel
 	IPC_Channel m_recvChannel; // receive channel
+	bool        m_bDataPending;  // data committed without notifyData (batch)
+	bool        m_bMultiProducer;
+	volatile LONG m_sendClaim; // ring position claimed by the senders | IPC_CLAIM_LOCKED
+	DWORD       m_pollArmed;   // IPC_POLL_XXX counted in the ring waiter fields
 	HANDLE      m_hUserEvent;  // user event object
+	char        m_connName [80];
+	bool        m_bServerSide;
+
+	// large message sections
+	DWORD       m_sectionThreshold;
+	DWORD       m_sectionSeq;  // last section sent
+	Handle      m_sections [IPC_MAX_PENDING_SECTIONS];  // not opened by the receiver yet
+	DWORD       m_sectionSeqs [IPC_MAX_PENDING_SECTIONS];
+
+	// pending sendReserve
+	IPC_MSG_HDR   *m_reserveHdr;     // ring slot, NULL if m_reserveBuf is used
+	unsigned char *m_reserveBuf;     // buffer for messages larger than the ring
+	DWORD          m_reserveBufSize;
+	DWORD          m_reserveSize;    // IPC_MSG_INVALID - no reservation
+	DWORD          m_reserveTimeout; // applies to the commit as well
+	Handle         m_reserveSection; // section for messages above the threshold
+	MapView        m_reserveView;
+	DWORD          m_reserveSeq;
+
+	// pending recvView
+	const IPC_MSG_HDR *m_viewHdr;    // ring packet, NULL if m_viewBuf is used
+	const void    *m_viewPtr;        // NULL - no view
+	unsigned char *m_viewBuf;        // buffer for messages split into packets
+	DWORD          m_viewBufSize;
+	Handle         m_viewSection;    // adopted large message section
+	MapView        m_viewMap;
 
 	DWORD m_lastError;
 
@@ -377,6 +781,37 @@ private:
 	DWORD setLastError (DWORD ec)
 		{ m_lastError = ec; return ec; }
 
+	// wait for a channel event together with hClose and the peer process;
+	// bFirst waits also for the user event with the (remaining) timeout
+	DWORD waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0);
+	// the same for the peer position seen by the caller (multi-producer sends)
+	DWORD waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0, LONG seen);
+
+	// send/receive message with the channel locked
+	// bDefer: don't notify the receiver after the last packet (m_bDataPending)
+	// bWhole: a message the ring cannot take in one packet now goes in a
+	// section, so nothing waits after the first packet (async sends)
+	DWORD sendLocked (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0, bool bDefer = false, bool bWhole = false);
+	// rsz - bytes stored; the whole message size with IPC_ERR_MSG_TRUNCATED
+	DWORD recvLocked (IPC_BufCursor& data, DWORD tmo, DWORD t0, DWORD& rsz);
+
+	// multi-producer mode: send a single packet message without the mutex;
+	// the locked senders stop the claims and own the ring head until unlock
+	DWORD sendShared (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0);
+	void  lockClaims ();
+	void  unlockClaims ();
+	void  waitPublished (DWORD pos);
+
+	// wait for the first packet of the next message
+	const IPC_MSG_HDR * recvPeek (DWORD tmo, DWORD t0, DWORD& err);
+
+	// large message sections
+	void  formatSectionName (char *pathBuf, bool bSend, DWORD seq);
+	void  sweepSections ();
+	DWORD createSection (DWORD size, Handle& hSection, MapView& view, DWORD& seq, DWORD tmo, DWORD t0);
+	DWORD sendSection (Handle& hSection, DWORD seq, DWORD size, DWORD tmo, DWORD t0);
+	DWORD openSection (const IPC_MSG_HDR *msgHdr, Handle& hSection, MapView& view, DWORD& size);
+
 	void waitForOperationsComplete(DWORD tmo = INFINITE);
 
 	IPC_Connection (const IPC_Connection&);
@@ -396,16 +831,46 @@ public:
 
 	DWORD getVersion ();
 
-	HIPCSERVER serverStart (const char *epName);
+	HIPCSERVER serverStart (const char *epName, DWORD sendSize = 0, DWORD recvSize = 0);
 	BOOL serverStop (HIPCSERVER hServer);
 
 	HIPCCONNECTION serverWaitForConnection (HIPCSERVER hServer, DWORD tmo, HANDLE hBreakEvent = NULL);
-	HIPCCONNECTION connect (const char *epName, DWORD tmo);
+	HIPCCONNECTION connect (const char *epName, DWORD tmo, DWORD sendSize = 0, DWORD recvSize = 0);
 	BOOL closeConnection (HIPCCONNECTION hConn);
 
 	DWORD send (HIPCCONNECTION hConn, const void *buf, DWORD bufSize, DWORD tmo);
 	DWORD recv (HIPCCONNECTION hConn, void *buf, DWORD bufSize, DWORD tmo);
 
+	DWORD sendV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo);
+	DWORD recvV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo);
+
+	DWORD sendBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD tmo);
+	DWORD recvBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo);
+
+	DWORD sendReserve (HIPCCONNECTION hConn, DWORD size, void **ppBuf, DWORD tmo);
+	DWORD sendCommit (HIPCCONNECTION hConn, void *pBuf, DWORD size);
+
+	DWORD recvView (HIPCCONNECTION hConn, const void **ppBuf, DWORD tmo);
+	BOOL recvRelease (HIPCCONNECTION hConn, const void *pBuf);
+
+	BOOL setSectionThreshold (HIPCCONNECTION hConn, DWORD threshold);
+	BOOL setSpinTime (HIPCCONNECTION hConn, DWORD us);
+	BOOL setMultiProducer (HIPCCONNECTION hConn, BOOL bEnable);
+
+	HIPCPOLL pollCreate ();
+	BOOL pollClose (HIPCPOLL hPoll);
+	BOOL pollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConn, DWORD events);
+	BOOL pollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConn);
+	DWORD pollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *events, DWORD count, DWORD tmo);
+
+	BOOL sendAsync (HIPCCONNECTION hConn, void *buf, DWORD bufSize, IPC_ASYNC_CALLBACK cb, void *ctx);
+	BOOL recvAsync (HIPCCONNECTION hConn, void *buf, DWORD bufSize, IPC_ASYNC_CALLBACK cb, void *ctx);
+	BOOL cancelAsync (HIPCCONNECTION hConn, void *ctx);
+
+	// connection of IPC_ServerRun and the RPC engine, with a reference
+	IPC_PollSource * pollAcquire (HIPCCONNECTION hConn) { return static_cast<IPC_Connection *> (m_connections.acquire (hConn)); }
+	void pollRelease (HIPCCONNECTION hConn) { m_connections.release (hConn); }
+
 	BOOL setUserEvent (HIPCCONNECTION hConn, HANDLE hUserEvent);
 	BOOL getUserEvent (HIPCCONNECTION hConn, HANDLE *phUserEvent);
 	BOOL resetUserEvent (HIPCCONNECTION hConnection);
@@ -424,6 +889,10 @@ public:
 
 	SECURITY_ATTRIBUTES * getSecurityAttributes ()	{ return m_pSA; }
 
+	// spinning makes sense on multiprocessor systems only
+	bool canSpin () const	{ return m_bMultiCpu; }
+	LONGLONG usToTicks (DWORD us) const	{ return m_ticksPerSec * us / 1000000; }
+
 private:
 	IPC_Runtime ();
 	IPC_Runtime (const IPC_Runtime&);
@@ -431,6 +900,8 @@ private:
 
 	bool          m_bInitOK;
 	OSVERSIONINFO m_osVersion;
+	bool          m_bMultiCpu;
+	LONGLONG      m_ticksPerSec;
 
 	HSA           m_hSA;
 	SECURITY_ATTRIBUTES *m_pSA;
@@ -452,14 +923,7 @@ private:
 		{ return (( unsigned long )h==IPC_RC_ERROR || ( unsigned long )h==IPC_RC_TIMEOUT) ? NULL : (IPC_Server *)h; }
 
 	// connection handle management
-	static IPC_Connection * getConnection (HIPCCONNECTION h)
-		{ return (( unsigned long )h==IPC_RC_ERROR || ( unsigned long )h==IPC_RC_TIMEOUT) ? NULL : (IPC_Connection *)h; }
-
-	static HIPCCONNECTION registerConnection (IPC_Connection *pConn)
-		{ return (HIPCCONNECTION)pConn; }
-
-	static IPC_Connection *unregisterConnection (HIPCCONNECTION h)
-		{ return (( unsigned long )h==IPC_RC_ERROR || ( unsigned long )h==IPC_RC_TIMEOUT) ? NULL : (IPC_Connection *)h; }
+	IPC_HandleTable m_connections;
 
  // single instance of the runtime
  static IPC_Runtime g_instance;
@@ -470,7 +934,7 @@ private:
 
 inline DWORD IPC_Runtime::send (HIPCCONNECTION hConn, const void *buf, DWORD bufSize, DWORD tmo)
 {
-	IPC_Connection *conn = getConnection (hConn);
+	IPC_ConnectionRef conn (m_connections, hConn);
 	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
 
 	DWORD err = conn->send (buf, bufSize, tmo);
@@ -479,7 +943,7 @@ inline DWORD IPC_Runtime::send (HIPCCONNECTION hConn, const void *buf, DWORD buf
 
 inline DWORD IPC_Runtime::recv (HIPCCONNECTION hConn, void *buf, DWORD bufSize, DWORD tmo)
 {
-	IPC_Connection *conn = getConnection (hConn);
+	IPC_ConnectionRef conn (m_connections, hConn);
 	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
 
 	DWORD rsz = 0;
@@ -487,6 +951,173 @@ inline DWORD IPC_Runtime::recv (HIPCCONNECTION hConn, void *buf, DWORD bufSize,
 	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
 }
 
+inline DWORD IPC_Runtime::sendV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendV (bufs, count, tmo);
+	return (err == 0) ? IPC_BufCursor::totalSize (bufs, count) : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD rsz = 0;
+	DWORD err = conn->recvV (bufs, count, tmo, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD sent = 0;
+	DWORD err = conn->sendBatch (msgs, count, tmo, sent);
+	return (err == 0 || sent != 0) ? sent : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD received = 0;
+	DWORD err = conn->recvBatch (msgs, count, sizes, tmo, received);
+	return (err == 0 || received != 0) ? received : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendReserve (HIPCCONNECTION hConn, DWORD size, void **ppBuf, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendReserve (size, ppBuf, tmo);
+	return (err == 0) ? size : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendCommit (HIPCCONNECTION hConn, void *pBuf, DWORD size)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendCommit (pBuf, size);
+	return (err == 0) ? size : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvView (HIPCCONNECTION hConn, const void **ppBuf, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD rsz = 0;
+	DWORD err = conn->recvView (ppBuf, tmo, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+inline BOOL IPC_Runtime::recvRelease (HIPCCONNECTION hConn, const void *pBuf)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->recvRelease (pBuf) == 0;
+}
+
+inline BOOL IPC_Runtime::setSectionThreshold (HIPCCONNECTION hConn, DWORD threshold)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setSectionThreshold (threshold);
+}
+
+inline BOOL IPC_Runtime::setSpinTime (HIPCCONNECTION hConn, DWORD us)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setSpinTime (us);
+}
+
+inline BOOL IPC_Runtime::setMultiProducer (HIPCCONNECTION hConn, BOOL bEnable)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setMultiProducer (bEnable);
+}
+
+inline HIPCPOLL IPC_Runtime::pollCreate ()
+{
+	IPC_PollSet *poll = new IPC_PollSet ();
+	if (poll == NULL) return (HIPCPOLL)IPC_RC_INVALID_HANDLE;
+	if (! poll->isValid ()) {
+		delete poll;
+		return (HIPCPOLL)IPC_RC_INVALID_HANDLE;
+	}
+	return (HIPCPOLL)poll;
+}
+
+inline BOOL IPC_Runtime::pollClose (HIPCPOLL hPoll)
+{
+	if (hPoll == NULL) return FALSE;
+	delete (IPC_PollSet *)hPoll;
+	return TRUE;
+}
+
+inline BOOL IPC_Runtime::pollAdd (HIPCPOLL hPoll, HIPCCONNECTION hConn, DWORD events)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (hPoll == NULL || conn == NULL) return FALSE;
+
+	return ((IPC_PollSet *)hPoll)->add (conn, hConn, events) == 0;
+}
+
+inline BOOL IPC_Runtime::pollRemove (HIPCPOLL hPoll, HIPCCONNECTION hConn)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (hPoll == NULL || conn == NULL) return FALSE;
+
+	return ((IPC_PollSet *)hPoll)->remove (conn) == 0;
+}
+
+inline DWORD IPC_Runtime::pollWait (HIPCPOLL hPoll, IPC_POLL_EVENT *events, DWORD count, DWORD tmo)
+{
+	if (hPoll == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD ready;
+	DWORD err = ((IPC_PollSet *)hPoll)->wait (events, count, tmo, ready);
+	return (err == 0) ? ready : IPC_ERR_TO_RC (err);
+}
+
+inline BOOL IPC_Runtime::sendAsync (HIPCCONNECTION hConn, void *buf, DWORD bufSize, IPC_ASYNC_CALLBACK cb, void *ctx)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return IPC_AsyncEngine::instance ().post (conn, hConn, IPC_AsyncEngine::SEND, buf, bufSize, cb, ctx) == 0;
+}
+
+inline BOOL IPC_Runtime::recvAsync (HIPCCONNECTION hConn, void *buf, DWORD bufSize, IPC_ASYNC_CALLBACK cb, void *ctx)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return IPC_AsyncEngine::instance ().post (conn, hConn, IPC_AsyncEngine::RECV, buf, bufSize, cb, ctx) == 0;
+}
+
+inline BOOL IPC_Runtime::cancelAsync (HIPCCONNECTION hConn, void *ctx)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	IPC_AsyncEngine::instance ().cancel (conn, ctx);
+	return TRUE;
+}
+
 #endif // _ipc_impl_h_INCLUDED_
 
 
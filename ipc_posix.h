@@ -0,0 +1,146 @@
+// ipc_posix.h
+//
+// Interprocess communication library (IPC)
+//
+// Win32 primitives used by the portable parts of the library, for the
+// POSIX builds; the base types come with ipc_def.h
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_posix_h_INCLUDED_
+#define _ipc_posix_h_INCLUDED_ 1
+
+#ifndef _WIN32
+
+#include <ipc_def.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#	include <linux/futex.h>
+#	include <sys/syscall.h>
+#endif
+
+typedef int32_t       LONG;
+typedef int64_t       LONGLONG;
+typedef uintptr_t     ULONG_PTR;
+typedef unsigned char BYTE;
+
+#define MAX_PATH 260
+
+////////////////////////////////////////////////////////////////
+// interlocked operations, full barriers like their Win32 originals
+
+inline LONG InterlockedCompareExchange (volatile LONG *p, LONG v, LONG cmp)
+	{ __atomic_compare_exchange_n (p, &cmp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); return cmp; }
+
+inline LONG InterlockedExchange (volatile LONG *p, LONG v)
+	{ return __atomic_exchange_n (p, v, __ATOMIC_SEQ_CST); }
+
+inline LONG InterlockedExchangeAdd (volatile LONG *p, LONG v)
+	{ return __atomic_fetch_add (p, v, __ATOMIC_SEQ_CST); }
+
+inline LONG InterlockedIncrement (volatile LONG *p)
+	{ return __atomic_add_fetch (p, 1, __ATOMIC_SEQ_CST); }
+
+inline LONG InterlockedDecrement (volatile LONG *p)
+	{ return __atomic_sub_fetch (p, 1, __ATOMIC_SEQ_CST); }
+
+inline LONG ReadAcquire (const volatile LONG *p)
+	{ return __atomic_load_n (p, __ATOMIC_ACQUIRE); }
+
+inline void WriteRelease (volatile LONG *p, LONG v)
+	{ __atomic_store_n (p, v, __ATOMIC_RELEASE); }
+
+inline void MemoryBarrier ()
+	{ __atomic_thread_fence (__ATOMIC_SEQ_CST); }
+
+inline void YieldProcessor ()
+{
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_ia32_pause ();
+#elif defined (__aarch64__)
+	__asm__ __volatile__ ("yield");
+#endif
+}
+
+////////////////////////////////////////////////////////////////
+// time and threads
+
+inline DWORD GetTickCount ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+inline void Sleep (DWORD ms)
+{
+	struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+	while (nanosleep (&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+inline BOOL SwitchToThread ()
+	{ return sched_yield () == 0; }
+
+inline DWORD GetCurrentProcessId ()
+	{ return (DWORD)getpid (); }
+
+////////////////////////////////////////////////////////////////
+// wait words in shared memory: the futex of the word, no FUTEX_PRIVATE_FLAG
+
+// sleeps while *p == seen, ms milliseconds at most; may return early
+inline void IPC_FutexWait (volatile LONG *p, LONG seen, DWORD ms)
+{
+#ifdef __linux__
+	struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+	syscall (SYS_futex, (LONG *)p, FUTEX_WAIT, seen, (ms == INFINITE) ? NULL : &ts, NULL, 0);
+#else
+	// no futex: poll the word
+	for (DWORD t0 = GetTickCount (); ReadAcquire (p) == seen; ) {
+		if (ms != INFINITE && GetTickCount () - t0 >= ms) break;
+		Sleep (1);
+	}
+#endif
+}
+
+// wakes all the sleepers of the word
+inline void IPC_FutexWake (volatile LONG *p)
+{
+#ifdef __linux__
+	syscall (SYS_futex, (LONG *)p, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)p;
+#endif
+}
+
+////////////////////////////////////////////////////////////////
+// critical section: a recursive process-private mutex
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+inline void InitializeCriticalSection (CRITICAL_SECTION *cs)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (cs, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+inline void DeleteCriticalSection (CRITICAL_SECTION *cs)  { pthread_mutex_destroy (cs); }
+inline void EnterCriticalSection (CRITICAL_SECTION *cs)   { pthread_mutex_lock (cs); }
+inline void LeaveCriticalSection (CRITICAL_SECTION *cs)   { pthread_mutex_unlock (cs); }
+
+#endif // _WIN32
+
+#endif // _ipc_posix_h_INCLUDED_
@@ -0,0 +1,355 @@
+// ipc_proto.h
+//
+// Interprocess communication library (IPC)
+//
+// Implementation defines shared by the Win32 and POSIX backends: limits,
+// the channel ring and connection request layouts, connection handles
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_proto_h_INCLUDED_
+#define _ipc_proto_h_INCLUDED_ 1
+
+#ifndef _WIN32
+#	include "ipc_posix.h"
+#endif
+
+#include <ipc.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+class IPC_Connection;
+
+////////////////////////////////////////////////////////////////
+// Utilites and constants
+
+const HIPCSERVER     HIPCSERVER_INVALID = 0;
+const HIPCCONNECTION HIPCCONNECTION_INVALID = 0;
+
+// timeout values are limited to 1/4 of max range
+inline bool IsValidTimeout (DWORD tmo)
+	{ return (tmo == INFINITE || tmo < 0x40000000); }
+
+// time left from tmo started at t0 (t0 is used only for finite nonzero tmo)
+inline DWORD IPC_RemainingTimeout (DWORD tmo, DWORD t0)
+{
+	if (tmo == INFINITE || tmo == 0) return tmo;
+	DWORD dt = GetTickCount () - t0;
+	return (dt < tmo) ? tmo - dt : 0;
+}
+
+// name limits
+const int IPC_MAX_PATH = MAX_PATH;
+const int IPC_MAX_SERVER_NAME = IPC_MAX_PATH - 40;
+
+const int   IPC_CONNECT_SLOTS = 16;    // connection requests in flight per port
+const DWORD IPC_MSG_SIZE_LIMIT = 0x20000000;
+const DWORD IPC_CACHE_LINE = 64;
+
+// connection channel ring data size, negotiated per connection and direction
+const DWORD IPC_DEFAULT_CHANNEL_SIZE = IPC_CHANNEL_SIZE_DEFAULT;
+const DWORD IPC_MIN_CHANNEL_SIZE     = IPC_CHANNEL_SIZE_MIN;
+const DWORD IPC_MAX_CHANNEL_SIZE     = IPC_CHANNEL_SIZE_MAX;
+
+// requested size rounded up to power of 2 (0 - default size), 0 if too large
+inline DWORD IPC_ChannelSize (DWORD size)
+{
+	if (size == 0) return IPC_DEFAULT_CHANNEL_SIZE;
+	if (size > IPC_MAX_CHANNEL_SIZE) return 0;
+	DWORD n = IPC_MIN_CHANNEL_SIZE;
+	while (n < size) n <<= 1;
+	return n;
+}
+
+inline bool IPC_IsValidChannelSize (DWORD size)
+	{ return size >= IPC_MIN_CHANNEL_SIZE && size <= IPC_MAX_CHANNEL_SIZE && (size & (size - 1)) == 0; }
+
+inline DWORD IPC_ERR_TO_RC (DWORD ec)
+	{ return (ec == IPC_ERR_TIMEOUT) ? IPC_RC_TIMEOUT : IPC_RC_ERROR; }
+
+inline HIPCSERVER IPC_ERR_TO_HIPCSERVER (DWORD ec)
+	{ return (ec == IPC_ERR_TIMEOUT) ? ( HIPCSERVER ) IPC_RC_TIMEOUT : ( HIPCSERVER ) IPC_RC_INVALID_HANDLE; }
+
+inline HIPCCONNECTION IPC_ERR_TO_HIPCCONNECTION (DWORD ec)
+	{ return (ec == IPC_ERR_TIMEOUT) ? ( HIPCCONNECTION ) IPC_RC_TIMEOUT : ( HIPCCONNECTION ) IPC_RC_INVALID_HANDLE; }
+
+////////////////////////////////////////////////////////////////
+// critical section of the pipe and socket transports, and its scope lock
+
+struct CCritSec
+{
+	CCritSec() { InitializeCriticalSection(&m_cs); }
+	~CCritSec() { DeleteCriticalSection(&m_cs); }
+	CRITICAL_SECTION m_cs;
+};
+
+class CCSLock
+{
+	CCritSec& m_cs;
+public:
+	CCSLock(CCritSec& cs): m_cs(cs) { EnterCriticalSection(&m_cs.m_cs); }
+	~CCSLock() { LeaveCriticalSection(&m_cs.m_cs); }
+};
+
+////////////////////////////////////////////////////////////////
+// Shared memory layout
+
+#pragma pack(push,1)
+
+struct IPC_MSG_HDR
+{
+	DWORD msgSize;
+	DWORD pktSize;
+};
+
+const DWORD IPC_MSG_INVALID       = 0xFFFFFFFF;
+const DWORD IPC_MSG_WRAP          = 0xFFFFFFFE;  // ring padding up to the end of the buffer
+const DWORD IPC_MSG_SECTION       = 0x80000000;  // msgSize flag: packet is IPC_SECTION_DESC
+
+// descriptor of a large message passed in a separate shared section
+struct IPC_SECTION_DESC
+{
+	DWORD seq;  // section sequence number (part of the section name)
+};
+
+// connection channel ring header
+// head and tail are free-running byte counters written by the sender and
+// the receiver only; each of them lives on its own cache line together with
+// the other fields written by the same side. A side about to block counts
+// itself in its waiter field, the peer signals the channel event only if
+// the field is nonzero.
+// The ring data (negotiated channel size) follows the header and holds
+// IPC_MSG_HDR records aligned to IPC_RING_ALIGN.
+struct IPC_RING_HDR
+{
+	volatile LONG head;    // bytes written by the sender
+	volatile LONG closed;  // nonzero after either side closed the connection
+	volatile LONG spaceWaiter; // waiters for the ring space (blocked sender, poll sets)
+	BYTE  pad1 [IPC_CACHE_LINE - 3*sizeof (LONG)];
+	volatile LONG tail;    // bytes consumed by the receiver
+	volatile LONG sectionAck;  // last section opened by the receiver
+	volatile LONG dataWaiter;  // waiters for the ring data (blocked receiver, poll sets)
+	BYTE  pad2 [IPC_CACHE_LINE - 3*sizeof (LONG)];
+};
+
+const DWORD IPC_RING_ALIGN   = 8;
+const DWORD IPC_RING_MIN_PKT = 256;  // don't split messages into smaller packets
+
+inline DWORD IPC_RingAlign (DWORD n)
+	{ return (n + IPC_RING_ALIGN - 1) & ~(IPC_RING_ALIGN - 1); }
+
+// connection establishment request
+// handles are already duplicated to the server process
+struct IPC_CONNECT_REQUEST
+{
+	DWORD  clientPid;
+	char   connName [80];  // UUID
+	DWORD  clientSendSize; // client->server channel size
+	DWORD  serverSendSize; // server->client channel size
+};
+
+struct IPC_CONNECT_REPLY
+{
+	DWORD  status; // zero - OK, nonzero - error
+	DWORD  clientSendSize; // accepted channel sizes
+	DWORD  serverSendSize;
+};
+
+// connection request slot states
+const LONG IPC_SLOT_FREE      = 0;
+const LONG IPC_SLOT_CLAIMED   = 1;  // the client fills the request
+const LONG IPC_SLOT_REQUEST   = 2;  // posted, waiting for accept
+const LONG IPC_SLOT_ACCEPTING = 3;  // taken by a server thread
+const LONG IPC_SLOT_REPLIED   = 4;  // reply ready, the client frees the slot
+
+const DWORD IPC_CONNECT_SLOT_SIZE = 2*IPC_CACHE_LINE;
+
+// connection request slot in the port buffer
+// a client owns a slot from claiming it until it reads the reply,
+// so clients connect and server threads accept independently
+struct IPC_CONNECT_SLOT
+{
+	volatile LONG state;
+	IPC_CONNECT_REQUEST request;
+	IPC_CONNECT_REPLY   reply;
+	BYTE  pad [IPC_CONNECT_SLOT_SIZE - sizeof (LONG) - sizeof (IPC_CONNECT_REQUEST) - sizeof (IPC_CONNECT_REPLY)];
+};
+
+// port buffer: IPC_PORT_INFO, then the slots on their own cache lines
+const DWORD IPC_CONNECT_SLOTS_OFFSET = IPC_CACHE_LINE;
+
+#pragma pack(pop)
+
+///////////////////////////////////////////////////////////////
+// utility class: position in a scatter/gather buffer array
+
+class IPC_BufCursor
+{
+public:
+	IPC_BufCursor (const IPC_BUF *bufs, DWORD count)
+		: m_bufs (bufs), m_count (count), m_idx (0), m_off (0) {}
+
+	// copy size bytes out of the buffers to dst
+	// returns bytes copied (less at the end of the buffers)
+	DWORD gather (void *dst, DWORD size);
+
+	// copy size bytes from src into the buffers
+	// returns bytes copied (less at the end of the buffers)
+	DWORD scatter (const void *src, DWORD size);
+
+#ifndef _WIN32
+	// describe up to size bytes from the position in at most maxIov iovecs,
+	// without moving; returns the bytes described
+	DWORD iov (struct iovec *iov, int maxIov, DWORD size, int& count) const;
+
+	// move size bytes forward
+	void skip (DWORD size);
+#endif
+
+	// total size of the buffers, IPC_MSG_INVALID on overflow
+	static DWORD totalSize (const IPC_BUF *bufs, DWORD count);
+
+private:
+	const IPC_BUF *m_bufs;
+	DWORD m_count;
+	DWORD m_idx;  // current buffer
+	DWORD m_off;  // offset in the current buffer
+};
+
+inline unsigned int IPC_strlen (const char *s)
+	{ return s==NULL ? 0 : strlen(s); }
+
+////////////////////////////////////////////////////////////////
+// Connection handle table
+//
+// Every transport hands out its connections through one: the shared memory
+// runtime its IPC_Connection objects, the pipe and socket layers their
+// transport objects.
+// A handle is (generation << 16) | (slot index + 1), so a stale handle
+// fails the generation check instead of reaching freed memory. Lookups are
+// lock-free: a call takes a reference by a CAS on the slot state, which
+// holds the generation, the closed flag and the calls in flight. Closing
+// sets the flag, so no call gets in, and waits for the calls in flight
+// to leave; then the slot gets the next generation and is reused.
+
+const DWORD IPC_HANDLE_PAGE_SLOTS = 256;
+const DWORD IPC_HANDLE_PAGES      = 256;
+const DWORD IPC_HANDLE_SLOTS      = IPC_HANDLE_PAGE_SLOTS * IPC_HANDLE_PAGES - 1;  // index + 1 fits in 16 bits
+const DWORD IPC_HANDLE_GEN_MAX    = 0x7FFF;  // handles stay below IPC_RC_TIMEOUT
+
+const LONG  IPC_SLOT_CLOSED       = 0x8000;  // closed or free, no new references
+const LONG  IPC_SLOT_REFS         = 0x7FFF;  // calls in flight
+
+struct IPC_HandleSlot
+{
+	volatile LONG    state;     // generation << 16 | IPC_SLOT_CLOSED | references
+	LONG             nextFree;  // free list link, index + 1 (0 - end)
+	void * volatile  obj;       // connection object of the transport
+
+	// a slot per cache line: the references of one connection don't
+	// bounce the lines of the others
+	unsigned char    pad [IPC_CACHE_LINE - 2 * sizeof (LONG) - sizeof (void *)];
+};
+
+class IPC_HandleTable
+{
+public:
+	IPC_HandleTable ();
+	~IPC_HandleTable ();
+
+	// returns the new handle, HIPCCONNECTION_INVALID when the table is full
+	HIPCCONNECTION add (void *obj);
+
+	// the connection with a reference for one call, NULL for a stale handle
+	inline void * acquire (HIPCCONNECTION h);
+	inline void release (HIPCCONNECTION h);
+
+	// stop new calls on h; returns the connection, NULL if h is stale
+	// or another thread is closing it
+	void * close (HIPCCONNECTION h);
+
+	// after close: wait for the calls in flight and free the slot
+	void remove (HIPCCONNECTION h);
+
+private:
+	IPC_HandleSlot * slotAt (DWORD idx) const
+		{ return &m_pages[idx / IPC_HANDLE_PAGE_SLOTS][idx % IPC_HANDLE_PAGE_SLOTS]; }
+
+	// NULL if h is out of range
+	inline IPC_HandleSlot * slot (HIPCCONNECTION h) const;
+
+	static LONG generation (HIPCCONNECTION h)
+		{ return (LONG)(((DWORD)(ULONG_PTR)h >> 16) & IPC_HANDLE_GEN_MAX); }
+
+	void push (DWORD idx);
+	bool grow ();
+
+	IPC_HandleSlot * volatile m_pages [IPC_HANDLE_PAGES];
+	void *           m_pageMem [IPC_HANDLE_PAGES];
+	DWORD            m_pageCount;
+	volatile LONG    m_freeHead;   // tag << 16 | index + 1 of the first free slot
+	CRITICAL_SECTION m_csGrow;
+
+	IPC_HandleTable (const IPC_HandleTable&);
+	IPC_HandleTable& operator= (const IPC_HandleTable&);
+};
+
+inline IPC_HandleSlot * IPC_HandleTable::slot (HIPCCONNECTION h) const
+{
+	ULONG_PTR v = (ULONG_PTR)h;
+	if (v > 0x7FFFFFFF || (v & 0xFFFF) == 0 || (v >> 16) == 0) return NULL;
+
+	DWORD idx = (DWORD)(v & 0xFFFF) - 1;
+	IPC_HandleSlot *page = m_pages[idx / IPC_HANDLE_PAGE_SLOTS];
+	return (page == NULL) ? NULL : &page[idx % IPC_HANDLE_PAGE_SLOTS];
+}
+
+inline void * IPC_HandleTable::acquire (HIPCCONNECTION h)
+{
+	IPC_HandleSlot *s = slot (h);
+	if (s == NULL) return NULL;
+
+	LONG gen = generation (h);
+	for (;;) {
+		LONG st = s->state;
+		if ((st >> 16) != gen || (st & IPC_SLOT_CLOSED) != 0) return NULL;
+		if ((st & IPC_SLOT_REFS) == IPC_SLOT_REFS) { SwitchToThread (); continue; }
+
+		if (InterlockedCompareExchange (&s->state, st + 1, st) == st) return s->obj;
+	}
+}
+
+inline void IPC_HandleTable::release (HIPCCONNECTION h)
+{
+	InterlockedDecrement (&slot (h)->state);
+}
+
+// reference on the T of a handle for the duration of one call
+template <class T>
+class IPC_HandleRef
+{
+public:
+	IPC_HandleRef (IPC_HandleTable& table, HIPCCONNECTION h)
+		: m_table (table), m_h (h), m_obj (static_cast<T *> (table.acquire (h))) {}
+	~IPC_HandleRef ()
+		{ if (m_obj != NULL) m_table.release (m_h); }
+
+	operator T * () const   { return m_obj; }
+	T * operator-> () const { return m_obj; }
+
+private:
+	IPC_HandleTable& m_table;
+	HIPCCONNECTION   m_h;
+	T               *m_obj;
+
+	IPC_HandleRef (const IPC_HandleRef&);
+	IPC_HandleRef& operator= (const IPC_HandleRef&);
+};
+
+typedef IPC_HandleRef<IPC_Connection> IPC_ConnectionRef;
+
+#endif // _ipc_proto_h_INCLUDED_
@@ -0,0 +1,148 @@
+// ipc_ring.h
+//
+// Interprocess communication library (IPC)
+//
+// io_uring engine of the socket transport: multishot receives into a
+// registered buffer ring, linked sends of many connections submitted together
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_ring_h_INCLUDED_
+#define _ipc_ring_h_INCLUDED_ 1
+
+#include "ipc_sock.h"
+
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+////////////////////////////////////////////////////////////////
+// One ring and one thread per process serve all attached connections.
+// The sockets are registered files. Each connection keeps a multishot
+// receive armed; the kernel stores the packets in the buffers of a
+// registered buffer ring and they queue on the connection until
+// IPC_Recv or an IPC_RecvAsync takes them, so a busy receiver makes no
+// receive calls at all. IPC_SendAsync queues the message; the thread
+// links the queued packets of a connection into a chain, which keeps their
+// order, and submits the chains of all connections in one io_uring_enter.
+// A connection holding RING_CONN_BUFS buffers has its receive cancelled
+// until it is drained to half of that, so one idle reader cannot take the
+// whole buffer ring. Needs Linux 6.0, Attach fails where io_uring is
+// missing or disabled and the connection keeps the plain socket calls.
+
+#define RING_SQ_ENTRIES 256
+#define RING_CQ_ENTRIES 4096
+#define RING_BUF_COUNT 128				// receive buffers, power of 2
+#define RING_BUF_SIZE SOCK_PKT_MAX		// a buffer holds a packet
+#define RING_CONN_BUFS 16				// queued buffers per connection
+#define RING_MAX_CONNS 1024				// registered files
+#define RING_CHAIN_MAX 32				// linked sends per connection at a time
+
+struct CRingConn;
+struct CRingOp;
+
+class CSocketRing
+{
+public:
+	static CSocketRing& Instance() { return g_instance; }
+
+	// registers fd, NULL if the engine or a free slot is missing
+	CRingConn* Attach(int fd, HIPCCONNECTION hConn);
+
+	// the transport closes: a waiting receiver wakes up, queued async
+	// operations fail; Release frees the slot once nothing is in flight
+	void Shutdown(CRingConn* c);
+	void Release(CRingConn* c);
+
+	// takes the next queued packet (MSG_PEEK leaves it queued) into iov;
+	// returns the bytes stored, 0 at the end of the connection, or -1 with
+	// errno, EAGAIN when the caller has to wait for WaitFd to be readable
+	ssize_t Recv(CRingConn* c, const struct iovec *iov, int nIov, int nFlags);
+	int WaitFd(const CRingConn* c) const;
+
+	// IPC_SendAsync/IPC_RecvAsync/IPC_CancelAsync of an attached connection
+	DWORD Post(CRingConn* c, bool bSend, void *pvBuf, DWORD dwSize, DWORD dwMaxPkt,
+		IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+	void Cancel(CRingConn* c, void *pvContext);
+
+private:
+	bool m_bStarted;
+	bool m_bFailed;
+	CRITICAL_SECTION m_cs;
+
+	// the rings
+	int m_fdRing;
+	void *m_pRingMem;
+	size_t m_nRingMemSize;
+	struct io_uring_sqe *m_pSqes;
+	size_t m_nSqesSize;
+	unsigned *m_pSqHead, *m_pSqTail, m_nSqMask, m_nSqEntries;
+	unsigned *m_pCqHead, *m_pCqTail, m_nCqMask;
+	struct io_uring_cqe *m_pCqes;
+	unsigned m_nSqTail;					// local tail, published by Submit
+
+	// receive buffers
+	struct io_uring_buf_ring *m_pBufRing;
+	BYTE *m_pBufs;
+	unsigned short m_nBufTail;
+	int m_nBufsFree;
+	DWORD m_arrBufLen[RING_BUF_COUNT];
+	short m_arrBufNext[RING_BUF_COUNT];	// queue links, -1 ends
+
+	// wake-up of the thread by the posting threads
+	int m_evWake;
+	uint64_t m_qwWake;
+	bool m_bWakeArmed;
+	bool m_bWakePending;
+
+	CRingConn *m_pConns;
+	int m_nConns;
+	CRingConn *m_pFreeConns;
+	CRingConn *m_pReady;				// to be processed by the thread
+	CRingConn *m_pStalled;				// receive to be armed when buffers free up
+	bool m_bStarved;
+	CRingOp *m_pFreeOps;
+	CRingOp *m_pDone;					// completed, callbacks to run in order
+	CRingOp *m_pDoneLast;
+
+	static CSocketRing g_instance;
+
+	CSocketRing();
+	~CSocketRing();
+
+	// called with m_cs held
+	bool Start();
+	void Cleanup();
+	void Wake();
+	void MakeReady(CRingConn* c);
+	void Reap();
+	void OnRecv(CRingConn* c, int nRes, unsigned nFlags);
+	void OnSend(CRingOp* op, int nRes);
+	void Process(CRingConn* c);
+	void ArmRecv(CRingConn* c);
+	void CancelRecv(CRingConn* c);
+	void PrepSends(CRingConn* c);
+	void Deliver(CRingConn* c);
+	void FailOps(CRingOp*& pFirst, CRingOp*& pLast, bool bUntouched, void *pvContext);
+	void Complete(CRingOp* op, DWORD dwResult);
+	void FreeConn(CRingConn* c);
+	int PopBuf(CRingConn* c);
+	void ReturnBuf(int nBid);
+	bool CanArm(const CRingConn* c) const;
+	struct io_uring_sqe* GetSqe();
+
+	// the thread, without m_cs
+	static void* ThreadProc(void *pvParam);
+	void Run();
+	void Submit(bool bWait);
+
+	CSocketRing(const CSocketRing&);
+	CSocketRing& operator=(const CSocketRing&);
+};
+
+#endif // _ipc_ring_h_INCLUDED_
@@ -0,0 +1,570 @@
+// ipc_shm.h
+//
+// Interprocess communication library (IPC)
+//
+// Implementation defines of the POSIX builds: the connection protocol of
+// channel.cpp over shm_open() segments, futex waits and pidfd
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_shm_h_INCLUDED_
+#define _ipc_shm_h_INCLUDED_ 1
+
+#include "ipc_proto.h"
+
+////////////////////////////////////////////////////////////////
+// Forward declarations
+
+class IPC_Runtime;
+class IPC_Server;
+class IPC_Connection;
+
+////////////////////////////////////////////////////////////////
+// Segments
+//
+// The port segment holds IPC_SHM_PORT_INFO and the connection request
+// slots at IPC_CONNECT_SLOTS_OFFSET, as the Win32 port buffer does. The
+// client creates a connection segment with the two channel rings and posts
+// its name in a slot; the server maps it and drops the name.
+// All waits are futex waits on the words the peer moves: the ring head and
+// tail, the port sequences and the slot state. A wait sleeps for
+// IPC_SHM_WAIT_SLICE at most and then looks at the peer's pidfd, so a
+// crashed peer is noticed within a slice; a closing peer wakes the
+// sleepers at once. The user events and the break event of accept are file
+// descriptors, as with the socket transport; a futex can't wait for them,
+// so the waits they apply to are cut to IPC_SHM_EVENT_SLICE and poll them
+// in between.
+// A message at or above the section threshold goes through a segment of
+// its own, as the Win32 sections do: the sender creates and fills it and
+// queues an IPC_SECTION_DESC, the receiver maps it and drops the name.
+
+const char IPC_SHM_PORT_PREFIX[] = "/jr-ipc-p-";  // shm_open() name prefixes
+const char IPC_SHM_CONN_PREFIX[] = "/jr-ipc-c-";
+const char IPC_SHM_SECTION_PREFIX[] = "/jr-ipc-l-";  // followed by the connection name, direction and sequence number
+
+const DWORD IPC_SHM_MAGIC      = 0x50434A52;  // 'JRCP'
+const DWORD IPC_SHM_WAIT_SLICE = 100;         // ms between the peer checks
+const DWORD IPC_SHM_EVENT_SLICE = 10;         // ms between the user event checks
+
+const int IPC_SHM_MAX_USER_EVENTS = 16;
+
+// sections created but not opened by the receiver yet
+const int IPC_SHM_MAX_PENDING_SECTIONS = 8;
+
+// spin phase before blocking on a wait word (microseconds)
+const DWORD IPC_SHM_SPIN_DEFAULT_US = 20;
+
+#pragma pack(push,1)
+
+struct IPC_SHM_PORT_INFO
+{
+	volatile LONG magic;       // IPC_SHM_MAGIC once the port is ready
+	DWORD  serverPid;
+	DWORD  sendSize;           // server preferred server->client channel size (0 - default)
+	DWORD  recvSize;           // server preferred client->server channel size (0 - default)
+	volatile LONG closed;      // nonzero after the server stopped
+	volatile LONG connectSeq;  // bumped by the client when it posts a request
+	volatile LONG freeSeq;     // bumped when a slot is freed
+	BYTE   pad [IPC_CONNECT_SLOTS_OFFSET - 7*sizeof (LONG)];
+};
+
+#pragma pack(pop)
+
+const DWORD IPC_SHM_PORT_SIZE = IPC_CONNECT_SLOTS_OFFSET + IPC_CONNECT_SLOTS * sizeof (IPC_CONNECT_SLOT);
+
+///////////////////////////////////////////////////////////////
+// utility class: mapped segment holder
+
+class IPC_ShmMap
+{
+public:
+	IPC_ShmMap () : m_buf (NULL), m_size (0) {}
+	~IPC_ShmMap () { close (); }
+
+	// returns IPC_ERR_XXX; open () fails with IPC_ERR_CLOSED until the
+	// creator has sized the segment
+	DWORD create (const char *path, DWORD size);
+	DWORD open (const char *path, DWORD minSize);
+	void  close ();
+
+	unsigned char * data () const	{ return (unsigned char *)m_buf; }
+	DWORD size () const				{ return m_size; }
+	bool isValid () const			{ return m_buf != NULL; }
+
+private:
+	void  *m_buf;
+	DWORD  m_size;
+
+	DWORD map (int fd, DWORD size);
+
+	IPC_ShmMap (const IPC_ShmMap&);
+	IPC_ShmMap& operator= (const IPC_ShmMap&);
+};
+
+///////////////////////////////////////////////////////////////
+// utility class: peer process, watched through a pidfd
+
+class IPC_Peer
+{
+public:
+	IPC_Peer () : m_pid (0), m_fd (-1) {}
+	~IPC_Peer () { close (); }
+
+	bool open (DWORD pid);
+	void close ();
+
+	bool isAlive () const;
+
+private:
+	DWORD m_pid;
+	int   m_fd;    // -1: no pidfd in this kernel, kill (pid, 0) instead
+
+	IPC_Peer (const IPC_Peer&);
+	IPC_Peer& operator= (const IPC_Peer&);
+};
+
+////////////////////////////////////////////////////////////////
+// IPC channel control
+
+struct IPC_Channel
+{
+	pthread_mutex_t m_mutex;  // (local) access mutex, recursive
+	unsigned char * m_buffer;
+	DWORD  m_bufSize;
+	IPC_RING_HDR * m_ring;
+	DWORD  m_spinUs;          // spin phase before a futex wait
+	LONG   m_seenHead;        // peer position seen by the last ringPeek
+	LONG   m_seenTail;        // peer position seen by the last ringReserve
+
+	IPC_Channel ();
+	~IPC_Channel ();
+
+	// buf points to IPC_RING_HDR followed by dataSize bytes of ring data
+	void setRing (void *buf, DWORD dataSize)
+		{ m_ring = (IPC_RING_HDR *)buf; m_buffer = (unsigned char *)(m_ring + 1); m_bufSize = dataSize; }
+
+	// sender side: returns slot for a packet of [minPkt, maxPkt] bytes
+	// (actual size in pktSize) or NULL if the ring is full
+	IPC_MSG_HDR * ringReserve (DWORD minPkt, DWORD maxPkt, DWORD& pktSize);
+	void ringCommit (DWORD pktSize);
+
+	// receiver side: returns the next packet or NULL if the ring is empty
+	const IPC_MSG_HDR * ringPeek ();
+	DWORD ringPktSize (const IPC_MSG_HDR *hdr) const;
+	void ringRelease (const IPC_MSG_HDR *hdr);
+
+	// the wait words are the ring positions themselves
+	void notifyData ()   { MemoryBarrier (); if (m_ring->dataWaiter) IPC_FutexWake (&m_ring->head); }
+	void notifySpace ()  { MemoryBarrier (); if (m_ring->spaceWaiter) IPC_FutexWake (&m_ring->tail); }
+
+	// spins while *pWord == seen, returns true if the word changed
+	bool spin (const volatile LONG *pWord, LONG seen) const;
+
+	DWORD lock (DWORD tmo);  // returns IPC_ERR_XXXX
+	void  unlock ();
+
+private:
+	IPC_Channel (const IPC_Channel&);
+	IPC_Channel& operator= (const IPC_Channel&);
+};
+
+// IPC channel locker with auto-unlock
+class IPC_Channel_Lock
+{
+public:
+	IPC_Channel_Lock () : m_pChannel (NULL) {}
+	~IPC_Channel_Lock () { unlock (); }
+
+	DWORD lock (IPC_Channel *pChannel, DWORD tmo)
+	{
+		DWORD err = pChannel->lock (tmo);
+		if (err == 0) m_pChannel = pChannel;
+		return err;
+	}
+
+	void unlock ()
+		{ if (m_pChannel != NULL) m_pChannel->unlock (); m_pChannel = NULL; }
+
+private:
+	IPC_Channel *m_pChannel;
+};
+
+////////////////////////////////////////////////////////////////
+// Server object
+
+class IPC_Server
+{
+public:
+	IPC_Server ();
+	~IPC_Server ();
+
+	// sendSize/recvSize - preferred channel sizes for accepted connections (0 - default)
+	DWORD listen (const char *epName, DWORD sendSize = 0, DWORD recvSize = 0);
+	BOOL  unlisten ();
+
+	// may be called by several threads at once, each takes its own request;
+	// a readable breakFd (-1 - none) ends the wait as the timeout does
+	IPC_Connection * accept (DWORD tmo, DWORD& err, int breakFd = -1);
+
+private:
+	IPC_ShmMap  m_buffer;      // port info and connection slots
+	char        m_path [IPC_MAX_PATH];
+	volatile LONG m_accepting; // accept () calls in progress
+
+	IPC_Server (const IPC_Server&);
+	IPC_Server& operator= (const IPC_Server&);
+};
+
+////////////////////////////////////////////////////////////////
+// Connection object
+
+class IPC_Connection
+{
+public:
+	IPC_Connection ();
+	~IPC_Connection ();
+
+	// returns IPC_ERR_XXX
+	// sendSize/recvSize - requested channel sizes (0 - default),
+	// the larger of the client and server preferences is used
+	DWORD connect (const char *epName, DWORD tmo, DWORD sendSize = 0, DWORD recvSize = 0);
+	BOOL close ();
+
+	// mark the connection closed and wake the blocked calls, close () follows
+	void shutdown ();
+
+	// returns IPC_ERR_XXX
+	DWORD send (const void *buf, DWORD bufSize, DWORD tmo);
+	DWORD recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz);
+
+	// scatter/gather: the message is the concatenation of the buffers
+	DWORD sendV (const IPC_BUF *bufs, DWORD count, DWORD tmo);
+	DWORD recvV (const IPC_BUF *bufs, DWORD count, DWORD tmo, DWORD& rsz);
+
+	// batches: one message per buffer, the receiver is woken once per batch;
+	// a truncated message ends the batch but is counted, with its whole size
+	DWORD sendBatch (const IPC_BUF *msgs, DWORD count, DWORD tmo, DWORD& sent);
+	DWORD recvBatch (const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received);
+
+	// zero-copy send and receive, as with the Win32 backend
+	DWORD sendReserve (DWORD size, void **ppBuf, DWORD tmo);
+	DWORD sendCommit (void *pBuf, DWORD size);
+	DWORD recvView (const void **ppBuf, DWORD tmo, DWORD& rsz);
+	DWORD recvRelease (const void *pBuf);
+
+	// messages of threshold bytes and larger go through a section
+	BOOL setSectionThreshold (DWORD threshold);
+
+	// spin time before blocking (microseconds or IPC_SPIN_ADAPTIVE)
+	BOOL setSpinTime (DWORD us);
+
+	// the senders always take the channel mutex here
+	BOOL setMultiProducer (BOOL bEnable);
+
+	// user events: file descriptors, a readable one ends the wait for the
+	// first packet of a message with IPC_ERR_USER_EVENT_SET
+	BOOL setEvents (HANDLE *pUserEvents, DWORD count);
+	BOOL getEvents (DWORD *pdwUserEvents);
+	void resetEvents ();
+
+	DWORD getLastError () const { return m_lastError; }
+
+	bool initServerSide (const IPC_CONNECT_REQUEST *connData);
+
+private:
+	IPC_Peer    m_peer;        // the peer process
+	IPC_ShmMap  m_buffer;      // both channel rings
+	IPC_Channel m_sendChannel; // send channel
+	IPC_Channel m_recvChannel; // receive channel
+
+	bool        m_bDataPending;  // data committed without notifyData (batch)
+	char        m_connName [80];
+	bool        m_bServerSide;
+
+	// large message sections
+	DWORD       m_sectionThreshold;
+	DWORD       m_sectionSeq;  // last section created
+	DWORD       m_sectionSeqs [IPC_SHM_MAX_PENDING_SECTIONS];  // not opened by the receiver yet, 0 - free
+
+	// pending sendReserve
+	IPC_MSG_HDR   *m_reserveHdr;     // ring slot, NULL if m_reserveBuf is used
+	unsigned char *m_reserveBuf;     // buffer for messages larger than the ring
+	DWORD          m_reserveBufSize;
+	DWORD          m_reserveSize;    // IPC_MSG_INVALID - no reservation
+	DWORD          m_reserveTimeout; // applies to the commit as well
+	IPC_ShmMap     m_reserveSection; // section for messages above the threshold
+	DWORD          m_reserveSeq;
+
+	// pending recvView
+	const IPC_MSG_HDR *m_viewHdr;    // ring packet, NULL if m_viewBuf is used
+	const void    *m_viewPtr;        // NULL - no view
+	unsigned char *m_viewBuf;        // buffer for messages split into packets
+	DWORD          m_viewBufSize;
+	IPC_ShmMap     m_viewSection;    // section of a large message
+
+	DWORD m_lastError;
+
+	CRITICAL_SECTION m_eventsCs;
+	volatile LONG    m_userEventCount;
+	int              m_userEvents [IPC_SHM_MAX_USER_EVENTS];
+
+	void clearLastError ()
+		{ m_lastError = 0; }
+
+	DWORD setLastError (DWORD ec)
+		{ m_lastError = ec; return ec; }
+
+	// one of the user events is readable
+	bool userEventSet ();
+
+	bool initClientSide (IPC_CONNECT_REQUEST *connData, char *pathBuf);
+
+	// post the request in a free slot of the port and wait for the reply
+	DWORD request (IPC_ShmMap& port, const IPC_CONNECT_REQUEST& req, DWORD tmo, DWORD t0, IPC_CONNECT_REPLY& reply);
+
+	// wait until the peer moves the ring, the connection is closed or the
+	// peer dies; bFirst applies the (remaining) timeout
+	DWORD waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0);
+
+	// send/receive message with the channel locked
+	// bDefer: don't notify the receiver after the last packet (m_bDataPending)
+	DWORD sendLocked (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0, bool bDefer = false);
+	// rsz - bytes stored; the whole message size with IPC_ERR_MSG_TRUNCATED
+	DWORD recvLocked (IPC_BufCursor& data, DWORD tmo, DWORD t0, DWORD& rsz);
+
+	// wait for the first packet of the next message
+	const IPC_MSG_HDR * recvPeek (DWORD tmo, DWORD t0, DWORD& err);
+
+	// large message sections, with the channel locked
+	void  formatSectionName (char *pathBuf, bool bSend, DWORD seq);
+	void  sweepSections ();
+	void  dropSection (DWORD seq);
+	DWORD createSection (DWORD size, IPC_ShmMap& view, DWORD& seq, DWORD tmo, DWORD t0);
+	DWORD sendSection (DWORD seq, DWORD size, DWORD tmo, DWORD t0, bool bDefer);
+	DWORD openSection (const IPC_MSG_HDR *msgHdr, IPC_ShmMap& view, DWORD& size);
+
+	IPC_Connection (const IPC_Connection&);
+	IPC_Connection& operator= (const IPC_Connection&);
+};
+
+////////////////////////////////////////////////////////////////
+// Global IPC runtime object
+
+class IPC_Runtime
+{
+public:
+	DWORD getVersion ();
+
+	HIPCSERVER serverStart (const char *epName, DWORD sendSize = 0, DWORD recvSize = 0);
+	BOOL serverStop (HIPCSERVER hServer);
+
+	HIPCCONNECTION serverWaitForConnection (HIPCSERVER hServer, DWORD tmo, int breakFd = -1);
+	HIPCCONNECTION connect (const char *epName, DWORD tmo, DWORD sendSize = 0, DWORD recvSize = 0);
+	BOOL closeConnection (HIPCCONNECTION hConn);
+
+	DWORD send (HIPCCONNECTION hConn, const void *buf, DWORD bufSize, DWORD tmo);
+	DWORD recv (HIPCCONNECTION hConn, void *buf, DWORD bufSize, DWORD tmo);
+
+	DWORD sendV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo);
+	DWORD recvV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo);
+
+	DWORD sendBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD tmo);
+	DWORD recvBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo);
+
+	DWORD sendReserve (HIPCCONNECTION hConn, DWORD size, void **ppBuf, DWORD tmo);
+	DWORD sendCommit (HIPCCONNECTION hConn, void *pBuf, DWORD size);
+
+	DWORD recvView (HIPCCONNECTION hConn, const void **ppBuf, DWORD tmo);
+	BOOL recvRelease (HIPCCONNECTION hConn, const void *pBuf);
+
+	BOOL setSectionThreshold (HIPCCONNECTION hConn, DWORD threshold);
+	BOOL setSpinTime (HIPCCONNECTION hConn, DWORD us);
+	BOOL setMultiProducer (HIPCCONNECTION hConn, BOOL bEnable);
+
+	BOOL setEvents (HIPCCONNECTION hConn, HANDLE *pUserEvents, DWORD count);
+	BOOL getEvents (HIPCCONNECTION hConn, DWORD *pdwUserEvents);
+	BOOL resetEvents (HIPCCONNECTION hConn);
+
+	DWORD getConnectionLastErr (HIPCCONNECTION hConn);
+
+	static inline IPC_Runtime& instance () { return g_instance; }
+
+	// generate unique connection name (buffer size must be at least 80)
+	bool generateConnectionName (char *nameBuf);
+
+	// pathBuf size must be at least IPC_MAX_PATH
+	// return path length
+	unsigned int formatObjectPath (char *pathBuf, const char *prefix, const char *name);
+
+	// spinning makes sense on multiprocessor systems only
+	bool canSpin () const	{ return m_bMultiCpu; }
+
+private:
+	IPC_Runtime ();
+	IPC_Runtime (const IPC_Runtime&);
+	IPC_Runtime& operator= (const IPC_Runtime&);
+
+	bool          m_bMultiCpu;
+	volatile LONG m_connSeq;  // connection names of this process
+
+	// server handle management
+	static IPC_Server * getServer (HIPCSERVER h)
+		{ return ((ULONG_PTR)h==IPC_RC_ERROR || (ULONG_PTR)h==IPC_RC_TIMEOUT) ? NULL : (IPC_Server *)h; }
+
+	// connection handle management
+	IPC_HandleTable m_connections;
+
+	// single instance of the runtime
+	static IPC_Runtime g_instance;
+};
+
+////////////////////////////////////////////////////////////////
+// inline methods
+
+inline DWORD IPC_Runtime::send (HIPCCONNECTION hConn, const void *buf, DWORD bufSize, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->send (buf, bufSize, tmo);
+	return (err == 0) ? bufSize : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recv (HIPCCONNECTION hConn, void *buf, DWORD bufSize, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD rsz = 0;
+	DWORD err = conn->recv (buf, bufSize, tmo, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendV (bufs, count, tmo);
+	return (err == 0) ? IPC_BufCursor::totalSize (bufs, count) : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvV (HIPCCONNECTION hConn, const IPC_BUF *bufs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD rsz = 0;
+	DWORD err = conn->recvV (bufs, count, tmo, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD sent = 0;
+	DWORD err = conn->sendBatch (msgs, count, tmo, sent);
+	return (err == 0 || sent != 0) ? sent : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvBatch (HIPCCONNECTION hConn, const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD received = 0;
+	DWORD err = conn->recvBatch (msgs, count, sizes, tmo, received);
+	return (err == 0 || received != 0) ? received : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendReserve (HIPCCONNECTION hConn, DWORD size, void **ppBuf, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendReserve (size, ppBuf, tmo);
+	return (err == 0) ? size : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::sendCommit (HIPCCONNECTION hConn, void *pBuf, DWORD size)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD err = conn->sendCommit (pBuf, size);
+	return (err == 0) ? size : IPC_ERR_TO_RC (err);
+}
+
+inline DWORD IPC_Runtime::recvView (HIPCCONNECTION hConn, const void **ppBuf, DWORD tmo)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return IPC_ERR_TO_RC (IPC_ERR_INVALID_ARG);
+
+	DWORD rsz = 0;
+	DWORD err = conn->recvView (ppBuf, tmo, rsz);
+	return (err == 0) ? rsz : IPC_ERR_TO_RC (err);
+}
+
+inline BOOL IPC_Runtime::recvRelease (HIPCCONNECTION hConn, const void *pBuf)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->recvRelease (pBuf) == 0;
+}
+
+inline BOOL IPC_Runtime::setSectionThreshold (HIPCCONNECTION hConn, DWORD threshold)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setSectionThreshold (threshold);
+}
+
+inline BOOL IPC_Runtime::setSpinTime (HIPCCONNECTION hConn, DWORD us)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setSpinTime (us);
+}
+
+inline BOOL IPC_Runtime::setMultiProducer (HIPCCONNECTION hConn, BOOL bEnable)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setMultiProducer (bEnable);
+}
+
+inline BOOL IPC_Runtime::setEvents (HIPCCONNECTION hConn, HANDLE *pUserEvents, DWORD count)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->setEvents (pUserEvents, count);
+}
+
+inline BOOL IPC_Runtime::getEvents (HIPCCONNECTION hConn, DWORD *pdwUserEvents)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	return conn->getEvents (pdwUserEvents);
+}
+
+inline BOOL IPC_Runtime::resetEvents (HIPCCONNECTION hConn)
+{
+	IPC_ConnectionRef conn (m_connections, hConn);
+	if (conn == NULL) return FALSE;
+
+	conn->resetEvents ();
+	return TRUE;
+}
+
+#endif // _ipc_shm_h_INCLUDED_
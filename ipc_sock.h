@@ -0,0 +1,171 @@
+// ipc_sock.h
+//
+// Interprocess communication library (IPC)
+//
+// Unix-domain SOCK_SEQPACKET transport of the POSIX builds, the
+// counterpart of the Win32 pipe transport
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+
+#ifndef _ipc_sock_h_INCLUDED_
+#define _ipc_sock_h_INCLUDED_ 1
+
+#include "ipc_proto.h"
+
+#include <sys/socket.h>
+
+struct CRingConn;
+
+////////////////////////////////////////////////////////////////
+// Every packet starts with an IPC_MSG_HDR: msgSize is the size of the whole
+// message, pktSize the payload of this packet. A message larger than the
+// packet limit of the connection (half its socket send buffer, at most
+// SOCK_PKT_MAX with the header) goes out in several packets under the send
+// lock, so they arrive back to back.
+// The sockets are nonblocking: a call tries the transfer first and polls
+// the socket (and the user events) only when it would block.
+// The user events are file descriptors passed as (HANDLE)(intptr_t)fd,
+// usually eventfds; a readable one is signaled.
+
+#define SOCK_PREFIX "JR_IPC_"			// abstract socket names
+#define SOCK_BACKLOG_DEFAULT 64
+#define SOCK_MAX_USER_EVENTS 16
+#define SOCK_IOV_MAX 32					// packet header + message segments per sendmsg/recvmsg
+#define SOCK_BATCH_MAX 16				// messages per sendmmsg
+#define SOCK_PKT_MAX (0x10000 + 8)		// a 64K message and its header, the receive buffer size of the io_uring engine
+
+// the fd of a user event handle
+inline int SOCK_HandleFd(HANDLE h)
+{
+	return (int)(intptr_t)h;
+}
+
+class CSocketTransport
+{
+	int m_fd;
+	CCritSec m_cs;					// user events, last error
+	CCritSec m_csSend;				// send path, reserve buffer
+	CCritSec m_csRecv;				// receive path, view buffer
+	volatile LONG m_lBroken;		// I/O failed, the socket is closed by the destructor
+	DWORD m_dwLastError;
+	DWORD m_dwMaxPkt;				// payload of a packet
+	int m_nEventCount;
+	int m_arrUserEvents[SOCK_MAX_USER_EVENTS];
+	BYTE* m_pReserveBuf;			// SendReserve buffer
+	DWORD m_dwReserveBufSize;
+	DWORD m_dwReserveSize;			// NO_RESERVATION if not reserved
+	DWORD m_dwReserveTimeout;		// of SendReserve, used by SendCommit
+	BYTE* m_pViewBuf;				// RecvView buffer
+	DWORD m_dwViewBufSize;
+	bool m_bViewHeld;
+	CRingConn* m_pRing;				// io_uring engine connection, NULL - plain socket calls
+
+	enum { NO_RESERVATION = 0xFFFFFFFF };
+
+	DWORD SetError(DWORD dwError);
+
+	// marks the socket failed, returns IPC_ERR_XXX for errno
+	DWORD Broken(int nErrno);
+
+	bool IsBroken() const
+	{
+		return m_fd < 0 || m_lBroken != 0;
+	}
+
+	// socket buffer sizes and the packet limit
+	void Tune(DWORD dwSendSize, DWORD dwRecvSize);
+
+	// waits for nEvents on the socket and, if bUser, for the user events;
+	// returns 0 (try again), IPC_ERR_TIMEOUT or IPC_ERR_USER_EVENT_SET
+	DWORD Wait(short nEvents, DWORD dwTimeout, bool bUser);
+
+	// transfer one message, the caller holds the lock of the direction;
+	// the timeout applies until the first packet has gone through;
+	// dwSize - bytes stored, the whole message size with IPC_ERR_MSG_TRUNCATED
+	DWORD SendMsg(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwSize, DWORD dwTimeout);
+	DWORD RecvMsg(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout, DWORD& dwSize);
+
+	// single packet messages of pMsgs go out by sendmmsg, the rest by SendMsg
+	DWORD SendMany(const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout, DWORD& dwSent);
+
+	// receives the next message into the view buffer, sized by MSG_PEEK
+	DWORD RecvToView(DWORD dwTimeout, DWORD& dwSize);
+
+	// recvmsg, or the next packet the io_uring engine has queued
+	ssize_t RecvPacket(struct iovec *iov, int nIov, int nFlags);
+
+public:
+	CSocketTransport();
+	CSocketTransport(int fd, DWORD dwSendSize, DWORD dwRecvSize);
+	~CSocketTransport();
+
+	HIPCCONNECTION Connect(const char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize);
+
+	// hands the receive side to the io_uring engine, false if it is not available;
+	// hConn - the handle its async callbacks report
+	bool AttachRing(HIPCCONNECTION hConn);
+
+	// wakes the blocked calls, the new ones fail; the destructor calls it too
+	void Shutdown();
+
+	DWORD Recv(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout);
+	DWORD Send(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout);
+
+	DWORD SendReserve(DWORD dwSize, void **ppvBuf, DWORD dwTimeout);
+	DWORD SendCommit(void *pvBuf, DWORD dwSize);
+
+	DWORD SendV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout);
+	DWORD RecvV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout);
+
+	DWORD SendBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout);
+	DWORD RecvBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout);
+
+	DWORD RecvView(const void **ppvBuf, DWORD dwTimeout);
+	BOOL RecvRelease(const void *pvBuf);
+
+	// only with the io_uring engine
+	BOOL SendAsync(void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+	BOOL RecvAsync(void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext);
+	BOOL CancelAsync(void *pvContext);
+
+	BOOL SetEvents(HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents);
+	BOOL GetEvents(DWORD *pdwUserEvents, DWORD *pdwIPCEvents);
+	void ResetEvents();
+
+	DWORD GetConnectionLastErr();
+
+private:
+	CSocketTransport(const CSocketTransport&);
+	CSocketTransport& operator=(const CSocketTransport&);
+};
+
+class CSocketServer
+{
+	int m_fd;
+	int m_evStop;					// eventfd, signaled by the destructor
+	CCritSec m_cs;
+	int m_nBacklog;
+	DWORD m_dwSendSize;				// socket buffer sizes of the accepted connections
+	DWORD m_dwRecvSize;
+
+public:
+	// dwSendSize/dwRecvSize - socket buffer sizes (0 - system default)
+	CSocketServer(DWORD dwSendSize = 0, DWORD dwRecvSize = 0);
+	~CSocketServer();
+
+	bool Create(const char *epName);
+
+	// dwBacklog - pending connections the socket queues (0 - SOCK_BACKLOG_DEFAULT)
+	void SetBacklog(DWORD dwBacklog);
+
+	HIPCCONNECTION ServerWaitForConnection(DWORD dwTimeout, HANDLE hBreakEvent);
+
+private:
+	CSocketServer(const CSocketServer&);
+	CSocketServer& operator=(const CSocketServer&);
+};
+
+#endif // _ipc_sock_h_INCLUDED_
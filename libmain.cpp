@@ -0,0 +1,526 @@
+// libmain.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Shared library entry points of the POSIX builds (libjr_ipc.so)
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_shm.h"
+#include "ipc_ring.h"
+
+#include <assert.h>
+
+class IIpc
+{
+public:
+	virtual DWORD GetVersion() = 0;
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize) = 0;
+	virtual BOOL ServerStop (HIPCSERVER hServer) = 0;
+	virtual HIPCCONNECTION ServerWaitForConnection (HIPCSERVER hServer, DWORD dwTimeout, HANDLE hBreakEvent /*= NULL*/) = 0;
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize) = 0;
+	virtual BOOL CloseConnection (HIPCCONNECTION hConnection) = 0;
+	virtual DWORD Recv (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout) = 0;
+	virtual DWORD Send( HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout ) = 0;
+	virtual BOOL SetEvents( HIPCCONNECTION hConnection, HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents ) = 0;
+	virtual BOOL GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents ) = 0;
+	virtual BOOL ResetEvents( HIPCCONNECTION hConnection ) = 0;
+	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection ) = 0;
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout) = 0;
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize) = 0;
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout) = 0;
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf) = 0;
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold) = 0;
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds) = 0;
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable) = 0;
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout) = 0;
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout) = 0;
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog) = 0;
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) = 0;
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext) = 0;
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext) = 0;
+};
+
+class CMemoryMappedIpc: public IIpc
+{
+public:
+	virtual DWORD GetVersion()
+	{ return IPC_Runtime::instance().getVersion(); }
+
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+	{ return IPC_Runtime::instance().serverStart (epName, dwSendSize, dwRecvSize); }
+
+	virtual BOOL ServerStop (HIPCSERVER hServer)
+	{ return IPC_Runtime::instance().serverStop (hServer); }
+
+	// hBreakEvent: a file descriptor, as with the socket transport
+	virtual HIPCCONNECTION ServerWaitForConnection (HIPCSERVER hServer, DWORD dwTimeout, HANDLE hBreakEvent /*= NULL*/)
+	{ return IPC_Runtime::instance().serverWaitForConnection (hServer, dwTimeout, hBreakEvent ? SOCK_HandleFd(hBreakEvent) : -1); }
+
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+	{ return IPC_Runtime::instance().connect (pszServerName, dwTimeout, dwSendSize, dwRecvSize); }
+
+	virtual BOOL CloseConnection (HIPCCONNECTION hConnection)
+	{ return IPC_Runtime::instance().closeConnection (hConnection); }
+
+	virtual DWORD Recv (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recv (hConnection, pvBuf, dwBufSize, dwTimeout); }
+
+	virtual DWORD Send( HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout )
+	{ return IPC_Runtime::instance().send (hConnection, pvBuf, dwBufSize, dwTimeout); }
+
+	// the user events are file descriptors, the channels have no IPC events
+	virtual BOOL SetEvents( HIPCCONNECTION hConnection, HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents )
+	{ return IPC_Runtime::instance().setEvents (hConnection, pUserEvents, dwUserEventsCount); }
+
+	virtual BOOL GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents )
+	{
+		if (!IPC_Runtime::instance().getEvents (hConnection, pdwUserEvents))
+			return FALSE;
+		if (pdwIPCEvents)
+			*pdwIPCEvents = 0;
+		return TRUE;
+	}
+
+	virtual BOOL ResetEvents( HIPCCONNECTION hConnection )
+	{ return IPC_Runtime::instance().resetEvents (hConnection); }
+
+	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection )
+	{ return IPC_Runtime::instance().getConnectionLastErr (hConnection); }
+
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendReserve (hConnection, dwSize, ppvBuf, dwTimeout); }
+
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+	{ return IPC_Runtime::instance().sendCommit (hConnection, pvBuf, dwSize); }
+
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvView (hConnection, ppvBuf, dwTimeout); }
+
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+	{ return IPC_Runtime::instance().recvRelease (hConnection, pvBuf); }
+
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+	{ return IPC_Runtime::instance().setSectionThreshold (hConnection, dwThreshold); }
+
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+	{ return IPC_Runtime::instance().setSpinTime (hConnection, dwMicroseconds); }
+
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+	{ return IPC_Runtime::instance().setMultiProducer (hConnection, bEnable); }
+
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendV (hConnection, pBufs, dwCount, dwTimeout); }
+
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvV (hConnection, pBufs, dwCount, dwTimeout); }
+
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().sendBatch (hConnection, pMsgs, dwCount, dwTimeout); }
+
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+	{ return IPC_Runtime::instance().recvBatch (hConnection, pMsgs, dwCount, pdwSizes, dwTimeout); }
+
+	// fixed number of connection request slots, as with the Win32 shared
+	// memory transport: the call is ignored and succeeds for a valid server
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+	{ return hServer != NULL && (ULONG_PTR)hServer != IPC_RC_ERROR && (ULONG_PTR)hServer != IPC_RC_TIMEOUT; }
+
+	// there is no I/O thread for the shared memory channels
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{ return FALSE; }
+
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{ return FALSE; }
+
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+	{ return FALSE; }
+};
+
+class CSocketIpc: public IIpc
+{
+	typedef IPC_HandleRef<CSocketTransport> CSocketRef;
+
+	bool m_bRing;	// connections go to the io_uring engine
+	IPC_HandleTable m_handles;	// connections, a reference per call
+
+	static bool IsConnection(HIPCCONNECTION h)
+	{ return h != NULL && (ULONG_PTR)h != IPC_RC_ERROR && (ULONG_PTR)h != IPC_RC_TIMEOUT; }
+
+	// the handle of a new connection, a full table fails it
+	HIPCCONNECTION AddSocket(CSocketTransport* sock)
+	{
+		HIPCCONNECTION h = m_handles.add(sock);
+		if (h == HIPCCONNECTION_INVALID)
+		{
+			delete sock;
+			return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+		}
+		if (m_bRing)
+			sock->AttachRing(h);
+		return h;
+	}
+
+public:
+	CSocketIpc(bool bRing): m_bRing(bRing) {}
+
+	virtual DWORD GetVersion()
+	{ return IPC_Runtime::instance().getVersion(); }
+
+	virtual HIPCSERVER ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+	{
+		// the channel sizes tune the socket buffers of the accepted connections
+		CSocketServer* server = new CSocketServer(dwSendSize, dwRecvSize);
+		if (server->Create(epName))
+			return (HIPCSERVER) server;
+		delete server;
+		return (HIPCSERVER) IPC_RC_INVALID_HANDLE;
+	}
+
+	virtual BOOL ServerStop (HIPCSERVER hServer)
+	{
+		assert(hServer);
+		if (!hServer)
+			return FALSE;
+		delete static_cast<CSocketServer*>(hServer);
+		return TRUE;
+	}
+
+	virtual HIPCCONNECTION ServerWaitForConnection (HIPCSERVER hServer, DWORD dwTimeout, HANDLE hBreakEvent /*= NULL*/)
+	{
+		assert(hServer);
+		if (!hServer)
+			return (HIPCCONNECTION) IPC_RC_ERROR;
+		HIPCCONNECTION res = static_cast<CSocketServer*>(hServer)->ServerWaitForConnection(dwTimeout, hBreakEvent);
+		if (!IsConnection(res))
+			return res;
+		return AddSocket(static_cast<CSocketTransport*>(res));
+	}
+
+	virtual HIPCCONNECTION ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+	{
+		CSocketTransport* sock = new CSocketTransport();
+		HIPCCONNECTION res = sock->Connect(pszServerName, dwTimeout, dwSendSize, dwRecvSize);
+		if (static_cast<CSocketTransport*>(res) != sock)
+		{
+			delete sock;
+			return res;
+		}
+		return AddSocket(sock);
+	}
+
+	virtual BOOL CloseConnection (HIPCCONNECTION hConnection)
+	{
+		CSocketTransport* sock = static_cast<CSocketTransport*>(m_handles.close(hConnection));
+		if (!sock)
+			return FALSE;
+
+		// get the blocked calls out, the handle is freed when they have left
+		sock->Shutdown();
+		m_handles.remove(hConnection);
+		delete sock;
+		return TRUE;
+	}
+
+	virtual DWORD Recv (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->Recv(pvBuf, dwBufSize, dwTimeout);
+	}
+
+	virtual DWORD Send( HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout )
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->Send(pvBuf, dwBufSize, dwTimeout);
+	}
+
+	virtual BOOL SetEvents( HIPCCONNECTION hConnection, HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents )
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->SetEvents(pUserEvents, dwUserEventsCount, pIPCEvents);
+	}
+
+	virtual BOOL GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents )
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->GetEvents(pdwUserEvents, pdwIPCEvents);
+	}
+
+	virtual BOOL ResetEvents( HIPCCONNECTION hConnection )
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		sock->ResetEvents();
+		return TRUE;
+	}
+
+	virtual DWORD GetConnectionLastErr( HIPCCONNECTION hConnection )
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_ERR_UNKNOWN;
+		return sock->GetConnectionLastErr();
+	}
+
+	virtual DWORD SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->SendReserve(dwSize, ppvBuf, dwTimeout);
+	}
+
+	virtual DWORD SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->SendCommit(pvBuf, dwSize);
+	}
+
+	virtual DWORD RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->RecvView(ppvBuf, dwTimeout);
+	}
+
+	virtual BOOL RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->RecvRelease(pvBuf);
+	}
+
+	virtual BOOL SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+	{
+		// socket messages are packets, there are no shared sections to tune
+		CSocketRef sock(m_handles, hConnection);
+		return sock != NULL;
+	}
+
+	virtual BOOL SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+	{
+		// socket waits are poll () calls, there is nothing to spin on
+		CSocketRef sock(m_handles, hConnection);
+		return sock != NULL;
+	}
+
+	virtual BOOL SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+	{
+		// a socket message is written under an in-process lock, no ring to claim
+		CSocketRef sock(m_handles, hConnection);
+		return sock != NULL;
+	}
+
+	virtual DWORD SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->SendV(pBufs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->RecvV(pBufs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->SendBatch(pMsgs, dwCount, dwTimeout);
+	}
+
+	virtual DWORD RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return IPC_RC_ERROR;
+		return sock->RecvBatch(pMsgs, dwCount, pdwSizes, dwTimeout);
+	}
+
+	virtual BOOL SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+	{
+		assert(hServer);
+		if (!hServer)
+			return FALSE;
+		static_cast<CSocketServer*>(hServer)->SetBacklog(dwBacklog);
+		return TRUE;
+	}
+
+	virtual BOOL SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->SendAsync(pvBuf, dwBufSize, pfnCallback, pvContext);
+	}
+
+	virtual BOOL RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->RecvAsync(pvBuf, dwBufSize, pfnCallback, pvContext);
+	}
+
+	virtual BOOL CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+	{
+		CSocketRef sock(m_handles, hConnection);
+		if (!sock)
+			return FALSE;
+		return sock->CancelAsync(pvContext);
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+static IIpc* g_pIpc = NULL;
+
+// JR_IPC_TRANSPORT=socket selects the socket transport, =uring the socket
+// transport with the io_uring engine, the shared memory transport is the
+// default; the server and its clients must agree on sockets or shared memory
+__attribute__((constructor)) static void LibMain()
+{
+	const char* pszTransport = getenv("JR_IPC_TRANSPORT");
+	if (pszTransport && strcmp(pszTransport, "socket") == 0)
+	{
+		static CSocketIpc sockipc(false);
+		g_pIpc = &sockipc;
+	}
+	else if (pszTransport && strcmp(pszTransport, "uring") == 0)
+	{
+		static CSocketIpc ringipc(true);
+		g_pIpc = &ringipc;
+	}
+	else
+	{
+		static CMemoryMappedIpc mmipc;
+		g_pIpc = &mmipc;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// exported functions
+
+IPC_API DWORD __stdcall IPC_GetVersion()
+{ return g_pIpc->GetVersion(); }
+
+IPC_API HIPCSERVER __stdcall IPC_ServerStart (const char *epName)
+{ return g_pIpc->ServerStartEx(epName, 0, 0); }
+
+IPC_API BOOL __stdcall IPC_ServerStop (HIPCSERVER hServer)
+{ return g_pIpc->ServerStop(hServer); }
+
+IPC_API HIPCCONNECTION __stdcall IPC_ServerWaitForConnection (HIPCSERVER hServer, DWORD dwTimeout, HANDLE hBreakEvent /*= NULL*/)
+{ return g_pIpc->ServerWaitForConnection(hServer, dwTimeout, hBreakEvent); }
+
+IPC_API HIPCCONNECTION __stdcall IPC_Connect (char *pszServerName, DWORD dwTimeout)
+{ return g_pIpc->ConnectEx(pszServerName, dwTimeout, 0, 0); }
+
+IPC_API BOOL __stdcall IPC_CloseConnection (HIPCCONNECTION hConnection)
+{ return g_pIpc->CloseConnection(hConnection); }
+
+IPC_API DWORD __stdcall IPC_Recv (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+{ return g_pIpc->Recv(hConnection, pvBuf, dwBufSize, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_Send( HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, DWORD dwTimeout )
+{ return g_pIpc->Send(hConnection, pvBuf, dwBufSize, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_SetEvents( HIPCCONNECTION hConnection, HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents )
+{ return g_pIpc->SetEvents(hConnection, pUserEvents, dwUserEventsCount, pIPCEvents ); }
+
+IPC_API BOOL __stdcall IPC_GetEvents( HIPCCONNECTION hConnection, DWORD *pdwUserEvents, DWORD *pdwIPCEvents )
+{ return g_pIpc->GetEvents(hConnection, pdwUserEvents, pdwIPCEvents); }
+
+IPC_API BOOL __stdcall IPC_ResetEvents( HIPCCONNECTION hConnection )
+{ return g_pIpc->ResetEvents(hConnection); }
+
+IPC_API DWORD __stdcall IPC_GetConnectionLastErr( HIPCCONNECTION hConnection )
+{ return g_pIpc->GetConnectionLastErr(hConnection); }
+
+IPC_API HIPCSERVER __stdcall IPC_ServerStartEx (const char *epName, DWORD dwSendSize, DWORD dwRecvSize)
+{ return g_pIpc->ServerStartEx(epName, dwSendSize, dwRecvSize); }
+
+IPC_API HIPCCONNECTION __stdcall IPC_ConnectEx (char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+{ return g_pIpc->ConnectEx(pszServerName, dwTimeout, dwSendSize, dwRecvSize); }
+
+IPC_API DWORD __stdcall IPC_SendReserve (HIPCCONNECTION hConnection, DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+{ return g_pIpc->SendReserve(hConnection, dwSize, ppvBuf, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_SendCommit (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwSize)
+{ return g_pIpc->SendCommit(hConnection, pvBuf, dwSize); }
+
+IPC_API DWORD __stdcall IPC_RecvView (HIPCCONNECTION hConnection, const void **ppvBuf, DWORD dwTimeout)
+{ return g_pIpc->RecvView(hConnection, ppvBuf, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_RecvRelease (HIPCCONNECTION hConnection, const void *pvBuf)
+{ return g_pIpc->RecvRelease(hConnection, pvBuf); }
+
+IPC_API BOOL __stdcall IPC_SetSectionThreshold (HIPCCONNECTION hConnection, DWORD dwThreshold)
+{ return g_pIpc->SetSectionThreshold(hConnection, dwThreshold); }
+
+IPC_API BOOL __stdcall IPC_SetSpinTime (HIPCCONNECTION hConnection, DWORD dwMicroseconds)
+{ return g_pIpc->SetSpinTime(hConnection, dwMicroseconds); }
+
+IPC_API BOOL __stdcall IPC_SetMultiProducer (HIPCCONNECTION hConnection, BOOL bEnable)
+{ return g_pIpc->SetMultiProducer(hConnection, bEnable); }
+
+IPC_API DWORD __stdcall IPC_SendV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->SendV(hConnection, pBufs, dwCount, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_RecvV (HIPCCONNECTION hConnection, const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->RecvV(hConnection, pBufs, dwCount, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_SendBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+{ return g_pIpc->SendBatch(hConnection, pMsgs, dwCount, dwTimeout); }
+
+IPC_API DWORD __stdcall IPC_RecvBatch (HIPCCONNECTION hConnection, const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+{ return g_pIpc->RecvBatch(hConnection, pMsgs, dwCount, pdwSizes, dwTimeout); }
+
+IPC_API BOOL __stdcall IPC_SetBacklog (HIPCSERVER hServer, DWORD dwBacklog)
+{ return g_pIpc->SetBacklog(hServer, dwBacklog); }
+
+IPC_API DWORD __stdcall IPC_Reply (HIPCCONNECTION hConnection, DWORD dwCallId, const void *pvReply, DWORD dwReplySize, DWORD dwTimeout)
+{
+	IPC_CALL_HDR hdr = { dwCallId, 0 };
+	IPC_BUF bufs[2] = { { &hdr, sizeof (hdr) }, { (void *)pvReply, dwReplySize } };
+
+	DWORD rc = g_pIpc->SendV(hConnection, bufs, 2, dwTimeout);
+	return (rc == IPC_RC_TIMEOUT || rc == IPC_RC_ERROR) ? rc : dwReplySize;
+}
+
+IPC_API BOOL __stdcall IPC_SendAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{ return g_pIpc->SendAsync(hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+IPC_API BOOL __stdcall IPC_RecvAsync (HIPCCONNECTION hConnection, void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{ return g_pIpc->RecvAsync(hConnection, pvBuf, dwBufSize, pfnCallback, pvContext); }
+
+IPC_API BOOL __stdcall IPC_CancelAsync (HIPCCONNECTION hConnection, void *pvContext)
+{ return g_pIpc->CancelAsync(hConnection, pvContext); }
+
+IPC_API void __stdcall IPC_Init ()
+{}
+
+IPC_API void __stdcall IPC_Done ()
+{}
@@ -0,0 +1,270 @@
+// poll.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Poll set: readiness of many connections
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_impl.h"
+
+////////////////////////////////////////////////////////////////
+// IPC_PollEntry
+
+struct IPC_PollHandle
+{
+	IPC_PollEntry *entry;
+	HANDLE hObject;   // pollHandles of the source
+	HANDLE hWait;     // registered wait, 0 if none
+	bool   bFired;    // the wait was satisfied, not processed yet
+};
+
+struct IPC_PollEntry
+{
+	IPC_PollSet    *set;
+	IPC_PollSource *src;
+	HIPCCONNECTION  hConn;
+	DWORD           events;   // IPC_POLL_XXX requested
+	DWORD           armed;    // events armed by pollArm
+	bool            bQueued;
+	bool            bRemoved;
+	bool            bOneShot;
+	bool            bParked;  // reported, waits for rearm ()
+	IPC_PollEntry  *next;     // all entries
+	IPC_PollEntry  *prev;
+	IPC_PollEntry  *nextQueued;
+	int             nWaits;
+	IPC_PollHandle    waits [IPC_POLL_MAX_HANDLES];
+};
+
+void IPC_PollSource::pollRemove ()
+{
+	// the poll sets of the async and RPC engines are left in their detach
+	if (m_pPollEntry && m_pAsyncConn == NULL && m_pRpcConn == NULL) m_pPollEntry->set->remove (this);
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_PollSet
+
+IPC_PollSet::IPC_PollSet () : m_bInterrupted (false), m_pFirst (NULL), m_pQueue (NULL)
+{
+	InitializeCriticalSection (&m_cs);
+	m_hWake = CreateEvent (NULL, FALSE, FALSE, NULL);
+}
+
+IPC_PollSet::~IPC_PollSet ()
+{
+	while (m_pFirst) remove (m_pFirst->src);
+	DeleteCriticalSection (&m_cs);
+}
+
+// called with m_cs held
+void IPC_PollSet::queue (IPC_PollEntry *e)
+{
+	if (e->bQueued || e->bRemoved || e->bParked) return;
+	e->bQueued = true;
+	e->nextQueued = m_pQueue;
+	m_pQueue = e;
+}
+
+// thread pool callback: only queues the entry, the checks run in wait ()
+void CALLBACK IPC_PollSet::onSignal (PVOID ctx, BOOLEAN bTimedOut)
+{
+	IPC_PollHandle *w = (IPC_PollHandle *)ctx;
+	IPC_PollSet *set = w->entry->set;
+
+	EnterCriticalSection (&set->m_cs);
+	w->bFired = true;
+	set->queue (w->entry);
+	LeaveCriticalSection (&set->m_cs);
+
+	SetEvent (set->m_hWake);
+}
+
+DWORD IPC_PollSet::add (IPC_PollSource *src, HIPCCONNECTION hConn, DWORD events, bool bOneShot /*= false*/)
+{
+	if (src == NULL || (events & ~(IPC_POLL_IN|IPC_POLL_OUT|IPC_POLL_CLOSED)) != 0) return IPC_ERR_INVALID_ARG;
+
+	// a changed event mask is a new entry
+	if (src->m_pPollEntry) {
+		if (src->m_pPollEntry->set != this) return IPC_ERR_INVALID_ARG;
+		remove (src);
+	}
+
+	IPC_PollEntry *e = new IPC_PollEntry;
+	if (e == NULL) return IPC_ERR_OUT_OF_MEMORY;
+	memset (e, 0, sizeof (*e));
+	e->set = this;
+	e->src = src;
+	e->hConn = hConn;
+	e->events = events | IPC_POLL_CLOSED;
+	e->bOneShot = bOneShot;
+
+	HANDLE hdls[IPC_POLL_MAX_HANDLES];
+	e->nWaits = src->pollHandles (e->events, hdls);
+	for (int i = 0; i < e->nWaits; i++) {
+		e->waits[i].entry = e;
+		e->waits[i].hObject = hdls[i];
+	}
+
+	EnterCriticalSection (&m_cs);
+	src->m_pPollEntry = e;
+	e->next = m_pFirst;
+	if (m_pFirst) m_pFirst->prev = e;
+	m_pFirst = e;
+	queue (e);
+	LeaveCriticalSection (&m_cs);
+
+	// a waiting thread picks the new entry up
+	SetEvent (m_hWake);
+	return 0;
+}
+
+DWORD IPC_PollSet::remove (IPC_PollSource *src)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_PollEntry *e = src->m_pPollEntry;
+	if (e == NULL || e->set != this) {
+		LeaveCriticalSection (&m_cs);
+		return IPC_ERR_INVALID_ARG;
+	}
+
+	// callbacks from now on leave the entry alone
+	e->bRemoved = true;
+	src->m_pPollEntry = NULL;
+
+	if (e->prev) e->prev->next = e->next; else m_pFirst = e->next;
+	if (e->next) e->next->prev = e->prev;
+
+	if (e->bQueued) {
+		IPC_PollEntry **pp = &m_pQueue;
+		while (*pp != e) pp = &(*pp)->nextQueued;
+		*pp = e->nextQueued;
+	}
+
+	if (e->armed) src->pollDisarm (e->armed);
+
+	LeaveCriticalSection (&m_cs);
+
+	// the callbacks take m_cs, so wait for them outside of it
+	for (int i = 0; i < e->nWaits; i++) {
+		if (e->waits[i].hWait) UnregisterWaitEx (e->waits[i].hWait, INVALID_HANDLE_VALUE);
+	}
+
+	delete e;
+	return 0;
+}
+
+void IPC_PollSet::rearm (IPC_PollSource *src)
+{
+	EnterCriticalSection (&m_cs);
+	IPC_PollEntry *e = src->m_pPollEntry;
+	if (e != NULL && e->set == this && e->bParked) {
+		e->bParked = false;
+		queue (e);
+	}
+	LeaveCriticalSection (&m_cs);
+
+	SetEvent (m_hWake);
+}
+
+void IPC_PollSet::interrupt ()
+{
+	EnterCriticalSection (&m_cs);
+	m_bInterrupted = true;
+	LeaveCriticalSection (&m_cs);
+
+	SetEvent (m_hWake);
+}
+
+DWORD IPC_PollSet::wait (IPC_POLL_EVENT *events, DWORD count, DWORD tmo, DWORD& ready)
+{
+	ready = 0;
+	if (events == NULL || count == 0 || ! IsValidTimeout (tmo)) return IPC_ERR_INVALID_ARG;
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	for (;;) {
+		EnterCriticalSection (&m_cs);
+
+		// check the queued entries; the ready ones stay queued,
+		// they are reported again until they are drained
+		IPC_PollEntry *again = NULL;
+		while (m_pQueue && ready < count) {
+			IPC_PollEntry *e = m_pQueue;
+			m_pQueue = e->nextQueued;
+			e->bQueued = false;
+
+			// a fired wait is done (WT_EXECUTEONLYONCE), release it now
+			for (int i = 0; i < e->nWaits; i++) {
+				IPC_PollHandle& w = e->waits[i];
+				if (w.bFired) {
+					UnregisterWaitEx (w.hWait, NULL);
+					w.hWait = 0;
+					w.bFired = false;
+					e->src->pollFired (i);
+				}
+			}
+
+			// arm before the recheck: either the peer sees the arm
+			// or the recheck sees the change
+			DWORD st = e->src->pollCheck (e->events);
+			if (st == 0) {
+				e->src->pollArm (e->events);
+				e->armed = e->events;
+				st = e->src->pollCheck (e->events);
+			}
+
+			if (st != 0) {
+				if (e->armed) {
+					e->src->pollDisarm (e->armed);
+					e->armed = 0;
+				}
+				events[ready].hConnection = e->hConn;
+				events[ready].dwEvents = st;
+				ready++;
+
+				if (e->bOneShot) {
+					e->bParked = true;
+					continue;
+				}
+				e->bQueued = true;
+				e->nextQueued = again;
+				again = e;
+				continue;
+			}
+
+			for (int i = 0; i < e->nWaits; i++) {
+				IPC_PollHandle& w = e->waits[i];
+				if (w.hWait == 0 && ! RegisterWaitForSingleObject (&w.hWait, w.hObject, onSignal, &w, INFINITE, WT_EXECUTEONLYONCE)) {
+					w.hWait = 0;
+				}
+			}
+		}
+
+		// the reported entries go behind the not checked ones
+		if (again) {
+			IPC_PollEntry **pp = &m_pQueue;
+			while (*pp) pp = &(*pp)->nextQueued;
+			*pp = again;
+		}
+
+		// reported events go first, the interrupt stays for the next call
+		const bool bInterrupted = (ready == 0 && m_bInterrupted);
+		if (bInterrupted) m_bInterrupted = false;
+
+		LeaveCriticalSection (&m_cs);
+
+		if (ready != 0) return 0;
+		if (bInterrupted) return IPC_ERR_USER_EVENT_SET;
+
+		DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+		DWORD st = WaitForSingleObject (m_hWake, rtmo);
+		if (st == WAIT_TIMEOUT) return IPC_ERR_TIMEOUT;
+		if (st != WAIT_OBJECT_0) return IPC_ERR_UNKNOWN;
+	}
+}
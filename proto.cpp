@@ -0,0 +1,220 @@
+// proto.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Parts of the implementation shared by the Win32 and POSIX backends
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#ifdef _WIN32
+#	include "ipc_impl.h"
+#else
+#	include "ipc_shm.h"
+#endif
+
+////////////////////////////////////////////////////////////////
+// IPC_BufCursor
+
+DWORD IPC_BufCursor::gather (void *dst, DWORD size)
+{
+	unsigned char *p = (unsigned char *)dst;
+	DWORD done = 0;
+
+	while (done < size && m_idx < m_count) {
+		DWORD portion = m_bufs[m_idx].dwSize - m_off;
+		if (portion > size - done) portion = size - done;
+		memcpy (p + done, (const unsigned char *)m_bufs[m_idx].pvBuf + m_off, portion);
+
+		done += portion;
+		m_off += portion;
+		if (m_off == m_bufs[m_idx].dwSize) { m_idx++; m_off = 0; }
+	}
+	return done;
+}
+
+DWORD IPC_BufCursor::scatter (const void *src, DWORD size)
+{
+	const unsigned char *p = (const unsigned char *)src;
+	DWORD done = 0;
+
+	while (done < size && m_idx < m_count) {
+		DWORD portion = m_bufs[m_idx].dwSize - m_off;
+		if (portion > size - done) portion = size - done;
+		memcpy ((unsigned char *)m_bufs[m_idx].pvBuf + m_off, p + done, portion);
+
+		done += portion;
+		m_off += portion;
+		if (m_off == m_bufs[m_idx].dwSize) { m_idx++; m_off = 0; }
+	}
+	return done;
+}
+
+#ifndef _WIN32
+
+DWORD IPC_BufCursor::iov (struct iovec *iov, int maxIov, DWORD size, int& count) const
+{
+	DWORD idx = m_idx, off = m_off;
+	DWORD done = 0;
+	count = 0;
+
+	while (done < size && idx < m_count && count < maxIov) {
+		DWORD portion = m_bufs[idx].dwSize - off;
+		if (portion > size - done) portion = size - done;
+		if (portion != 0) {
+			iov[count].iov_base = (unsigned char *)m_bufs[idx].pvBuf + off;
+			iov[count].iov_len = portion;
+			count++;
+		}
+
+		done += portion;
+		off = 0;
+		idx++;
+	}
+	return done;
+}
+
+void IPC_BufCursor::skip (DWORD size)
+{
+	while (size != 0 && m_idx < m_count) {
+		DWORD portion = m_bufs[m_idx].dwSize - m_off;
+		if (portion > size) portion = size;
+
+		size -= portion;
+		m_off += portion;
+		if (m_off == m_bufs[m_idx].dwSize) { m_idx++; m_off = 0; }
+	}
+}
+
+#endif
+
+DWORD IPC_BufCursor::totalSize (const IPC_BUF *bufs, DWORD count)
+{
+	DWORD total = 0;
+	for (DWORD i = 0; i < count; i++) {
+		if (bufs[i].dwSize > IPC_MSG_INVALID - total) return IPC_MSG_INVALID;
+		total += bufs[i].dwSize;
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_HandleTable
+
+IPC_HandleTable::IPC_HandleTable () : m_pageCount (0), m_freeHead (0)
+{
+	InitializeCriticalSection (&m_csGrow);
+	for (DWORD i = 0; i < IPC_HANDLE_PAGES; i++) {
+		m_pages[i] = NULL;
+		m_pageMem[i] = NULL;
+	}
+}
+
+IPC_HandleTable::~IPC_HandleTable ()
+{
+	for (DWORD i = 0; i < m_pageCount; i++) free (m_pageMem[i]);
+	DeleteCriticalSection (&m_csGrow);
+}
+
+HIPCCONNECTION IPC_HandleTable::add (void *obj)
+{
+	// pop a free slot, the tag in the head keeps a slot that was popped
+	// and pushed back meanwhile from being popped twice
+	DWORD idx;
+	for (;;) {
+		LONG head = m_freeHead;
+		if ((head & 0xFFFF) == 0) {
+			if (! grow ()) return HIPCCONNECTION_INVALID;
+			continue;
+		}
+
+		idx = (head & 0xFFFF) - 1;
+		LONG next = (LONG)(((DWORD)head + 0x10000) & 0xFFFF0000) | slotAt (idx)->nextFree;
+		if (InterlockedCompareExchange (&m_freeHead, next, head) == head) break;
+	}
+
+	IPC_HandleSlot *s = slotAt (idx);
+	LONG gen = s->state >> 16;
+	s->obj = obj;
+	WriteRelease (&s->state, gen << 16);
+
+	return (HIPCCONNECTION)(ULONG_PTR)(((DWORD)gen << 16) | (idx + 1));
+}
+
+void * IPC_HandleTable::close (HIPCCONNECTION h)
+{
+	IPC_HandleSlot *s = slot (h);
+	if (s == NULL) return NULL;
+
+	LONG gen = generation (h);
+	for (;;) {
+		LONG st = s->state;
+		if ((st >> 16) != gen || (st & IPC_SLOT_CLOSED) != 0) return NULL;
+		if (InterlockedCompareExchange (&s->state, st | IPC_SLOT_CLOSED, st) == st) return s->obj;
+	}
+}
+
+void IPC_HandleTable::remove (HIPCCONNECTION h)
+{
+	IPC_HandleSlot *s = slot (h);
+
+	// the calls in flight see the connection closed and return promptly
+	for (int i = 0; (s->state & IPC_SLOT_REFS) != 0; i++) {
+		if (i < 64) SwitchToThread ();
+		else Sleep (1);
+	}
+
+	// the generation wraps after IPC_HANDLE_GEN_MAX reuses of the slot
+	LONG gen = generation (h) % IPC_HANDLE_GEN_MAX + 1;
+	s->obj = NULL;
+	WriteRelease (&s->state, (gen << 16) | IPC_SLOT_CLOSED);
+
+	push ((DWORD)((ULONG_PTR)h & 0xFFFF) - 1);
+}
+
+void IPC_HandleTable::push (DWORD idx)
+{
+	IPC_HandleSlot *s = slotAt (idx);
+	for (;;) {
+		LONG head = m_freeHead;
+		s->nextFree = head & 0xFFFF;
+		LONG next = (LONG)(((DWORD)head + 0x10000) & 0xFFFF0000) | (LONG)(idx + 1);
+		if (InterlockedCompareExchange (&m_freeHead, next, head) == head) return;
+	}
+}
+
+// add a page of free slots; the pages stay until exit, a stale handle
+// may still look at them
+bool IPC_HandleTable::grow ()
+{
+	EnterCriticalSection (&m_csGrow);
+
+	bool bOK = true;
+	if ((m_freeHead & 0xFFFF) == 0) {
+		// another thread may have grown the table meanwhile
+		void *mem = (m_pageCount < IPC_HANDLE_PAGES)
+			? malloc (IPC_HANDLE_PAGE_SLOTS * sizeof (IPC_HandleSlot) + IPC_CACHE_LINE) : NULL;
+
+		if (mem == NULL) bOK = false;
+		else {
+			IPC_HandleSlot *page = (IPC_HandleSlot *)
+				(((ULONG_PTR)mem + IPC_CACHE_LINE - 1) & ~(ULONG_PTR)(IPC_CACHE_LINE - 1));
+			memset (page, 0, IPC_HANDLE_PAGE_SLOTS * sizeof (IPC_HandleSlot));
+			for (DWORD i = 0; i < IPC_HANDLE_PAGE_SLOTS; i++) page[i].state = (1 << 16) | IPC_SLOT_CLOSED;
+
+			DWORD first = m_pageCount * IPC_HANDLE_PAGE_SLOTS;
+			m_pageMem[m_pageCount] = mem;
+			MemoryBarrier ();
+			m_pages[m_pageCount++] = page;
+
+			// low indexes first; the last index of the table does not fit a handle
+			for (DWORD i = IPC_HANDLE_PAGE_SLOTS; i-- > 0; ) {
+				if (first + i < IPC_HANDLE_SLOTS) push (first + i);
+			}
+		}
+	}
+
+	LeaveCriticalSection (&m_csGrow);
+	return bOK;
+}
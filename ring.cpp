@@ -0,0 +1,957 @@
+// ring.cpp
+//
+// Interprocess communication library (IPC)
+//
+// io_uring engine of the socket transport
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_ring.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+// user_data of the requests: a send is its CRingOp, the others are tagged
+enum
+{
+	KEY_SEND = 0,
+	KEY_RECV = 1,					// (generation << 32) | (slot << 2) | KEY_RECV
+	KEY_CANCEL = 2,
+	KEY_WAKE = 3,
+	KEY_MASK = 3
+};
+
+struct CRingConn
+{
+	CRingConn *next;				// free list
+	CRingConn *nextReady;
+	CRingConn *nextStalled;
+	int nSlot;						// registered file index
+	DWORD dwGen;					// incremented by every Attach of the slot
+	int evWait;						// eventfd of the waiting receiver
+	HIPCCONNECTION hConn;
+	bool bWaiting;
+	bool bReady;
+	bool bStalled;
+	bool bArmed;					// multishot receive in flight
+	bool bCancelling;
+	bool bEnded;					// no more packets, nErr 0 - end of file
+	int nErr;
+	bool bBroken;					// a send failed
+	bool bDead;						// Shutdown
+	bool bReleased;					// Release
+	int nHead;						// queued buffers
+	int nTail;
+	int nQueued;
+	int nSendsInFlight;
+	CRingOp *pSendFirst, *pSendLast;
+	CRingOp *pRecvFirst, *pRecvLast;
+};
+
+struct CRingOp
+{
+	CRingOp *next;
+	CRingConn *conn;
+	HIPCCONNECTION hConn;
+	BYTE *pBuf;
+	DWORD dwSize;
+	IPC_ASYNC_CALLBACK pfnCallback;
+	void *pvContext;
+	DWORD dwResult;
+	DWORD dwMaxPkt;
+	DWORD dwDone;					// bytes sent or stored
+	DWORD dwPkt;					// send: payload of the packet in flight
+	DWORD dwReceived;				// recv: payload of the packets taken
+	DWORD dwMsgSize;
+	bool bStarted;					// recv: the first packet is taken
+	bool bTruncated;
+	bool bInFlight;
+	IPC_MSG_HDR hdr;
+	struct iovec iov[2];
+	struct msghdr msg;
+};
+
+static __thread bool t_bRingThread = false;
+
+static inline uint64_t RecvKey(const CRingConn* c)
+{
+	return ((uint64_t)c->dwGen << 32) | ((uint64_t)c->nSlot << 2) | KEY_RECV;
+}
+
+static size_t CopyToIov(const struct iovec *iov, int nIov, const BYTE *p, size_t nSize)
+{
+	size_t nCopied = 0;
+	for (int i = 0; i < nIov && nCopied < nSize; ++i)
+	{
+		size_t n = nSize - nCopied < iov[i].iov_len ? nSize - nCopied : iov[i].iov_len;
+		memcpy(iov[i].iov_base, p + nCopied, n);
+		nCopied += n;
+	}
+	return nCopied;
+}
+
+// multishot receives and registered buffer rings are in Linux 6.0
+static bool KernelSupported()
+{
+	struct utsname u;
+	int nMajor = 0;
+	if (uname(&u) != 0 || sscanf(u.release, "%d", &nMajor) != 1)
+		return false;
+	return nMajor >= 6;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CSocketRing
+
+CSocketRing CSocketRing::g_instance;
+
+CSocketRing::CSocketRing()
+	: m_bStarted(false)
+	, m_bFailed(false)
+	, m_fdRing(-1)
+	, m_pRingMem(MAP_FAILED)
+	, m_nRingMemSize(0)
+	, m_pSqes((struct io_uring_sqe *)MAP_FAILED)
+	, m_nSqesSize(0)
+	, m_nSqTail(0)
+	, m_pBufRing((struct io_uring_buf_ring *)MAP_FAILED)
+	, m_pBufs((BYTE *)MAP_FAILED)
+	, m_nBufTail(0)
+	, m_nBufsFree(0)
+	, m_evWake(-1)
+	, m_qwWake(0)
+	, m_bWakeArmed(false)
+	, m_bWakePending(false)
+	, m_pConns(NULL)
+	, m_nConns(0)
+	, m_pFreeConns(NULL)
+	, m_pReady(NULL)
+	, m_pStalled(NULL)
+	, m_bStarved(false)
+	, m_pFreeOps(NULL)
+	, m_pDone(NULL)
+	, m_pDoneLast(NULL)
+{
+	InitializeCriticalSection(&m_cs);
+}
+
+CSocketRing::~CSocketRing()
+{
+	// the thread may still be inside m_cs when the process exits
+	if (!m_bStarted)
+		DeleteCriticalSection(&m_cs);
+}
+
+bool CSocketRing::Start()
+{
+	if (m_bStarted || m_bFailed)
+		return m_bStarted;
+
+	// a failed start is not retried
+	m_bFailed = true;
+	if (!KernelSupported())
+		return false;
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = RING_CQ_ENTRIES;
+	m_fdRing = (int)syscall(__NR_io_uring_setup, RING_SQ_ENTRIES, &p);
+	if (m_fdRing < 0)
+		return false;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+	{
+		Cleanup();
+		return false;
+	}
+
+	// the SQ and CQ rings share one mapping
+	size_t nSqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t nCqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	m_nRingMemSize = nSqSize > nCqSize ? nSqSize : nCqSize;
+	m_pRingMem = mmap(NULL, m_nRingMemSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQ_RING);
+	m_nSqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_pSqes = (struct io_uring_sqe *)mmap(NULL, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fdRing, IORING_OFF_SQES);
+	if (m_pRingMem == MAP_FAILED || m_pSqes == MAP_FAILED)
+	{
+		Cleanup();
+		return false;
+	}
+
+	BYTE *pRing = (BYTE *)m_pRingMem;
+	m_pSqHead = (unsigned *)(pRing + p.sq_off.head);
+	m_pSqTail = (unsigned *)(pRing + p.sq_off.tail);
+	m_nSqMask = *(unsigned *)(pRing + p.sq_off.ring_mask);
+	m_nSqEntries = p.sq_entries;
+	m_pCqHead = (unsigned *)(pRing + p.cq_off.head);
+	m_pCqTail = (unsigned *)(pRing + p.cq_off.tail);
+	m_nCqMask = *(unsigned *)(pRing + p.cq_off.ring_mask);
+	m_pCqes = (struct io_uring_cqe *)(pRing + p.cq_off.cqes);
+	m_nSqTail = *m_pSqTail;
+
+	// SQ slot i always holds SQE i
+	unsigned *pArray = (unsigned *)(pRing + p.sq_off.array);
+	for (unsigned i = 0; i < p.sq_entries; ++i)
+		pArray[i] = i;
+
+	// an empty file table, the kernel refuses one over RLIMIT_NOFILE
+	struct rlimit rl;
+	m_nConns = RING_MAX_CONNS;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)m_nConns)
+		m_nConns = (int)rl.rlim_cur;
+	int *pFds = new int[m_nConns];
+	for (int i = 0; i < m_nConns; ++i)
+		pFds[i] = -1;
+	long rc = syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_FILES, pFds, m_nConns);
+	delete[] pFds;
+	if (rc < 0)
+	{
+		Cleanup();
+		return false;
+	}
+
+	// the receive buffers
+	m_pBufRing = (struct io_uring_buf_ring *)mmap(NULL, RING_BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	m_pBufs = (BYTE *)mmap(NULL, (size_t)RING_BUF_COUNT * RING_BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m_pBufRing == MAP_FAILED || m_pBufs == MAP_FAILED)
+	{
+		Cleanup();
+		return false;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)m_pBufRing;
+	reg.ring_entries = RING_BUF_COUNT;
+	reg.bgid = 0;
+	if (syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		Cleanup();
+		return false;
+	}
+	for (int i = 0; i < RING_BUF_COUNT; ++i)
+		ReturnBuf(i);
+
+	m_evWake = eventfd(0, EFD_CLOEXEC);
+	if (m_evWake < 0)
+	{
+		Cleanup();
+		return false;
+	}
+
+	m_pConns = new CRingConn[m_nConns];
+	memset(m_pConns, 0, m_nConns * sizeof(CRingConn));
+	for (int i = m_nConns - 1; i >= 0; --i)
+	{
+		m_pConns[i].nSlot = i;
+		m_pConns[i].evWait = -1;
+		m_pConns[i].next = m_pFreeConns;
+		m_pFreeConns = &m_pConns[i];
+	}
+
+	pthread_t th;
+	if (pthread_create(&th, NULL, ThreadProc, this) != 0)
+	{
+		Cleanup();
+		return false;
+	}
+	pthread_detach(th);
+
+	m_bStarted = true;
+	m_bFailed = false;
+	return true;
+}
+
+// undoes a failed Start
+void CSocketRing::Cleanup()
+{
+	if (m_fdRing >= 0)
+		close(m_fdRing);
+	if (m_pRingMem != MAP_FAILED)
+		munmap(m_pRingMem, m_nRingMemSize);
+	if (m_pSqes != MAP_FAILED)
+		munmap(m_pSqes, m_nSqesSize);
+	if (m_pBufRing != MAP_FAILED)
+		munmap(m_pBufRing, RING_BUF_COUNT * sizeof(struct io_uring_buf));
+	if (m_pBufs != MAP_FAILED)
+		munmap(m_pBufs, (size_t)RING_BUF_COUNT * RING_BUF_SIZE);
+	if (m_evWake >= 0)
+		close(m_evWake);
+	delete[] m_pConns;
+
+	m_fdRing = -1;
+	m_pRingMem = MAP_FAILED;
+	m_pSqes = (struct io_uring_sqe *)MAP_FAILED;
+	m_pBufRing = (struct io_uring_buf_ring *)MAP_FAILED;
+	m_pBufs = (BYTE *)MAP_FAILED;
+	m_evWake = -1;
+	m_pConns = NULL;
+	m_pFreeConns = NULL;
+}
+
+CRingConn* CSocketRing::Attach(int fd, HIPCCONNECTION hConn)
+{
+	EnterCriticalSection(&m_cs);
+	CRingConn* c = Start() ? m_pFreeConns : NULL;
+	if (c)
+		m_pFreeConns = c->next;
+	LeaveCriticalSection(&m_cs);
+	if (!c)
+		return NULL;
+
+	// the slot is ours until it goes back to the free list
+	if (c->evWait < 0)
+		c->evWait = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	struct io_uring_files_update up;
+	memset(&up, 0, sizeof(up));
+	up.offset = c->nSlot;
+	up.fds = (uint64_t)(uintptr_t)&fd;
+	if (c->evWait < 0 || syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_FILES_UPDATE, &up, 1) != 1)
+	{
+		EnterCriticalSection(&m_cs);
+		c->next = m_pFreeConns;
+		m_pFreeConns = c;
+		LeaveCriticalSection(&m_cs);
+		return NULL;
+	}
+
+	EnterCriticalSection(&m_cs);
+	int nSlot = c->nSlot;
+	DWORD dwGen = c->dwGen + 1;
+	int evWait = c->evWait;
+	memset(c, 0, sizeof(*c));
+	c->nSlot = nSlot;
+	c->dwGen = dwGen;
+	c->evWait = evWait;
+	c->hConn = hConn;
+	c->nHead = c->nTail = -1;
+	MakeReady(c);
+	Wake();
+	LeaveCriticalSection(&m_cs);
+	return c;
+}
+
+void CSocketRing::Shutdown(CRingConn* c)
+{
+	EnterCriticalSection(&m_cs);
+	c->bDead = true;
+	if (c->bWaiting)
+	{
+		uint64_t nOne = 1;
+		c->bWaiting = false;
+		if (write(c->evWait, &nOne, sizeof(nOne)) < 0)
+			assert(false);
+	}
+	MakeReady(c);
+	Wake();
+	LeaveCriticalSection(&m_cs);
+}
+
+void CSocketRing::Release(CRingConn* c)
+{
+	EnterCriticalSection(&m_cs);
+	c->bReleased = true;
+	MakeReady(c);
+	Wake();
+	LeaveCriticalSection(&m_cs);
+}
+
+ssize_t CSocketRing::Recv(CRingConn* c, const struct iovec *iov, int nIov, int nFlags)
+{
+	EnterCriticalSection(&m_cs);
+
+	if (c->bDead)
+	{
+		LeaveCriticalSection(&m_cs);
+		errno = EPIPE;
+		return -1;
+	}
+	if (c->nHead < 0)
+	{
+		// the thread signals evWait with the next packet
+		int nErr = c->bEnded ? c->nErr : EAGAIN;
+		if (!c->bEnded)
+			c->bWaiting = true;
+		LeaveCriticalSection(&m_cs);
+		if (!nErr)
+			return 0;
+		errno = nErr;
+		return -1;
+	}
+
+	int nBid = c->nHead;
+	const BYTE *pBuf = m_pBufs + (size_t)nBid * RING_BUF_SIZE;
+	if (nFlags & MSG_PEEK)
+	{
+		size_t n = CopyToIov(iov, nIov, pBuf, m_arrBufLen[nBid]);
+		LeaveCriticalSection(&m_cs);
+		return (ssize_t)n;
+	}
+
+	// the buffer is not reused before it is returned, copy it unlocked
+	PopBuf(c);
+	LeaveCriticalSection(&m_cs);
+	size_t n = CopyToIov(iov, nIov, pBuf, m_arrBufLen[nBid]);
+	EnterCriticalSection(&m_cs);
+
+	ReturnBuf(nBid);
+	if (!c->bArmed && !c->bEnded && !c->bReady && !c->bStalled && c->nQueued < RING_CONN_BUFS / 2)
+	{
+		MakeReady(c);
+		Wake();
+	}
+	else if (m_bStarved && m_nBufsFree >= RING_BUF_COUNT / 4)
+	{
+		m_bStarved = false;
+		Wake();
+	}
+	LeaveCriticalSection(&m_cs);
+	return (ssize_t)n;
+}
+
+int CSocketRing::WaitFd(const CRingConn* c) const
+{
+	return c->evWait;
+}
+
+DWORD CSocketRing::Post(CRingConn* c, bool bSend, void *pvBuf, DWORD dwSize, DWORD dwMaxPkt,
+	IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{
+	if ((!pvBuf && dwSize) || !pfnCallback || (bSend && dwSize >= IPC_MSG_SIZE_LIMIT))
+		return IPC_ERR_INVALID_ARG;
+
+	EnterCriticalSection(&m_cs);
+
+	CRingOp* op = m_pFreeOps;
+	if (op)
+		m_pFreeOps = op->next;
+	else if (!(op = new CRingOp))
+	{
+		LeaveCriticalSection(&m_cs);
+		return IPC_ERR_OUT_OF_MEMORY;
+	}
+	memset(op, 0, sizeof(*op));
+	op->conn = c;
+	op->hConn = c->hConn;
+	op->pBuf = (BYTE *)pvBuf;
+	op->dwSize = dwSize;
+	op->pfnCallback = pfnCallback;
+	op->pvContext = pvContext;
+	op->dwMaxPkt = dwMaxPkt;
+
+	CRingOp*& pFirst = bSend ? c->pSendFirst : c->pRecvFirst;
+	CRingOp*& pLast = bSend ? c->pSendLast : c->pRecvLast;
+	if (pLast)
+		pLast->next = op;
+	else
+		pFirst = op;
+	pLast = op;
+
+	MakeReady(c);
+	Wake();
+	LeaveCriticalSection(&m_cs);
+	return 0;
+}
+
+void CSocketRing::Cancel(CRingConn* c, void *pvContext)
+{
+	EnterCriticalSection(&m_cs);
+	FailOps(c->pSendFirst, c->pSendLast, true, pvContext);
+	FailOps(c->pRecvFirst, c->pRecvLast, true, pvContext);
+	if (m_pDone)
+		Wake();
+	LeaveCriticalSection(&m_cs);
+}
+
+// the thread sees a change at its next turn, one write per turn at most
+void CSocketRing::Wake()
+{
+	if (m_bWakePending || t_bRingThread)
+		return;
+	m_bWakePending = true;
+	uint64_t nOne = 1;
+	if (write(m_evWake, &nOne, sizeof(nOne)) < 0)
+		assert(false);
+}
+
+void CSocketRing::MakeReady(CRingConn* c)
+{
+	if (c->bReady)
+		return;
+	c->bReady = true;
+	c->nextReady = m_pReady;
+	m_pReady = c;
+}
+
+struct io_uring_sqe* CSocketRing::GetSqe()
+{
+	unsigned nHead = __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+	if (m_nSqTail - nHead >= m_nSqEntries)
+		return NULL;
+	struct io_uring_sqe *sqe = &m_pSqes[m_nSqTail & m_nSqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	m_nSqTail++;
+	return sqe;
+}
+
+void CSocketRing::Reap()
+{
+	unsigned nHead = *m_pCqHead;
+	unsigned nTail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+	for (; nHead != nTail; ++nHead)
+	{
+		const struct io_uring_cqe *cqe = &m_pCqes[nHead & m_nCqMask];
+		switch (cqe->user_data & KEY_MASK)
+		{
+		case KEY_SEND:
+			OnSend((CRingOp *)(uintptr_t)cqe->user_data, cqe->res);
+			break;
+
+		case KEY_RECV:
+		{
+			CRingConn* c = &m_pConns[(cqe->user_data >> 2) & 0x3FFFFFFF];
+			if (c->dwGen == (DWORD)(cqe->user_data >> 32))
+				OnRecv(c, cqe->res, cqe->flags);
+			else if (cqe->flags & IORING_CQE_F_BUFFER)
+			{
+				m_nBufsFree--;
+				ReturnBuf(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+			break;
+		}
+
+		case KEY_WAKE:
+			m_bWakeArmed = false;
+			break;
+		}
+	}
+	__atomic_store_n(m_pCqHead, nHead, __ATOMIC_RELEASE);
+}
+
+void CSocketRing::OnRecv(CRingConn* c, int nRes, unsigned nFlags)
+{
+	if (nFlags & IORING_CQE_F_BUFFER)
+	{
+		int nBid = nFlags >> IORING_CQE_BUFFER_SHIFT;
+		m_nBufsFree--;
+		if (c->bDead)
+			ReturnBuf(nBid);
+		else
+		{
+			m_arrBufLen[nBid] = nRes > 0 ? (DWORD)nRes : 0;
+			m_arrBufNext[nBid] = -1;
+			if (c->nTail >= 0)
+				m_arrBufNext[c->nTail] = (short)nBid;
+			else
+				c->nHead = nBid;
+			c->nTail = nBid;
+			c->nQueued++;
+		}
+	}
+
+	// the receive ends with the end of file, an error, no free buffer or a cancel
+	if (!(nFlags & IORING_CQE_F_MORE))
+	{
+		c->bArmed = false;
+		c->bCancelling = false;
+		if (nRes == 0)
+			c->bEnded = true;
+		else if (nRes < 0 && nRes != -ENOBUFS && nRes != -ECANCELED)
+		{
+			c->bEnded = true;
+			c->nErr = -nRes;
+		}
+	}
+
+	if (c->bWaiting && (c->nHead >= 0 || c->bEnded))
+	{
+		uint64_t nOne = 1;
+		c->bWaiting = false;
+		if (write(c->evWait, &nOne, sizeof(nOne)) < 0)
+			assert(false);
+	}
+	MakeReady(c);
+}
+
+void CSocketRing::OnSend(CRingOp* op, int nRes)
+{
+	CRingConn* c = op->conn;
+	c->nSendsInFlight--;
+	op->bInFlight = false;
+
+	// a packet goes as a whole; a link after a failed send is cancelled
+	if (nRes == (int)(sizeof(IPC_MSG_HDR) + op->dwPkt))
+	{
+		op->dwDone += op->dwPkt;
+		if (op->dwDone == op->dwSize)
+		{
+			assert(c->pSendFirst == op);
+			c->pSendFirst = op->next;
+			if (!c->pSendFirst)
+				c->pSendLast = NULL;
+			Complete(op, op->dwSize);
+		}
+	}
+	else if (nRes != -EAGAIN && nRes != -EINTR && nRes != -ECANCELED)
+		c->bBroken = true;
+	MakeReady(c);
+}
+
+void CSocketRing::Process(CRingConn* c)
+{
+	if (c->bDead)
+	{
+		FailOps(c->pSendFirst, c->pSendLast, false, NULL);
+		FailOps(c->pRecvFirst, c->pRecvLast, false, NULL);
+		while (c->nHead >= 0)
+			ReturnBuf(PopBuf(c));
+		if (c->bArmed)
+			CancelRecv(c);
+		else if (c->bReleased && !c->nSendsInFlight)
+			FreeConn(c);
+		return;
+	}
+
+	Deliver(c);
+
+	if (c->bBroken)
+		FailOps(c->pSendFirst, c->pSendLast, false, NULL);
+	else if (!c->nSendsInFlight && c->pSendFirst)
+		PrepSends(c);
+
+	if (c->bArmed)
+	{
+		if (c->nQueued >= RING_CONN_BUFS)
+			CancelRecv(c);
+	}
+	else if (!c->bEnded && !c->bStalled)
+	{
+		// a full queue is armed again by Recv once drained
+		if (CanArm(c))
+			ArmRecv(c);
+		else if (c->nQueued < RING_CONN_BUFS / 2)
+		{
+			c->bStalled = true;
+			c->nextStalled = m_pStalled;
+			m_pStalled = c;
+			m_bStarved = true;
+		}
+	}
+}
+
+bool CSocketRing::CanArm(const CRingConn* c) const
+{
+	return m_nBufsFree >= RING_BUF_COUNT / 4 && c->nQueued < RING_CONN_BUFS / 2;
+}
+
+void CSocketRing::ArmRecv(CRingConn* c)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	if (!sqe)
+	{
+		MakeReady(c);
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = c->nSlot;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = 0;
+	sqe->user_data = RecvKey(c);
+	c->bArmed = true;
+}
+
+void CSocketRing::CancelRecv(CRingConn* c)
+{
+	if (c->bCancelling)
+		return;
+	struct io_uring_sqe *sqe = GetSqe();
+	if (!sqe)
+	{
+		MakeReady(c);
+		return;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = RecvKey(c);
+	sqe->user_data = KEY_CANCEL;
+	c->bCancelling = true;
+}
+
+// links the queued packets, up to the first one a larger message continues after
+void CSocketRing::PrepSends(CRingConn* c)
+{
+	struct io_uring_sqe *prev = NULL;
+	int n = 0;
+	for (CRingOp* op = c->pSendFirst; op && n < RING_CHAIN_MAX; op = op->next, ++n)
+	{
+		struct io_uring_sqe *sqe = GetSqe();
+		if (!sqe)
+		{
+			if (!n)
+				MakeReady(c);
+			break;
+		}
+
+		DWORD dwLeft = op->dwSize - op->dwDone;
+		op->dwPkt = dwLeft < op->dwMaxPkt ? dwLeft : op->dwMaxPkt;
+		op->hdr.msgSize = op->dwSize;
+		op->hdr.pktSize = op->dwPkt;
+		op->iov[0].iov_base = &op->hdr;
+		op->iov[0].iov_len = sizeof(op->hdr);
+		op->iov[1].iov_base = op->pBuf + op->dwDone;
+		op->iov[1].iov_len = op->dwPkt;
+		op->msg.msg_iov = op->iov;
+		op->msg.msg_iovlen = op->dwPkt ? 2 : 1;
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = c->nSlot;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = (uint64_t)(uintptr_t)op;
+		if (prev)
+			prev->flags |= IOSQE_IO_LINK;
+		prev = sqe;
+
+		op->bInFlight = true;
+		c->nSendsInFlight++;
+		if (op->dwDone + op->dwPkt < op->dwSize)
+			break;
+	}
+}
+
+// copies the queued packets into the posted receives
+void CSocketRing::Deliver(CRingConn* c)
+{
+	while (c->pRecvFirst && c->nHead >= 0)
+	{
+		CRingOp* op = c->pRecvFirst;
+		int nBid = PopBuf(c);
+		const BYTE *pBuf = m_pBufs + (size_t)nBid * RING_BUF_SIZE;
+		DWORD dwLen = m_arrBufLen[nBid];
+
+		IPC_MSG_HDR hdr;
+		if (dwLen < sizeof(hdr) || (memcpy(&hdr, pBuf, sizeof(hdr)), hdr.pktSize > dwLen - sizeof(hdr)))
+		{
+			// the peer does not speak the protocol
+			ReturnBuf(nBid);
+			while (c->nHead >= 0)
+				ReturnBuf(PopBuf(c));
+			c->bEnded = true;
+			c->nErr = EPROTO;
+			break;
+		}
+
+		if (!op->bStarted)
+		{
+			op->dwMsgSize = hdr.msgSize;
+			op->bStarted = true;
+		}
+		DWORD dwRoom = op->dwSize - op->dwDone;
+		DWORD dwStored = hdr.pktSize < dwRoom ? hdr.pktSize : dwRoom;
+		memcpy(op->pBuf + op->dwDone, pBuf + sizeof(hdr), dwStored);
+		op->dwDone += dwStored;
+		op->dwReceived += hdr.pktSize;
+		if (dwStored < hdr.pktSize)
+			op->bTruncated = true;
+		ReturnBuf(nBid);
+
+		if (op->dwReceived >= op->dwMsgSize)
+		{
+			c->pRecvFirst = op->next;
+			if (!c->pRecvFirst)
+				c->pRecvLast = NULL;
+			Complete(op, op->bTruncated ? IPC_RC_ERROR : op->dwDone);
+		}
+	}
+
+	if (c->bEnded && c->nHead < 0)
+		FailOps(c->pRecvFirst, c->pRecvLast, false, NULL);
+}
+
+// with bUntouched only the operations not started fail (IPC_CancelAsync),
+// otherwise all that are not in flight
+void CSocketRing::FailOps(CRingOp*& pFirst, CRingOp*& pLast, bool bUntouched, void *pvContext)
+{
+	CRingOp* prev = NULL;
+	CRingOp* op = pFirst;
+	while (op)
+	{
+		CRingOp* next = op->next;
+		bool bFail = !op->bInFlight;
+		if (bUntouched)
+			bFail = bFail && !op->dwDone && !op->bStarted && (!pvContext || op->pvContext == pvContext);
+		if (bFail)
+		{
+			if (prev)
+				prev->next = next;
+			else
+				pFirst = next;
+			if (pLast == op)
+				pLast = prev;
+			Complete(op, IPC_RC_ERROR);
+		}
+		else
+			prev = op;
+		op = next;
+	}
+}
+
+void CSocketRing::Complete(CRingOp* op, DWORD dwResult)
+{
+	op->dwResult = dwResult;
+	op->next = NULL;
+	if (m_pDoneLast)
+		m_pDoneLast->next = op;
+	else
+		m_pDone = op;
+	m_pDoneLast = op;
+}
+
+void CSocketRing::FreeConn(CRingConn* c)
+{
+	int fd = -1;
+	struct io_uring_files_update up;
+	memset(&up, 0, sizeof(up));
+	up.offset = c->nSlot;
+	up.fds = (uint64_t)(uintptr_t)&fd;
+	syscall(__NR_io_uring_register, m_fdRing, IORING_REGISTER_FILES_UPDATE, &up, 1);
+
+	if (c->bStalled)
+	{
+		CRingConn** pp = &m_pStalled;
+		while (*pp != c)
+			pp = &(*pp)->nextStalled;
+		*pp = c->nextStalled;
+		c->bStalled = false;
+	}
+
+	c->dwGen++;
+	c->next = m_pFreeConns;
+	m_pFreeConns = c;
+}
+
+int CSocketRing::PopBuf(CRingConn* c)
+{
+	int nBid = c->nHead;
+	c->nHead = m_arrBufNext[nBid];
+	if (c->nHead < 0)
+		c->nTail = -1;
+	c->nQueued--;
+	return nBid;
+}
+
+// the buffer ring tail is published to the kernel, no call is needed;
+// the ring is indexed by hand, in C++ the flexible bufs member of
+// io_uring_buf_ring is laid out after an empty struct
+void CSocketRing::ReturnBuf(int nBid)
+{
+	struct io_uring_buf *b = (struct io_uring_buf *)m_pBufRing + (m_nBufTail & (RING_BUF_COUNT - 1));
+	b->addr = (uint64_t)(uintptr_t)(m_pBufs + (size_t)nBid * RING_BUF_SIZE);
+	b->len = RING_BUF_SIZE;
+	b->bid = (unsigned short)nBid;
+	m_nBufTail++;
+	__atomic_store_n(&m_pBufRing->tail, m_nBufTail, __ATOMIC_RELEASE);
+	m_nBufsFree++;
+}
+
+void* CSocketRing::ThreadProc(void *pvParam)
+{
+	t_bRingThread = true;
+	((CSocketRing *)pvParam)->Run();
+	return NULL;
+}
+
+// a turn: take the completions, prepare the requests of the changed
+// connections, run the callbacks, submit and wait in one io_uring_enter
+void CSocketRing::Run()
+{
+	for (;;)
+	{
+		EnterCriticalSection(&m_cs);
+
+		Reap();
+		m_bWakePending = false;
+		if (!m_bWakeArmed)
+		{
+			struct io_uring_sqe *sqe = GetSqe();
+			if (sqe)
+			{
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = m_evWake;
+				sqe->addr = (uint64_t)(uintptr_t)&m_qwWake;
+				sqe->len = sizeof(m_qwWake);
+				sqe->user_data = KEY_WAKE;
+				m_bWakeArmed = true;
+			}
+		}
+
+		CRingConn* pReady = m_pReady;
+		m_pReady = NULL;
+		while (pReady)
+		{
+			CRingConn* c = pReady;
+			pReady = c->nextReady;
+			c->bReady = false;
+			Process(c);
+		}
+
+		CRingConn** pp = &m_pStalled;
+		while (*pp)
+		{
+			CRingConn* c = *pp;
+			// a closed or full connection leaves the list, Process or Recv takes it on
+			if (c->bDead || CanArm(c) || c->nQueued >= RING_CONN_BUFS / 2)
+			{
+				*pp = c->nextStalled;
+				c->bStalled = false;
+				if (c->bDead)
+					MakeReady(c);
+				else if (CanArm(c))
+					ArmRecv(c);
+			}
+			else
+				pp = &c->nextStalled;
+		}
+		if (m_pStalled)
+			m_bStarved = true;
+
+		CRingOp* pDone = m_pDone;
+		m_pDone = m_pDoneLast = NULL;
+		LeaveCriticalSection(&m_cs);
+
+		for (CRingOp* op = pDone; op; op = op->next)
+			op->pfnCallback(op->hConn, op->dwResult, op->pvContext);
+
+		EnterCriticalSection(&m_cs);
+		while (pDone)
+		{
+			CRingOp* op = pDone;
+			pDone = op->next;
+			op->next = m_pFreeOps;
+			m_pFreeOps = op;
+		}
+		bool bMore = m_pReady != NULL || m_pDone != NULL;
+		LeaveCriticalSection(&m_cs);
+
+		Submit(!bMore);
+	}
+}
+
+void CSocketRing::Submit(bool bWait)
+{
+	__atomic_store_n(m_pSqTail, m_nSqTail, __ATOMIC_RELEASE);
+	unsigned nToSubmit = m_nSqTail - __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+
+	// EINTR, EAGAIN, EBUSY: the next turn tries again
+	syscall(__NR_io_uring_enter, m_fdRing, nToSubmit, bWait ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+}
@@ -0,0 +1,463 @@
+// rpc.cpp
+//
+// Interprocess communication library (IPC)
+//
+// RPC engine: IPC_Call/IPC_CallAsync/IPC_Reply
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_impl.h"
+
+////////////////////////////////////////////////////////////////
+// IPC_RpcConn
+
+struct IPC_RpcCall
+{
+	IPC_RpcCall        *next;
+	DWORD               id;
+	bool                bSending;  // the poster is still in the send, it fails the call itself
+	HIPCCONNECTION      hConn;
+	void               *buf;
+	DWORD               size;
+	DWORD               rsz;       // reply size
+	DWORD               err;       // IPC_ERR_XXX
+	IPC_ASYNC_CALLBACK  cb;        // NULL - IPC_Call, hDone is signaled
+	void               *ctx;
+	HANDLE              hDone;
+};
+
+struct IPC_RpcConn
+{
+	CRITICAL_SECTION cs;       // the fields below; m_cs only attaches and frees it
+	IPC_PollSource *src;
+	IPC_ServeOps   *ops;
+	HIPCCONNECTION  hConn;
+	DWORD           lastId;
+	IPC_RpcCall    *calls [IPC_RPC_SLOTS];  // pending calls by id & (IPC_RPC_SLOTS - 1)
+	volatile LONG   posting;   // callers between acquire and release
+	bool            busy;      // the dispatcher is receiving
+	bool            bClosed;   // detached or broken, no more calls
+	IPC_RpcConn    *nextDead;
+};
+
+void IPC_PollSource::rpcDetach ()
+{
+	if (m_pRpcConn) IPC_RpcEngine::instance ().detach (this);
+}
+
+// called with c->cs held: the link to the pending call or NULL
+static IPC_RpcCall ** IPC_RpcFind (IPC_RpcConn *c, DWORD id)
+{
+	for (IPC_RpcCall **pp = &c->calls [id & (IPC_RPC_SLOTS - 1)]; *pp; pp = &(*pp)->next) {
+		if ((*pp)->id == id) return pp;
+	}
+	return NULL;
+}
+
+// called with c->cs held: unlinks the calls no poster is sending,
+// with bCancel only the async ones posted with ctx (all if NULL)
+static IPC_RpcCall * IPC_RpcTake (IPC_RpcConn *c, bool bCancel, void *ctx)
+{
+	IPC_RpcCall *taken = NULL;
+	for (DWORD i = 0; i < IPC_RPC_SLOTS; i++) {
+		IPC_RpcCall **pp = &c->calls [i];
+		while (IPC_RpcCall *call = *pp) {
+			if (call->bSending || (bCancel && (call->cb == NULL || (ctx != NULL && call->ctx != ctx)))) {
+				pp = &call->next;
+				continue;
+			}
+			*pp = call->next;
+			call->next = taken;
+			taken = call;
+		}
+	}
+	return taken;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_RpcEngine
+
+IPC_RpcEngine IPC_RpcEngine::g_instance;
+
+IPC_RpcEngine::IPC_RpcEngine () : m_bStarted (false), m_pDead (NULL)
+{
+	InitializeCriticalSection (&m_cs);
+}
+
+IPC_RpcEngine::~IPC_RpcEngine ()
+{
+	// the dispatcher may still be inside m_cs when the process exits
+	if (! m_bStarted) DeleteCriticalSection (&m_cs);
+}
+
+// called with m_cs held
+bool IPC_RpcEngine::start ()
+{
+	if (m_bStarted) return true;
+	if (! m_set.isValid ()) return false;
+
+	HANDLE h = CreateThread (NULL, 0, dispatcher, this, 0, NULL);
+	if (h == NULL) return false;
+	CloseHandle (h);
+
+	m_bStarted = true;
+	return true;
+}
+
+DWORD IPC_RpcEngine::call (IPC_ServeOps& ops, HIPCCONNECTION hConn, const void *req, DWORD reqSize,
+	void *reply, DWORD replySize, DWORD tmo, DWORD& rsz)
+{
+	rsz = 0;
+	if (! IsValidTimeout (tmo)) return IPC_ERR_INVALID_ARG;
+
+	DWORD t0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_RpcCall call;
+	memset (&call, 0, sizeof (call));
+	call.hConn = hConn;
+	call.buf = reply;
+	call.size = replySize;
+	call.hDone = CreateEvent (NULL, TRUE, FALSE, NULL);
+	if (call.hDone == NULL) return IPC_ERR_UNKNOWN;
+
+	IPC_RpcConn *c;
+	DWORD err = post (ops, hConn, &call, req, reqSize, tmo, c);
+	if (err == 0) {
+		if (WaitForSingleObject (call.hDone, IPC_RemainingTimeout (tmo, t0)) != WAIT_OBJECT_0) {
+			// take the call back unless the dispatcher is completing it
+			EnterCriticalSection (&c->cs);
+			IPC_RpcCall **pp = IPC_RpcFind (c, call.id);
+			if (pp) *pp = call.next;
+			LeaveCriticalSection (&c->cs);
+
+			if (pp) call.err = IPC_ERR_TIMEOUT;
+			else WaitForSingleObject (call.hDone, INFINITE);
+		}
+		err = call.err;
+		rsz = call.rsz;
+		release (c);
+	}
+
+	CloseHandle (call.hDone);
+	return err;
+}
+
+DWORD IPC_RpcEngine::callAsync (IPC_ServeOps& ops, HIPCCONNECTION hConn, const void *req, DWORD reqSize,
+	void *reply, DWORD replySize, IPC_ASYNC_CALLBACK cb, void *ctx)
+{
+	if (cb == NULL) return IPC_ERR_INVALID_ARG;
+
+	IPC_RpcCall *call = new IPC_RpcCall;
+	if (call == NULL) return IPC_ERR_OUT_OF_MEMORY;
+	memset (call, 0, sizeof (*call));
+	call->hConn = hConn;
+	call->buf = reply;
+	call->size = replySize;
+	call->cb = cb;
+	call->ctx = ctx;
+
+	// the call belongs to the engine once posted
+	IPC_RpcConn *c;
+	DWORD err = post (ops, hConn, call, req, reqSize, INFINITE, c);
+	if (err != 0) {
+		delete call;
+		return err;
+	}
+
+	release (c);
+	return 0;
+}
+
+DWORD IPC_RpcEngine::reply (IPC_ServeOps& ops, HIPCCONNECTION hConn, DWORD callId,
+	const void *buf, DWORD size, DWORD tmo)
+{
+	IPC_CALL_HDR hdr = { callId, 0 };
+	IPC_BUF bufs[2] = { { &hdr, sizeof (hdr) }, { (void *)buf, size } };
+
+	DWORD rc = ops.SendV (hConn, bufs, 2, tmo);
+	return (rc == IPC_RC_TIMEOUT || rc == IPC_RC_ERROR) ? rc : size;
+}
+
+// the call state of src, attached first if ops is given; it is not freed
+// before release
+IPC_RpcConn * IPC_RpcEngine::acquire (IPC_PollSource *src, IPC_ServeOps *ops, HIPCCONNECTION hConn, DWORD& err)
+{
+	err = IPC_ERR_INVALID_ARG;
+	EnterCriticalSection (&m_cs);
+
+	IPC_RpcConn *c = src->m_pRpcConn;
+	if (c == NULL && ops != NULL) {
+		// the dispatcher receives the replies, a connection is in one poll set at a time
+		if (! start ()) err = IPC_ERR_UNKNOWN;
+		else if (src->m_pPollEntry != NULL) err = IPC_ERR_INVALID_ARG;
+		else if ((c = new IPC_RpcConn) == NULL) err = IPC_ERR_OUT_OF_MEMORY;
+		else {
+			memset (c, 0, sizeof (*c));
+			InitializeCriticalSection (&c->cs);
+			c->src = src;
+			c->ops = ops;
+			c->hConn = hConn;
+			if (m_set.add (src, (HIPCCONNECTION)c, IPC_POLL_IN) == 0) src->m_pRpcConn = c;
+			else {
+				DeleteCriticalSection (&c->cs);
+				delete c;
+				c = NULL;
+				err = IPC_ERR_UNKNOWN;
+			}
+		}
+	}
+	if (c != NULL) InterlockedIncrement (&c->posting);
+
+	LeaveCriticalSection (&m_cs);
+	return c;
+}
+
+void IPC_RpcEngine::release (IPC_RpcConn *c)
+{
+	InterlockedDecrement (&c->posting);
+}
+
+// registers the call and sends the request; on success the call is
+// completed later (also when the connection is closed meanwhile) and
+// conn must be released after the caller is done with it
+DWORD IPC_RpcEngine::post (IPC_ServeOps& ops, HIPCCONNECTION hConn, IPC_RpcCall *call,
+	const void *req, DWORD reqSize, DWORD tmo, IPC_RpcConn *&conn)
+{
+	conn = NULL;
+	if ((req == NULL && reqSize != 0) || (call->buf == NULL && call->size != 0)) return IPC_ERR_INVALID_ARG;
+	if (reqSize >= IPC_MSG_SIZE_LIMIT - sizeof (IPC_CALL_HDR)) return IPC_ERR_INVALID_ARG;
+
+	// the reference keeps src alive until the call is registered; after
+	// that the connection's rpcDetach completes it
+	IPC_PollSourceRef src (ops, hConn);
+	if (src == NULL) return IPC_ERR_INVALID_ARG;
+
+	DWORD err;
+	IPC_RpcConn *c = acquire (src, &ops, hConn, err);
+	if (c == NULL) return err;
+
+	EnterCriticalSection (&c->cs);
+
+	if (c->bClosed) {
+		LeaveCriticalSection (&c->cs);
+		release (c);
+		return IPC_ERR_CLOSED;
+	}
+
+	call->id = ++c->lastId;
+	call->bSending = true;
+	IPC_RpcCall **slot = &c->calls [call->id & (IPC_RPC_SLOTS - 1)];
+	call->next = *slot;
+	*slot = call;
+
+	LeaveCriticalSection (&c->cs);
+
+	IPC_CALL_HDR hdr = { call->id, 0 };
+	IPC_BUF bufs[2] = { { &hdr, sizeof (hdr) }, { (void *)req, reqSize } };
+	DWORD rc = ops.SendV (hConn, bufs, 2, tmo);
+	err = (rc == IPC_RC_TIMEOUT) ? IPC_ERR_TIMEOUT : (rc == IPC_RC_ERROR) ? IPC_ERR_UNKNOWN : 0;
+
+	EnterCriticalSection (&c->cs);
+
+	// the reply may have completed the call already
+	bool bClosed = false;
+	IPC_RpcCall **pp = IPC_RpcFind (c, call->id);
+	if (pp) {
+		call->bSending = false;
+		if (err != 0 || c->bClosed) {
+			*pp = call->next;
+			bClosed = (err == 0);
+		}
+	}
+
+	LeaveCriticalSection (&c->cs);
+
+	if (err != 0) {
+		release (c);
+		return err;
+	}
+
+	// no reply can come any more
+	if (bClosed) complete (call, IPC_ERR_CLOSED);
+
+	conn = c;
+	return 0;
+}
+
+// IPC_Call wakes up, the async call runs its callback and is freed
+void IPC_RpcEngine::complete (IPC_RpcCall *call, DWORD err)
+{
+	call->err = err;
+	if (call->cb == NULL) {
+		SetEvent (call->hDone);
+		return;
+	}
+
+	call->cb (call->hConn, (err == 0) ? call->rsz : IPC_ERR_TO_RC (err), call->ctx);
+	delete call;
+}
+
+void IPC_RpcEngine::detach (IPC_PollSource *src)
+{
+	EnterCriticalSection (&m_cs);
+
+	IPC_RpcConn *c = src->m_pRpcConn;
+	if (c == NULL) {
+		LeaveCriticalSection (&m_cs);
+		return;
+	}
+
+	// src stays attached until the calls are failed, new ones see it closed
+	EnterCriticalSection (&c->cs);
+	c->bClosed = true;
+	LeaveCriticalSection (&c->cs);
+	m_set.remove (src);
+
+	LeaveCriticalSection (&m_cs);
+
+	// the dispatcher receives with no timeout, it leaves soon;
+	// the calls being sent are failed by their posters
+	EnterCriticalSection (&c->cs);
+	while (c->busy) {
+		LeaveCriticalSection (&c->cs);
+		Sleep (1);
+		EnterCriticalSection (&c->cs);
+	}
+	IPC_RpcCall *failed = IPC_RpcTake (c, false, NULL);
+	LeaveCriticalSection (&c->cs);
+
+	EnterCriticalSection (&m_cs);
+	src->m_pRpcConn = NULL;
+	c->src = NULL;
+	c->nextDead = m_pDead;
+	m_pDead = c;
+	LeaveCriticalSection (&m_cs);
+
+	while (IPC_RpcCall *call = failed) {
+		failed = call->next;
+		complete (call, IPC_ERR_CLOSED);
+	}
+}
+
+void IPC_RpcEngine::cancel (IPC_PollSource *src, void *ctx)
+{
+	if (src == NULL) return;
+
+	DWORD err;
+	IPC_RpcConn *c = acquire (src, NULL, NULL, err);
+	if (c == NULL) return;
+
+	EnterCriticalSection (&c->cs);
+	IPC_RpcCall *failed = IPC_RpcTake (c, true, ctx);
+	LeaveCriticalSection (&c->cs);
+
+	release (c);
+
+	while (IPC_RpcCall *call = failed) {
+		failed = call->next;
+		complete (call, IPC_ERR_UNKNOWN);
+	}
+}
+
+// dispatcher: c->busy is set
+void IPC_RpcEngine::receive (IPC_RpcConn *c)
+{
+	IPC_RpcCall *done = NULL;
+	bool bBroken = false;
+
+	for (int n = 0; n < IPC_RPC_BATCH; n++) {
+		const void *msg;
+		DWORD rsz = c->ops->RecvView (c->hConn, &msg, 0);
+		if (rsz == IPC_RC_TIMEOUT) break;
+		if (rsz == IPC_RC_ERROR) {
+			bBroken = true;
+			break;
+		}
+
+		if (rsz >= sizeof (IPC_CALL_HDR)) {
+			const IPC_CALL_HDR *hdr = (const IPC_CALL_HDR *)msg;
+
+			EnterCriticalSection (&c->cs);
+			IPC_RpcCall **pp = IPC_RpcFind (c, hdr->dwCallId);
+			IPC_RpcCall *call = pp ? *pp : NULL;
+			if (call) *pp = call->next;
+			LeaveCriticalSection (&c->cs);
+
+			// the call is ours now, its buffer stays valid until completed
+			if (call) {
+				DWORD size = rsz - sizeof (IPC_CALL_HDR);
+				call->rsz = (size < call->size) ? size : call->size;
+				memcpy (call->buf, hdr + 1, call->rsz);
+				call->err = (size > call->size) ? IPC_ERR_MSG_TRUNCATED : 0;
+				call->next = done;
+				done = call;
+			}
+		}
+		c->ops->RecvRelease (c->hConn, msg);
+	}
+
+	EnterCriticalSection (&c->cs);
+
+	// no reply comes on a broken connection
+	if (bBroken && ! c->bClosed) {
+		c->bClosed = true;
+		m_set.remove (c->src);
+
+		IPC_RpcCall *failed = IPC_RpcTake (c, false, NULL);
+		while (IPC_RpcCall *call = failed) {
+			failed = call->next;
+			call->err = IPC_ERR_CLOSED;
+			call->next = done;
+			done = call;
+		}
+	}
+	c->busy = false;
+
+	LeaveCriticalSection (&c->cs);
+
+	// the callbacks may close the connection
+	while (IPC_RpcCall *call = done) {
+		done = call->next;
+		complete (call, call->err);
+	}
+}
+
+DWORD WINAPI IPC_RpcEngine::dispatcher (LPVOID param)
+{
+	IPC_RpcEngine *engine = (IPC_RpcEngine *)param;
+	IPC_POLL_EVENT events [IPC_RPC_EVENTS];
+
+	for (;;) {
+		// the poll set has dropped them, no wait reports them any more
+		EnterCriticalSection (&engine->m_cs);
+		IPC_RpcConn **pp = &engine->m_pDead;
+		while (IPC_RpcConn *c = *pp) {
+			if (c->posting != 0) {
+				pp = &c->nextDead;
+				continue;
+			}
+			*pp = c->nextDead;
+			DeleteCriticalSection (&c->cs);
+			delete c;
+		}
+		LeaveCriticalSection (&engine->m_cs);
+
+		DWORD ready;
+		DWORD err = engine->m_set.wait (events, IPC_RPC_EVENTS, INFINITE, ready);
+		if (err != 0) return err;
+
+		for (DWORD i = 0; i < ready; i++) {
+			IPC_RpcConn *c = (IPC_RpcConn *)events[i].hConnection;
+
+			EnterCriticalSection (&c->cs);
+			bool bClosed = c->bClosed;
+			c->busy = ! bClosed;
+			LeaveCriticalSection (&c->cs);
+
+			if (! bClosed) engine->receive (c);
+		}
+	}
+}
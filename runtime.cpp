@@ -103,6 +103,15 @@ IPC_Runtime::IPC_Runtime () : m_bInitOK (false), m_hSA (0), m_pSA (NULL),
 {
 	InitializeCriticalSection (& m_postInitCSect);
 
+	SYSTEM_INFO si;
+	GetSystemInfo (& si);
+	m_bMultiCpu = si.dwNumberOfProcessors > 1;
+
+	LARGE_INTEGER freq;
+	if (! QueryPerformanceFrequency (& freq)) freq.QuadPart = 0;
+	m_ticksPerSec = freq.QuadPart;
+	if (m_ticksPerSec == 0) m_bMultiCpu = false;
+
 	memset (&m_osVersion, 0, sizeof (m_osVersion));
 	m_osVersion.dwOSVersionInfoSize = sizeof (m_osVersion);
 
@@ -159,14 +168,14 @@ DWORD IPC_Runtime::getVersion ()
 		 | MODULE_VERSION_D;
 }
 
-HIPCSERVER IPC_Runtime::serverStart (const char *epName)
+HIPCSERVER IPC_Runtime::serverStart (const char *epName, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
 {
 	checkPostInit ();
 
 	IPC_Server *pServer = new IPC_Server ();
 	if (! pServer) return HIPCSERVER_INVALID;
 
-	DWORD ec = pServer->listen (epName);
+	DWORD ec = pServer->listen (epName, sendSize, recvSize);
 	if (ec != 0) {
 		delete pServer;
 		return IPC_ERR_TO_HIPCSERVER(ec);
@@ -204,7 +213,7 @@ HIPCCONNECTION IPC_Runtime::serverWaitForConnection (HIPCSERVER hServer, DWORD t
 	IPC_Connection *pConn = pServer->accept (tmo, err, hBreakEvent);
 	if (! pConn) return IPC_ERR_TO_HIPCCONNECTION (err);
 
-	HIPCCONNECTION h = registerConnection (pConn);
+	HIPCCONNECTION h = m_connections.add (pConn);
 	if (h == HIPCCONNECTION_INVALID) {
 		// very unlikely
 		pConn->close ();
@@ -215,20 +224,20 @@ HIPCCONNECTION IPC_Runtime::serverWaitForConnection (HIPCSERVER hServer, DWORD t
 	return h;
 }
 
-HIPCCONNECTION IPC_Runtime::connect (const char *epName, DWORD tmo)
+HIPCCONNECTION IPC_Runtime::connect (const char *epName, DWORD tmo, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
 {
 	checkPostInit ();
 
 	IPC_Connection *pConn = new IPC_Connection ();
 	if (! pConn) return IPC_ERR_TO_HIPCCONNECTION (IPC_ERR_INVALID_ARG);
 
-	DWORD err = pConn->connect (epName, tmo);
+	DWORD err = pConn->connect (epName, tmo, sendSize, recvSize);
 	if (err != 0) {
 		delete pConn;
 		return IPC_ERR_TO_HIPCCONNECTION (err);
 	}
 
-	HIPCCONNECTION h = registerConnection (pConn);
+	HIPCCONNECTION h = m_connections.add (pConn);
 	if (h == HIPCCONNECTION_INVALID) {
 		// very unlikely
 		pConn->close ();
@@ -241,9 +250,13 @@ HIPCCONNECTION IPC_Runtime::connect (const char *epName, DWORD tmo)
 
 BOOL IPC_Runtime::closeConnection (HIPCCONNECTION hConn)
 {
-	IPC_Connection *pConn = unregisterConnection (hConn);
+	IPC_Connection *pConn = static_cast<IPC_Connection *> (m_connections.close (hConn));
 	if (! pConn) return FALSE;
-	
+
+	// get the blocked calls out, the handle is freed when they have left
+	pConn->shutdown ();
+	m_connections.remove (hConn);
+
 	BOOL f = pConn->close ();
 	delete pConn;
 
@@ -252,7 +265,7 @@ BOOL IPC_Runtime::closeConnection (HIPCCONNECTION hConn)
 
 BOOL IPC_Runtime::setUserEvent (HIPCCONNECTION hConn, HANDLE hUserEvent)
 {
-	IPC_Connection *pConn = getConnection (hConn);
+	IPC_ConnectionRef pConn (m_connections, hConn);
 	if (! pConn) return FALSE;
 	
 	return pConn->setUserEvent (hUserEvent);
@@ -260,7 +273,7 @@ BOOL IPC_Runtime::setUserEvent (HIPCCONNECTION hConn, HANDLE hUserEvent)
 
 BOOL IPC_Runtime::getUserEvent (HIPCCONNECTION hConn, HANDLE *phUserEvent)
 {
-	IPC_Connection *pConn = getConnection (hConn);
+	IPC_ConnectionRef pConn (m_connections, hConn);
 	if (! pConn) return FALSE;
 	
 	return pConn->getUserEvent (phUserEvent);
@@ -268,7 +281,7 @@ BOOL IPC_Runtime::getUserEvent (HIPCCONNECTION hConn, HANDLE *phUserEvent)
 
 BOOL IPC_Runtime::resetUserEvent (HIPCCONNECTION hConn)
 {
-	IPC_Connection *pConn = getConnection (hConn);
+	IPC_ConnectionRef pConn (m_connections, hConn);
 	if (! pConn) return FALSE;
 	
 	return pConn->resetUserEvent ();
@@ -276,7 +289,7 @@ BOOL IPC_Runtime::resetUserEvent (HIPCCONNECTION hConn)
 
 DWORD IPC_Runtime::getConnectionLastErr (HIPCCONNECTION hConn)
 {
-	IPC_Connection *pConn = unregisterConnection (hConn);
+	IPC_ConnectionRef pConn (m_connections, hConn);
 	if (! pConn) return IPC_ERR_INVALID_ARG;
 
 	return pConn->getLastError ();
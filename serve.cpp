@@ -0,0 +1,278 @@
+// serve.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Server runner: IPC_ServerRun
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_impl.h"
+
+////////////////////////////////////////////////////////////////
+// IPC_ServeConn, IPC_ServeWorker
+
+struct IPC_ServeConn
+{
+	HIPCCONNECTION  hConn;
+	IPC_PollSource *src;
+	IPC_ServeConn  *prev;       // worker queue
+	IPC_ServeConn  *next;
+	IPC_ServeConn  *prevConn;   // all connections
+	IPC_ServeConn  *nextConn;
+};
+
+struct IPC_ServeWorker
+{
+	IPC_ServeRunner *runner;
+	DWORD            index;
+	HANDLE           hThread;
+	CRITICAL_SECTION cs;
+	IPC_ServeConn   *oldest;    // thieves take this end
+	IPC_ServeConn   *newest;    // the owner takes this end
+};
+
+struct IPC_ServeStart
+{
+	IPC_ServeRunner *runner;
+	DWORD            index;
+};
+
+////////////////////////////////////////////////////////////////
+// IPC_ServeRunner
+
+IPC_ServeRunner::IPC_ServeRunner (IPC_ServeOps& ops, IPC_SERVER_HANDLER handler, void *ctx)
+	: m_ops (ops), m_handler (handler), m_ctx (ctx), m_workers (NULL), m_nWorkers (0),
+	  m_nextWorker (0), m_pConns (NULL)
+{
+	InitializeCriticalSection (&m_cs);
+}
+
+IPC_ServeRunner::~IPC_ServeRunner ()
+{
+	DeleteCriticalSection (&m_cs);
+}
+
+void IPC_ServeRunner::push (DWORD worker, IPC_ServeConn *c, bool bOldest)
+{
+	IPC_ServeWorker& w = m_workers[worker];
+
+	EnterCriticalSection (&w.cs);
+	if (bOldest) {
+		c->prev = NULL;
+		c->next = w.oldest;
+		if (w.oldest) w.oldest->prev = c; else w.newest = c;
+		w.oldest = c;
+	} else {
+		c->next = NULL;
+		c->prev = w.newest;
+		if (w.newest) w.newest->next = c; else w.oldest = c;
+		w.newest = c;
+	}
+	LeaveCriticalSection (&w.cs);
+
+	ReleaseSemaphore (m_hWork, 1, NULL);
+}
+
+// own queue newest first (its data is warm), then the oldest of the others
+IPC_ServeConn * IPC_ServeRunner::pop (DWORD worker)
+{
+	for (DWORD i = 0; i < m_nWorkers; i++) {
+		IPC_ServeWorker& w = m_workers[(worker + i) % m_nWorkers];
+		const bool bOwn = (i == 0);
+
+		EnterCriticalSection (&w.cs);
+		IPC_ServeConn *c = bOwn ? w.newest : w.oldest;
+		if (c != NULL) {
+			if (bOwn) {
+				w.newest = c->prev;
+				if (w.newest) w.newest->next = NULL; else w.oldest = NULL;
+			} else {
+				w.oldest = c->next;
+				if (w.oldest) w.oldest->prev = NULL; else w.newest = NULL;
+			}
+		}
+		LeaveCriticalSection (&w.cs);
+
+		if (c != NULL) return c;
+	}
+	return NULL;
+}
+
+// a connection is handled by one worker at a time
+void IPC_ServeRunner::serve (DWORD worker, IPC_ServeConn *c)
+{
+	for (int n = 0; n < IPC_SERVE_BATCH; n++) {
+		const DWORD st = c->src->pollCheck (IPC_POLL_IN);
+
+		if (st & IPC_POLL_IN) {
+			const void *pv = NULL;
+			DWORD size = m_ops.RecvView (c->hConn, &pv, 0);
+			if (size == IPC_RC_TIMEOUT) break;
+			if (size == IPC_RC_ERROR) {
+				closeConn (c);
+				return;
+			}
+			m_handler (c->hConn, pv, size, m_ctx);
+			m_ops.RecvRelease (c->hConn, pv);
+			continue;
+		}
+
+		if (st & IPC_POLL_CLOSED) {
+			closeConn (c);
+			return;
+		}
+
+		// drained, park it in the poll set again
+		m_set.rearm (c->src);
+		return;
+	}
+
+	// the batch is used up: behind the rest of this queue, first to be stolen
+	push (worker, c, true);
+}
+
+void IPC_ServeRunner::closeConn (IPC_ServeConn *c)
+{
+	m_handler (c->hConn, NULL, IPC_RC_ERROR, m_ctx);
+
+	EnterCriticalSection (&m_cs);
+	if (c->prevConn) c->prevConn->nextConn = c->nextConn; else m_pConns = c->nextConn;
+	if (c->nextConn) c->nextConn->prevConn = c->prevConn;
+	LeaveCriticalSection (&m_cs);
+
+	// the connection leaves the poll set as it closes
+	m_ops.CloseConnection (c->hConn);
+	delete c;
+}
+
+DWORD WINAPI IPC_ServeRunner::poller (LPVOID param)
+{
+	IPC_ServeRunner *runner = (IPC_ServeRunner *)param;
+	IPC_POLL_EVENT events [IPC_ASYNC_EVENTS];
+
+	for (;;) {
+		DWORD ready;
+		DWORD err = runner->m_set.wait (events, IPC_ASYNC_EVENTS, INFINITE, ready);
+		if (err != 0) return err;
+
+		for (DWORD i = 0; i < ready; i++) {
+			runner->push (runner->m_nextWorker, (IPC_ServeConn *)events[i].hConnection, false);
+			runner->m_nextWorker = (runner->m_nextWorker + 1) % runner->m_nWorkers;
+		}
+	}
+}
+
+DWORD WINAPI IPC_ServeRunner::worker (LPVOID param)
+{
+	IPC_ServeWorker *w = (IPC_ServeWorker *)param;
+	IPC_ServeRunner *runner = w->runner;
+
+	HANDLE hdls[2];
+	hdls[0] = runner->m_hStop;
+	hdls[1] = runner->m_hWork;
+
+	for (;;) {
+		// a unit of m_hWork may be left over from a connection taken without it
+		if (WaitForMultipleObjects (2, hdls, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) return 0;
+
+		while (IPC_ServeConn *c = runner->pop (w->index)) {
+			runner->serve (w->index, c);
+			if (WaitForSingleObject (runner->m_hStop, 0) == WAIT_OBJECT_0) return 0;
+		}
+	}
+}
+
+DWORD IPC_ServeRunner::run (HIPCSERVER hServer, DWORD workers, HANDLE hStop)
+{
+	if (hServer == NULL || m_handler == NULL || hStop == NULL) return IPC_ERR_INVALID_ARG;
+	if (! m_set.isValid ()) return IPC_ERR_UNKNOWN;
+
+	if (workers == 0) {
+		SYSTEM_INFO si;
+		GetSystemInfo (&si);
+		workers = si.dwNumberOfProcessors;
+	}
+	if (workers > IPC_SERVE_MAX_WORKERS) workers = IPC_SERVE_MAX_WORKERS;
+
+	m_hWork = CreateSemaphore (NULL, 0, 0x7fffffff, NULL);
+	m_hStop = CreateEvent (NULL, TRUE, FALSE, NULL);
+	m_workers = new IPC_ServeWorker [workers];
+	if (! m_hWork.isValid () || ! m_hStop.isValid () || m_workers == NULL) {
+		delete [] m_workers;
+		m_workers = NULL;
+		return IPC_ERR_OUT_OF_MEMORY;
+	}
+
+	for (m_nWorkers = 0; m_nWorkers < workers; m_nWorkers++) {
+		IPC_ServeWorker& w = m_workers[m_nWorkers];
+		w.runner = this;
+		w.index = m_nWorkers;
+		w.oldest = w.newest = NULL;
+		InitializeCriticalSection (&w.cs);
+		w.hThread = CreateThread (NULL, 0, worker, &w, 0, NULL);
+		if (w.hThread == NULL) {
+			DeleteCriticalSection (&w.cs);
+			break;
+		}
+	}
+
+	HANDLE hPoller = (m_nWorkers != 0) ? CreateThread (NULL, 0, poller, this, 0, NULL) : NULL;
+	DWORD err = (hPoller != NULL) ? 0 : IPC_ERR_UNKNOWN;
+
+	// accept until stopped; a client that fails the handshake is skipped,
+	// failures in a row back off so a broken server doesn't spin
+	DWORD backoff = 0;
+	while (err == 0 && WaitForSingleObject (hStop, backoff) == WAIT_TIMEOUT) {
+		HIPCCONNECTION hConn = m_ops.ServerWaitForConnection (hServer, INFINITE, hStop);
+		if (! CHECK_IPC_HCONNECTION (hConn)) {
+			backoff = (backoff == 0) ? 1 : (backoff * 2 < IPC_SERVE_BACKOFF_MAX) ? backoff * 2 : IPC_SERVE_BACKOFF_MAX;
+			continue;
+		}
+		backoff = 0;
+
+		// the runner owns hConn and only closeConn closes it, so src stays
+		// valid after the reference is dropped
+		IPC_ServeConn *c = new IPC_ServeConn;
+		IPC_PollSource *src = IPC_PollSourceRef (m_ops, hConn);
+		if (c == NULL || src == NULL) {
+			delete c;
+			m_ops.CloseConnection (hConn);
+			continue;
+		}
+		memset (c, 0, sizeof (*c));
+		c->hConn = hConn;
+		c->src = src;
+
+		EnterCriticalSection (&m_cs);
+		c->nextConn = m_pConns;
+		if (m_pConns) m_pConns->prevConn = c;
+		m_pConns = c;
+		LeaveCriticalSection (&m_cs);
+
+		if (m_set.add (src, (HIPCCONNECTION)c, IPC_POLL_IN, true) != 0) closeConn (c);
+	}
+
+	// the poller first, so no connection moves to a queue any more
+	if (hPoller != NULL) {
+		m_set.interrupt ();
+		WaitForSingleObject (hPoller, INFINITE);
+		CloseHandle (hPoller);
+	}
+
+	SetEvent (m_hStop);
+	for (DWORD i = 0; i < m_nWorkers; i++) {
+		WaitForSingleObject (m_workers[i].hThread, INFINITE);
+		CloseHandle (m_workers[i].hThread);
+		DeleteCriticalSection (&m_workers[i].cs);
+	}
+	delete [] m_workers;
+	m_workers = NULL;
+	m_nWorkers = 0;
+
+	// what is left is parked in the poll set or was queued
+	while (m_pConns) closeConn (m_pConns);
+
+	return err;
+}
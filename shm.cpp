@@ -0,0 +1,1399 @@
+// shm.cpp
+//
+// Interprocess communication library (IPC)
+//
+// POSIX shared memory backend: the connection protocol of channel.cpp
+// over shm_open() segments, futex waits and pidfd
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_shm.h"
+#include "version.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#	include <sys/syscall.h>
+#endif
+
+static inline LONGLONG IPC_Micros ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (LONGLONG)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// a wait of the remaining time rtmo, cut to the peer (or event) check interval
+static inline DWORD IPC_WaitSlice (DWORD rtmo, DWORD slice = IPC_SHM_WAIT_SLICE)
+	{ return (rtmo < slice) ? rtmo : slice; }
+
+// one of the file descriptors is readable
+static bool IPC_FdReadable (const int *fds, int count)
+{
+	struct pollfd pfd [IPC_SHM_MAX_USER_EVENTS];
+	for (int i = 0; i < count; i++) {
+		pfd[i].fd = fds[i];
+		pfd[i].events = POLLIN;
+		pfd[i].revents = 0;
+	}
+	return count != 0 && poll (pfd, count, 0) > 0;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_ShmMap
+
+DWORD IPC_ShmMap::create (const char *path, DWORD size)
+{
+	int fd = shm_open (path, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) return (errno == EEXIST) ? IPC_ERR_INVALID_ARG : IPC_ERR_UNKNOWN;
+
+	// any user may connect, as with the Windows security attributes
+	fchmod (fd, 0666);
+	if (ftruncate (fd, size) != 0) {
+		::close (fd);
+		shm_unlink (path);
+		return IPC_ERR_OUT_OF_MEMORY;
+	}
+
+	DWORD err = map (fd, size);
+	if (err != 0) shm_unlink (path);
+	return err;
+}
+
+DWORD IPC_ShmMap::open (const char *path, DWORD minSize)
+{
+	int fd = shm_open (path, O_RDWR, 0);
+	if (fd < 0) return IPC_ERR_CLOSED;
+
+	struct stat st;
+	if (fstat (fd, &st) != 0 || st.st_size < (off_t)minSize) {
+		::close (fd);
+		return IPC_ERR_CLOSED;
+	}
+	return map (fd, (DWORD)st.st_size);
+}
+
+DWORD IPC_ShmMap::map (int fd, DWORD size)
+{
+	void *p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close (fd);
+	if (p == MAP_FAILED) return IPC_ERR_OUT_OF_MEMORY;
+
+	m_buf = p;
+	m_size = size;
+	return 0;
+}
+
+void IPC_ShmMap::close ()
+{
+	if (m_buf != NULL) munmap (m_buf, m_size);
+	m_buf = NULL;
+	m_size = 0;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Peer
+
+bool IPC_Peer::open (DWORD pid)
+{
+	close ();
+	m_pid = pid;
+
+#if defined (__linux__) && defined (SYS_pidfd_open)
+	// the pidfd follows this very process, a reused pid can't fool it
+	m_fd = (int)syscall (SYS_pidfd_open, (pid_t)pid, 0);
+	if (m_fd < 0 && errno == ESRCH) return false;
+#endif
+	return isAlive ();
+}
+
+void IPC_Peer::close ()
+{
+	if (m_fd >= 0) ::close (m_fd);
+	m_fd = -1;
+	m_pid = 0;
+}
+
+bool IPC_Peer::isAlive () const
+{
+	if (m_fd >= 0) {
+		// a pidfd turns readable when the process exits
+		struct pollfd pfd = { m_fd, POLLIN, 0 };
+		return poll (&pfd, 1, 0) == 0;
+	}
+	return m_pid != 0 && (kill ((pid_t)m_pid, 0) == 0 || errno == EPERM);
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Channel
+
+IPC_Channel::IPC_Channel () : m_buffer (NULL), m_bufSize (0), m_ring (NULL),
+	m_spinUs (IPC_SHM_SPIN_DEFAULT_US), m_seenHead (0), m_seenTail (0)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&m_mutex, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+IPC_Channel::~IPC_Channel ()
+{
+	pthread_mutex_destroy (&m_mutex);
+}
+
+DWORD IPC_Channel::lock (DWORD tmo)
+{
+	int rc;
+	if (tmo == INFINITE) rc = pthread_mutex_lock (&m_mutex);
+	else if (tmo == 0) rc = pthread_mutex_trylock (&m_mutex);
+	else {
+		struct timespec ts;
+		clock_gettime (CLOCK_REALTIME, &ts);
+		ts.tv_sec += tmo / 1000;
+		ts.tv_nsec += (long)(tmo % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+		rc = pthread_mutex_timedlock (&m_mutex, &ts);
+	}
+
+	switch (rc) {
+	case 0:
+		return 0;
+	case EBUSY:
+	case ETIMEDOUT:
+		return IPC_ERR_TIMEOUT;
+	default:
+		return IPC_ERR_UNKNOWN;
+	}
+}
+
+void IPC_Channel::unlock ()
+{
+	pthread_mutex_unlock (&m_mutex);
+}
+
+IPC_MSG_HDR * IPC_Channel::ringReserve (DWORD minPkt, DWORD maxPkt, DWORD& pktSize)
+{
+	const DWORD hdrSize = sizeof (IPC_MSG_HDR);
+
+	for (;;) {
+		DWORD head = (DWORD)m_ring->head;
+		m_seenTail = ReadAcquire (&m_ring->tail);
+		DWORD freeSize = m_bufSize - (head - (DWORD)m_seenTail);
+		DWORD off = head & (m_bufSize - 1);
+		DWORD contig = m_bufSize - off;
+
+		// all offsets are aligned, so room is either zero or >= hdrSize
+		DWORD room = (contig < freeSize) ? contig : freeSize;
+		if (room >= hdrSize && room - hdrSize >= minPkt) {
+			pktSize = room - hdrSize;
+			if (pktSize > maxPkt) pktSize = maxPkt;
+			return (IPC_MSG_HDR *)(m_buffer + off);
+		}
+
+		// not enough space before the end of the ring: pad and wrap around
+		if (off == 0 || contig > freeSize) return NULL;
+
+		IPC_MSG_HDR *pad = (IPC_MSG_HDR *)(m_buffer + off);
+		pad->msgSize = IPC_MSG_WRAP;
+		pad->pktSize = contig - hdrSize;
+		WriteRelease (&m_ring->head, (LONG)(head + contig));
+
+		// a sleeping receiver has to skip the pad before the space shows up
+		notifyData ();
+	}
+}
+
+void IPC_Channel::ringCommit (DWORD pktSize)
+{
+	DWORD head = (DWORD)m_ring->head;
+	WriteRelease (&m_ring->head, (LONG)(head + IPC_RingAlign (sizeof (IPC_MSG_HDR) + pktSize)));
+}
+
+const IPC_MSG_HDR * IPC_Channel::ringPeek ()
+{
+	for (;;) {
+		DWORD tail = (DWORD)m_ring->tail;
+		m_seenHead = ReadAcquire (&m_ring->head);
+		if ((DWORD)m_seenHead == tail) return NULL;
+
+		DWORD off = tail & (m_bufSize - 1);
+		const IPC_MSG_HDR *hdr = (const IPC_MSG_HDR *)(m_buffer + off);
+		if (hdr->msgSize != IPC_MSG_WRAP) return hdr;
+
+		WriteRelease (&m_ring->tail, (LONG)(tail + m_bufSize - off));
+		notifySpace ();
+	}
+}
+
+DWORD IPC_Channel::ringPktSize (const IPC_MSG_HDR *hdr) const
+{
+	DWORD maxPkt = m_bufSize - (DWORD)((const unsigned char *)hdr - m_buffer) - sizeof (IPC_MSG_HDR);
+	return (hdr->pktSize > maxPkt) ? maxPkt : hdr->pktSize; // sender error !!!
+}
+
+void IPC_Channel::ringRelease (const IPC_MSG_HDR *hdr)
+{
+	DWORD tail = (DWORD)m_ring->tail;
+	WriteRelease (&m_ring->tail, (LONG)(tail + IPC_RingAlign (sizeof (IPC_MSG_HDR) + ringPktSize (hdr))));
+}
+
+bool IPC_Channel::spin (const volatile LONG *pWord, LONG seen) const
+{
+	if (m_spinUs == 0 || ! IPC_Runtime::instance ().canSpin ()) return false;
+
+	LONGLONG t0 = IPC_Micros ();
+	for (unsigned int i = 1; ; i++) {
+		if (*pWord != seen) return true;
+		YieldProcessor ();
+
+		// reading the clock costs more than a pause, check it now and then
+		if ((i & 31) == 0 && IPC_Micros () - t0 >= m_spinUs) return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Server
+
+IPC_Server::IPC_Server () : m_accepting (0)
+{
+	m_path[0] = 0;
+}
+
+IPC_Server::~IPC_Server ()
+{
+	unlisten ();
+}
+
+DWORD IPC_Server::listen (const char *epName, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
+{
+	unsigned int nameLen = IPC_strlen (epName);
+	if (nameLen == 0 || nameLen > IPC_MAX_SERVER_NAME || strchr (epName, '/') != NULL) return IPC_ERR_INVALID_ARG;
+	if (sendSize > IPC_MAX_CHANNEL_SIZE || recvSize > IPC_MAX_CHANNEL_SIZE) return IPC_ERR_INVALID_ARG;
+
+	IPC_Runtime::instance ().formatObjectPath (m_path, IPC_SHM_PORT_PREFIX, epName);
+
+	// the port of a crashed server stays behind, take its name over
+	DWORD err = m_buffer.create (m_path, IPC_SHM_PORT_SIZE);
+	if (err == IPC_ERR_INVALID_ARG) {
+		IPC_ShmMap old;
+		IPC_Peer server;
+		if (old.open (m_path, IPC_SHM_PORT_SIZE) == 0) {
+			IPC_SHM_PORT_INFO *info = (IPC_SHM_PORT_INFO *)old.data ();
+			if (ReadAcquire (&info->magic) == (LONG)IPC_SHM_MAGIC && ! server.open (info->serverPid)) {
+				shm_unlink (m_path);
+				err = m_buffer.create (m_path, IPC_SHM_PORT_SIZE);
+			}
+		}
+	}
+	if (err != 0) {
+		m_path[0] = 0;
+		return err;
+	}
+
+	// the segment is zeroed: no slots are taken
+	IPC_SHM_PORT_INFO *portInfo = (IPC_SHM_PORT_INFO *)m_buffer.data ();
+	portInfo->serverPid = GetCurrentProcessId ();
+	portInfo->sendSize = sendSize;
+	portInfo->recvSize = recvSize;
+
+	// open the port for the clients
+	WriteRelease (&portInfo->magic, (LONG)IPC_SHM_MAGIC);
+	return 0;
+}
+
+BOOL IPC_Server::unlisten ()
+{
+	if (! m_buffer.isValid ()) return FALSE;
+
+	// the new clients don't find the port, the waiting ones see it closed
+	shm_unlink (m_path);
+
+	IPC_SHM_PORT_INFO *portInfo = (IPC_SHM_PORT_INFO *)m_buffer.data ();
+	InterlockedExchange (&portInfo->closed, 1);
+	InterlockedIncrement (&portInfo->connectSeq);
+	IPC_FutexWake (&portInfo->connectSeq);
+	InterlockedIncrement (&portInfo->freeSeq);
+	IPC_FutexWake (&portInfo->freeSeq);
+
+	// the current accept operations return promptly
+	while (m_accepting != 0) Sleep (1);
+
+	m_buffer.close ();
+	m_path[0] = 0;
+	return TRUE;
+}
+
+IPC_Connection * IPC_Server::accept (DWORD tmo, DWORD& err, int breakFd /*= -1*/)
+{
+	if (! IsValidTimeout (tmo)) { err = IPC_ERR_INVALID_ARG; return NULL; }
+	err = 0;
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	InterlockedIncrement (&m_accepting);
+
+	IPC_SHM_PORT_INFO *portInfo = (IPC_SHM_PORT_INFO *)m_buffer.data ();
+	IPC_CONNECT_SLOT *slots = (IPC_CONNECT_SLOT *)(m_buffer.data () + IPC_CONNECT_SLOTS_OFFSET);
+
+	// take a posted request
+	int slot = -1;
+	IPC_CONNECT_REQUEST connReq;
+	while (slot < 0) {
+		if (portInfo->closed) err = IPC_ERR_CLOSED;
+		if (err != 0) {
+			InterlockedDecrement (&m_accepting);
+			return NULL;
+		}
+
+		// the client bumps connectSeq after posting, a request posted
+		// after the scan moves it and the wait returns at once
+		LONG seq = ReadAcquire (&portInfo->connectSeq);
+		for (int i = 0; i < IPC_CONNECT_SLOTS; i++) {
+			if (InterlockedCompareExchange (&slots[i].state, IPC_SLOT_ACCEPTING, IPC_SLOT_REQUEST) == IPC_SLOT_REQUEST) {
+				slot = i;
+				break;
+			}
+		}
+
+		if (slot < 0) {
+			DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+			if (rtmo == 0 || (breakFd >= 0 && IPC_FdReadable (&breakFd, 1))) err = IPC_ERR_TIMEOUT;
+			else IPC_FutexWait (&portInfo->connectSeq, seq, (breakFd >= 0) ? IPC_WaitSlice (rtmo, IPC_SHM_EVENT_SLICE) : rtmo);
+			continue;
+		}
+
+		connReq = slots[slot].request;
+		// zero-terminate name, just in case...
+		connReq.connName[sizeof(connReq.connName)-1] = 0;
+
+		// nobody is left to free the slot of a dead client
+		IPC_Peer client;
+		if (! client.open (connReq.clientPid)) {
+			InterlockedExchange (&slots[slot].state, IPC_SLOT_FREE);
+			InterlockedIncrement (&portInfo->freeSeq);
+			IPC_FutexWake (&portInfo->freeSeq);
+			slot = -1;
+		}
+	}
+
+	DWORD clientSendSize = connReq.clientSendSize;
+	DWORD serverSendSize = connReq.serverSendSize;
+
+	// initialize connection, other threads accept the other slots meanwhile
+	IPC_Connection *pConn = NULL;
+	if (! IPC_IsValidChannelSize (clientSendSize) || ! IPC_IsValidChannelSize (serverSendSize)) {
+		err = IPC_ERR_INVALID_ARG;
+	} else if ((pConn = new IPC_Connection ()) != NULL) {
+		if (pConn->initServerSide (&connReq)) {
+			err = 0;
+		} else {
+			delete pConn;
+			pConn = NULL;
+			err = IPC_ERR_UNKNOWN;
+		}
+	} else {
+		err = IPC_ERR_OUT_OF_MEMORY;
+	}
+
+	IPC_CONNECT_REPLY *connRep = &slots[slot].reply;
+	connRep->status = err;
+	connRep->clientSendSize = clientSendSize;
+	connRep->serverSendSize = serverSendSize;
+
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_REPLIED);
+	IPC_FutexWake (&slots[slot].state);
+
+	InterlockedDecrement (&m_accepting);
+	return pConn;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Connection
+
+IPC_Connection::IPC_Connection () : m_bDataPending (false), m_bServerSide (false),
+	m_sectionThreshold (IPC_SECTION_THRESHOLD_DEFAULT), m_sectionSeq (0),
+	m_reserveHdr (NULL), m_reserveBuf (NULL), m_reserveBufSize (0), m_reserveSize (IPC_MSG_INVALID),
+	m_reserveTimeout (INFINITE), m_reserveSeq (0),
+	m_viewHdr (NULL), m_viewPtr (NULL), m_viewBuf (NULL), m_viewBufSize (0),
+	m_userEventCount (0)
+{
+	clearLastError ();
+	m_connName[0] = 0;
+	for (int i = 0; i < IPC_SHM_MAX_PENDING_SECTIONS; i++) m_sectionSeqs[i] = 0;
+	InitializeCriticalSection (&m_eventsCs);
+}
+
+IPC_Connection::~IPC_Connection ()
+{
+	close ();
+	free (m_reserveBuf);
+	free (m_viewBuf);
+	DeleteCriticalSection (&m_eventsCs);
+}
+
+DWORD IPC_Connection::connect (const char *epName, DWORD tmo, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
+{
+	// no synchronization here, sorry...
+	clearLastError ();
+
+	unsigned int nameLen = IPC_strlen (epName);
+	if (nameLen == 0 || nameLen > IPC_MAX_SERVER_NAME || strchr (epName, '/') != NULL) return setLastError (IPC_ERR_INVALID_ARG);
+
+	sendSize = IPC_ChannelSize (sendSize);
+	recvSize = IPC_ChannelSize (recvSize);
+	if (sendSize == 0 || recvSize == 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	if (! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	char pathBuf[IPC_MAX_PATH];
+	IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_SHM_PORT_PREFIX, epName);
+
+	// wait for the server to listen; a port left by a crashed server
+	// counts as not listening until a new server takes it over
+	IPC_ShmMap port;
+	for (;;) {
+		if (port.open (pathBuf, IPC_SHM_PORT_SIZE) == 0) {
+			IPC_SHM_PORT_INFO *info = (IPC_SHM_PORT_INFO *)port.data ();
+			if (ReadAcquire (&info->magic) == (LONG)IPC_SHM_MAGIC && ! info->closed
+				&& m_peer.open (info->serverPid)) break;
+			port.close ();
+		}
+
+		DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+		if (rtmo == 0) return setLastError (IPC_ERR_TIMEOUT);
+		Sleep (rtmo < 10 ? rtmo : 10);
+	}
+
+	IPC_SHM_PORT_INFO *portInfo = (IPC_SHM_PORT_INFO *)port.data ();
+
+	// negotiate channel sizes: the larger of the client and server preferences
+	DWORD serverSize = IPC_ChannelSize (portInfo->recvSize);
+	if (serverSize > sendSize) sendSize = serverSize;
+	serverSize = IPC_ChannelSize (portInfo->sendSize);
+	if (serverSize > recvSize) recvSize = serverSize;
+
+	// create the connection segment before taking a slot,
+	// other clients use the slots meanwhile
+	IPC_CONNECT_REQUEST request;
+	request.clientSendSize = sendSize;
+	request.serverSendSize = recvSize;
+	if (! initClientSide (&request, pathBuf)) return setLastError (IPC_ERR_UNKNOWN);
+
+	// the server drops the name when it maps the segment,
+	// the name is ours to drop if it never did
+	IPC_CONNECT_REPLY reply;
+	DWORD err = this->request (port, request, tmo, t0, reply);
+	shm_unlink (pathBuf);
+
+	if (err == 0 && reply.status != 0) err = reply.status;
+	if (err == 0 && (reply.clientSendSize != sendSize || reply.serverSendSize != recvSize)) err = IPC_ERR_UNKNOWN;
+	if (err != 0) {
+		m_buffer.close ();
+		m_peer.close ();
+	}
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::request (IPC_ShmMap& port, const IPC_CONNECT_REQUEST& req, DWORD tmo, DWORD t0, IPC_CONNECT_REPLY& reply)
+{
+	IPC_SHM_PORT_INFO *portInfo = (IPC_SHM_PORT_INFO *)port.data ();
+	IPC_CONNECT_SLOT *slots = (IPC_CONNECT_SLOT *)(port.data () + IPC_CONNECT_SLOTS_OFFSET);
+
+	// claim a free slot
+	int slot = -1;
+	while (slot < 0) {
+		LONG seq = ReadAcquire (&portInfo->freeSeq);
+		for (int i = 0; i < IPC_CONNECT_SLOTS; i++) {
+			if (InterlockedCompareExchange (&slots[i].state, IPC_SLOT_CLAIMED, IPC_SLOT_FREE) == IPC_SLOT_FREE) {
+				slot = i;
+				break;
+			}
+		}
+		if (slot >= 0) break;
+
+		if (portInfo->closed || ! m_peer.isAlive ()) return IPC_ERR_UNKNOWN;
+
+		DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+		if (rtmo == 0) return IPC_ERR_TIMEOUT;
+		IPC_FutexWait (&portInfo->freeSeq, seq, IPC_WaitSlice (rtmo));
+	}
+
+	// post the request
+	slots[slot].request = req;
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_REQUEST);
+	InterlockedIncrement (&portInfo->connectSeq);
+	IPC_FutexWake (&portInfo->connectSeq);
+
+	DWORD rtmo = IPC_RemainingTimeout (tmo, t0);
+	for (;;) {
+		LONG st = ReadAcquire (&slots[slot].state);
+		if (st == IPC_SLOT_REPLIED) break;
+
+		// the server stopped or died: the slot goes with the port
+		if ((portInfo->closed && st == IPC_SLOT_REQUEST) || ! m_peer.isAlive ()) return IPC_ERR_UNKNOWN;
+
+		if (rtmo == 0) {
+			// timeout: withdraw the request unless a server thread has taken it
+			if (InterlockedCompareExchange (&slots[slot].state, IPC_SLOT_FREE, IPC_SLOT_REQUEST) == IPC_SLOT_REQUEST) {
+				InterlockedIncrement (&portInfo->freeSeq);
+				IPC_FutexWake (&portInfo->freeSeq);
+				return IPC_ERR_TIMEOUT;
+			}
+			// the server is creating the connection, wait for its reply
+			rtmo = INFINITE;
+			continue;
+		}
+
+		IPC_FutexWait (&slots[slot].state, st, IPC_WaitSlice (rtmo));
+		if (rtmo != INFINITE) rtmo = IPC_RemainingTimeout (tmo, t0);
+	}
+
+	// check reply
+	reply = slots[slot].reply;
+	InterlockedExchange (&slots[slot].state, IPC_SLOT_FREE);
+	InterlockedIncrement (&portInfo->freeSeq);
+	IPC_FutexWake (&portInfo->freeSeq);
+	return 0;
+}
+
+bool IPC_Connection::initClientSide (IPC_CONNECT_REQUEST *connData, char *pathBuf)
+{
+	// create the segment for two channel rings of the requested sizes:
+	// first:  client->server channel ring
+	// second: server->client channel ring
+	connData->clientPid = GetCurrentProcessId ();
+	if (! IPC_Runtime::instance ().generateConnectionName (connData->connName)) return false;
+	memcpy (m_connName, connData->connName, sizeof (m_connName));
+	m_bServerSide = false;
+
+	IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_SHM_CONN_PREFIX, connData->connName);
+
+	const DWORD sendOffset = 0;
+	const DWORD recvOffset = sizeof (IPC_RING_HDR) + connData->clientSendSize;
+	const DWORD totalSize = recvOffset + sizeof (IPC_RING_HDR) + connData->serverSendSize;
+
+	if (m_buffer.create (pathBuf, totalSize) != 0) return false;
+
+	m_sendChannel.setRing (m_buffer.data () + sendOffset, connData->clientSendSize);
+	m_recvChannel.setRing (m_buffer.data () + recvOffset, connData->serverSendSize);
+	return true;
+}
+
+bool IPC_Connection::initServerSide (const IPC_CONNECT_REQUEST *connData)
+{
+	if (! m_peer.open (connData->clientPid)) return false;
+
+	const DWORD recvOffset = 0;
+	const DWORD sendOffset = sizeof (IPC_RING_HDR) + connData->clientSendSize;
+	const DWORD totalSize = sendOffset + sizeof (IPC_RING_HDR) + connData->serverSendSize;
+
+	char pathBuf[IPC_MAX_PATH];
+	IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_SHM_CONN_PREFIX, connData->connName);
+
+	if (m_buffer.open (pathBuf, totalSize) != 0) return false;
+	shm_unlink (pathBuf);
+
+	memcpy (m_connName, connData->connName, sizeof (m_connName));
+	m_bServerSide = true;
+
+	m_recvChannel.setRing (m_buffer.data () + recvOffset, connData->clientSendSize);
+	m_sendChannel.setRing (m_buffer.data () + sendOffset, connData->serverSendSize);
+	return true;
+}
+
+BOOL IPC_Connection::close ()
+{
+	if (! m_buffer.isValid ()) return FALSE;
+
+	shutdown ();
+
+	// the sections the receiver has not opened go with the connection
+	for (int i = 0; i < IPC_SHM_MAX_PENDING_SECTIONS; i++) {
+		if (m_sectionSeqs[i] != 0) dropSection (m_sectionSeqs[i]);
+	}
+	m_reserveSection.close ();
+	m_viewSection.close ();
+
+	m_buffer.close ();
+	m_peer.close ();
+	return TRUE;
+}
+
+void IPC_Connection::shutdown ()
+{
+	if (! m_buffer.isValid ()) return;
+
+	// the blocked calls of both sides see the closed flag
+	InterlockedExchange (&m_sendChannel.m_ring->closed, 1);
+	InterlockedExchange (&m_recvChannel.m_ring->closed, 1);
+
+	IPC_FutexWake (&m_sendChannel.m_ring->head);
+	IPC_FutexWake (&m_sendChannel.m_ring->tail);
+	IPC_FutexWake (&m_recvChannel.m_ring->head);
+	IPC_FutexWake (&m_recvChannel.m_ring->tail);
+}
+
+DWORD IPC_Connection::waitChannel (IPC_Channel& channel, bool bData, bool bFirst, DWORD tmo, DWORD t0)
+{
+	volatile LONG *pWatch = bData ? &channel.m_ring->head : &channel.m_ring->tail;
+	volatile LONG *pWaiter = bData ? &channel.m_ring->dataWaiter : &channel.m_ring->spaceWaiter;
+	LONG seen = bData ? channel.m_seenHead : channel.m_seenTail;
+
+	// spin phase: a busy peer usually moves the ring within microseconds
+	bool bSpin = ! (bFirst && tmo == 0);
+	if (bSpin && channel.spin (pWatch, seen)) return 0;
+
+	// announce the wait, the peer wakes the word only if it sees the
+	// waiter; the futex rechecks the word, so a move in between is not lost
+	InterlockedIncrement (pWaiter);
+
+	DWORD rtmo = bFirst ? IPC_RemainingTimeout (tmo, t0) : INFINITE;
+	bool bEvents = bFirst && m_userEventCount != 0;
+	DWORD err;
+	for (;;) {
+		if (*pWatch != seen) { err = 0; break; }
+		if (channel.m_ring->closed) { err = IPC_ERR_CLOSED; break; }
+		if (bEvents && userEventSet ()) { err = IPC_ERR_USER_EVENT_SET; break; }
+		if (rtmo == 0) { err = IPC_ERR_TIMEOUT; break; }
+
+		IPC_FutexWait (pWatch, seen, IPC_WaitSlice (rtmo, bEvents ? IPC_SHM_EVENT_SLICE : IPC_SHM_WAIT_SLICE));
+
+		if (*pWatch == seen && ! m_peer.isAlive ()) { err = IPC_ERR_BROKEN; break; }
+		if (bFirst) rtmo = IPC_RemainingTimeout (tmo, t0);
+	}
+
+	InterlockedDecrement (pWaiter);
+	return err;
+}
+
+// The channel is a single-producer/single-consumer ring: the sender keeps
+// writing packets while there is free space and the receiver drains them
+// concurrently. Either side blocks only when the ring is full or empty.
+// The timeout applies until the first packet of a message is queued or
+// received, the rest of the message is transferred unconditionally.
+
+DWORD IPC_Connection::send (const void *buf, DWORD bufSize, DWORD tmo)
+{
+	IPC_BUF data = { (void *)buf, bufSize };
+	return sendV (&data, 1, tmo);
+}
+
+DWORD IPC_Connection::sendV (const IPC_BUF *bufs, DWORD count, DWORD tmo)
+{
+	clearLastError ();
+	if (bufs == NULL && count != 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	DWORD bufSize = IPC_BufCursor::totalSize (bufs, count);
+	if (bufSize >= IPC_MSG_SIZE_LIMIT || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	// lock connection object
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_sendChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	IPC_BufCursor data (bufs, count);
+	return setLastError (sendLocked (data, bufSize, tmo, t0));
+}
+
+DWORD IPC_Connection::sendLocked (IPC_BufCursor& data, DWORD bufSize, DWORD tmo, DWORD t0, bool bDefer /*= false*/)
+{
+	if (m_reserveSize != IPC_MSG_INVALID) return IPC_ERR_INVALID_ARG; // reserved by this thread
+	if (m_sendChannel.m_ring->closed) return IPC_ERR_CLOSED;
+
+	if (bufSize >= m_sectionThreshold) {
+		// large message: copy into a dedicated section, send the descriptor only
+		IPC_ShmMap view;
+		DWORD seq;
+		DWORD err = createSection (bufSize, view, seq, tmo, t0);
+		if (err != 0) return err;
+
+		data.gather (view.data (), bufSize);
+		view.close ();
+		return sendSection (seq, bufSize, tmo, t0, bDefer);
+	}
+
+	// send packets
+	const DWORD msgSize = bufSize;
+	bool bFirst = true;
+
+	do {
+		DWORD minPkt = (bufSize < IPC_RING_MIN_PKT) ? bufSize : IPC_RING_MIN_PKT;
+		DWORD portion;
+		IPC_MSG_HDR *msgHdr = m_sendChannel.ringReserve (minPkt, bufSize, portion);
+		if (msgHdr == NULL) {
+			// ring is full, wait for the receiver
+			DWORD err = waitChannel (m_sendChannel, false, bFirst, tmo, t0);
+			if (err != 0) return err;
+			continue;
+		}
+
+		msgHdr->msgSize = msgSize;
+		msgHdr->pktSize = portion;
+		data.gather (msgHdr + 1, portion);
+		bufSize -= portion;
+
+		m_sendChannel.ringCommit (portion);
+		if (bufSize != 0 || ! bDefer) m_sendChannel.notifyData ();
+		else m_bDataPending = true;
+		bFirst = false;
+
+	} while (bufSize != 0);
+
+	return 0;
+}
+
+DWORD IPC_Connection::sendBatch (const IPC_BUF *msgs, DWORD count, DWORD tmo, DWORD& sent)
+{
+	clearLastError ();
+	sent = 0;
+	if ((msgs == NULL && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	for (DWORD i = 0; i < count; i++) {
+		if (msgs[i].dwSize >= IPC_MSG_SIZE_LIMIT) return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_sendChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	// pack the messages back to back, the timeout applies to the whole batch
+	for (; sent < count; sent++) {
+		IPC_BufCursor data (&msgs[sent], 1);
+		err = sendLocked (data, msgs[sent].dwSize, tmo, t0, true);
+		if (err != 0) break;
+	}
+
+	// wake the receiver once for the batch
+	if (m_bDataPending) {
+		m_bDataPending = false;
+		m_sendChannel.notifyData ();
+	}
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::sendReserve (DWORD size, void **ppBuf, DWORD tmo)
+{
+	clearLastError ();
+	if (ppBuf == NULL || size >= IPC_MSG_SIZE_LIMIT || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	*ppBuf = NULL;
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	DWORD err = m_sendChannel.lock (tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	// the mutex is recursive, so a second reserve from the same thread gets here
+	if (m_reserveSize != IPC_MSG_INVALID) err = IPC_ERR_INVALID_ARG;
+	else if (m_sendChannel.m_ring->closed) err = IPC_ERR_CLOSED;
+
+	if (err == 0 && size >= m_sectionThreshold) {
+		// large message: reserve a dedicated section, sent as a descriptor on commit
+		err = createSection (size, m_reserveSection, m_reserveSeq, tmo, t0);
+		if (err == 0) *ppBuf = m_reserveSection.data ();
+	} else if (err == 0 && size <= m_sendChannel.m_bufSize - sizeof (IPC_MSG_HDR)) {
+		// the message fits into the ring: wait for contiguous space
+		DWORD pktSize;
+		while ((m_reserveHdr = m_sendChannel.ringReserve (size, size, pktSize)) == NULL) {
+			err = waitChannel (m_sendChannel, false, true, tmo, t0);
+			if (err != 0) break;
+		}
+		if (err == 0) *ppBuf = m_reserveHdr + 1;
+	} else if (err == 0) {
+		// larger messages are serialized into the local buffer
+		// and sent by the chunked path on commit
+		if (size > m_reserveBufSize) {
+			unsigned char *p = (unsigned char *)realloc (m_reserveBuf, size);
+			if (p == NULL) err = IPC_ERR_OUT_OF_MEMORY;
+			else { m_reserveBuf = p; m_reserveBufSize = size; }
+		}
+		if (err == 0) *ppBuf = m_reserveBuf;
+	}
+
+	if (err != 0) {
+		m_sendChannel.unlock ();
+		return setLastError (err);
+	}
+
+	m_reserveSize = size;
+	m_reserveTimeout = tmo;
+	return 0;
+}
+
+DWORD IPC_Connection::sendCommit (void *pBuf, DWORD size)
+{
+	clearLastError ();
+	if (m_reserveSize == IPC_MSG_INVALID) return setLastError (IPC_ERR_INVALID_ARG);
+
+	// lock recursively to make sure the caller owns the reservation
+	DWORD err = m_sendChannel.lock (0);
+	if (err != 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	void *pReserved = m_reserveSection.isValid () ? (void *)m_reserveSection.data ()
+		: (m_reserveHdr != NULL) ? (void *)(m_reserveHdr + 1) : (void *)m_reserveBuf;
+	if (pBuf != pReserved || size > m_reserveSize) {
+		m_sendChannel.unlock ();
+		return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	m_reserveSize = IPC_MSG_INVALID;
+
+	// the reserved ring slot is committed at once; a section descriptor and
+	// a chunked message wait for the ring within the timeout of the reservation
+	DWORD tmo = m_reserveTimeout;
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	if (m_reserveSection.isValid ()) {
+		m_reserveSection.close ();
+		err = sendSection (m_reserveSeq, size, tmo, t0, false);
+	} else if (m_reserveHdr != NULL) {
+		m_reserveHdr->msgSize = size;
+		m_reserveHdr->pktSize = size;
+		m_reserveHdr = NULL;
+		m_sendChannel.ringCommit (size);
+		m_sendChannel.notifyData ();
+	} else {
+		IPC_BUF reserved = { m_reserveBuf, size };
+		IPC_BufCursor data (&reserved, 1);
+		err = sendLocked (data, size, tmo, t0);
+	}
+
+	m_sendChannel.unlock ();  // recursive lock
+	m_sendChannel.unlock ();  // sendReserve lock
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::recv (void *buf, DWORD bufSize, DWORD tmo, DWORD& rsz)
+{
+	IPC_BUF data = { buf, bufSize };
+	return recvV (&data, 1, tmo, rsz);
+}
+
+DWORD IPC_Connection::recvV (const IPC_BUF *bufs, DWORD count, DWORD tmo, DWORD& rsz)
+{
+	clearLastError ();
+	if ((bufs == NULL && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+
+	// lock connection object
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_recvChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	IPC_BufCursor data (bufs, count);
+	return setLastError (recvLocked (data, tmo, t0, rsz));
+}
+
+const IPC_MSG_HDR * IPC_Connection::recvPeek (DWORD tmo, DWORD t0, DWORD& err)
+{
+	const IPC_MSG_HDR *msgHdr;
+	while ((msgHdr = m_recvChannel.ringPeek ()) == NULL) {
+		err = waitChannel (m_recvChannel, true, true, tmo, t0);
+		if (err != 0) return NULL;
+	}
+	err = 0;
+	return msgHdr;
+}
+
+DWORD IPC_Connection::recvLocked (IPC_BufCursor& data, DWORD tmo, DWORD t0, DWORD& rsz)
+{
+	if (m_viewPtr != NULL) return IPC_ERR_INVALID_ARG; // view held by this thread
+
+	DWORD err;
+	const IPC_MSG_HDR *msgHdr = recvPeek (tmo, t0, err);
+	if (msgHdr == NULL) return err;
+
+	if (msgHdr->msgSize & IPC_MSG_SECTION) {
+		// large message passed in a dedicated section
+		IPC_ShmMap view;
+		DWORD msgSize;
+		err = openSection (msgHdr, view, msgSize);
+		if (err != 0) return err;
+
+		rsz = data.scatter (view.data (), msgSize);
+		if (rsz < msgSize) {
+			rsz = msgSize;
+			return IPC_ERR_MSG_TRUNCATED;
+		}
+		return 0;
+	}
+
+	DWORD orgMsgSize = msgHdr->msgSize;
+	DWORD msgSize = orgMsgSize;
+	rsz = 0;
+
+	for (;;) {
+		DWORD pktSize = m_recvChannel.ringPktSize (msgHdr);
+		if (pktSize > msgSize) pktSize = msgSize;
+
+		rsz += data.scatter (msgHdr + 1, pktSize);
+
+		m_recvChannel.ringRelease (msgHdr);
+		m_recvChannel.notifySpace ();
+
+		msgSize -= pktSize;
+		if (msgSize == 0) break;
+
+		while ((msgHdr = m_recvChannel.ringPeek ()) == NULL) {
+			err = waitChannel (m_recvChannel, true, false, tmo, t0);
+			if (err != 0) return err;
+		}
+	}
+
+	if (rsz < orgMsgSize) {
+		rsz = orgMsgSize;
+		return IPC_ERR_MSG_TRUNCATED;
+	}
+	return 0;
+}
+
+DWORD IPC_Connection::recvBatch (const IPC_BUF *msgs, DWORD count, DWORD *sizes, DWORD tmo, DWORD& received)
+{
+	clearLastError ();
+	received = 0;
+	if (((msgs == NULL || sizes == NULL) && count != 0) || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	IPC_Channel_Lock locker;
+	DWORD err = locker.lock (&m_recvChannel, tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	for (; received < count; received++) {
+		// wait for the first message only, then drain what is queued
+		if (received != 0 && m_recvChannel.ringPeek () == NULL) break;
+
+		IPC_BufCursor data (&msgs[received], 1);
+		err = recvLocked (data, tmo, t0, sizes[received]);
+		if (err == IPC_ERR_MSG_TRUNCATED) received++;  // consumed: counted with its whole size
+		if (err != 0) break;
+	}
+	return setLastError (err);
+}
+
+DWORD IPC_Connection::recvView (const void **ppBuf, DWORD tmo, DWORD& rsz)
+{
+	clearLastError ();
+	if (ppBuf == NULL || ! IsValidTimeout (tmo)) return setLastError (IPC_ERR_INVALID_ARG);
+	*ppBuf = NULL;
+
+	DWORD t0 = 0;
+	if (tmo != INFINITE && tmo != 0) t0 = GetTickCount ();
+
+	DWORD err = m_recvChannel.lock (tmo);
+	if (err != 0) return setLastError (err); // timeout or error
+
+	const IPC_MSG_HDR *msgHdr = NULL;
+	if (m_viewPtr != NULL) err = IPC_ERR_INVALID_ARG; // view held by this thread
+	else msgHdr = recvPeek (tmo, t0, err);
+
+	if (err == 0) {
+		DWORD msgSize = msgHdr->msgSize;
+		if (msgSize & IPC_MSG_SECTION) {
+			// large message: adopt the section mapping
+			err = openSection (msgHdr, m_viewSection, rsz);
+			if (err == 0) {
+				m_viewHdr = NULL;
+				m_viewPtr = m_viewSection.data ();
+			}
+		} else if (m_recvChannel.ringPktSize (msgHdr) >= msgSize) {
+			// single packet message: view the channel data in place
+			m_viewHdr = msgHdr;
+			m_viewPtr = msgHdr + 1;
+			rsz = msgSize;
+		} else {
+			// the message is split into packets: collect it in the local buffer
+			if (msgSize > m_viewBufSize) {
+				unsigned char *p = (unsigned char *)realloc (m_viewBuf, msgSize);
+				if (p == NULL) err = IPC_ERR_OUT_OF_MEMORY;
+				else { m_viewBuf = p; m_viewBufSize = msgSize; }
+			}
+			if (err == 0) {
+				IPC_BUF view = { m_viewBuf, msgSize };
+				IPC_BufCursor data (&view, 1);
+				err = recvLocked (data, tmo, t0, rsz);
+			}
+			if (err == 0) {
+				m_viewHdr = NULL;
+				m_viewPtr = m_viewBuf;
+			}
+		}
+	}
+
+	if (err != 0) {
+		m_recvChannel.unlock ();
+		return setLastError (err);
+	}
+
+	*ppBuf = m_viewPtr;
+	return 0;
+}
+
+DWORD IPC_Connection::recvRelease (const void *pBuf)
+{
+	clearLastError ();
+	if (m_viewPtr == NULL) return setLastError (IPC_ERR_INVALID_ARG);
+
+	// lock recursively to make sure the caller owns the view
+	DWORD err = m_recvChannel.lock (0);
+	if (err != 0) return setLastError (IPC_ERR_INVALID_ARG);
+
+	if (pBuf != m_viewPtr) {
+		m_recvChannel.unlock ();
+		return setLastError (IPC_ERR_INVALID_ARG);
+	}
+
+	// hand the ring space back to the sender
+	if (m_viewHdr != NULL) {
+		m_recvChannel.ringRelease (m_viewHdr);
+		m_recvChannel.notifySpace ();
+		m_viewHdr = NULL;
+	}
+	m_viewSection.close ();
+	m_viewPtr = NULL;
+
+	m_recvChannel.unlock ();  // recursive lock
+	m_recvChannel.unlock ();  // recvView lock
+	return 0;
+}
+
+// Messages of m_sectionThreshold bytes and larger don't go through the ring.
+// The sender creates a one-shot segment per message and queues only an
+// IPC_SECTION_DESC record, so the transfer costs a single copy instead of a
+// rendezvous per packet. The receiver drops the name once it has mapped the
+// segment and reports the sequence number in the ring's sectionAck field;
+// the names it never opened are dropped by the sender on close.
+
+void IPC_Connection::formatSectionName (char *pathBuf, bool bSend, DWORD seq)
+{
+	// the name follows the direction of the data, like the channel rings
+	bool bClientToServer = (bSend != m_bServerSide);
+
+	unsigned int prefixLen = IPC_Runtime::instance ().formatObjectPath (pathBuf, IPC_SHM_SECTION_PREFIX, m_connName);
+	snprintf (pathBuf + prefixLen, IPC_MAX_PATH - prefixLen, "%s%08X", bClientToServer ? "-cs" : "-sc", seq);
+}
+
+void IPC_Connection::sweepSections ()
+{
+	// the receiver acknowledges before releasing the descriptor,
+	// so a wait on the tail seen here can't miss the acknowledgement
+	m_sendChannel.m_seenTail = ReadAcquire (&m_sendChannel.m_ring->tail);
+
+	DWORD ack = (DWORD)ReadAcquire (&m_sendChannel.m_ring->sectionAck);
+	for (int i = 0; i < IPC_SHM_MAX_PENDING_SECTIONS; i++) {
+		if (m_sectionSeqs[i] != 0 && (LONG)(m_sectionSeqs[i] - ack) <= 0)
+			m_sectionSeqs[i] = 0;
+	}
+}
+
+void IPC_Connection::dropSection (DWORD seq)
+{
+	char pathBuf[IPC_MAX_PATH];
+	formatSectionName (pathBuf, true, seq);
+	shm_unlink (pathBuf);
+
+	for (int i = 0; i < IPC_SHM_MAX_PENDING_SECTIONS; i++) {
+		if (m_sectionSeqs[i] == seq) m_sectionSeqs[i] = 0;
+	}
+}
+
+DWORD IPC_Connection::createSection (DWORD size, IPC_ShmMap& view, DWORD& seq, DWORD tmo, DWORD t0)
+{
+	// wait until the receiver opens one of the pending sections
+	int i;
+	for (;;) {
+		sweepSections ();
+
+		i = 0;
+		while (i < IPC_SHM_MAX_PENDING_SECTIONS && m_sectionSeqs[i] != 0) i++;
+		if (i < IPC_SHM_MAX_PENDING_SECTIONS) break;
+
+		DWORD err = waitChannel (m_sendChannel, false, true, tmo, t0);
+		if (err != 0) return err;
+	}
+
+	// 0 marks a free pending slot
+	seq = ++m_sectionSeq;
+	if (seq == 0) seq = ++m_sectionSeq;
+
+	char pathBuf[IPC_MAX_PATH];
+	formatSectionName (pathBuf, true, seq);
+
+	DWORD err = view.create (pathBuf, size);
+	if (err != 0) return (err == IPC_ERR_INVALID_ARG) ? IPC_ERR_UNKNOWN : err;  // the name exists
+
+	m_sectionSeqs[i] = seq;
+	return 0;
+}
+
+DWORD IPC_Connection::sendSection (DWORD seq, DWORD size, DWORD tmo, DWORD t0, bool bDefer)
+{
+	DWORD err = m_sendChannel.m_ring->closed ? IPC_ERR_CLOSED : 0;
+
+	DWORD pktSize;
+	IPC_MSG_HDR *msgHdr = NULL;
+	while (err == 0 && (msgHdr = m_sendChannel.ringReserve (sizeof (IPC_SECTION_DESC), sizeof (IPC_SECTION_DESC), pktSize)) == NULL)
+		err = waitChannel (m_sendChannel, false, true, tmo, t0);
+
+	if (err != 0) {
+		dropSection (seq);
+		return err;
+	}
+
+	msgHdr->msgSize = size | IPC_MSG_SECTION;
+	msgHdr->pktSize = sizeof (IPC_SECTION_DESC);
+	((IPC_SECTION_DESC *)(msgHdr + 1))->seq = seq;
+
+	m_sendChannel.ringCommit (sizeof (IPC_SECTION_DESC));
+	if (! bDefer) m_sendChannel.notifyData ();
+	else m_bDataPending = true;
+	return 0;
+}
+
+DWORD IPC_Connection::openSection (const IPC_MSG_HDR *msgHdr, IPC_ShmMap& view, DWORD& size)
+{
+	size = msgHdr->msgSize & ~IPC_MSG_SECTION;
+
+	DWORD seq = 0;
+	if (m_recvChannel.ringPktSize (msgHdr) >= sizeof (IPC_SECTION_DESC))
+		seq = ((const IPC_SECTION_DESC *)(msgHdr + 1))->seq;
+
+	char pathBuf[IPC_MAX_PATH];
+	formatSectionName (pathBuf, false, seq);
+
+	// the mapping keeps the segment, the name has done its job
+	DWORD err = view.open (pathBuf, size);
+	shm_unlink (pathBuf);
+
+	// consume the descriptor and let the sender forget the section
+	WriteRelease (&m_recvChannel.m_ring->sectionAck, (LONG)seq);
+	m_recvChannel.ringRelease (msgHdr);
+	m_recvChannel.notifySpace ();
+
+	return (err == 0) ? 0 : IPC_ERR_UNKNOWN;
+}
+
+BOOL IPC_Connection::setSectionThreshold (DWORD threshold)
+{
+	clearLastError ();
+	m_sectionThreshold = (threshold == 0) ? IPC_SECTION_THRESHOLD_DEFAULT : threshold;
+	return TRUE;
+}
+
+BOOL IPC_Connection::setSpinTime (DWORD us)
+{
+	clearLastError ();
+	if (us == IPC_SPIN_ADAPTIVE) us = IPC_SHM_SPIN_DEFAULT_US;
+	m_sendChannel.m_spinUs = us;
+	m_recvChannel.m_spinUs = us;
+	return TRUE;
+}
+
+BOOL IPC_Connection::setEvents (HANDLE *pUserEvents, DWORD count)
+{
+	clearLastError ();
+	if ((pUserEvents == NULL && count != 0) || count > IPC_SHM_MAX_USER_EVENTS) {
+		setLastError (IPC_ERR_INVALID_ARG);
+		return FALSE;
+	}
+
+	EnterCriticalSection (&m_eventsCs);
+	for (DWORD i = 0; i < count; i++) m_userEvents[i] = (int)(intptr_t)pUserEvents[i];
+	m_userEventCount = (LONG)count;
+	LeaveCriticalSection (&m_eventsCs);
+	return TRUE;
+}
+
+// bit i of *pdwUserEvents: user event i is readable
+BOOL IPC_Connection::getEvents (DWORD *pdwUserEvents)
+{
+	clearLastError ();
+	EnterCriticalSection (&m_eventsCs);
+
+	struct pollfd pfd [IPC_SHM_MAX_USER_EVENTS];
+	int count = (int)m_userEventCount;
+	for (int i = 0; i < count; i++) {
+		pfd[i].fd = m_userEvents[i];
+		pfd[i].events = POLLIN;
+		pfd[i].revents = 0;
+	}
+	bool bOk = count == 0 || poll (pfd, count, 0) >= 0;
+
+	LeaveCriticalSection (&m_eventsCs);
+	if (! bOk) return FALSE;
+
+	if (pdwUserEvents) {
+		*pdwUserEvents = 0;
+		for (int i = 0; i < count; i++) {
+			if (pfd[i].revents & POLLIN) *pdwUserEvents |= 1u << i;
+		}
+	}
+	return TRUE;
+}
+
+void IPC_Connection::resetEvents ()
+{
+	clearLastError ();
+	EnterCriticalSection (&m_eventsCs);
+	m_userEventCount = 0;
+	LeaveCriticalSection (&m_eventsCs);
+}
+
+bool IPC_Connection::userEventSet ()
+{
+	EnterCriticalSection (&m_eventsCs);
+	bool bSet = IPC_FdReadable (m_userEvents, (int)m_userEventCount);
+	LeaveCriticalSection (&m_eventsCs);
+	return bSet;
+}
+
+BOOL IPC_Connection::setMultiProducer (BOOL bEnable)
+{
+	clearLastError ();
+	return TRUE;
+}
+
+////////////////////////////////////////////////////////////////
+// IPC_Runtime
+
+IPC_Runtime IPC_Runtime::g_instance;
+
+IPC_Runtime::IPC_Runtime () : m_connSeq (0)
+{
+	m_bMultiCpu = sysconf (_SC_NPROCESSORS_ONLN) > 1;
+}
+
+DWORD IPC_Runtime::getVersion ()
+{
+	return (MODULE_VERSION_A << 24)
+	     | (MODULE_VERSION_B << 16)
+		 | (MODULE_VERSION_C << 8)
+		 | MODULE_VERSION_D;
+}
+
+HIPCSERVER IPC_Runtime::serverStart (const char *epName, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
+{
+	IPC_Server *pServer = new IPC_Server ();
+	if (! pServer) return HIPCSERVER_INVALID;
+
+	DWORD ec = pServer->listen (epName, sendSize, recvSize);
+	if (ec != 0) {
+		delete pServer;
+		return IPC_ERR_TO_HIPCSERVER(ec);
+	}
+
+	return (HIPCSERVER)pServer;
+}
+
+BOOL IPC_Runtime::serverStop (HIPCSERVER hServer)
+{
+	IPC_Server *pServer = getServer (hServer);
+	if (! pServer) return FALSE;
+
+	BOOL f = pServer->unlisten ();
+	delete pServer;
+
+	return f;
+}
+
+HIPCCONNECTION IPC_Runtime::serverWaitForConnection (HIPCSERVER hServer, DWORD tmo, int breakFd /*= -1*/)
+{
+	IPC_Server *pServer = getServer (hServer);
+	if (! pServer) return IPC_ERR_TO_HIPCCONNECTION (IPC_ERR_INVALID_ARG);
+
+	DWORD err;
+	IPC_Connection *pConn = pServer->accept (tmo, err, breakFd);
+	if (! pConn) return IPC_ERR_TO_HIPCCONNECTION (err);
+
+	HIPCCONNECTION h = m_connections.add (pConn);
+	if (h == HIPCCONNECTION_INVALID) {
+		// very unlikely
+		pConn->close ();
+		delete pConn;
+		return HIPCCONNECTION_INVALID;
+	}
+
+	return h;
+}
+
+HIPCCONNECTION IPC_Runtime::connect (const char *epName, DWORD tmo, DWORD sendSize /*= 0*/, DWORD recvSize /*= 0*/)
+{
+	IPC_Connection *pConn = new IPC_Connection ();
+	if (! pConn) return IPC_ERR_TO_HIPCCONNECTION (IPC_ERR_INVALID_ARG);
+
+	DWORD err = pConn->connect (epName, tmo, sendSize, recvSize);
+	if (err != 0) {
+		delete pConn;
+		return IPC_ERR_TO_HIPCCONNECTION (err);
+	}
+
+	HIPCCONNECTION h = m_connections.add (pConn);
+	if (h == HIPCCONNECTION_INVALID) {
+		// very unlikely
+		pConn->close ();
+		delete pConn;
+		return HIPCCONNECTION_INVALID;
+	}
+
+	return h;
+}
+
+BOOL IPC_Runtime::closeConnection (HIPCCONNECTION hConn)
+{
+	IPC_Connection *pConn = static_cast<IPC_Connection *> (m_connections.close (hConn));
+	if (! pConn) return FALSE;
+
+	// get the blocked calls out, the handle is freed when they have left
+	pConn->shutdown ();
+	m_connections.remove (hConn);
+
+	BOOL f = pConn->close ();
+	delete pConn;
+
+	return f;
+}
+
+DWORD IPC_Runtime::getConnectionLastErr (HIPCCONNECTION hConn)
+{
+	IPC_ConnectionRef pConn (m_connections, hConn);
+	if (! pConn) return IPC_ERR_INVALID_ARG;
+
+	return pConn->getLastError ();
+}
+
+unsigned int IPC_Runtime::formatObjectPath (char *pathBuf, const char *prefix, const char *name)
+{
+	int n = snprintf (pathBuf, IPC_MAX_PATH, "%s%s", prefix ? prefix : "", name ? name : "");
+	return (n < 0) ? 0 : (n < IPC_MAX_PATH) ? (unsigned int)n : IPC_MAX_PATH - 1;
+}
+
+bool IPC_Runtime::generateConnectionName (char *nameBuf)
+{
+	// unique among the live processes, the time keeps a reused pid apart
+	struct timespec ts;
+	clock_gettime (CLOCK_REALTIME, &ts);
+
+	snprintf (nameBuf, 80, "%08x-%08x-%08lx%08lx", (unsigned)GetCurrentProcessId (),
+		(unsigned)InterlockedIncrement (&m_connSeq), (unsigned long)ts.tv_sec, (unsigned long)ts.tv_nsec);
+	return true;
+}
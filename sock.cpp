@@ -0,0 +1,855 @@
+// sock.cpp
+//
+// Interprocess communication library (IPC)
+//
+// Unix-domain SOCK_SEQPACKET transport of the POSIX builds
+//
+// (C) 2011 COSL
+//
+// Author: ouyang pumo (oump@cosl.com.cn)
+//
+#include "ipc_ring.h"
+
+#include <assert.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+
+// abstract socket address of a server, 0 if the name is too long
+static socklen_t SockAddress(struct sockaddr_un& addr, const char *epName)
+{
+	size_t nLen = strlen(epName);
+	if (nLen == 0 || nLen > sizeof(addr.sun_path) - sizeof(SOCK_PREFIX))
+		return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path + 1, SOCK_PREFIX, sizeof(SOCK_PREFIX) - 1);
+	memcpy(addr.sun_path + sizeof(SOCK_PREFIX), epName, nLen);
+	return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + sizeof(SOCK_PREFIX) + nLen);
+}
+
+static int SockTimeout(DWORD dwTimeout)
+{
+	return dwTimeout == INFINITE ? -1 : (int)dwTimeout;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CSocketTransport
+
+CSocketTransport::CSocketTransport()
+	: m_fd(-1)
+	, m_lBroken(0)
+	, m_dwLastError(0)
+	, m_dwMaxPkt(0)
+	, m_nEventCount(0)
+	, m_pReserveBuf(NULL)
+	, m_dwReserveBufSize(0)
+	, m_dwReserveSize(NO_RESERVATION)
+	, m_dwReserveTimeout(INFINITE)
+	, m_pViewBuf(NULL)
+	, m_dwViewBufSize(0)
+	, m_bViewHeld(false)
+	, m_pRing(NULL)
+{
+}
+
+CSocketTransport::CSocketTransport(int fd, DWORD dwSendSize, DWORD dwRecvSize)
+	: m_fd(fd)
+	, m_lBroken(0)
+	, m_dwLastError(0)
+	, m_dwMaxPkt(0)
+	, m_nEventCount(0)
+	, m_pReserveBuf(NULL)
+	, m_dwReserveBufSize(0)
+	, m_dwReserveSize(NO_RESERVATION)
+	, m_dwReserveTimeout(INFINITE)
+	, m_pViewBuf(NULL)
+	, m_dwViewBufSize(0)
+	, m_bViewHeld(false)
+	, m_pRing(NULL)
+{
+	Tune(dwSendSize, dwRecvSize);
+}
+
+CSocketTransport::~CSocketTransport()
+{
+	Shutdown();
+
+	// wait for both directions to leave
+	CCSLock lockSend(m_csSend);
+	CCSLock lockRecv(m_csRecv);
+	CCSLock lock(m_cs);
+
+	if (m_pRing)
+	{
+		CSocketRing::Instance().Release(m_pRing);
+		m_pRing = NULL;
+	}
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+	delete[] m_pReserveBuf;
+	m_pReserveBuf = NULL;
+	delete[] m_pViewBuf;
+	m_pViewBuf = NULL;
+}
+
+DWORD CSocketTransport::SetError(DWORD dwError)
+{
+	m_dwLastError = dwError;
+	return dwError == IPC_ERR_TIMEOUT ? IPC_RC_TIMEOUT : IPC_RC_ERROR;
+}
+
+// the other direction may be inside a call on m_fd,
+// so a failed socket is only marked here
+DWORD CSocketTransport::Broken(int nErrno)
+{
+	InterlockedExchange(&m_lBroken, 1);
+	return (nErrno == EPIPE || nErrno == ECONNRESET) ? IPC_ERR_CLOSED : IPC_ERR_UNKNOWN;
+}
+
+void CSocketTransport::Tune(DWORD dwSendSize, DWORD dwRecvSize)
+{
+	// the kernel caps the sizes at net.core.wmem_max/rmem_max
+	int n;
+	if (dwSendSize && IPC_ChannelSize(dwSendSize))
+	{
+		n = (int)dwSendSize;
+		setsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
+	}
+	if (dwRecvSize && IPC_ChannelSize(dwRecvSize))
+	{
+		n = (int)dwRecvSize;
+		setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+	}
+
+	// a packet over the send buffer is refused, two of them keep the peer busy
+	n = 0;
+	socklen_t nLen = sizeof(n);
+	getsockopt(m_fd, SOL_SOCKET, SO_SNDBUF, &n, &nLen);
+	m_dwMaxPkt = (DWORD)n / 2 > IPC_CHANNEL_SIZE_MIN ? (DWORD)n / 2 - sizeof(IPC_MSG_HDR) : IPC_CHANNEL_SIZE_MIN - sizeof(IPC_MSG_HDR);
+	if (m_dwMaxPkt > SOCK_PKT_MAX - sizeof(IPC_MSG_HDR))
+		m_dwMaxPkt = SOCK_PKT_MAX - sizeof(IPC_MSG_HDR);
+}
+
+DWORD CSocketTransport::Wait(short nEvents, DWORD dwTimeout, bool bUser)
+{
+	if (dwTimeout == 0)
+		return IPC_ERR_TIMEOUT;
+
+	// with the io_uring engine a receiver waits for its queue
+	struct pollfd pfd[1 + SOCK_MAX_USER_EVENTS];
+	bool bRing = m_pRing && nEvents == POLLIN;
+	pfd[0].fd = bRing ? CSocketRing::Instance().WaitFd(m_pRing) : m_fd;
+	pfd[0].events = nEvents;
+	int n = 1;
+	if (bUser)
+	{
+		CCSLock lock(m_cs);
+		for (int i = 0; i < m_nEventCount; ++i, ++n)
+		{
+			pfd[n].fd = m_arrUserEvents[i];
+			pfd[n].events = POLLIN;
+		}
+	}
+
+	int rc = poll(pfd, n, SockTimeout(dwTimeout));
+	if (rc == 0)
+		return IPC_ERR_TIMEOUT;
+
+	// an error or hangup of the socket comes out of the next transfer
+	if (rc < 0 || pfd[0].revents)
+	{
+		uint64_t nCount;
+		if (bRing && pfd[0].revents && read(pfd[0].fd, &nCount, sizeof(nCount)) < 0)
+			assert(errno == EAGAIN);
+		return 0;
+	}
+	return IPC_ERR_USER_EVENT_SET;
+}
+
+DWORD CSocketTransport::SendMsg(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwSize, DWORD dwTimeout)
+{
+	if (IsBroken())
+		return IPC_ERR_BROKEN;
+
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	IPC_MSG_HDR hdr;
+	hdr.msgSize = dwSize;
+
+	struct iovec iov[SOCK_IOV_MAX];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+
+	IPC_BufCursor data(pBufs, dwCount);
+	DWORD dwLeft = dwSize;
+	bool bFirst = true;
+	do
+	{
+		// many small segments make a shorter packet
+		int nIov;
+		hdr.pktSize = data.iov(iov + 1, SOCK_IOV_MAX - 1, dwLeft < m_dwMaxPkt ? dwLeft : m_dwMaxPkt, nIov);
+		msg.msg_iovlen = nIov + 1;
+
+		if (sendmsg(m_fd, &msg, MSG_NOSIGNAL) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return Broken(errno);
+
+			// the rest of a started message goes unconditionally
+			DWORD dwErr = bFirst
+				? Wait(POLLOUT, IPC_RemainingTimeout(dwTimeout, t0), true)
+				: Wait(POLLOUT, INFINITE, false);
+			if (dwErr)
+				return dwErr;
+			continue;
+		}
+
+		data.skip(hdr.pktSize);
+		dwLeft -= hdr.pktSize;
+		bFirst = false;
+	} while (dwLeft);
+
+	return 0;
+}
+
+DWORD CSocketTransport::RecvMsg(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout, DWORD& dwSize)
+{
+	dwSize = 0;
+	if (IsBroken())
+		return IPC_ERR_BROKEN;
+
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	IPC_MSG_HDR hdr;
+	struct iovec iov[SOCK_IOV_MAX];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+
+	// the packets fill the buffers, what does not fit is discarded
+	IPC_BufCursor data(pBufs, dwCount);
+	DWORD dwRoom = IPC_BufCursor::totalSize(pBufs, dwCount);
+	DWORD dwMsgSize = 0;
+	DWORD dwReceived = 0;
+	bool bTruncated = false;
+	bool bFirst = true;
+	for (;;)
+	{
+		int nIov;
+		data.iov(iov + 1, SOCK_IOV_MAX - 1, dwRoom, nIov);
+
+		ssize_t nBytes = RecvPacket(iov, nIov + 1, 0);
+		if (nBytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return Broken(errno);
+
+			DWORD dwErr = bFirst
+				? Wait(POLLIN, IPC_RemainingTimeout(dwTimeout, t0), true)
+				: Wait(POLLIN, INFINITE, false);
+			if (dwErr)
+				return dwErr;
+			continue;
+		}
+
+		// end of file: the peer has closed, no packet is shorter than its header
+		if (nBytes == 0)
+			return Broken(EPIPE);
+		if ((size_t)nBytes < sizeof(hdr))
+			return Broken(EPROTO);
+
+		DWORD dwStored = (DWORD)nBytes - sizeof(hdr);
+		if (hdr.pktSize > dwStored)
+			bTruncated = true;
+		if (bFirst)
+			dwMsgSize = hdr.msgSize;
+		bFirst = false;
+
+		data.skip(dwStored);
+		dwRoom -= dwStored;
+		dwSize += dwStored;
+		dwReceived += hdr.pktSize;
+		if (dwReceived >= dwMsgSize)
+			break;
+	}
+
+	if (!bTruncated)
+		return 0;
+	dwSize = dwMsgSize;
+	return IPC_ERR_MSG_TRUNCATED;
+}
+
+DWORD CSocketTransport::SendMany(const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout, DWORD& dwSent)
+{
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	IPC_MSG_HDR hdrs[SOCK_BATCH_MAX];
+	struct iovec iov[SOCK_BATCH_MAX][2];
+	struct mmsghdr msgs[SOCK_BATCH_MAX];
+	memset(msgs, 0, sizeof(msgs));
+
+	dwSent = 0;
+	while (dwSent < dwCount)
+	{
+		if (IsBroken())
+			return IPC_ERR_BROKEN;
+
+		// a message over the packet limit goes alone
+		if (pMsgs[dwSent].dwSize > m_dwMaxPkt)
+		{
+			DWORD dwErr = SendMsg(&pMsgs[dwSent], 1, pMsgs[dwSent].dwSize, IPC_RemainingTimeout(dwTimeout, t0));
+			if (dwErr)
+				return dwErr;
+			dwSent++;
+			continue;
+		}
+
+		// the run of single packet messages in one call
+		unsigned int n = 0;
+		for (; n < SOCK_BATCH_MAX && dwSent + n < dwCount && pMsgs[dwSent + n].dwSize <= m_dwMaxPkt; ++n)
+		{
+			const IPC_BUF& m = pMsgs[dwSent + n];
+			hdrs[n].msgSize = hdrs[n].pktSize = m.dwSize;
+			iov[n][0].iov_base = &hdrs[n];
+			iov[n][0].iov_len = sizeof(IPC_MSG_HDR);
+			iov[n][1].iov_base = m.pvBuf;
+			iov[n][1].iov_len = m.dwSize;
+			msgs[n].msg_hdr.msg_iov = iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 2;
+		}
+
+		int nDone = sendmmsg(m_fd, msgs, n, MSG_NOSIGNAL);
+		if (nDone < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return Broken(errno);
+
+			DWORD dwErr = Wait(POLLOUT, IPC_RemainingTimeout(dwTimeout, t0), true);
+			if (dwErr)
+				return dwErr;
+			continue;
+		}
+		dwSent += nDone;
+	}
+	return 0;
+}
+
+DWORD CSocketTransport::RecvToView(DWORD dwTimeout, DWORD& dwSize)
+{
+	if (IsBroken())
+		return IPC_ERR_BROKEN;
+
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	// the header of the first packet tells the message size
+	IPC_MSG_HDR hdr;
+	struct iovec iov = { &hdr, sizeof(hdr) };
+	for (;;)
+	{
+		ssize_t nBytes = RecvPacket(&iov, 1, MSG_PEEK);
+		if (nBytes == (ssize_t)sizeof(hdr))
+			break;
+		if (nBytes == 0)
+			return Broken(EPIPE);
+		if (nBytes > 0)
+			return Broken(EPROTO);
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return Broken(errno);
+
+		DWORD dwErr = Wait(POLLIN, IPC_RemainingTimeout(dwTimeout, t0), true);
+		if (dwErr)
+			return dwErr;
+	}
+
+	if (hdr.msgSize >= IPC_MSG_SIZE_LIMIT)
+		return Broken(EPROTO);
+	if (hdr.msgSize > m_dwViewBufSize)
+	{
+		BYTE* pBuf = new BYTE[hdr.msgSize];
+		if (!pBuf)
+			return IPC_ERR_OUT_OF_MEMORY;
+		delete[] m_pViewBuf;
+		m_pViewBuf = pBuf;
+		m_dwViewBufSize = hdr.msgSize;
+	}
+
+	IPC_BUF view = { m_pViewBuf, hdr.msgSize };
+	return RecvMsg(&view, 1, INFINITE, dwSize);
+}
+
+ssize_t CSocketTransport::RecvPacket(struct iovec *iov, int nIov, int nFlags)
+{
+	if (m_pRing)
+		return CSocketRing::Instance().Recv(m_pRing, iov, nIov, nFlags);
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = nIov;
+	return recvmsg(m_fd, &msg, nFlags);
+}
+
+HIPCCONNECTION CSocketTransport::Connect(const char *pszServerName, DWORD dwTimeout, DWORD dwSendSize, DWORD dwRecvSize)
+{
+	CCSLock lock(m_cs);
+
+	assert(m_fd < 0);
+	if (m_fd >= 0 || !pszServerName || !IsValidTimeout(dwTimeout))
+		return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+	struct sockaddr_un addr;
+	socklen_t nAddrLen = SockAddress(addr, pszServerName);
+	if (!nAddrLen)
+		return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	for (;;)
+	{
+		m_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (m_fd < 0)
+			return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+		// the sizes must be set before the connection is made
+		Tune(dwSendSize, dwRecvSize);
+		if (connect(m_fd, (struct sockaddr *)&addr, nAddrLen) == 0)
+			break;
+
+		int nErr = errno;
+		close(m_fd);
+		m_fd = -1;
+
+		// no server yet (ECONNREFUSED) or its backlog is full (EAGAIN): wait for it
+		if (nErr != ECONNREFUSED && nErr != EAGAIN && nErr != EINTR)
+			return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+		DWORD dwLeft = IPC_RemainingTimeout(dwTimeout, t0);
+		if (!dwLeft)
+			return (HIPCCONNECTION) IPC_RC_TIMEOUT;
+		Sleep(dwLeft < 10 ? dwLeft : 10);
+	}
+
+	return (HIPCCONNECTION) this;
+}
+
+bool CSocketTransport::AttachRing(HIPCCONNECTION hConn)
+{
+	CCSLock lockSend(m_csSend);
+	CCSLock lockRecv(m_csRecv);
+
+	if (m_fd < 0 || m_pRing)
+		return false;
+	m_pRing = CSocketRing::Instance().Attach(m_fd, hConn);
+	return m_pRing != NULL;
+}
+
+void CSocketTransport::Shutdown()
+{
+	// the blocked calls see the socket shut down
+	if (m_pRing)
+		CSocketRing::Instance().Shutdown(m_pRing);
+	if (m_fd >= 0)
+		shutdown(m_fd, SHUT_RDWR);
+}
+
+DWORD CSocketTransport::Recv(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+{
+	CCSLock lock(m_csRecv);
+
+	if ((!pvBuf && dwBufSize) || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	IPC_BUF buf = { pvBuf, dwBufSize };
+	DWORD dwSize;
+	DWORD dwErr = RecvMsg(&buf, 1, dwTimeout, dwSize);
+	return dwErr ? SetError(dwErr) : dwSize;
+}
+
+DWORD CSocketTransport::Send(void *pvBuf, DWORD dwBufSize, DWORD dwTimeout)
+{
+	CCSLock lock(m_csSend);
+
+	if ((!pvBuf && dwBufSize) || dwBufSize >= IPC_MSG_SIZE_LIMIT || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	IPC_BUF buf = { pvBuf, dwBufSize };
+	DWORD dwErr = SendMsg(&buf, 1, dwBufSize, dwTimeout);
+	return dwErr ? SetError(dwErr) : dwBufSize;
+}
+
+// a message is written at once, so the reserved buffer is local
+// and the timeout applies to the write in SendCommit
+DWORD CSocketTransport::SendReserve(DWORD dwSize, void **ppvBuf, DWORD dwTimeout)
+{
+	CCSLock lock(m_csSend);
+
+	if (!ppvBuf || dwSize >= IPC_MSG_SIZE_LIMIT || m_dwReserveSize != NO_RESERVATION || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	if (dwSize > m_dwReserveBufSize)
+	{
+		BYTE* pBuf = new BYTE[dwSize];
+		if (!pBuf)
+			return SetError(IPC_ERR_OUT_OF_MEMORY);
+		delete[] m_pReserveBuf;
+		m_pReserveBuf = pBuf;
+		m_dwReserveBufSize = dwSize;
+	}
+
+	m_dwReserveSize = dwSize;
+	m_dwReserveTimeout = dwTimeout;
+	*ppvBuf = m_pReserveBuf;
+	return dwSize;
+}
+
+DWORD CSocketTransport::SendCommit(void *pvBuf, DWORD dwSize)
+{
+	CCSLock lock(m_csSend);
+
+	if (m_dwReserveSize == NO_RESERVATION || pvBuf != m_pReserveBuf || dwSize > m_dwReserveSize)
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	m_dwReserveSize = NO_RESERVATION;
+	IPC_BUF buf = { m_pReserveBuf, dwSize };
+	DWORD dwErr = SendMsg(&buf, 1, dwSize, m_dwReserveTimeout);
+	return dwErr ? SetError(dwErr) : dwSize;
+}
+
+// the segments go out as they are, sendmsg gathers them
+DWORD CSocketTransport::SendV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{
+	CCSLock lock(m_csSend);
+
+	if ((!pBufs && dwCount) || m_dwReserveSize != NO_RESERVATION || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwSize = IPC_BufCursor::totalSize(pBufs, dwCount);
+	if (dwSize >= IPC_MSG_SIZE_LIMIT)
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwErr = SendMsg(pBufs, dwCount, dwSize, dwTimeout);
+	return dwErr ? SetError(dwErr) : dwSize;
+}
+
+// recvmsg scatters the packets, unless there are more segments than
+// iovecs: then the message is read into the view buffer and scattered from there
+DWORD CSocketTransport::RecvV(const IPC_BUF *pBufs, DWORD dwCount, DWORD dwTimeout)
+{
+	CCSLock lock(m_csRecv);
+
+	if ((!pBufs && dwCount) || m_bViewHeld || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwSize;
+	DWORD dwErr;
+	if (dwCount < SOCK_IOV_MAX)
+		dwErr = RecvMsg(pBufs, dwCount, dwTimeout, dwSize);
+	else if ((dwErr = RecvToView(dwTimeout, dwSize)) == 0)
+	{
+		IPC_BufCursor data(pBufs, dwCount);
+		if (data.scatter(m_pViewBuf, dwSize) < dwSize)
+			dwErr = IPC_ERR_MSG_TRUNCATED;
+	}
+	return dwErr ? SetError(dwErr) : dwSize;
+}
+
+// the single packet messages go by sendmmsg, up to SOCK_BATCH_MAX at a time
+DWORD CSocketTransport::SendBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD dwTimeout)
+{
+	CCSLock lock(m_csSend);
+
+	if ((!pMsgs && dwCount) || m_dwReserveSize != NO_RESERVATION || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+	for (DWORD i = 0; i < dwCount; ++i)
+		if (pMsgs[i].dwSize >= IPC_MSG_SIZE_LIMIT)
+			return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwSent;
+	DWORD dwErr = SendMany(pMsgs, dwCount, dwTimeout, dwSent);
+	if (dwErr && !dwSent)
+		return SetError(dwErr);
+	return dwSent;
+}
+
+// waits for the first message, then takes the messages already in the socket
+DWORD CSocketTransport::RecvBatch(const IPC_BUF *pMsgs, DWORD dwCount, DWORD *pdwSizes, DWORD dwTimeout)
+{
+	CCSLock lock(m_csRecv);
+
+	if (((!pMsgs || !pdwSizes) && dwCount) || m_bViewHeld || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwReceived = 0;
+	for (; dwReceived < dwCount; dwReceived++)
+	{
+		DWORD dwErr = RecvMsg(&pMsgs[dwReceived], 1, dwReceived ? 0 : dwTimeout, pdwSizes[dwReceived]);
+		if (dwErr == IPC_ERR_TIMEOUT && dwReceived)
+			break;
+		// a truncated message has left the socket: it is counted, with its whole size
+		if (dwErr == IPC_ERR_MSG_TRUNCATED)
+			dwReceived++;
+		if (dwErr)
+		{
+			DWORD rc = SetError(dwErr);
+			return dwReceived ? dwReceived : rc;
+		}
+	}
+	return dwReceived;
+}
+
+// the message is read into the local buffer and stays there until RecvRelease
+DWORD CSocketTransport::RecvView(const void **ppvBuf, DWORD dwTimeout)
+{
+	CCSLock lock(m_csRecv);
+
+	if (!ppvBuf || m_bViewHeld || !IsValidTimeout(dwTimeout))
+		return SetError(IPC_ERR_INVALID_ARG);
+
+	DWORD dwSize;
+	DWORD dwErr = RecvToView(dwTimeout, dwSize);
+	if (dwErr)
+		return SetError(dwErr);
+
+	m_bViewHeld = true;
+	*ppvBuf = m_pViewBuf;
+	return dwSize;
+}
+
+BOOL CSocketTransport::RecvRelease(const void *pvBuf)
+{
+	CCSLock lock(m_csRecv);
+
+	if (!m_bViewHeld || pvBuf != m_pViewBuf)
+	{
+		SetError(IPC_ERR_INVALID_ARG);
+		return FALSE;
+	}
+	m_bViewHeld = false;
+	return TRUE;
+}
+
+BOOL CSocketTransport::SendAsync(void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{
+	DWORD dwErr = m_pRing ? CSocketRing::Instance().Post(m_pRing, true, pvBuf, dwBufSize, m_dwMaxPkt, pfnCallback, pvContext) : IPC_ERR_INVALID_ARG;
+	if (dwErr)
+	{
+		SetError(dwErr);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL CSocketTransport::RecvAsync(void *pvBuf, DWORD dwBufSize, IPC_ASYNC_CALLBACK pfnCallback, void *pvContext)
+{
+	DWORD dwErr = m_pRing ? CSocketRing::Instance().Post(m_pRing, false, pvBuf, dwBufSize, m_dwMaxPkt, pfnCallback, pvContext) : IPC_ERR_INVALID_ARG;
+	if (dwErr)
+	{
+		SetError(dwErr);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL CSocketTransport::CancelAsync(void *pvContext)
+{
+	if (!m_pRing)
+	{
+		SetError(IPC_ERR_INVALID_ARG);
+		return FALSE;
+	}
+	CSocketRing::Instance().Cancel(m_pRing, pvContext);
+	return TRUE;
+}
+
+BOOL CSocketTransport::SetEvents(HANDLE *pUserEvents, DWORD dwUserEventsCount, HANDLE *pIPCEvents)
+{
+	CCSLock lock(m_cs);
+
+	if ((!pUserEvents && dwUserEventsCount) || dwUserEventsCount > SOCK_MAX_USER_EVENTS)
+		return FALSE;
+
+	for (DWORD i = 0; i < dwUserEventsCount; ++i)
+		m_arrUserEvents[i] = SOCK_HandleFd(pUserEvents[i]);
+	m_nEventCount = (int)dwUserEventsCount;
+	return TRUE;
+}
+
+// bit i of *pdwUserEvents: user event i is signaled
+BOOL CSocketTransport::GetEvents(DWORD *pdwUserEvents, DWORD *pdwIPCEvents)
+{
+	CCSLock lock(m_cs);
+
+	struct pollfd pfd[SOCK_MAX_USER_EVENTS];
+	for (int i = 0; i < m_nEventCount; ++i)
+	{
+		pfd[i].fd = m_arrUserEvents[i];
+		pfd[i].events = POLLIN;
+		pfd[i].revents = 0;
+	}
+	if (m_nEventCount && poll(pfd, m_nEventCount, 0) < 0)
+		return FALSE;
+
+	if (pdwUserEvents)
+	{
+		*pdwUserEvents = 0;
+		for (int i = 0; i < m_nEventCount; ++i)
+			if (pfd[i].revents & POLLIN)
+				*pdwUserEvents |= 1u << i;
+	}
+	if (pdwIPCEvents)
+		*pdwIPCEvents = 0;
+	return TRUE;
+}
+
+void CSocketTransport::ResetEvents()
+{
+	CCSLock lock(m_cs);
+	m_nEventCount = 0;
+}
+
+DWORD CSocketTransport::GetConnectionLastErr()
+{
+	CCSLock lock(m_cs);
+	return m_dwLastError;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CSocketServer
+
+CSocketServer::CSocketServer(DWORD dwSendSize, DWORD dwRecvSize)
+	: m_fd(-1)
+	, m_nBacklog(SOCK_BACKLOG_DEFAULT)
+	, m_dwSendSize(dwSendSize)
+	, m_dwRecvSize(dwRecvSize)
+{
+	m_evStop = eventfd(0, EFD_CLOEXEC);
+}
+
+CSocketServer::~CSocketServer()
+{
+	// a listening socket can't be shut down, wake the waiter by the event
+	if (m_evStop >= 0)
+	{
+		uint64_t nOne = 1;
+		if (write(m_evStop, &nOne, sizeof(nOne)) < 0)
+			assert(false);
+	}
+
+	CCSLock lock(m_cs);
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+	if (m_evStop >= 0)
+	{
+		close(m_evStop);
+		m_evStop = -1;
+	}
+}
+
+bool CSocketServer::Create(const char *epName)
+{
+	CCSLock lock(m_cs);
+
+	struct sockaddr_un addr;
+	socklen_t nAddrLen = epName ? SockAddress(addr, epName) : 0;
+	if (!nAddrLen || m_fd >= 0 || m_evStop < 0)
+		return false;
+
+	// the abstract name goes with the socket, a crashed server leaves nothing behind
+	m_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_fd < 0)
+		return false;
+	if (bind(m_fd, (struct sockaddr *)&addr, nAddrLen) == 0 && listen(m_fd, m_nBacklog) == 0)
+		return true;
+
+	close(m_fd);
+	m_fd = -1;
+	return false;
+}
+
+// listen () again takes the new size, also under a running ServerWaitForConnection
+void CSocketServer::SetBacklog(DWORD dwBacklog)
+{
+	if (!dwBacklog)
+		dwBacklog = SOCK_BACKLOG_DEFAULT;
+	m_nBacklog = dwBacklog < SOMAXCONN ? (int)dwBacklog : SOMAXCONN;
+	listen(m_fd, m_nBacklog);
+}
+
+HIPCCONNECTION CSocketServer::ServerWaitForConnection(DWORD dwTimeout, HANDLE hBreakEvent)
+{
+	CCSLock lock(m_cs);
+
+	if (m_fd < 0 || !IsValidTimeout(dwTimeout))
+		return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+	DWORD t0 = 0;
+	if (dwTimeout != INFINITE && dwTimeout != 0)
+		t0 = GetTickCount();
+
+	int fd;
+	for (;;)
+	{
+		fd = accept4(m_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd >= 0)
+			break;
+		// the client is gone already
+		if (errno == EINTR || errno == ECONNABORTED)
+			continue;
+		if (errno != EAGAIN)
+			return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE;
+
+		DWORD dwLeft = IPC_RemainingTimeout(dwTimeout, t0);
+		if (!dwLeft)
+			return (HIPCCONNECTION) IPC_RC_TIMEOUT; // timeout
+
+		struct pollfd pfd[3];
+		pfd[0].fd = m_fd;
+		pfd[1].fd = m_evStop;
+		pfd[2].fd = SOCK_HandleFd(hBreakEvent);
+		for (int i = 0; i < 3; ++i)
+		{
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+		if (poll(pfd, hBreakEvent ? 3 : 2, SockTimeout(dwLeft)) > 0 && !pfd[0].revents)
+		{
+			if (pfd[1].revents)
+				return (HIPCCONNECTION) IPC_RC_INVALID_HANDLE; // destructing
+			return (HIPCCONNECTION) IPC_RC_TIMEOUT; // user event
+		}
+	}
+
+	CSocketTransport* sock = new CSocketTransport(fd, m_dwSendSize, m_dwRecvSize);
+	return (HIPCCONNECTION) sock;
+}